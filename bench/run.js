@@ -0,0 +1,94 @@
+/*
+	Runs the generator benchmark (src/Benchmark.cpp) natively and under Node, and prints the results side by side.
+
+		node bench/run.js [--native bench/benchmark] [--wasm bench/benchmark.js] [--save FILE] [--baseline FILE] [--tolerance 10] [benchmark options]
+
+	Fails if the two builds generate different code (their checksums differ), and with --baseline, if a timing or the memory
+	growth of the wasm heap got worse than the saved results by more than the tolerance (in percent), so wasm regressions are caught
+	without a browser. The native memory is a peak resident set, too noisy to compare.
+*/
+
+const fs = require('fs');
+const path = require('path');
+const { spawnSync } = require('child_process');
+
+const options = { native: path.join(__dirname, 'benchmark'), wasm: path.join(__dirname, 'benchmark.js'), save: null, baseline: null, tolerance: 10 };
+const passed = [];
+for (let i = 2; i < process.argv.length; i++)
+{
+	const name = process.argv[i].replace(/^--/, '');
+	if (name in options && i + 1 < process.argv.length)
+		options[name] = name === 'tolerance' ? parseFloat(process.argv[++i]) : process.argv[++i];
+	else
+		passed.push(process.argv[i]);
+}
+
+// Run one build and parse the JSON line it prints
+function run(command, args)
+{
+	const result = spawnSync(command, args, { encoding: 'utf8' });
+	if (result.status !== 0)
+	{
+		console.error(`${command} failed: ${result.error ? result.error.message : result.stderr}`);
+		process.exit(1);
+	}
+	return JSON.parse(result.stdout.trim().split('\n').pop());
+}
+
+const results =
+{
+	native: run(options.native, passed),
+	wasm: run(process.execPath, [options.wasm, ...passed])
+};
+
+// Lower is better for every compared metric
+const metrics = ['generateNsPerSeed', 'compileNsPerSeed', 'randomNsPerDraw', 'hashNsPerCall', 'memoryGrowth'];
+for (const result of Object.values(results))
+	result.memoryGrowth = result.memoryAfter - result.memoryBefore;
+
+console.log(`${'metric'.padEnd(20)}${'native'.padStart(14)}${'wasm'.padStart(14)}${'wasm/native'.padStart(14)}`);
+for (const metric of metrics)
+{
+	const native = results.native[metric];
+	const wasm = results.wasm[metric];
+	const ratio = native > 0 ? (wasm / native).toFixed(2) : '-';
+	console.log(`${metric.padEnd(20)}${String(native).padStart(14)}${String(wasm).padStart(14)}${ratio.padStart(14)}`);
+}
+console.log(`wasm memory grew ${results.wasm.memoryGrowths} times, ${results.wasm.bytesPerSeed} bytes of code per seed`);
+
+let failed = false;
+if (results.native.checksum !== results.wasm.checksum)
+{
+	console.error(`The builds generated different code (checksums ${results.native.checksum} and ${results.wasm.checksum})`);
+	failed = true;
+}
+if (results.native.failedCompiles !== results.wasm.failedCompiles)
+{
+	console.error(`The builds failed to compile different numbers of seeds (${results.native.failedCompiles} and ${results.wasm.failedCompiles})`);
+	failed = true;
+}
+
+if (options.baseline)
+{
+	const baseline = JSON.parse(fs.readFileSync(options.baseline, 'utf8'));
+	for (const build of ['native', 'wasm'])
+	{
+		for (const metric of metrics)
+		{
+			if (build === 'native' && metric === 'memoryGrowth')
+				continue;
+			const before = baseline[build][metric];
+			const after = results[build][metric];
+			if (after > before * (1 + options.tolerance / 100))
+			{
+				console.error(`${build} ${metric} regressed: ${before} -> ${after} (${(100 * (after / Math.max(before, 1e-9) - 1)).toFixed(1)}%)`);
+				failed = true;
+			}
+		}
+	}
+}
+
+if (options.save)
+	fs.writeFileSync(options.save, JSON.stringify(results, null, '\t') + '\n');
+
+process.exit(failed ? 1 : 0);
@@ -0,0 +1,274 @@
+#include "Batch.h"
+
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <cstdio>
+#include <algorithm>
+
+#include "Shader.h"
+#include "Program.h"
+#include "Pruning.h"
+#include "Surrogates.h"
+#include "Moments.h"
+#include "Renderer.h"
+#include "BoundedQueue.h"
+#include "Metrics.h"
+
+#include "RandFS.h"
+
+namespace
+{
+	Metrics::Counter batchImages("pollock_batch_images_total", "Number of images output by batches");
+	Metrics::Counter batchFailures("pollock_batch_failures_total", "Number of seeds of batches that could not be compiled");
+	Metrics::Counter batchSkipped("pollock_batch_skipped_total", "Number of seeds of batches skipped as boring before rendering");
+	Metrics::Histogram generateTime("pollock_batch_generate_duration_seconds", "Time to generate and compile the program of one seed of a batch");
+
+	// Program of a seed on its way from the generators to the renderer, null if it could not be compiled or was skipped
+	struct Compiled
+	{
+		uint64_t index;
+		std::unique_ptr<Program> program;
+		double seconds;
+		bool skipped;
+	};
+
+	// Image on its way from the renderer to the output, in a buffer taken from the pool
+	struct Job
+	{
+		Batch::Image image;
+		uint8_t* pixels;
+	};
+
+	double Seconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+Batch::Batch(const Settings& settings) : m_Settings(settings)
+{
+	if (m_Settings.phases.empty())
+		m_Settings.phases.push_back(0.0f);
+}
+
+std::vector<float> Batch::VariantConstants(const std::vector<float>& constants, uint64_t seed, uint32_t variant)
+{
+	if (variant == 0U)
+		return constants;
+
+	// Drawn like the constants of the generator, in [0, 1)
+	std::vector<float> values(constants.size());
+	for (size_t i = 0U; i < values.size(); i++)
+		values[i] = float(Hash::DoubleO(uint64_t(variant) << 32 | i, seed));
+	return values;
+}
+
+void Batch::Run(uint64_t count, const SeedSource& seeds, const Sink& sink)
+{
+	const Settings& s = m_Settings;
+	const uint32_t pitch = s.width * 4U;
+	const size_t imageSize = size_t(pitch) * s.height;
+
+	#pragma region Generate
+
+	BoundedQueue<Compiled> programs(s.lookahead);
+	std::atomic<uint64_t> nextSeed{ 0ULL };
+	const uint32_t generatorCount = std::max(1U, s.generatorThreads);
+	std::atomic<uint32_t> runningGenerators{ generatorCount };
+
+	Moments::Settings boring;
+	boring.minContrast = s.minContrast;
+	boring.maxFlatness = s.maxFlatness;
+	boring.minMotion = s.minMotion;
+	const bool predict = s.minContrast > 0.0f || s.maxFlatness < 1.0f || s.minMotion > 0.0f;
+
+	auto generate = [&]()
+	{
+		for (uint64_t index = nextSeed++; index < count && !m_Stop; index = nextSeed++)
+		{
+			const uint64_t seed = seeds(index);
+			auto start = std::chrono::steady_clock::now();
+			std::unique_ptr<Program> program = std::make_unique<Program>();
+			bool skipped = false;
+			{
+				Metrics::Timer timer(generateTime);
+				if (!CompileProgram(GenerateShaderExpression(seed, s.correlated), *program))
+				{
+					std::fprintf(stderr, "Could not compile the shader of seed %llu\n", (unsigned long long)seed);
+					program.reset();
+				}
+				else if (predict && Moments::Boring(Moments::Predict(*program), boring))
+				{
+					// Before the pruning and the surrogates, which would only be wasted on it
+					program.reset();
+					skipped = true;
+				}
+				else
+				{
+					// The variants replace every constant, which would include the means of the pruned subtrees and the coefficients
+					// of the surrogates, so the members of a family are rendered from the program as compiled
+					if (s.prune > 0.0f && !s.deterministic && s.variants == 0U)
+					{
+						Pruning::Settings settings;
+						settings.errorBudget = s.prune;
+						Pruning::Prune(*program, settings);
+					}
+					if (s.surrogates > 0.0f && !s.deterministic && s.variants == 0U)
+					{
+						Surrogates::Settings settings;
+						settings.errorBound = s.surrogates;
+						Surrogates::Fit(*program, settings);
+					}
+				}
+			}
+
+			if (!programs.Push(Compiled{ index, std::move(program), Seconds(start), skipped }))
+				break;
+		}
+
+		// The last generator to finish ends the render loop once the queued programs are taken
+		if (--runningGenerators == 0U)
+			programs.Close();
+	};
+
+	std::vector<std::thread> generators;
+	for (uint32_t i = 0U; i < generatorCount; i++)
+		generators.emplace_back(generate);
+
+	#pragma endregion
+
+	#pragma region Buffers and output
+
+	// Enough buffers for a family in the renderer, every queue slot and the output
+	const uint32_t familySize = s.variants > 0U ? std::max(1U, std::min(s.familySize, s.variants + 1U)) : 1U;
+	const size_t bufferCount = size_t(s.queueDepth) + familySize + 1U;
+	std::vector<std::vector<uint8_t>> storage(bufferCount, std::vector<uint8_t>(imageSize));
+	BoundedQueue<uint8_t*> pool(bufferCount);
+	for (std::vector<uint8_t>& buffer : storage)
+		pool.Push(buffer.data());
+
+	BoundedQueue<Job> outputQueue(s.queueDepth);
+
+	// Unblock every stage when the sink ends the batch early
+	auto abort = [&]()
+	{
+		Stop();
+		programs.Close();
+		pool.Close();
+		outputQueue.Close();
+	};
+
+	std::thread output([&]()
+	{
+		Job job;
+		while (outputQueue.Pop(job))
+		{
+			job.image.pixels = job.pixels;
+			bool more = sink(job.image);
+			if (job.pixels)
+			{
+				batchImages.Add();
+				pool.Push(job.pixels);
+			}
+
+			if (!more)
+			{
+				abort();
+				break;
+			}
+		}
+	});
+
+	#pragma endregion
+
+	#pragma region Render
+
+	// The cache only pays off when a program is rendered several times
+	Renderer renderer(s.renderThreads);
+	renderer.SetCacheBudget(s.phases.size() > 1U ? s.cacheBudget : 0U);
+	renderer.SetDeterministic(s.deterministic);
+
+	// Render every phase of the variants of a program, a group of members at a time
+	auto renderFamily = [&](const Compiled& compiled)
+	{
+		const uint64_t seed = seeds(compiled.index);
+		const std::vector<float> constants = ProgramConstants(*compiled.program);
+		for (uint32_t first = 0U; first <= s.variants && !m_Stop; first += familySize)
+		{
+			const uint32_t members = std::min(familySize, s.variants + 1U - first);
+			std::vector<std::vector<float>> family;
+			for (uint32_t m = 0U; m < members; m++)
+				family.push_back(VariantConstants(constants, seed, first + m));
+
+			for (uint32_t p = 0U; p < s.phases.size() && !m_Stop; p++)
+			{
+				std::vector<Job> jobs(members);
+				std::vector<uint8_t*> pixels(members);
+				for (uint32_t m = 0U; m < members; m++)
+				{
+					jobs[m] = Job{ Image{ compiled.index, seed, first + m, p, s.phases[p], nullptr, compiled.seconds, 0.0 }, nullptr };
+					if (!pool.Pop(jobs[m].pixels))
+						return;
+					pixels[m] = jobs[m].pixels;
+				}
+
+				// The time of the whole family is shared by its members
+				auto start = std::chrono::steady_clock::now();
+				renderer.RenderFamily(*compiled.program, family, s.width, s.height, s.phases[p], pixels.data(), pitch);
+				double seconds = Seconds(start) / members;
+
+				for (Job& job : jobs)
+				{
+					job.image.renderSeconds = seconds;
+					if (!outputQueue.Push(job))
+						return;
+				}
+			}
+		}
+	};
+
+	Compiled compiled;
+	while (!m_Stop && programs.Pop(compiled))
+	{
+		const uint64_t seed = seeds(compiled.index);
+		if (!compiled.program)
+		{
+			(compiled.skipped ? batchSkipped : batchFailures).Add();
+			if (!outputQueue.Push(Job{ Image{ compiled.index, seed, 0U, 0U, s.phases[0], nullptr, compiled.seconds, 0.0, compiled.skipped }, nullptr }))
+				break;
+			continue;
+		}
+
+		if (s.variants > 0U)
+		{
+			renderFamily(compiled);
+			continue;
+		}
+
+		for (uint32_t p = 0U; p < s.phases.size() && !m_Stop; p++)
+		{
+			Job job{ Image{ compiled.index, seed, 0U, p, s.phases[p], nullptr, compiled.seconds, 0.0 }, nullptr };
+			if (!pool.Pop(job.pixels))
+				break;
+
+			auto start = std::chrono::steady_clock::now();
+			renderer.Render(*compiled.program, s.width, s.height, s.phases[p], job.pixels, pitch);
+			job.image.renderSeconds = Seconds(start);
+
+			if (!outputQueue.Push(job))
+				break;
+		}
+	}
+
+	#pragma endregion
+
+	// Let the queued images drain through the output, then stop the generators
+	outputQueue.Close();
+	output.join();
+
+	Stop();
+	programs.Close();
+	for (std::thread& generator : generators)
+		generator.join();
+}
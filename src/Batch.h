@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/*
+	Renders a list of seeds on the CPU, for galleries and other bulk jobs, without paying the startup of a process per seed.
+	The list is given by its length and a function that returns the seed at a position, so counted or shuffled ranges of any size
+	are never stored.
+
+	Like Stream, the work is split in pipelined stages connected by bounded queues:
+		generate  - generator threads take the next seed of the list and generate and compile its program
+		render    - the thread that calls Run renders every phase of the programs with a Renderer and its workers
+		output    - a thread hands the images to the sink, e.g. an archive writer
+	Programs are rendered as soon as they are compiled, so the images come out in completion order, not in the order of the list.
+	Each image carries the position of its seed in the list to match them up. Seeds whose predicted statistics are boring (see
+	Moments.h) are skipped by the generators, and come out as a single image without pixels. Pixels live in a fixed pool of buffers, so the
+	memory usage does not depend on the length of the list.
+
+	With variants, every seed is also rendered with new random constants, e.g. to score the members of its structure family.
+	The members are rendered together (see Renderer::RenderFamily), in groups of familySize, sharing the decode of the code
+	and the values that do not depend on the constants.
+*/
+class Batch
+{
+public:
+	struct Settings
+	{
+		uint32_t width = 640U;
+		uint32_t height = 360U;
+		std::vector<float> phases = { 0.0f }; // Phases of the animation loop rendered for every seed, in [0, 1)
+		uint32_t generatorThreads = 1U;
+		uint32_t renderThreads = 0U; // 0 for one per hardware thread
+		uint32_t lookahead = 4U; // Programs compiled ahead of the one being rendered
+		uint32_t queueDepth = 4U; // Images in flight between the render and output stages
+		float prune = 0.0f; // Error budget of the pruning pass (see Pruning.h), 0 disables it (ignored when deterministic or with variants)
+		float surrogates = 0.0f; // Error bound of the polynomial surrogates (see Surrogates.h), 0 disables them (ignored when deterministic or with variants)
+		bool correlated = false; // Same functions in the three channels (see GenerateShaderExpression)
+		size_t cacheBudget = size_t(256U) << 20U; // Memory for the time-independent values, only used with several phases (see Renderer)
+		bool deterministic = false; // Fixed point evaluator, with bit-identical images on every machine (see Fixed.h)
+		uint32_t variants = 0U; // Variants rendered for every seed in addition to its own constants
+		uint32_t familySize = 8U; // Members of a family rendered together, larger groups no longer fit the scratch in cache
+		float minContrast = 0.0f; // Seeds predicted to be boring are skipped before rendering (see Moments.h), the defaults skip none
+		float maxFlatness = 1.0f;
+		float minMotion = 0.0f;
+	};
+
+	struct Image
+	{
+		uint64_t index; // Position of the seed in the list
+		uint64_t seed;
+		uint32_t variant; // 0 for the constants of the seed, then the variants (see VariantConstants)
+		uint32_t phaseIndex; // Position of the phase in Settings::phases
+		float phase;
+		const uint8_t* pixels; // Tightly packed RGBA8 rows, valid until the sink returns, null if the seed could not be compiled or was skipped
+		double generateSeconds; // Time to generate and compile the program, shared by all phases of the seed
+		double renderSeconds;
+		bool skipped = false; // Predicted to be boring, nothing was rendered
+	};
+
+	// Called on the output thread for every image, returns false to stop the batch
+	using Sink = std::function<bool(const Image& image)>;
+	// Seed at a position of the list, called from the generator threads and the thread of Run
+	using SeedSource = std::function<uint64_t(uint64_t index)>;
+
+	Batch(const Settings& settings);
+
+	Batch(const Batch&) = delete;
+	Batch& operator=(const Batch&) = delete;
+
+	// Render every phase of every seed, until the list is done, the sink returns false or Stop is called
+	void Run(uint64_t count, const SeedSource& seeds, const Sink& sink);
+	// Can be called from any thread, the images already rendered are still output
+	void Stop() { m_Stop = true; }
+
+	// Random constants of the given variant of a program (variant 0 keeps the constants of the program)
+	static std::vector<float> VariantConstants(const std::vector<float>& constants, uint64_t seed, uint32_t variant);
+
+private:
+	Settings m_Settings;
+	std::atomic<bool> m_Stop{ false };
+};
@@ -0,0 +1,188 @@
+/*
+	Benchmark of the shader generator and RandFS, built both natively and for WebAssembly, so the two can be compared.
+
+	Runs a fixed corpus of seeds through the generator and the compiler, and prints the timings, the memory growth and a checksum
+	of the generated code as one JSON line. Production generation happens in the wasm build (32-bit memory, 64-bit integers
+	emulated on some engines, and memory growth that reallocates the heap), so its numbers can differ a lot from native ones.
+	The checksum must be the same on both builds, since the generator is deterministic.
+
+		benchmark --seeds 500 --repeat 3
+		node benchmark.js --seeds 500 --repeat 3
+
+	See bench/run.js, which runs both builds under Node and prints them side by side.
+*/
+
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/heap.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "Shader.h"
+#include "Program.h"
+
+#include "RandFS.h"
+
+namespace
+{
+	struct Options
+	{
+		uint64_t firstSeed = 1ULL;
+		uint32_t seeds = 500U;
+		uint32_t repeat = 3U; // Passes over the corpus, the fastest one is reported
+		uint32_t draws = 10000000U; // Calls of each RandFS function
+	};
+
+	void PrintUsage()
+	{
+		std::fprintf(stderr,
+			"Usage: benchmark [options]\n"
+			"  --first N         First seed of the corpus (default: 1)\n"
+			"  --seeds N         Seeds in the corpus (default: 500)\n"
+			"  --repeat N        Passes over the corpus, the fastest is reported (default: 3)\n"
+			"  --draws N         Calls of each RandFS function (default: 10000000)\n");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char* arg = argv[i];
+			const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+			auto next = [&]() { i++; return value; };
+
+			if (!value) return false;
+			else if (!std::strcmp(arg, "--first")) options.firstSeed = std::strtoull(next(), nullptr, 10);
+			else if (!std::strcmp(arg, "--seeds")) options.seeds = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--repeat")) options.repeat = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--draws")) options.draws = uint32_t(std::strtoul(next(), nullptr, 10));
+			else return false;
+		}
+		return options.seeds > 0U && options.repeat > 0U;
+	}
+
+	// Memory of the process: the size of the linear memory in wasm, the peak resident set natively
+	uint64_t MemoryBytes()
+	{
+#ifdef __EMSCRIPTEN__
+		return emscripten_get_heap_size();
+#else
+		rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return uint64_t(usage.ru_maxrss) * 1024ULL;
+#endif
+	}
+
+	double Nanoseconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	const uint64_t memoryBefore = MemoryBytes();
+	uint64_t memory = memoryBefore;
+	uint32_t memoryGrowths = 0U;
+	auto track = [&]()
+	{
+		uint64_t current = MemoryBytes();
+		memoryGrowths += current > memory;
+		memory = std::max(memory, current);
+	};
+
+	double randomNs = 0.0, hashNs = 0.0, generateNs = 0.0, compileNs = 0.0;
+	uint64_t checksum = 0ULL, bytes = 0ULL;
+	uint32_t failedCompiles = 0U;
+	for (uint32_t pass = 0U; pass < options.repeat; pass++)
+	{
+		#pragma region RandFS
+
+		// The sum keeps the calls from being optimized away, and is part of the checksum
+		uint64_t sum = 0ULL;
+		auto start = std::chrono::steady_clock::now();
+		Random rand(options.firstSeed);
+		for (uint32_t i = 0U; i < options.draws; i++)
+			sum += rand.UInt64();
+		double random = Nanoseconds(start);
+
+		start = std::chrono::steady_clock::now();
+		for (uint32_t i = 0U; i < options.draws; i++)
+			sum += Hash::UInt64(uint64_t(i));
+		double hash = Nanoseconds(start);
+
+		#pragma endregion
+
+		#pragma region Generator
+
+		checksum = sum;
+		bytes = 0ULL;
+
+		// Generation alone, as done by the browser for every seed
+		start = std::chrono::steady_clock::now();
+		for (uint32_t s = 0U; s < options.seeds; s++)
+		{
+			std::string code = GenerateShaderCode(options.firstSeed + s);
+			checksum = Hash::UInt64(Hash::String64(code.c_str()), checksum);
+			bytes += code.size();
+			track();
+		}
+		double generate = Nanoseconds(start);
+
+		// Compilation into a program and emission of its shader, as done with PRUNE or CACHE_SPACE
+		// Seeds that can not be compiled have nothing to emit, and are counted instead of being part of the checksum
+		double compile = 0.0;
+		failedCompiles = 0U;
+		for (uint32_t s = 0U; s < options.seeds; s++)
+		{
+			ShaderExpression expression = GenerateShaderExpression(options.firstSeed + s);
+			start = std::chrono::steady_clock::now();
+			Program program;
+			if (!CompileProgram(expression, program))
+			{
+				compile += Nanoseconds(start);
+				failedCompiles++;
+				continue;
+			}
+			std::string code = EmitShaderCode(program);
+			compile += Nanoseconds(start);
+			checksum = Hash::UInt64(Hash::String64(code.c_str()), checksum);
+			track();
+		}
+
+		#pragma endregion
+
+		randomNs = pass == 0U ? random : std::min(randomNs, random);
+		hashNs = pass == 0U ? hash : std::min(hashNs, hash);
+		generateNs = pass == 0U ? generate : std::min(generateNs, generate);
+		compileNs = pass == 0U ? compile : std::min(compileNs, compile);
+	}
+
+	std::printf("{ \"platform\": \"%s\", \"pointerBits\": %u, \"seeds\": %u, \"generateNsPerSeed\": %.0f, \"compileNsPerSeed\": %.0f, "
+		"\"randomNsPerDraw\": %.2f, \"hashNsPerCall\": %.2f, \"bytesPerSeed\": %.0f, \"memoryBefore\": %llu, \"memoryAfter\": %llu, "
+		"\"memoryGrowths\": %u, \"failedCompiles\": %u, \"checksum\": \"%016llx\" }\n",
+#ifdef __EMSCRIPTEN__
+		"wasm",
+#else
+		"native",
+#endif
+		unsigned(sizeof(void*) * 8U), options.seeds, generateNs / options.seeds, compileNs / options.seeds,
+		randomNs / std::max(options.draws, 1U), hashNs / std::max(options.draws, 1U),
+		double(bytes) / options.seeds, (unsigned long long)memoryBefore, (unsigned long long)memory, memoryGrowths, failedCompiles, (unsigned long long)checksum);
+
+	return 0;
+}
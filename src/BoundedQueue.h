@@ -0,0 +1,63 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <cstddef>
+#include <utility>
+#include <condition_variable>
+
+// Blocking FIFO with a fixed capacity, to connect pipeline stages running on different threads
+// A full queue stalls its producer, so a fast stage can never run ahead of a slow one and grow the memory usage
+template <typename T>
+class BoundedQueue
+{
+public:
+	BoundedQueue(size_t capacity) : m_Capacity(capacity > 0 ? capacity : 1) {}
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	// Wait for room and add the item, returns false if the queue was closed
+	bool Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_NotFull.wait(lock, [&]() { return m_Closed || m_Items.size() < m_Capacity; });
+		if (m_Closed)
+			return false;
+
+		m_Items.push_back(std::move(item));
+		m_NotEmpty.notify_one();
+		return true;
+	}
+
+	// Wait for an item and remove it, returns false once the queue is closed and empty
+	bool Pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_NotEmpty.wait(lock, [&]() { return m_Closed || !m_Items.empty(); });
+		if (m_Items.empty())
+			return false;
+
+		item = std::move(m_Items.front());
+		m_Items.pop_front();
+		m_NotFull.notify_one();
+		return true;
+	}
+
+	// Wake every waiting thread, Push fails from now on and Pop fails once the remaining items are taken
+	void Close()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Closed = true;
+		m_NotFull.notify_all();
+		m_NotEmpty.notify_all();
+	}
+
+private:
+	std::mutex m_Mutex;
+	std::condition_variable m_NotFull;
+	std::condition_variable m_NotEmpty;
+	std::deque<T> m_Items;
+	size_t m_Capacity;
+	bool m_Closed = false;
+};
@@ -0,0 +1,270 @@
+#include "Bytecode.h"
+#include "Shader.h"
+#include "Metrics.h"
+
+#include <map>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <cstring>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#endif
+
+namespace
+{
+	Metrics::Histogram decodeTime("pollock_bytecode_decode_duration_seconds", "Time to decode one program");
+
+	constexpr uint8_t MAGIC[3] = { 'P', 'P', 'B' };
+	constexpr double QUANTUM = 1e6; // Constants are stored in integer millionths
+
+	void WriteVarint(uint64_t value, std::vector<uint8_t>& out)
+	{
+		while (value >= 0x80ULL)
+		{
+			out.push_back(uint8_t(value) | 0x80U);
+			value >>= 7;
+		}
+		out.push_back(uint8_t(value));
+	}
+
+	class Reader
+	{
+	public:
+		Reader(const uint8_t* data, size_t size) : m_Data(data), m_Size(size), m_Pos(0) {}
+
+		bool Varint(uint64_t& value)
+		{
+			value = 0ULL;
+			for (uint32_t shift = 0U; shift < 64U; shift += 7U)
+			{
+				if (m_Pos >= m_Size)
+					return false;
+				uint8_t byte = m_Data[m_Pos++];
+				value |= uint64_t(byte & 0x7FU) << shift;
+				if (!(byte & 0x80U))
+					return true;
+			}
+			return false;
+		}
+
+		bool Bytes(const uint8_t* expected, size_t count)
+		{
+			if (m_Size - m_Pos < count)
+				return false;
+			for (size_t i = 0; i < count; i++)
+			{
+				if (m_Data[m_Pos + i] != expected[i])
+					return false;
+			}
+			m_Pos += count;
+			return true;
+		}
+
+		void Skip(size_t count) { m_Pos += count; }
+		const uint8_t* Position() const { return m_Data + m_Pos; }
+		size_t Remaining() const { return m_Size - m_Pos; }
+
+	private:
+		const uint8_t* m_Data;
+		size_t m_Size;
+		size_t m_Pos;
+	};
+}
+
+void Bytecode::Encode(const Program& program, std::vector<uint8_t>& out)
+{
+	out.insert(out.end(), MAGIC, MAGIC + 3);
+	WriteVarint(VERSION, out);
+
+	// Constant pool, in order of first use
+	std::map<int64_t, uint32_t> poolIndex;
+	std::vector<int64_t> pool;
+	std::vector<uint32_t> constantIndex(program.code.size());
+	for (uint32_t i = 0U; i < program.code.size(); i++)
+	{
+		if (program.code[i].op != Op::Const)
+			continue;
+
+		int64_t quantised = std::llround(double(program.code[i].value) * QUANTUM);
+		auto it = poolIndex.emplace(quantised, uint32_t(pool.size())).first;
+		if (it->second == pool.size())
+			pool.push_back(quantised);
+		constantIndex[i] = it->second;
+	}
+	WriteVarint(pool.size(), out);
+	for (int64_t constant : pool)
+		WriteVarint((uint64_t(constant) << 1) ^ uint64_t(constant >> 63), out); // Zigzag
+
+	WriteVarint(program.code.size(), out);
+	for (uint32_t i = 0U; i < program.code.size(); i++)
+	{
+		const Instruction& instruction = program.code[i];
+		WriteVarint(uint64_t(instruction.op), out);
+
+		if (instruction.op == Op::Const)
+			WriteVarint(constantIndex[i], out);
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+			WriteVarint(i - instruction.args[a], out);
+	}
+
+	for (uint32_t output : program.outputs)
+		WriteVarint(program.code.size() - output, out);
+}
+
+bool Bytecode::Decode(const uint8_t* data, size_t size, Program& program)
+{
+	Metrics::Timer timer(decodeTime);
+
+	Reader reader(data, size);
+	uint64_t version;
+	if (!reader.Bytes(MAGIC, 3) || !reader.Varint(version) || version != VERSION)
+		return false;
+
+	// Every entry takes at least one byte, which bounds the counts of malformed data
+	uint64_t poolSize;
+	if (!reader.Varint(poolSize) || poolSize > reader.Remaining())
+		return false;
+	std::vector<float> pool(poolSize);
+	for (float& constant : pool)
+	{
+		uint64_t zigzag;
+		if (!reader.Varint(zigzag))
+			return false;
+		int64_t quantised = int64_t(zigzag >> 1) ^ -int64_t(zigzag & 1ULL);
+		constant = float(double(quantised) / QUANTUM);
+	}
+
+	uint64_t codeSize;
+	if (!reader.Varint(codeSize) || codeSize == 0ULL || codeSize > reader.Remaining())
+		return false;
+	program.code.assign(codeSize, Instruction{});
+	program.stores.clear();
+	std::vector<uint32_t> depth(codeSize, 1U);
+	for (uint32_t i = 0U; i < codeSize; i++)
+	{
+		Instruction& instruction = program.code[i];
+
+		uint64_t op;
+		if (!reader.Varint(op) || op >= uint64_t(Op::Count) || Op(op) == Op::Cached)
+			return false;
+		instruction.op = Op(op);
+
+		if (instruction.op == Op::Const)
+		{
+			uint64_t index;
+			if (!reader.Varint(index) || index >= pool.size())
+				return false;
+			instruction.value = pool[index];
+		}
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+		{
+			uint64_t distance;
+			if (!reader.Varint(distance) || distance == 0ULL || distance > i)
+				return false;
+			instruction.args[a] = uint32_t(i - distance);
+			depth[i] = std::max(depth[i], depth[instruction.args[a]] + 1U);
+		}
+		if (depth[i] > MAX_DEPTH)
+			return false;
+	}
+
+	for (uint32_t& output : program.outputs)
+	{
+		uint64_t distance;
+		if (!reader.Varint(distance) || distance == 0ULL || distance > codeSize)
+			return false;
+		output = uint32_t(codeSize - distance);
+	}
+
+	ScheduleProgram(program);
+	return true;
+}
+
+void Bytecode::EncodePlaylist(const std::vector<Program>& programs, std::vector<uint8_t>& out)
+{
+	WriteVarint(programs.size(), out);
+
+	std::vector<uint8_t> encoded;
+	for (const Program& program : programs)
+	{
+		encoded.clear();
+		Encode(program, encoded);
+		WriteVarint(encoded.size(), out);
+		out.insert(out.end(), encoded.begin(), encoded.end());
+	}
+}
+
+bool Bytecode::DecodePlaylist(const uint8_t* data, size_t size, std::vector<Program>& programs)
+{
+	Reader reader(data, size);
+	uint64_t count;
+	if (!reader.Varint(count) || count > reader.Remaining())
+		return false;
+
+	programs.resize(count);
+	for (Program& program : programs)
+	{
+		uint64_t programSize;
+		if (!reader.Varint(programSize) || programSize > reader.Remaining())
+			return false;
+
+		if (!Decode(reader.Position(), programSize, program))
+			return false;
+		reader.Skip(programSize);
+	}
+	return true;
+}
+
+bool Bytecode::EncodeWords(const Program& program, std::vector<uint32_t>& out)
+{
+	// A program that failed to compile may be empty, or left with outputs of another program
+	if (program.code.empty() || program.registerCount > INTERPRETER_REGISTERS)
+		return false;
+	for (uint32_t output : program.outputs)
+		if (output >= program.code.size())
+			return false;
+	for (const Instruction& instruction : program.code)
+		if (instruction.op == Op::Cached)
+			return false;
+
+	const std::vector<Instruction>& code = program.code;
+	out.push_back(uint32_t(code.size()));
+	out.push_back(uint32_t(code[program.outputs[0]].dst) | uint32_t(code[program.outputs[1]].dst) << 8 | uint32_t(code[program.outputs[2]].dst) << 16);
+	for (const Instruction& instruction : code)
+	{
+		// Unused sources read register 0, which is always in range
+		uint32_t src[4] = {};
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+			src[a] = instruction.src[a];
+
+		out.push_back(uint32_t(instruction.op) | uint32_t(instruction.dst) << 8 | src[0] << 16 | src[1] << 24);
+		if (instruction.op == Op::Const)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &instruction.value, sizeof(bits));
+			out.push_back(bits);
+		}
+		else
+		{
+			out.push_back(src[2] | src[3] << 8);
+		}
+	}
+	return true;
+}
+
+#ifdef __EMSCRIPTEN__
+// Decode a program received by the page and return its shader code, or null if the data is malformed
+extern "C" EMSCRIPTEN_KEEPALIVE const char* DecodeShaderCode(const uint8_t* data, uint32_t size)
+{
+	static std::string code;
+
+	Program program;
+	if (!Bytecode::Decode(data, size, program))
+		return nullptr;
+
+	code = EmitShaderCode(program);
+	return code.c_str();
+}
+#endif
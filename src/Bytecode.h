@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Program.h"
+
+/*
+	Compact binary encoding of compiled programs, so clients can receive a program instead of a seed (which needs the
+	whole generator) or the WGSL text (which takes kilobytes to megabytes per seed).
+
+	All integers are LEB128 varints. The layout of version 1 is:
+
+		'P' 'P' 'B' version
+		constantCount constant... (deduplicated pool, each constant quantised to integer millionths and zigzag encoded)
+		instructionCount instruction...
+		output output output (distances back from the end of the code)
+
+	Each instruction is its op, followed by either the index of its constant in the pool (Op::Const),
+	or the distance back to each of its arguments. Identical subtrees are already shared by the program,
+	and arguments are usually computed right before their use, so most instructions take 2 or 3 bytes.
+
+	Quantisation is lossless for generated programs, since the generator writes its constants with 6 decimals
+	(the coefficients of polynomial surrogates are rounded, by far less than their error bound).
+	Ops are numbered as in the Op enum, where new ops are only appended, so older decoders reject the programs that use them.
+*/
+namespace Bytecode
+{
+	constexpr uint32_t VERSION = 1U;
+	// Longest chain of arguments accepted by Decode, far above the 24 of generated programs (with room for surrogates)
+	// The passes over the code do not recurse, and the cap also bounds the nesting of the shaders emitted for untrusted data
+	constexpr uint32_t MAX_DEPTH = 256U;
+
+	// Append the encoding of the program
+	void Encode(const Program& program, std::vector<uint8_t>& out);
+	// Decode one program and schedule it. Returns false if the data is malformed, deeper than MAX_DEPTH, or from an unknown version
+	bool Decode(const uint8_t* data, size_t size, Program& program);
+
+	// Playlists are a program count followed by each program prefixed with its size
+	void EncodePlaylist(const std::vector<Program>& programs, std::vector<uint8_t>& out);
+	bool DecodePlaylist(const uint8_t* data, size_t size, std::vector<Program>& programs);
+
+	/*
+		Fixed width encoding for the GPU interpreter (see EmitInterpreterShaderCode), which runs the programs of many seeds
+		in a single dispatch instead of compiling a pipeline for each. A program is a list of 32-bit words:
+
+			instructionCount
+			r | g << 8 | b << 16 (registers of the outputs)
+			op | dst << 8 | src0 << 16 | src1 << 24, then src2 | src3 << 8 (or the bits of the value of Op::Const) per instruction
+
+		The registers are those of ScheduleProgram, which needs at most 49 for generated programs, so the interpreter keeps them
+		in a private array of INTERPRETER_REGISTERS. Ops are numbered as in the Op enum, like the bytecode.
+	*/
+	constexpr uint32_t INTERPRETER_REGISTERS = 64U;
+
+	// Append the words of the program. Returns false and appends nothing if it is empty or malformed, needs more registers, or reads cache slots
+	bool EncodeWords(const Program& program, std::vector<uint32_t>& out);
+}
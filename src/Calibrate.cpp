@@ -0,0 +1,168 @@
+/*
+	Calibration of the cost model (see CostModel.h) for the CPU evaluator of the machine it runs on.
+
+	Times the renderer on a designed corpus and fits the cost of every op to the times:
+		chains    - for each op, programs that repeat it in a chain of several lengths, so the cost of every op is
+		            measured alone, whatever the mix of the generated seeds
+		seeds     - generated programs, with the mix of ops that matters in practice, every fifth one left out of the
+		            fit to measure the error of the predictions
+	The costs are saved for Headless --costs, which predicts frame times with them and uses them in place of OpCost.
+
+		calibrate --seeds 200 --out costs.txt
+*/
+
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "Shader.h"
+#include "Program.h"
+#include "Renderer.h"
+#include "CostModel.h"
+
+namespace
+{
+	struct Options
+	{
+		uint64_t firstSeed = 1ULL;
+		uint32_t seeds = 200U;
+		uint32_t width = 256U;
+		uint32_t height = 256U;
+		uint32_t repeat = 3U; // Renders of each program, the fastest one is kept
+		uint32_t threads = 1U; // Costs are per thread, more threads only make the measures noisier
+		const char* device = nullptr;
+		const char* out = "costs.txt";
+	};
+
+	void PrintUsage()
+	{
+		std::fprintf(stderr,
+			"Usage: calibrate [options]\n"
+			"  --first N         First seed of the corpus (default: 1)\n"
+			"  --seeds N         Generated seeds in the corpus (default: 200)\n"
+			"  --width N         Width of the renders (default: 256)\n"
+			"  --height N        Height of the renders (default: 256)\n"
+			"  --repeat N        Renders of each program, the fastest is kept (default: 3)\n"
+			"  --threads N       Render threads (default: 1)\n"
+			"  --device NAME     Name of the device saved with the costs, without spaces (default: native-cpu)\n"
+			"  --out FILE        File of the calibrated costs (default: costs.txt)\n");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char* arg = argv[i];
+			const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+			auto next = [&]() { i++; return value; };
+
+			if (!value) return false;
+			else if (!std::strcmp(arg, "--first")) options.firstSeed = std::strtoull(next(), nullptr, 10);
+			else if (!std::strcmp(arg, "--seeds")) options.seeds = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--width")) options.width = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--height")) options.height = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--repeat")) options.repeat = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--threads")) options.threads = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--device")) options.device = next();
+			else if (!std::strcmp(arg, "--out")) options.out = next();
+			else return false;
+		}
+		return options.width > 0U && options.height > 0U && options.repeat > 0U;
+	}
+
+	// Program that repeats op length times, each instance taking the previous results as arguments
+	// The values stay in [0, 1] like those of the generated trees, so no op hits slow paths such as denormals
+	Program Chain(Op op, uint32_t length)
+	{
+		Program program{};
+		const Op inputs[] = { Op::X, Op::Y, Op::SinTime, Op::Const };
+		for (Op input : inputs)
+		{
+			Instruction instruction{ input };
+			instruction.value = 0.37f;
+			program.code.push_back(instruction);
+		}
+		for (uint32_t i = 0U; i < length; i++)
+		{
+			Instruction instruction{ op };
+			for (uint32_t a = 0U; a < OpArity(op); a++)
+				instruction.args[a] = uint32_t(program.code.size() - 1U - a);
+			program.code.push_back(instruction);
+		}
+		for (uint32_t c = 0U; c < 3U; c++)
+			program.outputs[c] = uint32_t(program.code.size() - 1U - c);
+		ScheduleProgram(program);
+		return program;
+	}
+
+	double NanosecondsPerPixel(Renderer& renderer, const Program& program, const Options& options, std::vector<uint8_t>& pixels)
+	{
+		double best = 0.0;
+		for (uint32_t pass = 0U; pass < options.repeat; pass++)
+		{
+			auto start = std::chrono::steady_clock::now();
+			renderer.Render(program, options.width, options.height, 0.25f, pixels.data(), options.width * 4U);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			best = pass == 0U ? seconds : std::min(best, seconds);
+		}
+		// Per thread, like the costs
+		return 1e9 * best * renderer.ThreadCount() / (double(options.width) * options.height);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	// The cache would hide most of the work of the programs
+	Renderer renderer(options.threads);
+	renderer.SetCacheBudget(0U);
+	std::vector<uint8_t> pixels(size_t(options.width) * options.height * 4U);
+
+	// Every fifth seed is left out of the fit
+	std::vector<CostModel::Sample> samples, heldOut;
+	uint32_t chains = 0U, seeds = 0U;
+	for (uint32_t op = 0U; op < uint32_t(Op::Count); op++)
+	{
+		if (OpArity(Op(op)) == 0U || Op(op) == Op::Cached)
+			continue;
+		for (uint32_t length : { 8U, 32U, 96U })
+		{
+			Program program = Chain(Op(op), length);
+			samples.push_back(CostModel::MakeSample(program, NanosecondsPerPixel(renderer, program, options, pixels)));
+			chains++;
+		}
+	}
+	for (uint32_t s = 0U; s < options.seeds; s++)
+	{
+		Program program;
+		if (!CompileProgram(GenerateShaderExpression(options.firstSeed + s), program))
+			continue;
+		CostModel::Sample sample = CostModel::MakeSample(program, NanosecondsPerPixel(renderer, program, options, pixels));
+		(seeds++ % 5U == 4U ? heldOut : samples).push_back(sample);
+	}
+
+	CostModel::Costs costs = CostModel::Fit(samples, heldOut);
+	costs.device = options.device ? options.device : "native-cpu";
+
+	std::fprintf(stderr, "%-12s %10s %10s\n", "op", "ns/pixel", "static");
+	std::fprintf(stderr, "%-12s %10.3f\n", "pixel", costs.pixel);
+	for (uint32_t op = 0U; op < uint32_t(Op::Count); op++)
+		std::fprintf(stderr, "%-12s %10.3f %10.1f\n", OpName(Op(op)), costs.ops[op], OpCost(Op(op)));
+	std::fprintf(stderr, "%u chains and %u seeds, relative error of the %zu seeds left out of the fit: %.1f%%\n", chains, seeds, heldOut.size(), 100.0f * costs.error);
+
+	if (!CostModel::Save(costs, options.out))
+	{
+		std::fprintf(stderr, "Could not write %s\n", options.out);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,441 @@
+#include "CanvasView.h"
+#include "GraphicsState.h"
+#include "WallPanel.h"
+#include "Metrics.h"
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include <webgpu/webgpu_cpp.h>
+#include <emscripten/emscripten.h>
+#include <emscripten/html5.h>
+
+using namespace GraphicsState;
+
+namespace
+{
+	// State of Pan and Zoom
+	// Each frame renders the changes of the view into one of two textures, then draws that texture on the canvas
+	constexpr uint32_t VIEW_REFINE_FRAMES = 8U; // Frames to render a zoomed view again
+	constexpr uint32_t VIEW_COARSEST_STEP = 64U; // Rows refined first, then the rows in between
+	struct ViewMove
+	{
+		float factor; // 0 for a pan
+		int32_t dx, dy;
+		float x, y;
+	};
+	struct ViewRect
+	{
+		uint32_t x, y, width, height;
+	};
+	struct View
+	{
+		bool active = false;
+		double x = 0.0, y = 0.0, width = 1.0, height = 1.0; // Region of the uv space, accumulated in double over many moves
+		std::vector<ViewMove> moves; // Applied by the next frames, a zoom or a run of pans per frame
+		uint32_t textureWidth = 0U, textureHeight = 0U;
+		wgpu::Texture textures[2];
+		uint32_t current = 0U; // Texture that holds the view
+		wgpu::Buffer regionBuffer; // Region of the view, read by the region vertex shader
+		wgpu::Buffer transformBuffer; // Transform of a zoom, then the identity 256 bytes later
+		wgpu::BindGroup bindGroup;
+		wgpu::BindGroup resampleBindGroups[2][2]; // For each texture, with the transform of the zoom or the identity
+		wgpu::RenderPipeline pipeline; // Fragment module of the canvas pipeline, with the region vertex shader
+		wgpu::RenderPipeline resamplePipeline;
+		std::vector<uint32_t> refineOrder;
+		std::vector<uint8_t> stale; // One flag per row
+		uint32_t staleRows = 0U;
+		uint32_t nextRefine = 0U; // Position in refineOrder, the rows before it are not stale
+	};
+	View m_View;
+	Metrics::Counter m_ViewPixels("pollock_gpu_view_rendered_pixels_total", "Number of pixels rendered by the interactive view");
+
+	// Module of the resample pipeline, created with the first view
+	wgpu::ShaderModule m_ResampleModule;
+
+	// Create the textures, buffers and pipelines of the view for the given canvas size, the whole view is stale
+	void ViewSetup(uint32_t width, uint32_t height)
+	{
+		View& v = m_View;
+		v.textureWidth = width;
+		v.textureHeight = height;
+
+		#pragma region Textures and buffers
+
+		wgpu::TextureDescriptor td =
+		{
+			.usage		= wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::TextureBinding | wgpu::TextureUsage::CopySrc | wgpu::TextureUsage::CopyDst,
+			.dimension	= wgpu::TextureDimension::e2D,
+			.size		= { width, height, 1 },
+			.format		= m_Format
+		};
+		for (wgpu::Texture& texture : v.textures)
+		{
+			if (texture)
+				texture.Destroy();
+			texture = m_Device.CreateTexture(&td);
+		}
+		v.current = 0U;
+
+		if (!v.regionBuffer)
+		{
+			wgpu::BufferDescriptor ubd =
+			{
+				.usage				= wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst,
+				.size				= 4 * sizeof(float),
+				.mappedAtCreation	= false
+			};
+			v.regionBuffer = m_Device.CreateBuffer(&ubd);
+
+			ubd.size = 256U + 4 * sizeof(float);
+			v.transformBuffer = m_Device.CreateBuffer(&ubd);
+			const float identity[] = { 0.0f, 0.0f, 1.0f, 1.0f };
+			m_Device.GetQueue().WriteBuffer(v.transformBuffer, 256U, identity, sizeof(identity));
+		}
+
+		// Every 64th row, then every 32nd row not listed yet, and so on
+		v.refineOrder.clear();
+		std::vector<uint8_t> listed(height, 0U);
+		for (uint32_t step = VIEW_COARSEST_STEP; step > 0U; step /= 2U)
+		{
+			for (uint32_t row = 0U; row < height; row += step)
+			{
+				if (!listed[row])
+				{
+					v.refineOrder.push_back(row);
+					listed[row] = 1U;
+				}
+			}
+		}
+		v.stale.assign(height, 1U);
+		v.staleRows = height;
+		v.nextRefine = 0U;
+
+		#pragma endregion
+
+		#pragma region Pipelines
+
+		// Same bindings as the canvas pipeline, plus the region of the vertex shader
+		if (!v.pipeline)
+		{
+			bool uniform = m_ConstantMode == ConstantMode::Uniform && !m_Constants.empty();
+			std::vector<wgpu::BindGroupLayoutEntry> layoutEntries =
+			{
+				{ .binding = 0, .visibility = wgpu::ShaderStage::Fragment, .buffer = { .type = wgpu::BufferBindingType::Uniform } },
+				{ .binding = 3, .visibility = wgpu::ShaderStage::Vertex, .buffer = { .type = wgpu::BufferBindingType::Uniform } }
+			};
+			std::vector<wgpu::BindGroupEntry> entries =
+			{
+				{ .binding = 0, .buffer = m_Buffer, .offset = 0, .size = 4 * sizeof(float) },
+				{ .binding = 3, .buffer = v.regionBuffer, .offset = 0, .size = 4 * sizeof(float) }
+			};
+			if (uniform)
+			{
+				layoutEntries.push_back({ .binding = 1, .visibility = wgpu::ShaderStage::Fragment, .buffer = { .type = wgpu::BufferBindingType::Uniform } });
+				entries.push_back({ .binding = 1, .buffer = m_ConstantBuffer, .offset = 0, .size = (m_Constants.size() + 3U) / 4U * 4U * sizeof(float) });
+			}
+
+			wgpu::BindGroupLayoutDescriptor bgld = { .entryCount = layoutEntries.size(), .entries = layoutEntries.data() };
+			wgpu::BindGroupLayout layout = m_Device.CreateBindGroupLayout(&bgld);
+			wgpu::BindGroupDescriptor bgd = { .layout = layout, .entryCount = entries.size(), .entries = entries.data() };
+			v.bindGroup = m_Device.CreateBindGroup(&bgd);
+
+			std::vector<std::string> constantKeys;
+			std::vector<wgpu::ConstantEntry> constantEntries = OverrideConstants(m_Constants, constantKeys);
+			wgpu::ColorTargetState colorTargetState{ .format = m_Format };
+			wgpu::FragmentState fragmentState
+			{
+				.module = m_ShaderModule,
+				.constantCount = constantEntries.size(),
+				.constants = constantEntries.data(),
+				.targetCount = 1,
+				.targets = &colorTargetState
+			};
+			wgpu::PipelineLayoutDescriptor pld = { .bindGroupLayoutCount = 1, .bindGroupLayouts = &layout };
+			wgpu::RenderPipelineDescriptor rpd =
+			{
+				.layout = m_Device.CreatePipelineLayout(&pld),
+				.vertex = { .module = RegionModule() },
+				.fragment = &fragmentState
+			};
+			v.pipeline = m_Device.CreateRenderPipeline(&rpd);
+		}
+
+		// The resample pipeline does not depend on the program
+		if (!m_ResampleModule)
+		{
+			std::string code = EmitResampleShaderCode();
+			wgpu::ShaderModuleWGSLDescriptor wgsld{};
+			wgsld.code = code.c_str();
+			wgpu::ShaderModuleDescriptor shaderModuleDescriptor{ .nextInChain = &wgsld };
+			m_ResampleModule = m_Device.CreateShaderModule(&shaderModuleDescriptor);
+		}
+
+		std::vector<wgpu::BindGroupLayoutEntry> resampleEntries =
+		{
+			{ .binding = 0, .visibility = wgpu::ShaderStage::Fragment, .texture = { .sampleType = wgpu::TextureSampleType::Float } },
+			{ .binding = 1, .visibility = wgpu::ShaderStage::Fragment, .sampler = { .type = wgpu::SamplerBindingType::Filtering } },
+			{ .binding = 2, .visibility = wgpu::ShaderStage::Vertex, .buffer = { .type = wgpu::BufferBindingType::Uniform } }
+		};
+		wgpu::BindGroupLayoutDescriptor rbgld = { .entryCount = resampleEntries.size(), .entries = resampleEntries.data() };
+		wgpu::BindGroupLayout resampleLayout = m_Device.CreateBindGroupLayout(&rbgld);
+
+		wgpu::SamplerDescriptor sd{ .magFilter = wgpu::FilterMode::Linear, .minFilter = wgpu::FilterMode::Linear };
+		wgpu::Sampler sampler = m_Device.CreateSampler(&sd);
+		for (uint32_t t = 0U; t < 2U; t++)
+		{
+			for (uint32_t k = 0U; k < 2U; k++)
+			{
+				std::vector<wgpu::BindGroupEntry> entries =
+				{
+					{ .binding = 0, .textureView = v.textures[t].CreateView() },
+					{ .binding = 1, .sampler = sampler },
+					{ .binding = 2, .buffer = v.transformBuffer, .offset = k * 256U, .size = 4 * sizeof(float) }
+				};
+				wgpu::BindGroupDescriptor bgd = { .layout = resampleLayout, .entryCount = entries.size(), .entries = entries.data() };
+				v.resampleBindGroups[t][k] = m_Device.CreateBindGroup(&bgd);
+			}
+		}
+
+		wgpu::ColorTargetState colorTargetState{ .format = m_Format };
+		wgpu::FragmentState fragmentState{ .module = m_ResampleModule, .targetCount = 1, .targets = &colorTargetState };
+		wgpu::PipelineLayoutDescriptor pld = { .bindGroupLayoutCount = 1, .bindGroupLayouts = &resampleLayout };
+		wgpu::RenderPipelineDescriptor rpd =
+		{
+			.layout = m_Device.CreatePipelineLayout(&pld),
+			.vertex = { .module = m_ResampleModule },
+			.fragment = &fragmentState
+		};
+		v.resamplePipeline = m_Device.CreateRenderPipeline(&rpd);
+
+		#pragma endregion
+	}
+
+	// Draw a texture of the view into a target, through the transform of a zoom (slot 0) or the identity (slot 1)
+	void ViewResample(wgpu::CommandEncoder& encoder, const wgpu::TextureView& target, uint32_t source, uint32_t slot)
+	{
+		wgpu::RenderPassColorAttachment attachment
+		{
+			.view = target,
+			.loadOp = wgpu::LoadOp::Clear,
+			.storeOp = wgpu::StoreOp::Store
+		};
+		wgpu::RenderPassDescriptor rpd{ .colorAttachmentCount = 1, .colorAttachments = &attachment };
+		wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&rpd);
+		pass.SetPipeline(m_View.resamplePipeline);
+		pass.SetBindGroup(0, m_View.resampleBindGroups[source][slot]);
+		pass.Draw(6);
+		pass.End();
+	}
+}
+
+void CanvasView::Pan(int32_t dx, int32_t dy)
+{
+	if (!m_Pipeline || m_PipelinePending || m_Split || WallPanel::Active() || (dx == 0 && dy == 0))
+		return;
+	m_View.active = true;
+	m_View.moves.push_back(ViewMove{ 0.0f, dx, dy, 0.0f, 0.0f });
+}
+
+void CanvasView::Zoom(float factor, float x, float y)
+{
+	if (!m_Pipeline || m_PipelinePending || m_Split || WallPanel::Active() || !(factor > 0.0f) || factor == 1.0f)
+		return;
+	m_View.active = true;
+	m_View.moves.push_back(ViewMove{ factor, 0, 0, x, y });
+}
+
+void CanvasView::Reset()
+{
+	// The textures and buffers are released with the state, the resample module is kept
+	m_View = View{};
+}
+
+bool CanvasView::Active()
+{
+	return m_View.active;
+}
+
+void CanvasView::Update()
+{
+	View& v = m_View;
+
+	// The view follows the size of the canvas, and is rendered again as a whole when it changes
+	int canvasWidth = 0, canvasHeight = 0;
+	emscripten_get_canvas_element_size("#canvas", &canvasWidth, &canvasHeight);
+	if (canvasWidth <= 0 || canvasHeight <= 0)
+		return;
+	const uint32_t width = uint32_t(canvasWidth), height = uint32_t(canvasHeight);
+	bool changed = width != v.textureWidth || height != v.textureHeight;
+	if (changed)
+		ViewSetup(width, height);
+
+	// Nothing to render, the canvas keeps its content
+	if (!changed && v.moves.empty() && v.staleRows == 0U)
+		return;
+
+	wgpu::CommandEncoder encoder = m_Device.CreateCommandEncoder();
+	std::vector<ViewRect> rects;
+
+	#pragma region Moves
+
+	if (!v.moves.empty() && v.moves[0].factor > 0.0f)
+	{
+		// Zoom: the uv under the given position stays in place, and the previous view is resampled into the other texture
+		const ViewMove move = v.moves[0];
+		v.moves.erase(v.moves.begin());
+
+		const double u = v.x + v.width * move.x / width;
+		const double w = v.y + v.height * (1.0 - double(move.y) / height);
+		const double oldX = v.x, oldY = v.y, oldWidth = v.width, oldHeight = v.height;
+		v.width /= move.factor;
+		v.height /= move.factor;
+		v.x = u - v.width * move.x / width;
+		v.y = w - v.height * (1.0 - double(move.y) / height);
+
+		// Texture uv of the previous view (0 at the top) for the texture uv of the new one
+		const float transform[] =
+		{
+			float((v.x - oldX) / oldWidth),
+			float((oldY + oldHeight - v.y - v.height) / oldHeight),
+			float(v.width / oldWidth),
+			float(v.height / oldHeight)
+		};
+		m_Device.GetQueue().WriteBuffer(v.transformBuffer, 0, transform, sizeof(transform));
+
+		ViewResample(encoder, v.textures[1U - v.current].CreateView(), v.current, 0U);
+		v.current = 1U - v.current;
+		std::fill(v.stale.begin(), v.stale.end(), 1U);
+		v.staleRows = height;
+		v.nextRefine = 0U;
+	}
+	else if (!v.moves.empty())
+	{
+		// The pans queued since the previous frame add up
+		int32_t dx = 0, dy = 0;
+		while (!v.moves.empty() && v.moves[0].factor == 0.0f)
+		{
+			dx += v.moves[0].dx;
+			dy += v.moves[0].dy;
+			v.moves.erase(v.moves.begin());
+		}
+
+		// uv.y = 1 at the top, so moving down lowers the region
+		v.x += v.width * dx / width;
+		v.y -= v.height * dy / height;
+
+		const uint32_t ax = uint32_t(std::abs(dx)), ay = uint32_t(std::abs(dy));
+		if (ax >= width || ay >= height)
+		{
+			changed = true;
+		}
+		else if (ax > 0U || ay > 0U)
+		{
+			// Pixel (x, y) of the new view is pixel (x + dx, y + dy) of the previous one
+			const uint32_t keptWidth = width - ax, keptHeight = height - ay;
+			const uint32_t fromX = dx > 0 ? ax : 0U, toX = dx > 0 ? 0U : ax;
+			const uint32_t fromY = dy > 0 ? ay : 0U, toY = dy > 0 ? 0U : ay;
+			wgpu::ImageCopyTexture source{ .texture = v.textures[v.current], .origin = { fromX, fromY, 0 } };
+			wgpu::ImageCopyTexture destination{ .texture = v.textures[1U - v.current], .origin = { toX, toY, 0 } };
+			wgpu::Extent3D size{ keptWidth, keptHeight, 1 };
+			encoder.CopyTextureToTexture(&source, &destination, &size);
+			v.current = 1U - v.current;
+
+			// The stale rows move with their pixels
+			if (v.staleRows > 0U)
+			{
+				std::vector<uint8_t> stale(height, 0U);
+				for (uint32_t row = 0U; row < keptHeight; row++)
+					stale[toY + row] = v.stale[fromY + row];
+				v.stale.swap(stale);
+				v.staleRows = uint32_t(std::count(v.stale.begin(), v.stale.end(), 1U));
+				v.nextRefine = 0U;
+			}
+
+			// Exposed rows across the whole width, then the exposed columns of the kept rows
+			if (ay > 0U)
+				rects.push_back(ViewRect{ 0U, dy > 0 ? keptHeight : 0U, width, ay });
+			if (ax > 0U)
+				rects.push_back(ViewRect{ dx > 0 ? keptWidth : 0U, toY, ax, keptHeight });
+		}
+	}
+
+	#pragma endregion
+
+	#pragma region Render
+
+	// A new or resized view (or a pan beyond it) is rendered at once, a zoomed one over the next frames
+	if (changed)
+	{
+		rects.assign(1U, ViewRect{ 0U, 0U, width, height });
+		std::fill(v.stale.begin(), v.stale.end(), 0U);
+		v.staleRows = 0U;
+	}
+	const uint32_t budget = (height + VIEW_REFINE_FRAMES - 1U) / VIEW_REFINE_FRAMES;
+	for (uint32_t refined = 0U; v.staleRows > 0U && refined < budget; v.nextRefine++)
+	{
+		uint32_t row = v.refineOrder[v.nextRefine];
+		if (!v.stale[row])
+			continue;
+		rects.push_back(ViewRect{ 0U, row, width, 1U });
+		v.stale[row] = 0U;
+		v.staleRows--;
+		refined++;
+	}
+
+	// Every rect is drawn with the quad of the whole view, so its pixels get the same uv as in a full render
+	if (!rects.empty())
+	{
+		const float region[] = { float(v.x), float(v.y), float(v.width), float(v.height) };
+		m_Device.GetQueue().WriteBuffer(v.regionBuffer, 0, region, sizeof(region));
+
+		wgpu::RenderPassColorAttachment attachment
+		{
+			.view = v.textures[v.current].CreateView(),
+			.loadOp = wgpu::LoadOp::Load,
+			.storeOp = wgpu::StoreOp::Store
+		};
+		wgpu::RenderPassDescriptor rpd{ .colorAttachmentCount = 1, .colorAttachments = &attachment };
+		wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&rpd);
+		pass.SetPipeline(v.pipeline);
+		pass.SetBindGroup(0, v.bindGroup);
+		for (const ViewRect& rect : rects)
+		{
+			pass.SetScissorRect(rect.x, rect.y, rect.width, rect.height);
+			pass.Draw(6);
+			m_ViewPixels.Add(uint64_t(rect.width) * rect.height);
+		}
+		pass.End();
+	}
+
+	#pragma endregion
+
+	// Draw the view on the canvas
+	wgpu::SurfaceTexture surfaceTexture;
+	m_Surface.GetCurrentTexture(&surfaceTexture);
+	ViewResample(encoder, surfaceTexture.texture.CreateView(), v.current, 1U);
+
+	wgpu::CommandBuffer commands = encoder.Finish();
+	m_Device.GetQueue().Submit(1, &commands);
+	m_Frames.Add();
+}
+
+// Move the view of the current program (see CanvasView::Pan and CanvasView::Zoom), e.g. from the pointer and wheel events of the canvas
+// Positions and offsets are in pixels of the canvas, from its top left corner
+extern "C" EMSCRIPTEN_KEEPALIVE void PanView(int32_t dx, int32_t dy)
+{
+	CanvasView::Pan(dx, dy);
+}
+
+extern "C" EMSCRIPTEN_KEEPALIVE void ZoomView(float factor, float x, float y)
+{
+	CanvasView::Zoom(factor, x, y);
+}
+
+extern "C" EMSCRIPTEN_KEEPALIVE void ResetView()
+{
+	CanvasView::Reset();
+}
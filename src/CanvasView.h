@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+	Interactive view of the program shown by the canvas (see Viewport.h for the headless version).
+
+	The view is kept in a texture, and each frame only renders what changed: a pan shifts the view by whole pixels of the canvas
+	and renders the strips it exposes, a zoom (above 1 zooms in, around a position in pixels of the canvas) resamples the view
+	at once, then renders it again over the next frames, coarse to fine. Frames with nothing to render leave the canvas as is.
+	The first move freezes the animation, and Reset (or a new program) goes back to the animated full view.
+	Split programs and the panels of a wall are not supported, their moves are ignored.
+*/
+namespace CanvasView
+{
+	void Pan(int32_t dx, int32_t dy);
+	void Zoom(float factor, float x, float y);
+	void Reset();
+
+	// Whether the view replaces the animation, in which case Graphics::Update hands the frame over to Update
+	bool Active();
+	// Apply the next moves, render the rows and strips that changed, and draw the view on the canvas
+	void Update();
+}
@@ -0,0 +1,209 @@
+#include "CostModel.h"
+
+#include <cmath>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	constexpr size_t OP_COUNT = size_t(Op::Count);
+
+	// Solve the square system a x = b in place with Gaussian elimination and partial pivoting, false if it is singular
+	bool Solve(std::vector<double>& a, std::vector<double>& b, size_t n)
+	{
+		for (size_t column = 0U; column < n; column++)
+		{
+			size_t pivot = column;
+			for (size_t row = column + 1U; row < n; row++)
+				if (std::abs(a[row * n + column]) > std::abs(a[pivot * n + column]))
+					pivot = row;
+			if (std::abs(a[pivot * n + column]) < 1e-30)
+				return false;
+			if (pivot != column)
+			{
+				std::swap_ranges(a.begin() + column * n, a.begin() + (column + 1U) * n, a.begin() + pivot * n);
+				std::swap(b[column], b[pivot]);
+			}
+			for (size_t row = column + 1U; row < n; row++)
+			{
+				double factor = a[row * n + column] / a[column * n + column];
+				for (size_t k = column; k < n; k++)
+					a[row * n + k] -= factor * a[column * n + k];
+				b[row] -= factor * b[column];
+			}
+		}
+		for (size_t row = n; row-- > 0U;)
+		{
+			for (size_t k = row + 1U; k < n; k++)
+				b[row] -= a[row * n + k] * b[k];
+			b[row] /= a[row * n + row];
+		}
+		return true;
+	}
+
+	// Relative RMS error of the predictions of the given samples
+	float RelativeError(const CostModel::Costs& costs, const std::vector<const CostModel::Sample*>& samples)
+	{
+		double sum = 0.0;
+		for (const CostModel::Sample* sample : samples)
+		{
+			double predicted = costs.pixel;
+			for (size_t op = 0U; op < OP_COUNT; op++)
+				predicted += double(sample->counts[op]) * costs.ops[op];
+			double error = predicted / sample->nanosecondsPerPixel - 1.0;
+			sum += error * error;
+		}
+		return samples.empty() ? 0.0f : float(std::sqrt(sum / samples.size()));
+	}
+}
+
+CostModel::Sample CostModel::MakeSample(const Program& program, double nanosecondsPerPixel)
+{
+	Sample sample{ {}, nanosecondsPerPixel };
+	for (const Instruction& instruction : program.code)
+		sample.counts[size_t(instruction.op)] += 1.0f;
+	return sample;
+}
+
+CostModel::Costs CostModel::Fit(const std::vector<Sample>& samples, const std::vector<Sample>& heldOut)
+{
+	std::vector<const Sample*> fitted, checked;
+	for (const Sample& sample : samples)
+		fitted.push_back(&sample);
+	for (const Sample& sample : heldOut.empty() ? samples : heldOut)
+		checked.push_back(&sample);
+
+	// Column 0 is the fixed cost, then the ops run by at least one sample
+	std::vector<size_t> columns = { OP_COUNT };
+	for (size_t op = 0U; op < OP_COUNT; op++)
+		if (std::any_of(fitted.begin(), fitted.end(), [&](const Sample* sample) { return sample->counts[op] > 0.0f; }))
+			columns.push_back(op);
+
+	// Least squares of the relative errors, so cheap programs count as much as expensive ones
+	// Columns whose cost comes out negative are dropped one at a time, the most negative first
+	std::vector<double> solution;
+	for (;;)
+	{
+		const size_t n = columns.size();
+		std::vector<double> normal(n * n, 0.0), right(n, 0.0), row(n);
+		for (const Sample* sample : fitted)
+		{
+			double weight = 1.0 / std::max(sample->nanosecondsPerPixel, 1e-6);
+			for (size_t c = 0U; c < n; c++)
+				row[c] = weight * (columns[c] == OP_COUNT ? 1.0 : double(sample->counts[columns[c]]));
+			for (size_t i = 0U; i < n; i++)
+			{
+				for (size_t j = 0U; j < n; j++)
+					normal[i * n + j] += row[i] * row[j];
+				right[i] += row[i] * weight * sample->nanosecondsPerPixel;
+			}
+		}
+
+		// A touch of ridge keeps ops that always appear together solvable
+		double trace = 0.0;
+		for (size_t i = 0U; i < n; i++)
+			trace += normal[i * n + i];
+		for (size_t i = 0U; i < n; i++)
+			normal[i * n + i] += 1e-9 * trace / n;
+
+		if (!Solve(normal, right, n))
+			break;
+		size_t negative = n;
+		for (size_t c = 0U; c < n; c++)
+			if (right[c] < 0.0 && (negative == n || right[c] < right[negative]))
+				negative = c;
+		if (negative == n)
+		{
+			solution = right;
+			break;
+		}
+		columns.erase(columns.begin() + negative);
+	}
+
+	Costs costs;
+	for (size_t c = 0U; c < solution.size(); c++)
+		(columns[c] == OP_COUNT ? costs.pixel : costs.ops[columns[c]]) = float(solution[c]);
+
+	// Conversion to the units of OpCost, over the ops run by the corpus
+	double staticCost = 0.0, fittedCost = 0.0;
+	for (const Sample* sample : fitted)
+	{
+		for (size_t op = 0U; op < OP_COUNT; op++)
+		{
+			staticCost += double(sample->counts[op]) * OpCost(Op(op));
+			fittedCost += double(sample->counts[op]) * costs.ops[op];
+		}
+	}
+	costs.scale = fittedCost > 0.0 ? float(staticCost / fittedCost) : 0.0f;
+	for (size_t op = 0U; op < OP_COUNT && costs.scale > 0.0f; op++)
+		if (std::none_of(fitted.begin(), fitted.end(), [&](const Sample* sample) { return sample->counts[op] > 0.0f; }))
+			costs.ops[op] = OpCost(Op(op)) / costs.scale;
+
+	costs.error = RelativeError(costs, checked);
+	return costs;
+}
+
+double CostModel::PredictNanoseconds(const Costs& costs, const Program& program)
+{
+	double nanoseconds = costs.pixel;
+	for (const Instruction& instruction : program.code)
+		nanoseconds += costs.ops[size_t(instruction.op)];
+	return nanoseconds;
+}
+
+double CostModel::PredictSeconds(const Costs& costs, const Program& program, uint32_t width, uint32_t height, uint32_t threads)
+{
+	if (threads == 0U)
+		threads = std::max(1U, std::thread::hardware_concurrency());
+	return 1e-9 * PredictNanoseconds(costs, program) * width * height / threads;
+}
+
+bool CostModel::Save(const Costs& costs, const char* path)
+{
+	FILE* file = std::fopen(path, "w");
+	if (!file)
+		return false;
+	std::fprintf(file, "pollock-costs 1\ndevice %s\npixel %.6g\nerror %.6g\nscale %.6g\n", costs.device.empty() ? "unknown" : costs.device.c_str(), costs.pixel, costs.error, costs.scale);
+	for (size_t op = 0U; op < OP_COUNT; op++)
+		std::fprintf(file, "%s %.6g\n", OpName(Op(op)), costs.ops[op]);
+	return std::fclose(file) == 0;
+}
+
+bool CostModel::Load(const char* path, Costs& costs)
+{
+	FILE* file = std::fopen(path, "r");
+	if (!file)
+		return false;
+
+	char name[64], value[256];
+	bool valid = std::fscanf(file, "%63s %255s", name, value) == 2 && !std::strcmp(name, "pollock-costs") && !std::strcmp(value, "1");
+	costs = Costs{};
+	while (valid && std::fscanf(file, "%63s %255s", name, value) == 2)
+	{
+		float number = std::strtof(value, nullptr);
+		if (!std::strcmp(name, "device")) costs.device = value;
+		else if (!std::strcmp(name, "pixel")) costs.pixel = number;
+		else if (!std::strcmp(name, "error")) costs.error = number;
+		else if (!std::strcmp(name, "scale")) costs.scale = number;
+		else
+		{
+			// Unknown names are ops of a newer version, skipped
+			for (size_t op = 0U; op < OP_COUNT; op++)
+				if (!std::strcmp(name, OpName(Op(op))))
+					costs.ops[op] = number;
+		}
+	}
+	std::fclose(file);
+	return valid && costs.scale > 0.0f;
+}
+
+void CostModel::Apply(const Costs& costs)
+{
+	float units[OP_COUNT];
+	for (size_t op = 0U; op < OP_COUNT; op++)
+		units[op] = costs.ops[op] * costs.scale;
+	SetOpCosts(units);
+}
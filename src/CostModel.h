@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Program.h"
+
+/*
+	Cost model of programs measured on a device, instead of the static estimates of OpCost.
+
+	The time to render a pixel is modelled as a fixed cost plus the sum of the costs of the instructions of the program.
+	The costs are fitted by least squares to the times of a corpus of programs measured on the device (see Calibrate.cpp),
+	and the error of the model is measured on programs left out of the fit, so predictions come with a known error.
+
+	Calibrations are saved as text, one "name value" pair per line, with the names of OpName:
+
+		pollock-costs 1
+		device native-x86_64
+		pixel 1.84
+		fPow 9.71
+		...
+*/
+namespace CostModel
+{
+	struct Costs
+	{
+		std::string device;
+		float pixel = 0.0f; // Nanoseconds per pixel of every program (inputs, output and dispatch)
+		float ops[size_t(Op::Count)] = {}; // Nanoseconds per pixel of each instruction
+		float error = 0.0f; // Relative RMS error of the predictions on the programs left out of the fit
+		float scale = 0.0f; // Units of OpCost per nanosecond, to convert the costs for Apply
+	};
+
+	// Measured time of a program: how many instructions of each op it runs, and the nanoseconds per pixel it took
+	struct Sample
+	{
+		float counts[size_t(Op::Count)];
+		double nanosecondsPerPixel;
+	};
+	Sample MakeSample(const Program& program, double nanosecondsPerPixel);
+
+	// Fit the costs to the samples, and measure the error on the held out ones (on the fitted ones if there are none)
+	// Costs are not negative, and ops that no sample runs keep their static estimate, converted to nanoseconds
+	Costs Fit(const std::vector<Sample>& samples, const std::vector<Sample>& heldOut);
+
+	// Predicted nanoseconds per pixel of a program, on one thread
+	double PredictNanoseconds(const Costs& costs, const Program& program);
+	// Predicted time of a frame, assuming the threads share the rows evenly
+	double PredictSeconds(const Costs& costs, const Program& program, uint32_t width, uint32_t height, uint32_t threads);
+
+	bool Save(const Costs& costs, const char* path);
+	bool Load(const char* path, Costs& costs);
+
+	// Replace the static estimates of OpCost by the calibrated costs, in the same units, so SplitProgram, Pruning and
+	// Surrogates weigh the ops as the device does
+	void Apply(const Costs& costs);
+}
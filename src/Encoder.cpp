@@ -0,0 +1,1038 @@
+#include "Encoder.h"
+
+#include <mutex>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+#include "Metrics.h"
+
+namespace
+{
+	Metrics::Counter encodedImages("pollock_encoder_images_total", "Number of images encoded");
+	Metrics::Counter encodedBytes("pollock_encoder_bytes_total", "Number of bytes output by the image encoders");
+	Metrics::Histogram encodeTime("pollock_encoder_duration_seconds", "Time to encode one image, without the time spent writing it");
+
+	const char* const FORMAT_NAMES[] = { "raw", "ppm", "bmp", "qoi", "png", "png-best" };
+	const char* const FORMAT_EXTENSIONS[] = { "rgba", "ppm", "bmp", "qoi", "png", "png" };
+
+	constexpr size_t CHUNK_SIZE = size_t(1U) << 16U; // Output handed to the sink at once, and size of the IDAT chunks
+
+	double ElapsedSeconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void PutBE32(std::vector<uint8_t>& out, uint32_t value)
+	{
+		const uint8_t bytes[] = { uint8_t(value >> 24U), uint8_t(value >> 16U), uint8_t(value >> 8U), uint8_t(value) };
+		out.insert(out.end(), bytes, bytes + 4);
+	}
+
+	void PutLE(std::vector<uint8_t>& out, uint32_t value, uint32_t size)
+	{
+		for (uint32_t i = 0U; i < size; i++)
+			out.push_back(uint8_t(value >> (8U * i)));
+	}
+
+	#pragma region Checksums
+
+	struct CrcTable
+	{
+		uint32_t values[256];
+
+		CrcTable()
+		{
+			for (uint32_t n = 0U; n < 256U; n++)
+			{
+				uint32_t c = n;
+				for (uint32_t k = 0U; k < 8U; k++)
+					c = c & 1U ? 0xEDB88320U ^ (c >> 1U) : c >> 1U;
+				values[n] = c;
+			}
+		}
+	};
+	const CrcTable crcTable;
+
+	uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0U)
+	{
+		crc = ~crc;
+		for (size_t i = 0U; i < size; i++)
+			crc = crcTable.values[(crc ^ data[i]) & 0xFFU] ^ (crc >> 8U);
+		return ~crc;
+	}
+
+	#pragma endregion
+
+	#pragma region Expectations
+
+	// Speed and size of each format for Choose, measured on 640x360 frames of typical seeds, then following the encoded images
+	struct Expectation
+	{
+		double secondsPerPixel;
+		double bytesPerPixel;
+	};
+	std::mutex expectationMutex;
+	Expectation expectations[size_t(Encoder::Format::Count)] =
+	{
+		{ 3e-9, 4.0 }, // raw
+		{ 6e-9, 3.0 }, // ppm
+		{ 5e-9, 3.0 }, // bmp
+		{ 15e-9, 1.3 }, // qoi
+		{ 60e-9, 0.8 }, // png
+		{ 650e-9, 0.65 } // png-best
+	};
+
+	#pragma endregion
+}
+
+#pragma region Deflate
+
+namespace Encoder
+{
+	/*
+		Deflate encoder (RFC 1950 and 1951), fed with the filtered rows of a PNG as they come.
+
+		Matches are found with a hash of the next 4 bytes: the fast level only tries the last position with the same hash and
+		takes the first match, the best level walks the chain of previous positions and defers a match if the next byte starts
+		a longer one. Every block is written with the cheapest of its dynamic codes, the fixed codes or no compression.
+	*/
+	class Deflater
+	{
+	public:
+		Deflater(bool best) : m_Best(best), m_Head(size_t(1U) << HASH_BITS, -1), m_Previous(WINDOW_SIZE, -1) {}
+
+		// Compress the next bytes, the blocks completed are appended to out
+		void Write(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+		// Compress the rest and end the stream
+		void Finish(std::vector<uint8_t>& out);
+
+	private:
+		static constexpr uint32_t WINDOW_SIZE = 32768U;
+		static constexpr uint32_t MIN_MATCH = 4U;
+		static constexpr uint32_t MAX_MATCH = 258U;
+		static constexpr uint32_t HASH_BITS = 15U;
+		static constexpr uint32_t MAX_CHAIN = 128U; // Positions tried by the best level
+		static constexpr uint32_t NICE_MATCH = 128U; // Length that ends the search of the best level
+		static constexpr size_t BLOCK_TOKENS = 16384U;
+
+		static uint32_t Hash(const uint8_t* at)
+		{
+			uint32_t value;
+			std::memcpy(&value, at, 4U);
+			return (value * 2654435761U) >> (32U - HASH_BITS);
+		}
+
+		void Insert(int64_t position);
+		void LongestMatch(int64_t position, int64_t end, uint32_t& length, uint32_t& distance) const;
+		void Tokenize(bool final);
+		void WriteBlock(bool final);
+		void WriteStored(bool final);
+		void PutBits(uint32_t value, uint32_t count);
+		void Align();
+
+		bool m_Best;
+		bool m_Started = false;
+		std::vector<uint8_t>* m_Out = nullptr;
+		uint64_t m_Bits = 0ULL;
+		uint32_t m_BitCount = 0U;
+		uint32_t m_AdlerA = 1U, m_AdlerB = 0U;
+
+		// Positions are counted from the start of the stream, m_Window holds the bytes from m_Base
+		std::vector<uint8_t> m_Window;
+		int64_t m_Base = 0, m_Position = 0, m_BlockStart = 0;
+		std::vector<int64_t> m_Head; // Last position of each hash
+		std::vector<int64_t> m_Previous; // Previous position with the same hash, for each position of the window
+
+		// Match found at the next position by the lazy evaluation of the best level
+		int64_t m_LazyPosition = -1;
+		uint32_t m_LazyLength = 0U, m_LazyDistance = 0U;
+
+		// Literals are bytes, matches hold their distance in the high half
+		std::vector<uint32_t> m_Tokens;
+	};
+}
+
+namespace
+{
+	const uint16_t LENGTH_BASES[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const uint16_t DISTANCE_BASES[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	constexpr uint32_t LITERAL_CODES = 286U;
+	constexpr uint32_t DISTANCE_CODES = 30U;
+
+	// Code of every match length, and of every distance (directly up to 256, then by steps of 128)
+	struct CodeTables
+	{
+		uint8_t lengthCodes[259];
+		uint8_t distanceCodes[512];
+
+		CodeTables()
+		{
+			for (uint32_t code = 0U; code < 29U; code++)
+				for (uint32_t length = LENGTH_BASES[code]; length < 259U && length < LENGTH_BASES[code] + (1U << LENGTH_EXTRA[code]); length++)
+					lengthCodes[length] = uint8_t(code);
+			lengthCodes[258] = 28U;
+
+			for (uint32_t code = 0U; code < 30U; code++)
+			{
+				for (uint32_t distance = DISTANCE_BASES[code]; distance < DISTANCE_BASES[code] + (1U << DISTANCE_EXTRA[code]); distance++)
+				{
+					if (distance <= 256U)
+						distanceCodes[distance - 1U] = uint8_t(code);
+					else
+						distanceCodes[256U + ((distance - 1U) >> 7U)] = uint8_t(code);
+				}
+			}
+		}
+
+		uint32_t DistanceCode(uint32_t distance) const
+		{
+			return distance <= 256U ? distanceCodes[distance - 1U] : distanceCodes[256U + ((distance - 1U) >> 7U)];
+		}
+	};
+	const CodeTables codeTables;
+
+	// Lengths of a Huffman code for the given frequencies, at most limit bits long
+	// At least two symbols get a code, so the code is complete even with a single used symbol
+	void BuildLengths(const uint32_t* frequencies, uint32_t count, uint32_t limit, uint8_t* lengths)
+	{
+		std::vector<uint32_t> weights(frequencies, frequencies + count);
+		uint32_t used = uint32_t(std::count_if(weights.begin(), weights.end(), [](uint32_t w) { return w > 0U; }));
+		for (uint32_t i = 0U; i < count && used < 2U; i++)
+		{
+			if (weights[i] == 0U)
+			{
+				weights[i] = 1U;
+				used++;
+			}
+		}
+
+		std::vector<uint32_t> parents(2U * count);
+		std::vector<uint32_t> depths(2U * count);
+		std::vector<std::pair<uint64_t, uint32_t>> heap;
+		for (;;)
+		{
+			// Merge the two lightest nodes until one is left, internal nodes are numbered from count
+			heap.clear();
+			for (uint32_t i = 0U; i < count; i++)
+				if (weights[i] > 0U)
+					heap.emplace_back(weights[i], i);
+			auto greater = [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) { return a > b; };
+			std::make_heap(heap.begin(), heap.end(), greater);
+			uint32_t next = count;
+			while (heap.size() > 1U)
+			{
+				std::pop_heap(heap.begin(), heap.end(), greater);
+				std::pair<uint64_t, uint32_t> a = heap.back();
+				heap.pop_back();
+				std::pop_heap(heap.begin(), heap.end(), greater);
+				std::pair<uint64_t, uint32_t> b = heap.back();
+				heap.pop_back();
+				parents[a.second] = parents[b.second] = next;
+				heap.emplace_back(a.first + b.first, next++);
+				std::push_heap(heap.begin(), heap.end(), greater);
+			}
+
+			// Parents are numbered after their children, so the depths are known from the root down
+			uint32_t root = next - 1U, deepest = 0U;
+			depths[root] = 0U;
+			for (uint32_t node = root; node-- > count;)
+				depths[node] = depths[parents[node]] + 1U;
+			for (uint32_t i = 0U; i < count; i++)
+			{
+				lengths[i] = weights[i] > 0U ? uint8_t(depths[parents[i]] + 1U) : 0U;
+				deepest = std::max<uint32_t>(deepest, lengths[i]);
+			}
+			if (deepest <= limit)
+				return;
+
+			// Flatten the distribution until the code fits
+			for (uint32_t& weight : weights)
+				if (weight > 0U)
+					weight = (weight >> 1U) | 1U;
+		}
+	}
+
+	// Canonical codes of the given lengths, bit reversed since deflate writes them from their most significant bit
+	void BuildCodes(const uint8_t* lengths, uint32_t count, uint16_t* codes)
+	{
+		uint32_t lengthCounts[16] = {}, nextCodes[16] = {};
+		for (uint32_t i = 0U; i < count; i++)
+			lengthCounts[lengths[i]]++;
+		lengthCounts[0] = 0U;
+		for (uint32_t bits = 1U, code = 0U; bits < 16U; bits++)
+		{
+			code = (code + lengthCounts[bits - 1U]) << 1U;
+			nextCodes[bits] = code;
+		}
+		for (uint32_t i = 0U; i < count; i++)
+		{
+			uint32_t code = lengths[i] ? nextCodes[lengths[i]]++ : 0U, reversed = 0U;
+			for (uint32_t bit = 0U; bit < lengths[i]; bit++)
+				reversed |= ((code >> bit) & 1U) << (lengths[i] - 1U - bit);
+			codes[i] = uint16_t(reversed);
+		}
+	}
+
+	// Code lengths of a dynamic block, run length encoded with the symbols 16 (repeat), 17 and 18 (zeros)
+	struct CodeLengthSymbol
+	{
+		uint8_t symbol;
+		uint8_t extra;
+	};
+	void EncodeLengths(const uint8_t* lengths, uint32_t count, std::vector<CodeLengthSymbol>& symbols)
+	{
+		symbols.clear();
+		for (uint32_t i = 0U; i < count;)
+		{
+			uint32_t run = 1U;
+			while (i + run < count && lengths[i + run] == lengths[i])
+				run++;
+			i += run;
+
+			if (lengths[i - run] == 0U)
+			{
+				for (; run >= 11U; run -= std::min(run, 138U))
+					symbols.push_back({ 18U, uint8_t(std::min(run, 138U) - 11U) });
+				if (run >= 3U)
+				{
+					symbols.push_back({ 17U, uint8_t(run - 3U) });
+					run = 0U;
+				}
+			}
+			else
+			{
+				symbols.push_back({ lengths[i - run], 0U });
+				run--;
+				for (; run >= 3U; run -= std::min(run, 6U))
+					symbols.push_back({ 16U, uint8_t(std::min(run, 6U) - 3U) });
+			}
+			for (; run > 0U; run--)
+				symbols.push_back({ lengths[i - run], 0U });
+		}
+	}
+}
+
+void Encoder::Deflater::Write(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+	m_Out = &out;
+	if (!m_Started)
+	{
+		// zlib header: deflate with a 32 KB window, and the level as a hint
+		out.push_back(0x78U);
+		out.push_back(m_Best ? 0xDAU : 0x01U);
+		m_Started = true;
+	}
+
+	// The sums are reduced before they can overflow, after at most 5552 bytes
+	for (size_t done = 0U; done < size;)
+	{
+		size_t end = std::min(size, done + 5552U);
+		for (; done < end; done++)
+		{
+			m_AdlerA += data[done];
+			m_AdlerB += m_AdlerA;
+		}
+		m_AdlerA %= 65521U;
+		m_AdlerB %= 65521U;
+	}
+
+	m_Window.insert(m_Window.end(), data, data + size);
+	Tokenize(false);
+
+	// Drop the bytes that can no longer be matched nor stored, once they are worth moving the rest
+	int64_t keep = std::min(m_Position - int64_t(WINDOW_SIZE), m_BlockStart);
+	if (keep - m_Base >= int64_t(4U * WINDOW_SIZE))
+	{
+		m_Window.erase(m_Window.begin(), m_Window.begin() + (keep - m_Base));
+		m_Base = keep;
+	}
+}
+
+void Encoder::Deflater::Finish(std::vector<uint8_t>& out)
+{
+	Write(nullptr, 0U, out);
+	Tokenize(true);
+	WriteBlock(true);
+	Align();
+	PutBE32(out, (m_AdlerB << 16U) | m_AdlerA);
+}
+
+void Encoder::Deflater::Insert(int64_t position)
+{
+	uint32_t hash = Hash(m_Window.data() + (position - m_Base));
+	m_Previous[position & (WINDOW_SIZE - 1U)] = m_Head[hash];
+	m_Head[hash] = position;
+}
+
+void Encoder::Deflater::LongestMatch(int64_t position, int64_t end, uint32_t& length, uint32_t& distance) const
+{
+	length = 0U;
+	distance = 0U;
+	const uint8_t* at = m_Window.data() + (position - m_Base);
+	const uint32_t maxLength = uint32_t(std::min<int64_t>(MAX_MATCH, end - position));
+	const int64_t lowest = std::max(m_Base, position - int64_t(WINDOW_SIZE));
+
+	int64_t candidate = m_Head[Hash(at)];
+	for (uint32_t chain = m_Best ? MAX_CHAIN : 1U; chain > 0U && candidate >= lowest; chain--)
+	{
+		// Compare 8 bytes at a time, the first difference is the lowest set bit of their xor
+		const uint8_t* from = m_Window.data() + (candidate - m_Base);
+		uint32_t matched = 0U;
+		if (from[length] == at[length])
+		{
+			for (; matched + 8U <= maxLength; matched += 8U)
+			{
+				uint64_t a, b;
+				std::memcpy(&a, from + matched, 8U);
+				std::memcpy(&b, at + matched, 8U);
+				if (a != b)
+				{
+					matched += uint32_t(__builtin_ctzll(a ^ b)) >> 3U;
+					break;
+				}
+			}
+			matched = std::min(matched, maxLength);
+			while (matched < maxLength && from[matched] == at[matched])
+				matched++;
+		}
+
+		if (matched > length)
+		{
+			length = matched;
+			distance = uint32_t(position - candidate);
+			if (length >= NICE_MATCH || length == maxLength)
+				break;
+		}
+
+		// Older positions of the chain may have been overwritten by newer ones
+		int64_t previous = m_Previous[candidate & (WINDOW_SIZE - 1U)];
+		if (previous >= candidate)
+			break;
+		candidate = previous;
+	}
+
+	if (length < MIN_MATCH)
+		length = 0U;
+}
+
+void Encoder::Deflater::Tokenize(bool final)
+{
+	// Until the end of the stream, keep enough bytes ahead for the longest match
+	const int64_t end = m_Base + int64_t(m_Window.size());
+	const int64_t limit = final ? end : end - int64_t(MAX_MATCH);
+	while (m_Position < limit)
+	{
+		const int64_t position = m_Position;
+		uint32_t length = 0U, distance = 0U;
+		if (position == m_LazyPosition)
+		{
+			length = m_LazyLength;
+			distance = m_LazyDistance;
+		}
+		else if (end - position >= int64_t(MIN_MATCH))
+		{
+			LongestMatch(position, end, length, distance);
+		}
+		if (end - position >= int64_t(MIN_MATCH))
+			Insert(position);
+
+		// Lazy evaluation: a longer match at the next byte is worth a literal
+		if (m_Best && length > 0U && length < NICE_MATCH && end - position - 1 >= int64_t(MIN_MATCH))
+		{
+			LongestMatch(position + 1, end, m_LazyLength, m_LazyDistance);
+			m_LazyPosition = position + 1;
+			if (m_LazyLength > length)
+				length = 0U;
+		}
+
+		if (length > 0U)
+		{
+			m_Tokens.push_back((distance << 16U) | length);
+			for (int64_t inserted = position + 1; inserted < position + length && end - inserted >= int64_t(MIN_MATCH); inserted++)
+				Insert(inserted);
+			m_Position += length;
+		}
+		else
+		{
+			m_Tokens.push_back(m_Window[size_t(position - m_Base)]);
+			m_Position++;
+		}
+
+		if (m_Tokens.size() >= BLOCK_TOKENS)
+			WriteBlock(false);
+	}
+}
+
+void Encoder::Deflater::WriteBlock(bool final)
+{
+	#pragma region Costs
+
+	uint32_t literalFrequencies[LITERAL_CODES] = {}, distanceFrequencies[DISTANCE_CODES] = {};
+	uint64_t extraBits = 0ULL;
+	for (uint32_t token : m_Tokens)
+	{
+		if (token < 256U)
+		{
+			literalFrequencies[token]++;
+			continue;
+		}
+		uint32_t lengthCode = codeTables.lengthCodes[token & 0xFFFFU], distanceCode = codeTables.DistanceCode(token >> 16U);
+		literalFrequencies[257U + lengthCode]++;
+		distanceFrequencies[distanceCode]++;
+		extraBits += LENGTH_EXTRA[lengthCode] + DISTANCE_EXTRA[distanceCode];
+	}
+	literalFrequencies[256]++;
+
+	// Dynamic codes, with their lengths sent as a code of code lengths
+	uint8_t dynamicLengths[LITERAL_CODES];
+	uint8_t* literalLengths = dynamicLengths;
+	uint8_t distanceLengths[DISTANCE_CODES];
+	BuildLengths(literalFrequencies, LITERAL_CODES, 15U, literalLengths);
+	BuildLengths(distanceFrequencies, DISTANCE_CODES, 15U, distanceLengths);
+	uint32_t literalCount = LITERAL_CODES, distanceCount = DISTANCE_CODES;
+	while (literalCount > 257U && literalLengths[literalCount - 1U] == 0U)
+		literalCount--;
+	while (distanceCount > 1U && distanceLengths[distanceCount - 1U] == 0U)
+		distanceCount--;
+	uint8_t lengths[LITERAL_CODES + DISTANCE_CODES];
+	std::memcpy(lengths, literalLengths, literalCount);
+	std::memcpy(lengths + literalCount, distanceLengths, distanceCount);
+
+	std::vector<CodeLengthSymbol> symbols;
+	EncodeLengths(lengths, literalCount + distanceCount, symbols);
+	uint32_t codeLengthFrequencies[19] = {};
+	for (const CodeLengthSymbol& symbol : symbols)
+		codeLengthFrequencies[symbol.symbol]++;
+	uint8_t codeLengthLengths[19];
+	BuildLengths(codeLengthFrequencies, 19U, 7U, codeLengthLengths);
+	uint32_t codeLengthCount = 19U;
+	while (codeLengthCount > 4U && codeLengthLengths[CODE_LENGTH_ORDER[codeLengthCount - 1U]] == 0U)
+		codeLengthCount--;
+
+	uint64_t dynamicBits = 3U + 5U + 5U + 4U + 3U * codeLengthCount + extraBits;
+	for (const CodeLengthSymbol& symbol : symbols)
+		dynamicBits += codeLengthLengths[symbol.symbol] + (symbol.symbol == 16U ? 2U : symbol.symbol == 17U ? 3U : symbol.symbol == 18U ? 7U : 0U);
+	uint64_t fixedBits = 3U + extraBits;
+	for (uint32_t i = 0U; i < LITERAL_CODES; i++)
+	{
+		dynamicBits += uint64_t(literalFrequencies[i]) * literalLengths[i];
+		fixedBits += uint64_t(literalFrequencies[i]) * (i < 144U ? 8U : i < 256U ? 9U : i < 280U ? 7U : 8U);
+	}
+	for (uint32_t i = 0U; i < DISTANCE_CODES; i++)
+	{
+		dynamicBits += uint64_t(distanceFrequencies[i]) * distanceLengths[i];
+		fixedBits += uint64_t(distanceFrequencies[i]) * 5U;
+	}
+
+	// Stored blocks hold up to 65535 bytes after a byte aligned header
+	uint64_t storedSize = uint64_t(m_Position - m_BlockStart);
+	uint64_t storedBits = 8U * (storedSize + 5U * std::max<uint64_t>(1U, (storedSize + 65534U) / 65535U)) + 8U;
+
+	#pragma endregion
+
+	if (storedBits < std::min(dynamicBits, fixedBits))
+	{
+		WriteStored(final);
+	}
+	else
+	{
+		uint8_t fixedLengths[LITERAL_CODES + 2U];
+		uint8_t fixedDistanceLengths[DISTANCE_CODES];
+		bool dynamic = dynamicBits < fixedBits;
+		if (!dynamic)
+		{
+			for (uint32_t i = 0U; i < LITERAL_CODES + 2U; i++)
+				fixedLengths[i] = i < 144U ? 8U : i < 256U ? 9U : i < 280U ? 7U : 8U;
+			std::fill(fixedDistanceLengths, fixedDistanceLengths + DISTANCE_CODES, 5U);
+			literalLengths = fixedLengths;
+			std::memcpy(distanceLengths, fixedDistanceLengths, DISTANCE_CODES);
+		}
+
+		PutBits(final ? 1U : 0U, 1U);
+		PutBits(dynamic ? 2U : 1U, 2U);
+		if (dynamic)
+		{
+			uint16_t codeLengthCodes[19];
+			BuildCodes(codeLengthLengths, 19U, codeLengthCodes);
+			PutBits(literalCount - 257U, 5U);
+			PutBits(distanceCount - 1U, 5U);
+			PutBits(codeLengthCount - 4U, 4U);
+			for (uint32_t i = 0U; i < codeLengthCount; i++)
+				PutBits(codeLengthLengths[CODE_LENGTH_ORDER[i]], 3U);
+			for (const CodeLengthSymbol& symbol : symbols)
+			{
+				PutBits(codeLengthCodes[symbol.symbol], codeLengthLengths[symbol.symbol]);
+				if (symbol.symbol >= 16U)
+					PutBits(symbol.extra, symbol.symbol == 16U ? 2U : symbol.symbol == 17U ? 3U : 7U);
+			}
+		}
+
+		// The fixed code also counts the two unused literal codes, which come before the 9 bit codes
+		uint16_t literalCodes[LITERAL_CODES + 2U], distanceCodes[DISTANCE_CODES];
+		BuildCodes(literalLengths, dynamic ? LITERAL_CODES : LITERAL_CODES + 2U, literalCodes);
+		BuildCodes(distanceLengths, DISTANCE_CODES, distanceCodes);
+		for (uint32_t token : m_Tokens)
+		{
+			if (token < 256U)
+			{
+				PutBits(literalCodes[token], literalLengths[token]);
+				continue;
+			}
+			uint32_t length = token & 0xFFFFU, distance = token >> 16U;
+			uint32_t lengthCode = codeTables.lengthCodes[length], distanceCode = codeTables.DistanceCode(distance);
+			PutBits(literalCodes[257U + lengthCode], literalLengths[257U + lengthCode]);
+			PutBits(length - LENGTH_BASES[lengthCode], LENGTH_EXTRA[lengthCode]);
+			PutBits(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+			PutBits(distance - DISTANCE_BASES[distanceCode], DISTANCE_EXTRA[distanceCode]);
+		}
+		PutBits(literalCodes[256], literalLengths[256]);
+	}
+
+	m_Tokens.clear();
+	m_BlockStart = m_Position;
+}
+
+void Encoder::Deflater::WriteStored(bool final)
+{
+	int64_t position = m_BlockStart;
+	do
+	{
+		uint32_t size = uint32_t(std::min<int64_t>(65535, m_Position - position));
+		bool last = position + size == m_Position;
+		PutBits(final && last ? 1U : 0U, 1U);
+		PutBits(0U, 2U);
+		Align();
+		PutLE(*m_Out, size, 2U);
+		PutLE(*m_Out, ~size & 0xFFFFU, 2U);
+		const uint8_t* data = m_Window.data() + (position - m_Base);
+		m_Out->insert(m_Out->end(), data, data + size);
+		position += size;
+	}
+	while (position < m_Position);
+}
+
+void Encoder::Deflater::PutBits(uint32_t value, uint32_t count)
+{
+	m_Bits |= uint64_t(value) << m_BitCount;
+	m_BitCount += count;
+	if (m_BitCount >= 32U)
+	{
+		PutLE(*m_Out, uint32_t(m_Bits), 4U);
+		m_Bits >>= 32U;
+		m_BitCount -= 32U;
+	}
+}
+
+void Encoder::Deflater::Align()
+{
+	for (; m_BitCount > 0U; m_BitCount -= std::min(m_BitCount, 8U))
+	{
+		m_Out->push_back(uint8_t(m_Bits));
+		m_Bits >>= 8U;
+	}
+	m_Bits = 0ULL;
+}
+
+#pragma endregion
+
+#pragma region Writer
+
+const char* Encoder::Name(Format format)
+{
+	return FORMAT_NAMES[size_t(format)];
+}
+
+const char* Encoder::Extension(Format format)
+{
+	return FORMAT_EXTENSIONS[size_t(format)];
+}
+
+bool Encoder::Parse(const char* name, Format& format)
+{
+	for (size_t i = 0U; i < size_t(Format::Count); i++)
+	{
+		if (!std::strcmp(name, FORMAT_NAMES[i]))
+		{
+			format = Format(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+Encoder::Writer::Writer(Format format, uint32_t width, uint32_t height, const Sink& sink) : m_Format(format), m_Width(width), m_Height(height), m_Sink(sink)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	// The headers wait in the buffer for the first rows
+	switch (format)
+	{
+	case Format::Raw:
+		break;
+
+	case Format::PPM:
+	{
+		std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+		m_Buffer.assign(header.begin(), header.end());
+		break;
+	}
+
+	case Format::BMP:
+	{
+		// 24 bits per pixel, rows padded to 4 bytes, and a negative height for rows from the top
+		uint32_t imageSize = (width * 3U + 3U) / 4U * 4U * height;
+		m_Buffer = { 'B', 'M' };
+		PutLE(m_Buffer, 54U + imageSize, 4U);
+		PutLE(m_Buffer, 0U, 4U);
+		PutLE(m_Buffer, 54U, 4U);
+		PutLE(m_Buffer, 40U, 4U);
+		PutLE(m_Buffer, width, 4U);
+		PutLE(m_Buffer, uint32_t(-int32_t(height)), 4U);
+		PutLE(m_Buffer, 1U, 2U); // Planes
+		PutLE(m_Buffer, 24U, 2U);
+		PutLE(m_Buffer, 0U, 4U); // No compression
+		PutLE(m_Buffer, imageSize, 4U);
+		PutLE(m_Buffer, 2835U, 4U); // 72 dpi
+		PutLE(m_Buffer, 2835U, 4U);
+		PutLE(m_Buffer, 0U, 4U);
+		PutLE(m_Buffer, 0U, 4U);
+		break;
+	}
+
+	case Format::QOI:
+		m_Buffer = { 'q', 'o', 'i', 'f' };
+		PutBE32(m_Buffer, width);
+		PutBE32(m_Buffer, height);
+		m_Buffer.push_back(4U); // RGBA
+		m_Buffer.push_back(0U); // sRGB
+		break;
+
+	case Format::PNG:
+	case Format::PNGBest:
+	{
+		m_Buffer = { 0x89U, 'P', 'N', 'G', '\r', '\n', 0x1AU, '\n' };
+		std::vector<uint8_t> header = { 'I', 'H', 'D', 'R' };
+		PutBE32(header, width);
+		PutBE32(header, height);
+		header.insert(header.end(), { 8U, 2U, 0U, 0U, 0U }); // 8 bit RGB, deflate, adaptive filters, no interlace
+		PutBE32(m_Buffer, uint32_t(header.size() - 4U));
+		m_Buffer.insert(m_Buffer.end(), header.begin(), header.end());
+		PutBE32(m_Buffer, Crc32(header.data(), header.size()));
+
+		m_Deflater = std::make_unique<Deflater>(format == Format::PNGBest);
+		m_Current.resize(size_t(width) * 3U);
+		m_Above.assign(size_t(width) * 3U, 0U);
+		m_Filtered.resize(size_t(width) * 3U + 1U);
+		m_Candidate.resize(size_t(width) * 3U + 1U);
+		break;
+	}
+
+	default:
+		m_Failed = true;
+		break;
+	}
+
+	m_Seconds += ElapsedSeconds(start);
+}
+
+Encoder::Writer::~Writer() = default;
+
+bool Encoder::Writer::AddRows(const uint8_t* pixels, uint32_t rowCount, uint32_t rowPitch)
+{
+	auto start = std::chrono::steady_clock::now();
+	m_SinkSeconds = 0.0;
+	rowCount = std::min(rowCount, m_Height - m_Row);
+
+	if (m_Format == Format::Raw && rowPitch == m_Width * 4U)
+	{
+		// Tightly packed rows are written as they are
+		Emit(m_Buffer.data(), m_Buffer.size());
+		m_Buffer.clear();
+		Emit(pixels, size_t(rowPitch) * rowCount);
+		m_Row += rowCount;
+	}
+	else
+	{
+		for (uint32_t y = 0U; y < rowCount && !m_Failed; y++)
+		{
+			const uint8_t* row = pixels + size_t(y) * rowPitch;
+			switch (m_Format)
+			{
+			case Format::Raw:
+				m_Buffer.insert(m_Buffer.end(), row, row + size_t(m_Width) * 4U);
+				break;
+
+			case Format::PPM:
+			case Format::BMP:
+			{
+				size_t offset = m_Buffer.size();
+				size_t padding = m_Format == Format::BMP ? (4U - m_Width * 3U % 4U) % 4U : 0U;
+				m_Buffer.resize(offset + size_t(m_Width) * 3U + padding, 0U);
+				uint8_t* out = m_Buffer.data() + offset;
+				const uint32_t red = m_Format == Format::BMP ? 2U : 0U, blue = 2U - red;
+				for (uint32_t x = 0U; x < m_Width; x++)
+				{
+					out[3U * x + red] = row[4U * x];
+					out[3U * x + 1U] = row[4U * x + 1U];
+					out[3U * x + blue] = row[4U * x + 2U];
+				}
+				break;
+			}
+
+			case Format::QOI:
+				EncodeQOI(row);
+				break;
+
+			default:
+				FilterPNG(row);
+				m_Deflater->Write(m_Filtered.data(), m_Filtered.size(), m_Compressed);
+				FlushChunks(false);
+				break;
+			}
+
+			if (m_Buffer.size() >= CHUNK_SIZE)
+			{
+				Emit(m_Buffer.data(), m_Buffer.size());
+				m_Buffer.clear();
+			}
+			m_Row++;
+		}
+	}
+
+	m_Seconds += ElapsedSeconds(start) - m_SinkSeconds;
+	return !m_Failed;
+}
+
+bool Encoder::Writer::Finish()
+{
+	auto start = std::chrono::steady_clock::now();
+	m_SinkSeconds = 0.0;
+
+	if (m_Format == Format::QOI)
+	{
+		if (m_Run > 0U)
+			m_Buffer.push_back(uint8_t(0xC0U | (m_Run - 1U)));
+		m_Buffer.insert(m_Buffer.end(), { 0U, 0U, 0U, 0U, 0U, 0U, 0U, 1U });
+	}
+	else if (m_Deflater)
+	{
+		m_Deflater->Finish(m_Compressed);
+		FlushChunks(true);
+		m_Buffer.insert(m_Buffer.end(), { 0U, 0U, 0U, 0U, 'I', 'E', 'N', 'D' });
+		PutBE32(m_Buffer, Crc32(m_Buffer.data() + m_Buffer.size() - 4U, 4U));
+	}
+	Emit(m_Buffer.data(), m_Buffer.size());
+	m_Buffer.clear();
+
+	m_Seconds += ElapsedSeconds(start) - m_SinkSeconds;
+	if (m_Failed)
+		return false;
+
+	encodedImages.Add();
+	encodedBytes.Add(m_BytesWritten);
+	encodeTime.Record(uint64_t(m_Seconds * 1e9));
+
+	// Follow the recent images, without letting a tiny one decide
+	if (m_Width * m_Height > 0U)
+	{
+		double pixels = double(m_Width) * m_Height, weight = std::min(0.25, pixels / (4.0 * 640.0 * 360.0));
+		std::lock_guard<std::mutex> lock(expectationMutex);
+		Expectation& expectation = expectations[size_t(m_Format)];
+		expectation.secondsPerPixel += weight * (m_Seconds / pixels - expectation.secondsPerPixel);
+		expectation.bytesPerPixel += weight * (m_BytesWritten / pixels - expectation.bytesPerPixel);
+	}
+	return true;
+}
+
+bool Encoder::Writer::Emit(const uint8_t* data, size_t size)
+{
+	if (m_Failed || size == 0U)
+		return !m_Failed;
+	auto start = std::chrono::steady_clock::now();
+	m_Failed = !m_Sink(data, size);
+	m_BytesWritten += size;
+	m_SinkSeconds += ElapsedSeconds(start);
+	return !m_Failed;
+}
+
+bool Encoder::Writer::FlushChunks(bool final)
+{
+	// IDAT chunks of CHUNK_SIZE bytes, and the rest at the end
+	size_t done = 0U;
+	while (m_Compressed.size() - done >= CHUNK_SIZE || (final && done < m_Compressed.size()))
+	{
+		size_t size = std::min(CHUNK_SIZE, m_Compressed.size() - done);
+		const uint8_t type[] = { 'I', 'D', 'A', 'T' };
+		PutBE32(m_Buffer, uint32_t(size));
+		m_Buffer.insert(m_Buffer.end(), type, type + 4);
+		m_Buffer.insert(m_Buffer.end(), m_Compressed.begin() + done, m_Compressed.begin() + done + size);
+		PutBE32(m_Buffer, Crc32(m_Compressed.data() + done, size, Crc32(type, 4U)));
+		done += size;
+	}
+	m_Compressed.erase(m_Compressed.begin(), m_Compressed.begin() + done);
+	return !m_Failed;
+}
+
+void Encoder::Writer::EncodeQOI(const uint8_t* row)
+{
+	uint8_t* previous = m_Previous;
+	for (uint32_t x = 0U; x < m_Width; x++)
+	{
+		const uint8_t* pixel = row + 4U * x;
+		if (std::memcmp(pixel, previous, 4U) == 0)
+		{
+			if (++m_Run == 62U)
+			{
+				m_Buffer.push_back(uint8_t(0xC0U | (m_Run - 1U)));
+				m_Run = 0U;
+			}
+			continue;
+		}
+		if (m_Run > 0U)
+		{
+			m_Buffer.push_back(uint8_t(0xC0U | (m_Run - 1U)));
+			m_Run = 0U;
+		}
+
+		uint32_t index = (pixel[0] * 3U + pixel[1] * 5U + pixel[2] * 7U + pixel[3] * 11U) % 64U;
+		if (std::memcmp(m_Index + 4U * index, pixel, 4U) == 0)
+		{
+			m_Buffer.push_back(uint8_t(index));
+		}
+		else if (pixel[3] != previous[3])
+		{
+			m_Buffer.insert(m_Buffer.end(), { 0xFFU, pixel[0], pixel[1], pixel[2], pixel[3] });
+		}
+		else
+		{
+			// Differences wrap around, like the decoder
+			int32_t dr = int8_t(pixel[0] - previous[0]), dg = int8_t(pixel[1] - previous[1]), db = int8_t(pixel[2] - previous[2]);
+			int32_t drg = dr - dg, dbg = db - dg;
+			if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+				m_Buffer.push_back(uint8_t(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+			else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+				m_Buffer.insert(m_Buffer.end(), { uint8_t(0x80 | (dg + 32)), uint8_t((drg + 8) << 4 | (dbg + 8)) });
+			else
+				m_Buffer.insert(m_Buffer.end(), { 0xFEU, pixel[0], pixel[1], pixel[2] });
+		}
+		std::memcpy(m_Index + 4U * index, pixel, 4U);
+		std::memcpy(previous, pixel, 4U);
+	}
+}
+
+void Encoder::Writer::FilterPNG(const uint8_t* row)
+{
+	const size_t size = size_t(m_Width) * 3U;
+	uint8_t* current = m_Current.data();
+	for (uint32_t x = 0U; x < m_Width; x++)
+	{
+		current[3U * x] = row[4U * x];
+		current[3U * x + 1U] = row[4U * x + 1U];
+		current[3U * x + 2U] = row[4U * x + 2U];
+	}
+
+	// The filters are plain loops over bytes, which the compiler vectorizes
+	const uint8_t* above = m_Above.data();
+	auto filter = [&](uint8_t type, uint8_t* out)
+	{
+		out[0] = type;
+		out++;
+		switch (type)
+		{
+		case 0U:
+			std::memcpy(out, current, size);
+			break;
+		case 1U:
+			for (size_t i = 0U; i < std::min<size_t>(3U, size); i++)
+				out[i] = current[i];
+			for (size_t i = 3U; i < size; i++)
+				out[i] = uint8_t(current[i] - current[i - 3U]);
+			break;
+		case 2U:
+			for (size_t i = 0U; i < size; i++)
+				out[i] = uint8_t(current[i] - above[i]);
+			break;
+		case 3U:
+			for (size_t i = 0U; i < std::min<size_t>(3U, size); i++)
+				out[i] = uint8_t(current[i] - (above[i] >> 1U));
+			for (size_t i = 3U; i < size; i++)
+				out[i] = uint8_t(current[i] - ((current[i - 3U] + above[i]) >> 1U));
+			break;
+		default:
+			for (size_t i = 0U; i < size; i++)
+			{
+				int32_t a = i >= 3U ? current[i - 3U] : 0, b = above[i], c = i >= 3U ? above[i - 3U] : 0;
+				int32_t p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+				int32_t predictor = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+				out[i] = uint8_t(current[i] - predictor);
+			}
+			break;
+		}
+	};
+
+	// Sum of the filtered bytes as signed values, the usual estimate of how well a row compresses
+	auto cost = [&](const uint8_t* out)
+	{
+		uint64_t sum = 0ULL;
+		for (size_t i = 1U; i <= size; i++)
+			sum += uint64_t(std::abs(int32_t(int8_t(out[i]))));
+		return sum;
+	};
+
+	if (m_Format == Format::PNGBest)
+	{
+		filter(0U, m_Filtered.data());
+		uint64_t best = cost(m_Filtered.data());
+		for (uint8_t type = 1U; type <= 4U; type++)
+		{
+			filter(type, m_Candidate.data());
+			uint64_t candidate = cost(m_Candidate.data());
+			if (candidate < best)
+			{
+				best = candidate;
+				m_Filtered.swap(m_Candidate);
+			}
+		}
+	}
+	else
+	{
+		// Up is the cheapest filter that keeps the smooth gradients of the shaders compressible
+		filter(m_Row == 0U ? 1U : 2U, m_Filtered.data());
+	}
+
+	m_Above.swap(m_Current);
+}
+
+#pragma endregion
+
+bool Encoder::Encode(Format format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t rowPitch, std::vector<uint8_t>& out)
+{
+	out.clear();
+	Writer writer(format, width, height, [&](const uint8_t* data, size_t size)
+	{
+		out.insert(out.end(), data, data + size);
+		return true;
+	});
+	return writer.AddRows(pixels, height, rowPitch) && writer.Finish();
+}
+
+Encoder::Format Encoder::Choose(uint32_t width, uint32_t height, double budgetSeconds)
+{
+	const double pixels = double(width) * height;
+	std::lock_guard<std::mutex> lock(expectationMutex);
+	size_t smallest = size_t(Format::Count), fastest = 0U;
+	for (size_t i = 0U; i < size_t(Format::Count); i++)
+	{
+		const Expectation& expectation = expectations[i];
+		if (expectation.secondsPerPixel < expectations[fastest].secondsPerPixel)
+			fastest = i;
+		if (expectation.secondsPerPixel * pixels <= budgetSeconds && (smallest == size_t(Format::Count) || expectation.bytesPerPixel < expectations[smallest].bytesPerPixel))
+			smallest = i;
+	}
+	return Format(smallest < size_t(Format::Count) ? smallest : fastest);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+/*
+	Image encoders for delivering frames, from the fastest to the smallest output:
+		raw       - the RGBA8 rows as they are
+		ppm, bmp  - uncompressed RGB, readable by about everything
+		qoi       - the Quite OK Image format, a single pass of byte operations, about 3 times smaller than raw
+		png       - PNG with a greedy single probe deflate, smaller than zlib at level 1 and 6 times faster than level 6
+		png-best  - PNG with lazy matching over hash chains and the best filter of each row, 10 times slower, for archives
+	No external library is needed, the PNG files are compressed by a deflate encoder of this module.
+
+	Encoders are streaming: rows are added from the top in strips of any height, e.g. as the tiles of a poster are rendered,
+	and the output is handed to a sink as soon as it is ready, so only a few rows of an image are held in memory.
+	Images are encoded as opaque (RGB) except by raw and qoi, the renderers always write an alpha of 255.
+
+	Choose picks a format for a latency budget, from the speed and size of the images encoded so far by this process.
+*/
+namespace Encoder
+{
+	enum class Format : uint8_t
+	{
+		Raw,
+		PPM,
+		BMP,
+		QOI,
+		PNG,
+		PNGBest,
+		Count
+	};
+
+	// Name of the format on the command line and in manifests, and extension of its files
+	const char* Name(Format format);
+	const char* Extension(Format format);
+	bool Parse(const char* name, Format& format);
+
+	// Receives the encoded bytes in order, returns false to stop the encoding
+	using Sink = std::function<bool(const uint8_t* data, size_t size)>;
+
+	class Deflater;
+
+	class Writer
+	{
+	public:
+		Writer(Format format, uint32_t width, uint32_t height, const Sink& sink);
+		~Writer();
+
+		Writer(const Writer&) = delete;
+		Writer& operator=(const Writer&) = delete;
+
+		// Add the next rows of RGBA8 pixels, rowPitch bytes apart, returns false if the sink failed
+		bool AddRows(const uint8_t* pixels, uint32_t rowCount, uint32_t rowPitch);
+		// End the image once all of its rows were added, and record its speed and size for Choose
+		bool Finish();
+
+		size_t BytesWritten() const { return m_BytesWritten; }
+		// Time spent encoding, without the time spent in the sink
+		double Seconds() const { return m_Seconds; }
+
+	private:
+		bool Emit(const uint8_t* data, size_t size);
+		bool FlushChunks(bool final);
+		void EncodeQOI(const uint8_t* row);
+		void FilterPNG(const uint8_t* row);
+
+		Format m_Format;
+		uint32_t m_Width, m_Height;
+		Sink m_Sink;
+		uint32_t m_Row = 0U;
+		bool m_Failed = false;
+		size_t m_BytesWritten = 0U;
+		double m_Seconds = 0.0, m_SinkSeconds = 0.0;
+		std::vector<uint8_t> m_Buffer; // Output waiting for the sink
+
+		// QOI state, carried across rows
+		uint8_t m_Index[64 * 4] = {};
+		uint8_t m_Previous[4] = { 0U, 0U, 0U, 255U };
+		uint32_t m_Run = 0U;
+
+		// PNG state: RGB rows before and after filtering (with the filter type in front), and the output not yet in a chunk
+		std::unique_ptr<Deflater> m_Deflater;
+		std::vector<uint8_t> m_Current, m_Above, m_Filtered, m_Candidate;
+		std::vector<uint8_t> m_Compressed;
+	};
+
+	// Encode a whole image into out
+	bool Encode(Format format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t rowPitch, std::vector<uint8_t>& out);
+
+	// Format with the smallest expected output among those expected to encode an image of the given size within the budget,
+	// or the fastest format if none fits. The expectations start from typical frames and follow the images encoded since
+	Format Choose(uint32_t width, uint32_t height, double budgetSeconds);
+}
@@ -0,0 +1,369 @@
+#include "Evaluator.h"
+
+#include <cmath>
+
+#include "Metrics.h"
+
+namespace
+{
+	Metrics::Counter evaluatedPixels("pollock_evaluator_pixels_total", "Number of pixels evaluated on the CPU");
+	Metrics::Histogram batchTime("pollock_evaluator_batch_duration_seconds", "Time to evaluate one batch of pixels on the CPU");
+
+	#pragma region Function definitions
+
+	// CPU versions of the helpers in the generated WGSL code, kept as close as possible to the originals
+
+	// 1 input
+
+	inline float fInv(float x) { return 1.0f - x; }
+	inline float fSqr(float x) { return x * x; }
+	inline float fSqrt(float x) { return std::sqrt(x); }
+
+	inline float fSmooth(float x)
+	{
+		float x2 = x * x;
+		float x3 = x2 * x;
+		return x2 + x2 + x2 - x3 - x3;
+	}
+
+	inline float fSharp(float x) { return x * (x * (x + x - 3.0f) + 2.0f); }
+
+	// 2 inputs
+
+	inline float fAdd(float x, float y)
+	{
+		float res = x + y;
+		return res > 1.0f ? 2.0f - res : res;
+	}
+
+	inline float fSub(float x, float y)
+	{
+		float res = x - y;
+		return res < 0.0f ? -res : res;
+	}
+
+	inline float fMul(float x, float y) { return x * y; }
+
+	inline float fDiv(float x, float y)
+	{
+		float min = x > y ? y : x;
+		float max = x > y ? x : y;
+		if (max < 0.0001f)
+			max = 0.0001f;
+		return min / max;
+	}
+
+	inline float fAvg(float x, float y) { return (x + y) * 0.5f; }
+	inline float fGeom(float x, float y) { return std::sqrt(x * y); }
+
+	inline float fHarm(float x, float y)
+	{
+		float den = x + y;
+		if (den < 0.0001f)
+			den = 0.0001f;
+		return (2.0f * x * y) / den;
+	}
+
+	inline float fHypo(float x, float y) { return 0.70710678f * std::sqrt(x * x + y * y); } // Scale by 1 / sqrt(2)
+	inline float fMax(float x, float y) { return x > y ? x : y; }
+	inline float fMin(float x, float y) { return x < y ? x : y; }
+
+	inline float fPow(float x, float y)
+	{
+		float exp1 = y + y - 1.0f;
+		float exp2 = std::pow(10.0f, exp1);
+		return std::pow(x, exp2);
+	}
+
+	inline float fBell(float x, float y)
+	{
+		float y2 = y * y;
+		return std::pow(4.0f * x * (1.0f - x), 20.0f * y2 * y2 + 0.3f);
+	}
+
+	inline float fWave(float x, float y)
+	{
+		constexpr float MAX_FREQUENCY = 6.0f * 3.1415927f;
+		return 0.5f + 0.5f * std::cos(MAX_FREQUENCY * x * y);
+	}
+
+	inline float fBounce(float x, float y)
+	{
+		constexpr float FREQUENCY_FACTOR = 3.0f * 3.1415927f;
+		return std::fabs(std::cos(FREQUENCY_FACTOR * x * (y + 0.5f)) * std::exp2(-3.0f * x));
+	}
+
+	// 3 inputs
+
+	inline float fLerp(float x, float y, float z) { return (1.0f - z) * x + z * y; }
+
+	inline float fMlerp(float x, float y, float z)
+	{
+		float xMin = x < 0.0001f ? 0.0001f : x;
+		return xMin * std::pow(y / xMin, z);
+	}
+
+	inline float fClamp(float x, float y, float z)
+	{
+		float min = x > y ? y : x;
+		float max = x > y ? x : y;
+		if (z < min)
+			return min;
+		else if (z > max)
+			return max;
+		return z;
+	}
+
+	// 4 inputs
+
+	inline float fDist(float x, float y, float z, float w)
+	{
+		float dx = x - z;
+		float dy = y - w;
+		return 0.70710678f * std::sqrt(dx * dx + dy * dy); // Scale by 1 / sqrt(2)
+	}
+
+	inline float fDistLine(float x, float y, float z, float w)
+	{
+		if (z < 0.499f || z > 0.501f)
+		{
+			float m = std::tan(z * 3.1415927f);
+			float n = z < 0.499f ? (1.0f - w) * (1.0f + m) - m : w - m * w;
+			float c = (x + y * m - m * n) / (m * m + 1.0f);
+			float dx = c - x;
+			float dy = m * c + n - y;
+			return 0.70710678f * std::sqrt(dx * dx + dy * dy);
+		}
+		return 0.70710678f * std::fabs(w - x);
+	}
+
+	// Polynomial surrogates
+
+	inline float fHorner(float a, float t, float c) { return a * (t + t - 1.0f) + c; }
+
+	// Phase of the loop, recovered from the time inputs (see Renderer::PhaseInputs)
+	inline float Phase(float sinTime, float cosTime)
+	{
+		float phase = std::atan2(sinTime - 0.5f, cosTime - 0.5f) * 0.15915494f;
+		return phase < 0.0f ? phase + 1.0f : phase;
+	}
+
+	#pragma endregion
+
+	// Run a helper over a whole batch (one loop per instruction, so the dispatch cost is paid once per batch)
+	template <typename F>
+	inline void Apply(float* d, const float* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = f(s[0][i]);
+	}
+	template <typename F>
+	inline void Apply2(float* d, const float* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = f(s[0][i], s[1][i]);
+	}
+	template <typename F>
+	inline void Apply3(float* d, const float* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = f(s[0][i], s[1][i], s[2][i]);
+	}
+	template <typename F>
+	inline void Apply4(float* d, const float* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = f(s[0][i], s[1][i], s[2][i], s[3][i]);
+	}
+
+	inline void Fill(float* d, float value, uint32_t count)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = value;
+	}
+}
+
+void Evaluator::EvaluateInstruction(const Instruction& instruction, const float* const* args, const float* x, const float* y, float sinTime, float cosTime, uint32_t count, float* out)
+{
+	float* d = out;
+	const float* const* s = args;
+
+	switch (instruction.op)
+	{
+	case Op::X:			for (uint32_t i = 0U; i < count; i++) d[i] = x[i]; break;
+	case Op::Y:			for (uint32_t i = 0U; i < count; i++) d[i] = y[i]; break;
+	case Op::InvX:		for (uint32_t i = 0U; i < count; i++) d[i] = 1.0f - x[i]; break;
+	case Op::InvY:		for (uint32_t i = 0U; i < count; i++) d[i] = 1.0f - y[i]; break;
+	case Op::SinTime:	Fill(d, sinTime, count); break;
+	case Op::CosTime:	Fill(d, cosTime, count); break;
+	case Op::Const:		Fill(d, instruction.value, count); break;
+
+	case Op::Inv:		Apply(d, s, count, fInv); break;
+	case Op::Sqr:		Apply(d, s, count, fSqr); break;
+	case Op::Sqrt:		Apply(d, s, count, fSqrt); break;
+	case Op::Smooth:	Apply(d, s, count, fSmooth); break;
+	case Op::Sharp:		Apply(d, s, count, fSharp); break;
+
+	case Op::Add:		Apply2(d, s, count, fAdd); break;
+	case Op::Sub:		Apply2(d, s, count, fSub); break;
+	case Op::Mul:		Apply2(d, s, count, fMul); break;
+	case Op::Div:		Apply2(d, s, count, fDiv); break;
+	case Op::Avg:		Apply2(d, s, count, fAvg); break;
+	case Op::Geom:		Apply2(d, s, count, fGeom); break;
+	case Op::Harm:		Apply2(d, s, count, fHarm); break;
+	case Op::Hypo:		Apply2(d, s, count, fHypo); break;
+	case Op::Max:		Apply2(d, s, count, fMax); break;
+	case Op::Min:		Apply2(d, s, count, fMin); break;
+	case Op::Pow:		Apply2(d, s, count, fPow); break;
+	case Op::Bell:		Apply2(d, s, count, fBell); break;
+	case Op::Wave:		Apply2(d, s, count, fWave); break;
+	case Op::Bounce:	Apply2(d, s, count, fBounce); break;
+
+	case Op::Lerp:		Apply3(d, s, count, fLerp); break;
+	case Op::Mlerp:		Apply3(d, s, count, fMlerp); break;
+	case Op::Clamp:		Apply3(d, s, count, fClamp); break;
+
+	case Op::Dist:		Apply4(d, s, count, fDist); break;
+	case Op::DistLine:	Apply4(d, s, count, fDistLine); break;
+
+	case Op::Cached:	for (uint32_t i = 0U; i < count; i++) d[i] = s[0][i]; break;
+
+	case Op::Phase:		Fill(d, Phase(sinTime, cosTime), count); break;
+	case Op::Horner:	Apply3(d, s, count, fHorner); break;
+
+	default: break;
+	}
+}
+
+void Evaluator::EvaluateBatch(const Program& program, const float* x, const float* y, float sinTime, float cosTime, uint32_t count, float* r, float* g, float* b, std::vector<float>& scratch, const float* const* cache)
+{
+	Metrics::Timer timer(batchTime);
+	evaluatedPixels.Add(count);
+
+	// One register of BATCH_SIZE floats for each live value, as computed by ScheduleProgram
+	scratch.resize(size_t(program.registerCount) * BATCH_SIZE);
+
+	for (const Instruction& instruction : program.code)
+	{
+		const float* args[4];
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+			args[a] = scratch.data() + size_t(instruction.src[a]) * BATCH_SIZE;
+		if (instruction.op == Op::Cached)
+			args[0] = cache[instruction.args[0]];
+
+		EvaluateInstruction(instruction, args, x, y, sinTime, cosTime, count, scratch.data() + size_t(instruction.dst) * BATCH_SIZE);
+	}
+
+	// Copy the outputs out of the scratch registers
+	float* outputs[3] = { r, g, b };
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		const float* src = scratch.data() + size_t(program.code[program.outputs[c]].dst) * BATCH_SIZE;
+		for (uint32_t i = 0U; i < count; i++)
+			outputs[c][i] = src[i];
+	}
+}
+
+void Evaluator::EvaluateStores(const Program& program, const float* x, const float* y, uint32_t count, float* const* stores, std::vector<float>& scratch)
+{
+	Metrics::Timer timer(batchTime);
+	evaluatedPixels.Add(count);
+
+	scratch.resize(size_t(program.registerCount) * BATCH_SIZE);
+
+	// The space stage never reads the time
+	for (const Instruction& instruction : program.code)
+	{
+		const float* args[4];
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+			args[a] = scratch.data() + size_t(instruction.src[a]) * BATCH_SIZE;
+
+		EvaluateInstruction(instruction, args, x, y, 0.0f, 0.0f, count, scratch.data() + size_t(instruction.dst) * BATCH_SIZE);
+	}
+
+	for (size_t slot = 0U; slot < program.stores.size(); slot++)
+	{
+		const float* src = scratch.data() + size_t(program.code[program.stores[slot]].dst) * BATCH_SIZE;
+		for (uint32_t i = 0U; i < count; i++)
+			stores[slot][i] = src[i];
+	}
+}
+
+std::vector<uint8_t> Evaluator::VaryingInstructions(const Program& program)
+{
+	// Arguments always come before the instructions that read them
+	std::vector<uint8_t> varying(program.code.size(), 0U);
+	for (size_t i = 0U; i < program.code.size(); i++)
+	{
+		const Instruction& instruction = program.code[i];
+		varying[i] = instruction.op == Op::Const;
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+			varying[i] |= varying[instruction.args[a]];
+	}
+	return varying;
+}
+
+void Evaluator::EvaluateFamily(const Program& program, const std::vector<uint8_t>& varying, const float* const* constants, uint32_t members, const float* x, const float* y, float sinTime, float cosTime, uint32_t count, float* const* r, float* const* g, float* const* b, std::vector<float>& scratch)
+{
+	Metrics::Timer timer(batchTime);
+	evaluatedPixels.Add(uint64_t(count) * members);
+
+	// Register n of member m is at (n * members + m) * BATCH_SIZE, and the values shared by the family are in the slot of member 0
+	const size_t stride = size_t(members) * BATCH_SIZE;
+	scratch.resize(size_t(program.registerCount) * stride);
+	auto value = [&](uint32_t index, uint32_t member)
+	{
+		return scratch.data() + size_t(program.code[index].dst) * stride + (varying[index] ? size_t(member) * BATCH_SIZE : 0U);
+	};
+
+	uint32_t constant = 0U;
+	for (size_t i = 0U; i < program.code.size(); i++)
+	{
+		const Instruction& instruction = program.code[i];
+		float* d = scratch.data() + size_t(instruction.dst) * stride;
+
+		if (instruction.op == Op::Const)
+		{
+			for (uint32_t m = 0U; m < members; m++)
+				Fill(d + size_t(m) * BATCH_SIZE, constants[m][constant], count);
+			constant++;
+			continue;
+		}
+
+		const uint32_t arity = OpArity(instruction.op);
+		bool allVarying = true;
+		for (uint32_t a = 0U; a < arity; a++)
+			allVarying &= varying[instruction.args[a]] != 0U;
+
+		const float* args[4];
+		if (!varying[i] || allVarying)
+		{
+			// One call over the slot of member 0, or over the slots of every member at once since they are contiguous
+			// (the lanes past count in the last slot only compute values that are never read)
+			for (uint32_t a = 0U; a < arity; a++)
+				args[a] = value(instruction.args[a], 0U);
+			EvaluateInstruction(instruction, args, x, y, sinTime, cosTime, varying[i] ? uint32_t(stride - BATCH_SIZE) + count : count, d);
+			continue;
+		}
+
+		// Shared arguments are read by every member from slot 0, which can also be the destination (the scheduler reuses the
+		// register of a last use), so member 0 goes last
+		for (uint32_t m = members; m-- > 0U;)
+		{
+			for (uint32_t a = 0U; a < arity; a++)
+				args[a] = value(instruction.args[a], m);
+			EvaluateInstruction(instruction, args, x, y, sinTime, cosTime, count, d + size_t(m) * BATCH_SIZE);
+		}
+	}
+
+	float* const* outputs[3] = { r, g, b };
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		for (uint32_t m = 0U; m < members; m++)
+		{
+			const float* src = value(program.outputs[c], m);
+			for (uint32_t i = 0U; i < count; i++)
+				outputs[c][m][i] = src[i];
+		}
+	}
+}
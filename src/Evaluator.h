@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Program.h"
+
+namespace Evaluator
+{
+	// Maximum number of pixels processed by each instruction at once
+	// Large enough to amortize the dispatch of each instruction, small enough to keep all scratch registers in cache
+	constexpr uint32_t BATCH_SIZE = 256U;
+
+	// Evaluate the program over count pixels (at most BATCH_SIZE), in structure of arrays layout
+	// The scratch vector holds the registers of the program, and should be reused between calls to avoid reallocations
+	// Programs with Op::Cached instructions read the values of each slot from cache[slot] (see SplitProgram)
+	void EvaluateBatch(const Program& program, const float* x, const float* y, float sinTime, float cosTime, uint32_t count, float* r, float* g, float* b, std::vector<float>& scratch, const float* const* cache = nullptr);
+
+	// Evaluate the space stage of a split program over count pixels, writing the value of each store to stores[slot]
+	void EvaluateStores(const Program& program, const float* x, const float* y, uint32_t count, float* const* stores, std::vector<float>& scratch);
+
+	// Instructions whose values depend on at least one Op::Const, as 1 or 0 in the order of the code
+	// The other values are the same for every program of a structure family (see StructureHash)
+	std::vector<uint8_t> VaryingInstructions(const Program& program);
+
+	/*
+		Evaluate the programs of a structure family over the same count pixels, with a single pass over the shared code.
+
+		The code comes from program, and the values of its constants from constants[member] for each of the given members
+		(in the order of ProgramConstants). Each instruction is decoded once for the whole family: values that do not depend
+		on any constant (see VaryingInstructions) are computed once, and the others for all members in a single call when their
+		arguments allow it. The registers of the members are interleaved, so the scratch takes members times the space of
+		EvaluateBatch. r, g and b hold one array for each member. Programs with Op::Cached instructions are not supported.
+	*/
+	void EvaluateFamily(const Program& program, const std::vector<uint8_t>& varying, const float* const* constants, uint32_t members, const float* x, const float* y, float sinTime, float cosTime, uint32_t count, float* const* r, float* const* g, float* const* b, std::vector<float>& scratch);
+
+	// Evaluate a single instruction over count pixels, reading its arguments from the given arrays
+	// Used by passes that need the value of every instruction, instead of only the outputs
+	void EvaluateInstruction(const Instruction& instruction, const float* const* args, const float* x, const float* y, float sinTime, float cosTime, uint32_t count, float* out);
+}
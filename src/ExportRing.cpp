@@ -0,0 +1,446 @@
+#include "ExportRing.h"
+#include "GraphicsState.h"
+#include "Metrics.h"
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <webgpu/webgpu_cpp.h>
+#include <emscripten/emscripten.h>
+
+using namespace GraphicsState;
+
+namespace
+{
+	// State of Loop and Poster, which render a list of images with their own time and uv region, a batch per submission
+	constexpr uint32_t EXPORT_RING = 3U; // Staging buffers, so one can be read while the GPU works on the next ones
+	constexpr uint32_t MAX_EXPORT_BATCH = 64U; // Layers of the render target
+	constexpr uint64_t POSTER_BATCH_BYTES = uint64_t(32U) << 20U; // Pixels of the tiles of a batch, so small tiles share a submission
+	struct ExportBatch
+	{
+		wgpu::Buffer staging;
+		uint32_t first = 0U; // First image of the batch
+		uint32_t count = 0U;
+		bool busy = false; // Submitted and not given to the sink yet
+		bool mapped = false;
+	};
+	struct Export
+	{
+		uint32_t width = 0U, height = 0U, images = 0U, batch = 0U; // Size of the rendered images (the layers of the target)
+		uint32_t rowPitch = 0U; // Bytes per row in the staging buffers, padded to the 256 bytes required by copies
+		uint32_t submitted = 0U; // Images submitted so far
+		uint32_t delivered = 0U; // Images given to the sink so far
+		uint32_t nextSubmit = 0U; // Ring index of the next batch to submit
+		uint32_t nextRead = 0U; // Ring index of the next batch to give to the sink, so the images stay in order
+		ExportBatch ring[EXPORT_RING];
+		std::vector<float> times, regions; // Time uniforms and uv region of each image, 4 floats each
+		bool tiled = false; // The images cover different regions, so the cache of a split program is filled for each of them
+		wgpu::Texture target; // One layer per image of a batch
+		wgpu::Buffer timeBuffer, regionBuffer; // Uniforms of each image of a batch, 256 bytes apart (dynamic offsets)
+		wgpu::BindGroup bindGroup;
+		wgpu::RenderPipeline pipeline; // Fragment module of the canvas pipeline, with the region vertex shader and an RGBA8 target
+		wgpu::Texture cache; // Cached values of a split program at the size of the images
+		std::vector<wgpu::BindGroup> cacheBindGroups; // One per layer, for the region of its image
+		bool cacheValid = false;
+		std::vector<uint8_t> image; // Image without the row padding
+		std::function<void(uint32_t index, const uint8_t* pixels)> sink;
+		std::function<void(double ms, uint32_t stalls)> report;
+		double start = 0.0;
+		uint32_t stalls = 0U; // Times the GPU ran out of batches while images were left, i.e. it waited for the readback
+		bool running = false;
+	};
+	Export m_Export;
+	Metrics::Counter m_ExportedFrames("pollock_gpu_exported_frames_total", "Number of frames exported offscreen");
+	Metrics::Counter m_ExportedTiles("pollock_gpu_exported_tiles_total", "Number of poster tiles exported offscreen");
+
+	void ExportSetup();
+	void ExportPump();
+	void ExportMapped(WGPUBufferMapAsyncStatus status, void* userdata);
+}
+
+void ExportRing::Loop(uint32_t width, uint32_t height, uint32_t frames, uint32_t batch, FrameSink sink)
+{
+	// The export reuses the module and the buffers of the current program
+	if (m_Export.running || !m_Pipeline || m_PipelinePending || (m_Split && (m_CachePipelinePending || !m_CachePipeline)) || width == 0U || height == 0U || frames == 0U)
+		return;
+
+	Export& e = m_Export;
+	e = Export{};
+	e.width = width;
+	e.height = height;
+	e.images = frames;
+	e.batch = std::clamp(batch, 1U, std::min(frames, MAX_EXPORT_BATCH));
+
+	// Frames evenly spaced over one loop, with the same time inputs as Update, each covering the whole uv space
+	e.times.resize(size_t(frames) * 4U, 0.0f);
+	e.regions.resize(size_t(frames) * 4U, 0.0f);
+	for (uint32_t frame = 0U; frame < frames; frame++)
+	{
+		float angle = 6.2831853f * float(frame) / float(frames);
+		e.times[frame * 4U + 0U] = 0.5f + 0.5f * sinf(angle);
+		e.times[frame * 4U + 1U] = 0.5f + 0.5f * cosf(angle);
+		e.times[frame * 4U + 2U] = float(frame) / float(frames);
+		e.regions[frame * 4U + 2U] = 1.0f;
+		e.regions[frame * 4U + 3U] = 1.0f;
+	}
+
+	e.sink = [sink, width, height](uint32_t frame, const uint8_t* pixels)
+	{
+		sink(frame, pixels, width, height);
+		m_ExportedFrames.Add();
+	};
+	e.report = [width, height, frames, batch = e.batch](double ms, uint32_t stalls)
+	{
+		char report[256];
+		std::snprintf(report, sizeof(report), "{ \"frames\": %u, \"width\": %u, \"height\": %u, \"batch\": %u, \"ring\": %u, \"ms\": %.1f, \"fps\": %.2f, \"stalls\": %u }",
+			frames, width, height, batch, EXPORT_RING, ms, 1000.0 * frames / ms, stalls);
+		std::cout << report << std::endl;
+	};
+
+	ExportSetup();
+}
+
+void ExportRing::Poster(uint32_t width, uint32_t height, float phase, uint32_t tileWidth, uint32_t tileHeight, RowSink sink)
+{
+	if (m_Export.running || !m_Pipeline || m_PipelinePending || (m_Split && (m_CachePipelinePending || !m_CachePipeline)) || width == 0U || height == 0U || tileWidth == 0U || tileHeight == 0U)
+		return;
+
+	Export& e = m_Export;
+	e = Export{};
+	e.width = std::min({ tileWidth, width, MAX_TILE_SIZE });
+	e.height = std::min({ tileHeight, height, MAX_TILE_SIZE });
+	const uint32_t tw = e.width, th = e.height;
+	const uint32_t columns = (width + tw - 1U) / tw;
+	const uint32_t rows = (height + th - 1U) / th;
+	e.images = columns * rows;
+	e.batch = uint32_t(std::clamp<uint64_t>(POSTER_BATCH_BYTES / (uint64_t(tw) * th * 4U), 1U, std::min(e.images, MAX_EXPORT_BATCH)));
+	e.tiled = true;
+
+	// Tiles in row-major order, each mapping the whole render target to its part of the poster
+	// The tiles of the last column and row overhang the poster, and are cropped
+	float angle = 6.2831853f * phase;
+	e.times.resize(size_t(e.images) * 4U, 0.0f);
+	e.regions.resize(size_t(e.images) * 4U, 0.0f);
+	for (uint32_t tile = 0U; tile < e.images; tile++)
+	{
+		uint32_t x = tile % columns * tw;
+		uint32_t y = tile / columns * th;
+		e.times[tile * 4U + 0U] = 0.5f + 0.5f * sinf(angle);
+		e.times[tile * 4U + 1U] = 0.5f + 0.5f * cosf(angle);
+		e.times[tile * 4U + 2U] = phase;
+		// uv.y = 1 at the top, so the offset is the uv of the bottom of the tile
+		e.regions[tile * 4U + 0U] = float(double(x) / width);
+		e.regions[tile * 4U + 1U] = float(1.0 - double(y + th) / height);
+		e.regions[tile * 4U + 2U] = float(double(tw) / width);
+		e.regions[tile * 4U + 3U] = float(double(th) / height);
+	}
+
+	// The tiles of a row are assembled into a strip of the poster, given to the sink when its last tile arrives
+	std::shared_ptr<std::vector<uint8_t>> strip = std::make_shared<std::vector<uint8_t>>(size_t(width) * th * 4U);
+	e.sink = [sink, strip, width, height, columns, tw, th](uint32_t tile, const uint8_t* pixels)
+	{
+		uint32_t column = tile % columns;
+		uint32_t x = column * tw;
+		uint32_t y = tile / columns * th;
+		uint32_t w = std::min(tw, width - x);
+		uint32_t h = std::min(th, height - y);
+		for (uint32_t row = 0U; row < h; row++)
+			std::memcpy(strip->data() + (size_t(row) * width + x) * 4U, pixels + size_t(row) * tw * 4U, size_t(w) * 4U);
+		m_ExportedTiles.Add();
+
+		if (column == columns - 1U)
+			sink(y, h, strip->data(), width);
+	};
+	e.report = [width, height, tiles = e.images, tw, th, batch = e.batch](double ms, uint32_t stalls)
+	{
+		char report[320];
+		std::snprintf(report, sizeof(report), "{ \"width\": %u, \"height\": %u, \"tiles\": %u, \"tileWidth\": %u, \"tileHeight\": %u, \"batch\": %u, \"ring\": %u, \"ms\": %.1f, \"megapixelsPerSecond\": %.2f, \"stalls\": %u }",
+			width, height, tiles, tw, th, batch, EXPORT_RING, ms, double(width) * height / (1000.0 * ms), stalls);
+		std::cout << report << std::endl;
+	};
+
+	ExportSetup();
+}
+
+namespace
+{
+	// Create the targets, buffers and pipeline of the export described by m_Export, and start it
+	void ExportSetup()
+	{
+		Export& e = m_Export;
+		e.rowPitch = (e.width * 4U + 255U) / 256U * 256U;
+		e.image.resize(size_t(e.width) * e.height * 4U);
+
+		#pragma region Targets and buffers
+
+		// One layer for each image of a batch
+		wgpu::TextureDescriptor td =
+		{
+			.usage		= wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc,
+			.dimension	= wgpu::TextureDimension::e2D,
+			.size		= { e.width, e.height, e.batch },
+			.format		= wgpu::TextureFormat::RGBA8Unorm
+		};
+		e.target = m_Device.CreateTexture(&td);
+
+		// Time uniforms and regions of the images of a batch, at offsets aligned for dynamic offsets
+		wgpu::BufferDescriptor ubd =
+		{
+			.usage				= wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst,
+			.size				= uint64_t(e.batch) * 256U,
+			.mappedAtCreation	= false
+		};
+		e.timeBuffer = m_Device.CreateBuffer(&ubd);
+		e.regionBuffer = m_Device.CreateBuffer(&ubd);
+
+		for (ExportBatch& b : e.ring)
+		{
+			wgpu::BufferDescriptor sbd =
+			{
+				.usage				= wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst,
+				.size				= uint64_t(e.rowPitch) * e.height * e.batch,
+				.mappedAtCreation	= false
+			};
+			b.staging = m_Device.CreateBuffer(&sbd);
+		}
+
+		// The space stage of a split program is evaluated again at the size of the images, for the region of each layer
+		wgpu::TextureView cacheView;
+		if (m_Split)
+		{
+			e.cache = CreateCacheTexture(e.width, e.height);
+			cacheView = CreateCacheView(e.cache);
+			for (uint32_t k = 0U; k < e.batch; k++)
+				e.cacheBindGroups.push_back(CreateCacheBindGroup(cacheView, e.regionBuffer, uint64_t(k) * 256U));
+		}
+
+		#pragma endregion
+
+		#pragma region Pipeline
+
+		// Same bindings as the canvas pipeline, except for the dynamic offsets of the time uniforms and the region of the vertex shader
+		bool uniform = m_ConstantMode == ConstantMode::Uniform && !m_Constants.empty();
+		std::vector<wgpu::BindGroupLayoutEntry> layoutEntries =
+		{
+			{
+				.binding = 0,
+				.visibility = wgpu::ShaderStage::Fragment,
+				.buffer = { .type = wgpu::BufferBindingType::Uniform, .hasDynamicOffset = true, .minBindingSize = 4 * sizeof(float) }
+			},
+			{
+				.binding = 3,
+				.visibility = wgpu::ShaderStage::Vertex,
+				.buffer = { .type = wgpu::BufferBindingType::Uniform, .hasDynamicOffset = true, .minBindingSize = 4 * sizeof(float) }
+			}
+		};
+		std::vector<wgpu::BindGroupEntry> entries =
+		{
+			{ .binding = 0, .buffer = e.timeBuffer, .offset = 0, .size = 4 * sizeof(float) },
+			{ .binding = 3, .buffer = e.regionBuffer, .offset = 0, .size = 4 * sizeof(float) }
+		};
+		if (uniform)
+		{
+			layoutEntries.push_back({ .binding = 1, .visibility = wgpu::ShaderStage::Fragment, .buffer = { .type = wgpu::BufferBindingType::Uniform } });
+			entries.push_back({ .binding = 1, .buffer = m_ConstantBuffer, .offset = 0, .size = (m_Constants.size() + 3U) / 4U * 4U * sizeof(float) });
+		}
+		if (m_Split)
+		{
+			layoutEntries.push_back({ .binding = 2, .visibility = wgpu::ShaderStage::Fragment, .texture = { .sampleType = wgpu::TextureSampleType::UnfilterableFloat, .viewDimension = wgpu::TextureViewDimension::e2DArray } });
+			entries.push_back({ .binding = 2, .textureView = cacheView });
+		}
+
+		wgpu::BindGroupLayoutDescriptor bgld = { .entryCount = layoutEntries.size(), .entries = layoutEntries.data() };
+		wgpu::BindGroupLayout layout = m_Device.CreateBindGroupLayout(&bgld);
+		wgpu::BindGroupDescriptor bgd = { .layout = layout, .entryCount = entries.size(), .entries = entries.data() };
+		e.bindGroup = m_Device.CreateBindGroup(&bgd);
+
+		std::vector<std::string> constantKeys;
+		std::vector<wgpu::ConstantEntry> constantEntries = OverrideConstants(m_Constants, constantKeys);
+		wgpu::ColorTargetState colorTargetState{ .format = wgpu::TextureFormat::RGBA8Unorm };
+		wgpu::FragmentState fragmentState
+		{
+			.module = m_ShaderModule,
+			.constantCount = constantEntries.size(),
+			.constants = constantEntries.data(),
+			.targetCount = 1,
+			.targets = &colorTargetState
+		};
+		wgpu::PipelineLayoutDescriptor pld = { .bindGroupLayoutCount = 1, .bindGroupLayouts = &layout };
+		wgpu::RenderPipelineDescriptor rpd =
+		{
+			.layout = m_Device.CreatePipelineLayout(&pld),
+			.vertex = { .module = RegionModule() },
+			.fragment = &fragmentState
+		};
+		e.pipeline = m_Device.CreateRenderPipeline(&rpd);
+
+		#pragma endregion
+
+		e.start = emscripten_get_now();
+		e.running = true;
+		ExportPump();
+	}
+
+	// Render and copy the next batch into the next staging buffer, then wait for it to be mapped
+	void ExportSubmit()
+	{
+		Export& e = m_Export;
+		uint32_t index = e.nextSubmit;
+		ExportBatch& b = e.ring[index];
+		b.first = e.submitted;
+		b.count = std::min(e.batch, e.images - e.submitted);
+
+		// Queued after the previous submission, so it still reads the uniforms of its own batch
+		std::vector<float> times(size_t(b.count) * 64U, 0.0f);
+		std::vector<float> regions(size_t(b.count) * 64U, 0.0f);
+		for (uint32_t k = 0U; k < b.count; k++)
+		{
+			std::copy_n(e.times.begin() + size_t(b.first + k) * 4U, 4U, times.begin() + k * 64U);
+			std::copy_n(e.regions.begin() + size_t(b.first + k) * 4U, 4U, regions.begin() + k * 64U);
+		}
+		m_Device.GetQueue().WriteBuffer(e.timeBuffer, 0, times.data(), times.size() * sizeof(float));
+		m_Device.GetQueue().WriteBuffer(e.regionBuffer, 0, regions.data(), regions.size() * sizeof(float));
+
+		wgpu::CommandEncoder encoder = m_Device.CreateCommandEncoder();
+
+		for (uint32_t k = 0U; k < b.count; k++)
+		{
+			// Frames of a loop share the cache, while each tile of a poster needs the values of its own region
+			if (m_Split && (e.tiled || !e.cacheValid))
+			{
+				wgpu::ComputePassEncoder computePass = encoder.BeginComputePass();
+				computePass.SetPipeline(m_CachePipeline);
+				computePass.SetBindGroup(0, e.cacheBindGroups[k]);
+				computePass.DispatchWorkgroups((e.width + 7U) / 8U, (e.height + 7U) / 8U);
+				computePass.End();
+				e.cacheValid = true;
+			}
+
+			wgpu::TextureViewDescriptor tvd{ .dimension = wgpu::TextureViewDimension::e2D, .baseArrayLayer = k, .arrayLayerCount = 1 };
+			wgpu::RenderPassColorAttachment attachment
+			{
+				.view = e.target.CreateView(&tvd),
+				.loadOp = wgpu::LoadOp::Clear,
+				.storeOp = wgpu::StoreOp::Store
+			};
+			wgpu::RenderPassDescriptor rpd{ .colorAttachmentCount = 1, .colorAttachments = &attachment };
+
+			// In binding order: time uniforms, then region
+			uint32_t offsets[] = { k * 256U, k * 256U };
+			wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&rpd);
+			pass.SetPipeline(e.pipeline);
+			pass.SetBindGroup(0, e.bindGroup, 2, offsets);
+			pass.Draw(6);
+			pass.End();
+		}
+
+		// Every layer of the batch in a single copy
+		wgpu::ImageCopyTexture source{ .texture = e.target };
+		wgpu::ImageCopyBuffer destination
+		{
+			.layout = { .offset = 0, .bytesPerRow = e.rowPitch, .rowsPerImage = e.height },
+			.buffer = b.staging
+		};
+		wgpu::Extent3D size{ e.width, e.height, b.count };
+		encoder.CopyTextureToBuffer(&source, &destination, &size);
+
+		wgpu::CommandBuffer commands = encoder.Finish();
+		m_Device.GetQueue().Submit(1, &commands);
+
+		b.busy = true;
+		b.mapped = false;
+		b.staging.MapAsync(wgpu::MapMode::Read, 0, size_t(e.rowPitch) * e.height * b.count, ExportMapped, reinterpret_cast<void*>(uintptr_t(index)));
+
+		e.submitted += b.count;
+		e.nextSubmit = (index + 1U) % EXPORT_RING;
+	}
+
+	// Keep every staging buffer busy, so the GPU always has a batch to work on
+	void ExportPump()
+	{
+		Export& e = m_Export;
+		while (e.submitted < e.images && !e.ring[e.nextSubmit].busy)
+			ExportSubmit();
+	}
+
+	void ExportMapped(WGPUBufferMapAsyncStatus status, void* userdata)
+	{
+		Export& e = m_Export;
+		if (status != WGPUBufferMapAsyncStatus_Success)
+		{
+			std::cout << "Export readback failed: " << status << std::endl;
+			e.running = false;
+			return;
+		}
+		e.ring[uintptr_t(userdata)].mapped = true;
+
+		uint32_t inFlight = 0U;
+		for (const ExportBatch& b : e.ring)
+			inFlight += b.busy && !b.mapped ? 1U : 0U;
+		if (inFlight == 0U && e.submitted < e.images)
+			e.stalls++;
+
+		// Batches may be mapped out of order, but the sink gets them in order
+		while (e.ring[e.nextRead].mapped)
+		{
+			ExportBatch& b = e.ring[e.nextRead];
+			size_t imageSize = size_t(e.rowPitch) * e.height;
+			const uint8_t* data = static_cast<const uint8_t*>(b.staging.GetConstMappedRange(0, imageSize * b.count));
+			for (uint32_t k = 0U; k < b.count; k++)
+			{
+				const uint8_t* layer = data + imageSize * k;
+				if (e.rowPitch != e.width * 4U)
+				{
+					for (uint32_t row = 0U; row < e.height; row++)
+						std::memcpy(e.image.data() + size_t(row) * e.width * 4U, layer + size_t(row) * e.rowPitch, e.width * 4U);
+					layer = e.image.data();
+				}
+				e.sink(b.first + k, layer);
+			}
+			b.staging.Unmap();
+			b.busy = false;
+			b.mapped = false;
+
+			e.delivered += b.count;
+			e.nextRead = (e.nextRead + 1U) % EXPORT_RING;
+		}
+
+		if (e.delivered < e.images)
+		{
+			ExportPump();
+			return;
+		}
+
+		e.report(emscripten_get_now() - e.start, e.stalls);
+
+		// Free the targets and the staging buffers
+		e = Export{};
+	}
+}
+
+// Export one loop of the current program (see ExportRing::Loop), calling Module.onExportFrame(frame, pixels, width, height) for each frame
+// The pixels are a view of the wasm memory, only valid during the call (e.g. to create a VideoFrame for a VideoEncoder)
+extern "C" EMSCRIPTEN_KEEPALIVE void ExportLoop(uint32_t width, uint32_t height, uint32_t frames, uint32_t batch)
+{
+	ExportRing::Loop(width, height, frames, batch, [](uint32_t frame, const uint8_t* pixels, uint32_t width, uint32_t height)
+	{
+		EM_ASM({ if (Module.onExportFrame) Module.onExportFrame($0, HEAPU8.subarray($1, $1 + $2 * $3 * 4), $2, $3); }, frame, pixels, width, height);
+	});
+}
+
+// Export a poster of the current program at the given phase (see ExportRing::Poster), calling Module.onPosterRows(firstRow, pixels, width, rowCount)
+// for each strip of rows, from the top (the last strip ends at the height of the poster), e.g. to feed a streaming image encoder
+// The pixels are a view of the wasm memory, only valid during the call
+extern "C" EMSCRIPTEN_KEEPALIVE void ExportPoster(uint32_t width, uint32_t height, float phase, uint32_t tileWidth, uint32_t tileHeight)
+{
+	ExportRing::Poster(width, height, phase, tileWidth, tileHeight, [](uint32_t firstRow, uint32_t rowCount, const uint8_t* pixels, uint32_t width)
+	{
+		EM_ASM({ if (Module.onPosterRows) Module.onPosterRows($0, HEAPU8.subarray($1, $1 + $2 * $3 * 4), $2, $3); }, firstRow, pixels, width, rowCount);
+	});
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+
+/*
+	Offscreen export of the program shown by the canvas (see Graphics::SetProgram), without going through the canvas.
+
+	Both exports render a list of images (frames of a loop, or tiles of a poster) with their own time and uv region, through
+	the region vertex shader and the fragment module of the canvas. Each submission renders a batch of images into the layers
+	of a texture array and copies them to one of a ring of staging buffers, so the GPU renders the next batches while the
+	previous one is mapped and read. The current program must not change until the export is done, and the timings are
+	printed to the console as JSON at the end.
+*/
+namespace ExportRing
+{
+	// Render one loop of the current program as RGBA8 frames evenly spaced in phase, batch frames per submission
+	// The sink gets the frames in order (the pixels are tightly packed, and only valid during the call)
+	using FrameSink = std::function<void(uint32_t frame, const uint8_t* pixels, uint32_t width, uint32_t height)>;
+	void Loop(uint32_t width, uint32_t height, uint32_t frames, uint32_t batch, FrameSink sink);
+
+	// Render the current program at the given phase as a poster of any size, in tiles of up to tileWidth x tileHeight pixels,
+	// so it is not bounded by the texture size limit. Each tile is rendered with the region of the uv space it covers
+	// The tiles of a row are assembled into a strip, and the sink gets the strips from the top, as soon as their last tile arrives,
+	// so an image writer can stream them out (the pixels are tightly packed, and only valid during the call)
+	using RowSink = std::function<void(uint32_t firstRow, uint32_t rowCount, const uint8_t* pixels, uint32_t width)>;
+	void Poster(uint32_t width, uint32_t height, float phase, uint32_t tileWidth, uint32_t tileHeight, RowSink sink);
+}
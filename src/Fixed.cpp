@@ -0,0 +1,431 @@
+#include "Fixed.h"
+#include "Evaluator.h"
+
+#include <cmath>
+
+#include "Metrics.h"
+
+namespace
+{
+	Metrics::Counter evaluatedPixels("pollock_fixed_pixels_total", "Number of pixels evaluated on the CPU in fixed point");
+
+	using Fixed::FRACTION_BITS;
+	constexpr int64_t ONE = Fixed::ONE; // 64 bits, so 2 * ONE does not overflow
+
+	#pragma region Arithmetic
+
+	// Drop the given number of fraction bits, rounding to nearest
+	inline int64_t Round(int64_t v, uint32_t bits)
+	{
+		return (v + (int64_t(1) << (bits - 1U))) >> bits;
+	}
+
+	// Products and quotients of values with the given fraction bits (Q30 by default)
+	inline int64_t Mul(int64_t a, int64_t b, uint32_t bits = FRACTION_BITS) { return Round(a * b, bits); }
+
+	// Quotient rounded to nearest, for a positive denominator
+	inline int64_t DivRound(int64_t num, int64_t den)
+	{
+		return num >= 0 ? (num + den / 2) / den : (num - den / 2) / den;
+	}
+
+	inline int64_t Div(int64_t a, int64_t b, uint32_t bits = FRACTION_BITS)
+	{
+		return DivRound(a * (int64_t(1) << bits), b);
+	}
+
+	// Square root of a product (twice the fraction bits), rounded to nearest
+	// The double square root is only a first guess, corrected with integers, so the result does not depend on the platform
+	inline int64_t Sqrt(int64_t v)
+	{
+		if (v <= 0)
+			return 0;
+		uint64_t u = uint64_t(v);
+		uint64_t r = uint64_t(std::sqrt(double(u)));
+		while (r * r > u)
+			r--;
+		while ((r + 1U) * (r + 1U) <= u)
+			r++;
+		// (r + 0.5)^2 <= u
+		if (r * r + r < u)
+			r++;
+		return int64_t(r);
+	}
+
+	inline int64_t Abs(int64_t v) { return v < 0 ? -v : v; }
+
+	#pragma endregion
+
+	#pragma region Transcendental functions
+
+	// Taylor coefficients in Q30 of sin(pi/2 s) (odd powers) and cos(pi/2 s) (even powers), for s in [0, 1]
+	constexpr int64_t SIN[] = { 1686629713, -693598668, 85569306, -5026995, 172272, -3864, 61, -1 };
+	constexpr int64_t COS[] = { 1073741824, -1324675879, 272375560, -22401992, 987048, -27060, 506, -7 };
+	// 2 / (ln(2) (2k + 1)) in Q30, the series of log2(m) in z = (m - 1) / (m + 1)
+	constexpr int64_t LOG[] = { 3098164009, 1032721336, 619632802, 442594858, 344240445, 281651274, 238320308 };
+	// ln(2)^k / k! in Q30, the series of exp2(f)
+	constexpr int64_t EXP[] = { 1073741824, 744261118, 257941248, 59597083, 10327387, 1431680, 165394, 16377, 1419, 109, 8 };
+	constexpr int64_t SQRT2 = 1518500250; // Q30
+	constexpr int64_t LOG2_10 = 3566893132; // Q30
+
+	template <size_t N>
+	inline int64_t Horner(const int64_t (&c)[N], int64_t x)
+	{
+		int64_t acc = c[N - 1U];
+		for (size_t k = N - 1U; k > 0U; k--)
+			acc = Mul(acc, x, 30U) + c[k - 1U];
+		return acc;
+	}
+
+	// cos(2 pi t) in Q30, with t in turns as Q32 (a whole turn wraps around)
+	inline int64_t CosTurns(uint32_t turns)
+	{
+		uint32_t quadrant = turns >> 30;
+		int64_t s = turns & 0x3FFFFFFFU; // Q30 position in the quadrant
+		int64_t s2 = Mul(s, s, 30U);
+		switch (quadrant)
+		{
+		case 0U: return Horner(COS, s2);
+		case 1U: return -Mul(s, Horner(SIN, s2), 30U);
+		case 2U: return -Horner(COS, s2);
+		default: return Mul(s, Horner(SIN, s2), 30U);
+		}
+	}
+
+	inline int64_t SinTurns(uint32_t turns)
+	{
+		return CosTurns(turns - (1U << 30));
+	}
+
+	// log2 of a positive value with the given fraction bits, in Q32
+	inline int64_t Log2(int64_t v, uint32_t bits)
+	{
+		// Integer part (position of the highest bit, by binary search), then a mantissa m in [sqrt(1/2), sqrt(2)) as Q30
+		int32_t n = 0;
+		for (int32_t step = 32; step > 0; step /= 2)
+			n += (v >> (n + step)) > 0 ? step : 0;
+		int64_t m = n <= 30 ? v << (30 - n) : v >> (n - 30);
+		if (m > SQRT2)
+		{
+			m = (m + 1) >> 1;
+			n++;
+		}
+
+		int64_t z = DivRound((m - (int64_t(1) << 30)) * (int64_t(1) << 30), m + (int64_t(1) << 30));
+		int64_t log = Mul(z, Horner(LOG, Mul(z, z, 30U)), 30U);
+		return int64_t(n - int32_t(bits)) * (int64_t(1) << 32) + log * 4;
+	}
+
+	// 2^p for p in Q32, as a value with the given fraction bits
+	inline int64_t Exp2(int64_t p, uint32_t bits)
+	{
+		int64_t i = p >> 32;
+		int64_t f = (p & 0xFFFFFFFF) >> 2; // Q30 fraction in [0, 1)
+		int64_t e = Horner(EXP, f); // Q30 in [1, 2)
+
+		int64_t shift = i + int64_t(bits) - 30;
+		if (shift >= 0)
+			return shift < 32 ? e << shift : INT32_MAX;
+		if (shift <= -62)
+			return 0;
+		return Round(e, uint32_t(-shift));
+	}
+
+	// base^exponent with 0^e = 0 and b^0 = 1 like pow, for a Q20 exponent (so the product with the Q32 logarithm fits in 64 bits)
+	inline int64_t Pow(int64_t base, uint32_t baseBits, int64_t exponent, uint32_t bits = FRACTION_BITS)
+	{
+		if (exponent == 0)
+			return int64_t(1) << bits;
+		if (base <= 0)
+			return 0;
+		return Exp2(Round(Log2(base, baseBits) * exponent, 20U), bits);
+	}
+
+	#pragma endregion
+
+	#pragma region Function definitions
+
+	// Fixed point versions of the helpers in the generated WGSL code, following the float versions of Evaluator
+	// The constants are the float constants of the shader, which are exact in Q30
+
+	constexpr int64_t EPSILON = 107374; // 0.0001f
+	constexpr int64_t INV_SQRT2 = 759250112; // 0.70710678f
+	constexpr int64_t BELL_OFFSET = 314573; // 0.3 in Q20
+	constexpr int64_t DISTLINE_LOW = 535797184; // 0.499f
+	constexpr int64_t DISTLINE_HIGH = 537944640; // 0.501f
+	constexpr uint32_t DISTLINE_BITS = 20U; // The slope of the line goes up to 318, so its square needs a smaller fraction
+
+	// 1 input
+
+	inline int64_t fInv(int64_t x) { return ONE - x; }
+	inline int64_t fSqr(int64_t x) { return Mul(x, x); }
+	inline int64_t fSqrt(int64_t x) { return Sqrt(x * ONE); }
+
+	inline int64_t fSmooth(int64_t x)
+	{
+		int64_t x2 = Mul(x, x);
+		int64_t x3 = Mul(x2, x);
+		return x2 + x2 + x2 - x3 - x3;
+	}
+
+	inline int64_t fSharp(int64_t x) { return Mul(x, Mul(x, x + x - 3 * ONE) + 2 * ONE); }
+
+	// 2 inputs
+
+	inline int64_t fAdd(int64_t x, int64_t y)
+	{
+		int64_t res = x + y;
+		return res > ONE ? 2 * ONE - res : res;
+	}
+
+	inline int64_t fSub(int64_t x, int64_t y) { return Abs(x - y); }
+	inline int64_t fMul(int64_t x, int64_t y) { return Mul(x, y); }
+
+	inline int64_t fDiv(int64_t x, int64_t y)
+	{
+		int64_t min = x > y ? y : x;
+		int64_t max = x > y ? x : y;
+		if (max < EPSILON)
+			max = EPSILON;
+		return Div(min, max);
+	}
+
+	inline int64_t fAvg(int64_t x, int64_t y) { return (x + y + 1) >> 1; }
+	inline int64_t fGeom(int64_t x, int64_t y) { return Sqrt(x * y); }
+
+	inline int64_t fHarm(int64_t x, int64_t y)
+	{
+		int64_t den = x + y;
+		if (den < EPSILON)
+			den = EPSILON;
+		return DivRound(2 * x * y, den);
+	}
+
+	inline int64_t fHypo(int64_t x, int64_t y) { return Mul(INV_SQRT2, Sqrt(x * x + y * y)); }
+	inline int64_t fMax(int64_t x, int64_t y) { return x > y ? x : y; }
+	inline int64_t fMin(int64_t x, int64_t y) { return x < y ? x : y; }
+
+	inline int64_t fPow(int64_t x, int64_t y)
+	{
+		int64_t exp1 = y + y - ONE;
+		int64_t exp2 = Exp2(Round(exp1 * LOG2_10, 28U), 20U); // 10^exp1 as Q20
+		return Pow(x, FRACTION_BITS, exp2);
+	}
+
+	// The base keeps the full precision of its product, since the exponent (up to 20.3) amplifies its rounding error
+	inline int64_t fBell(int64_t x, int64_t y)
+	{
+		int64_t y2 = Mul(y, y);
+		return Pow(4 * x * (ONE - x), 2U * FRACTION_BITS, 20 * Round(Mul(y2, y2), 10U) + BELL_OFFSET);
+	}
+
+	// The frequencies are whole turns: 6 pi x y is 3 x y turns, as Q32
+	inline int64_t fWave(int64_t x, int64_t y)
+	{
+		uint32_t turns = uint32_t(Round(3 * x * y, 28U));
+		return ONE / 2 + Round(CosTurns(turns), 1U);
+	}
+
+	// 3 pi x (y + 0.5) is 3/4 x (2 y + 1) turns
+	inline int64_t fBounce(int64_t x, int64_t y)
+	{
+		uint32_t turns = uint32_t(Round(x * (2 * y + ONE), 28U) * 3 / 4);
+		return Abs(Mul(CosTurns(turns), Exp2(-3 * x * 4, FRACTION_BITS)));
+	}
+
+	// 3 inputs
+
+	inline int64_t fLerp(int64_t x, int64_t y, int64_t z) { return Mul(ONE - z, x) + Mul(z, y); }
+
+	// xMin (y / xMin)^z, as xMin^(1 - z) y^z so the ratio cannot overflow
+	inline int64_t fMlerp(int64_t x, int64_t y, int64_t z)
+	{
+		int64_t xMin = x < EPSILON ? EPSILON : x;
+		if (z == 0)
+			return xMin;
+		if (y <= 0)
+			return 0;
+		int64_t z20 = Round(z, 10U);
+		return Exp2(Round(((int64_t(1) << 20) - z20) * Log2(xMin, FRACTION_BITS) + z20 * Log2(y, FRACTION_BITS), 20U), FRACTION_BITS);
+	}
+
+	inline int64_t fClamp(int64_t x, int64_t y, int64_t z)
+	{
+		int64_t min = x > y ? y : x;
+		int64_t max = x > y ? x : y;
+		if (z < min)
+			return min;
+		else if (z > max)
+			return max;
+		return z;
+	}
+
+	// 4 inputs
+
+	inline int64_t fDist(int64_t x, int64_t y, int64_t z, int64_t w)
+	{
+		int64_t dx = x - z;
+		int64_t dy = y - w;
+		return Mul(INV_SQRT2, Sqrt(dx * dx + dy * dy));
+	}
+
+	inline int64_t fDistLine(int64_t x, int64_t y, int64_t z, int64_t w)
+	{
+		if (z < DISTLINE_LOW || z > DISTLINE_HIGH)
+		{
+			constexpr uint32_t B = DISTLINE_BITS;
+			constexpr int64_t one = int64_t(1) << B;
+
+			// tan(pi z), from the sine and cosine of z / 2 turns
+			uint32_t turns = uint32_t(z << (31U - FRACTION_BITS));
+			int64_t m = DivRound(SinTurns(turns) << B, CosTurns(turns));
+			x = Round(x, FRACTION_BITS - B);
+			y = Round(y, FRACTION_BITS - B);
+			w = Round(w, FRACTION_BITS - B);
+
+			int64_t n = z < DISTLINE_LOW ? Mul(one - w, one + m, B) - m : w - Mul(m, w, B);
+			int64_t c = Div(x + Mul(y, m, B) - Mul(m, n, B), Mul(m, m, B) + one, B);
+			int64_t dx = c - x;
+			int64_t dy = Mul(m, c, B) + n - y;
+			return Mul(INV_SQRT2, Sqrt(dx * dx + dy * dy) << (FRACTION_BITS - B));
+		}
+		return Mul(INV_SQRT2, Abs(w - x));
+	}
+
+	#pragma endregion
+
+	using Fixed::Value;
+
+	// Run a helper over a whole batch, like Evaluator
+	template <typename F>
+	inline void Apply(Value* d, const Value* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = Value(f(s[0][i]));
+	}
+	template <typename F>
+	inline void Apply2(Value* d, const Value* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = Value(f(s[0][i], s[1][i]));
+	}
+	template <typename F>
+	inline void Apply3(Value* d, const Value* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = Value(f(s[0][i], s[1][i], s[2][i]));
+	}
+	template <typename F>
+	inline void Apply4(Value* d, const Value* const* s, uint32_t count, F f)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = Value(f(s[0][i], s[1][i], s[2][i], s[3][i]));
+	}
+
+	inline void Fill(Value* d, Value value, uint32_t count)
+	{
+		for (uint32_t i = 0U; i < count; i++)
+			d[i] = value;
+	}
+
+	void EvaluateInstruction(const Instruction& instruction, const Value* const* s, const Value* x, const Value* y, Value sinTime, Value cosTime, uint32_t count, Value* d)
+	{
+		switch (instruction.op)
+		{
+		case Op::X:			for (uint32_t i = 0U; i < count; i++) d[i] = x[i]; break;
+		case Op::Y:			for (uint32_t i = 0U; i < count; i++) d[i] = y[i]; break;
+		case Op::InvX:		for (uint32_t i = 0U; i < count; i++) d[i] = ONE - x[i]; break;
+		case Op::InvY:		for (uint32_t i = 0U; i < count; i++) d[i] = ONE - y[i]; break;
+		case Op::SinTime:	Fill(d, sinTime, count); break;
+		case Op::CosTime:	Fill(d, cosTime, count); break;
+		case Op::Const:		Fill(d, Fixed::FromFloat(instruction.value), count); break;
+
+		case Op::Inv:		Apply(d, s, count, fInv); break;
+		case Op::Sqr:		Apply(d, s, count, fSqr); break;
+		case Op::Sqrt:		Apply(d, s, count, fSqrt); break;
+		case Op::Smooth:	Apply(d, s, count, fSmooth); break;
+		case Op::Sharp:		Apply(d, s, count, fSharp); break;
+
+		case Op::Add:		Apply2(d, s, count, fAdd); break;
+		case Op::Sub:		Apply2(d, s, count, fSub); break;
+		case Op::Mul:		Apply2(d, s, count, fMul); break;
+		case Op::Div:		Apply2(d, s, count, fDiv); break;
+		case Op::Avg:		Apply2(d, s, count, fAvg); break;
+		case Op::Geom:		Apply2(d, s, count, fGeom); break;
+		case Op::Harm:		Apply2(d, s, count, fHarm); break;
+		case Op::Hypo:		Apply2(d, s, count, fHypo); break;
+		case Op::Max:		Apply2(d, s, count, fMax); break;
+		case Op::Min:		Apply2(d, s, count, fMin); break;
+		case Op::Pow:		Apply2(d, s, count, fPow); break;
+		case Op::Bell:		Apply2(d, s, count, fBell); break;
+		case Op::Wave:		Apply2(d, s, count, fWave); break;
+		case Op::Bounce:	Apply2(d, s, count, fBounce); break;
+
+		case Op::Lerp:		Apply3(d, s, count, fLerp); break;
+		case Op::Mlerp:		Apply3(d, s, count, fMlerp); break;
+		case Op::Clamp:		Apply3(d, s, count, fClamp); break;
+
+		case Op::Dist:		Apply4(d, s, count, fDist); break;
+		case Op::DistLine:	Apply4(d, s, count, fDistLine); break;
+
+		default: break;
+		}
+	}
+}
+
+Fixed::Value Fixed::FromFloat(float value)
+{
+	// Scaling by a power of two is exact, and so is the rounding
+	return Value(std::lround(double(value) * ONE));
+}
+
+float Fixed::ToFloat(Value value)
+{
+	return float(value) / float(ONE);
+}
+
+uint8_t Fixed::ToUnorm8(Value value)
+{
+	value = value >= 0 ? value : 0;
+	value = value <= ONE ? value : ONE;
+	return uint8_t((int64_t(value) * 255 + ONE / 2) >> FRACTION_BITS);
+}
+
+Fixed::Value Fixed::PixelCenter(uint32_t index, uint32_t size)
+{
+	return Value(DivRound((2 * int64_t(index) + 1) * ONE, 2 * int64_t(size)));
+}
+
+void Fixed::PhaseInputs(float phase, Value& sinTime, Value& cosTime)
+{
+	// The phase is a fraction of a turn, exactly converted to Q32
+	uint32_t turns = uint32_t(int64_t(double(phase) * 4294967296.0));
+	sinTime = Value(ONE / 2 + Round(SinTurns(turns), 1U));
+	cosTime = Value(ONE / 2 + Round(CosTurns(turns), 1U));
+}
+
+void Fixed::EvaluateBatch(const Program& program, const Value* x, const Value* y, Value sinTime, Value cosTime, uint32_t count, Value* r, Value* g, Value* b, std::vector<Value>& scratch)
+{
+	constexpr uint32_t B = Evaluator::BATCH_SIZE;
+	evaluatedPixels.Add(count);
+
+	// Same registers as the float evaluator (see ScheduleProgram)
+	scratch.resize(size_t(program.registerCount) * B);
+
+	for (const Instruction& instruction : program.code)
+	{
+		const Value* args[4];
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+			args[a] = scratch.data() + size_t(instruction.src[a]) * B;
+
+		EvaluateInstruction(instruction, args, x, y, sinTime, cosTime, count, scratch.data() + size_t(instruction.dst) * B);
+	}
+
+	Value* outputs[3] = { r, g, b };
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		const Value* src = scratch.data() + size_t(program.code[program.outputs[c]].dst) * B;
+		for (uint32_t i = 0U; i < count; i++)
+			outputs[c][i] = src[i];
+	}
+}
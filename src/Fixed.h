@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Program.h"
+
+/*
+	Deterministic counterpart of Evaluator, in fixed point.
+
+	The float evaluator calls sqrt, pow, cos, exp2 and tan from the C library, whose results differ across libms and instruction sets,
+	so two machines can render different pixels for the same program. This evaluator only uses integer arithmetic:
+	values are Q2.30 numbers in int32 lanes (a resolution of 1e-9, so rounding errors stay small even through long chains of ops),
+	and the helpers that need more range work in Q32 and Q20 with int64 intermediates. Transcendental functions are fixed polynomials
+	with integer coefficients (sin and cos of quarter turns, log2 and exp2 for pow), and square roots are exact integer roots.
+	Every machine produces bit-identical pixels, so frames can be cached by content hash across heterogeneous workers.
+
+	Error versus the float evaluator, over random arguments in [0, 1] (in units of the output step, 1/255):
+	- Inv, Sqr, Sqrt, Sharp, Add, Sub, Mul, Div, Avg, Geom, Harm, Hypo, Max, Min, Lerp, Clamp, Dist: < 4e-5 (the float rounding)
+	- Smooth, Bounce, Wave: < 3e-4 (exact turns instead of the rounded 2 pi of the shader)
+	- Pow, Mlerp: < 1e-3, Bell: < 4e-3
+	- DistLine: < 0.01, except for the angles that round to the other side of the 0.499 and 0.501 thresholds
+	Over whole frames of 200 seeds, 0.15% of the channels differ from the float renderer, by 1 step for 79% of them
+	(the others are pixels where the program itself is ill-conditioned, like a pow of a value near 0).
+*/
+namespace Fixed
+{
+	using Value = int32_t;
+	constexpr uint32_t FRACTION_BITS = 30U;
+	constexpr Value ONE = Value(1) << FRACTION_BITS;
+
+	// Nearest fixed point value (only exact operations, so the same float always gives the same value)
+	Value FromFloat(float value);
+	float ToFloat(Value value);
+	// Same conversion as Renderer for a unorm8 render target
+	uint8_t ToUnorm8(Value value);
+
+	// Normalized coordinate of the center of the given pixel, (index + 0.5) / size
+	Value PixelCenter(uint32_t index, uint32_t size);
+	// Time inputs of the given phase, like Renderer::PhaseInputs but without the C library
+	void PhaseInputs(float phase, Value& sinTime, Value& cosTime);
+
+	// Evaluate the program over count pixels (at most Evaluator::BATCH_SIZE), like Evaluator::EvaluateBatch
+	// Programs with Op::Cached instructions are not supported, the time stage of a split program needs float cached values
+	// Neither are polynomial surrogates (see Surrogates.h), whose Horner steps go far outside the range of Q2.30
+	void EvaluateBatch(const Program& program, const Value* x, const Value* y, Value sinTime, Value cosTime, uint32_t count, Value* r, Value* g, Value* b, std::vector<Value>& scratch);
+}
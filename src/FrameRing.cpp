@@ -0,0 +1,211 @@
+#include "FrameRing.h"
+#include "Metrics.h"
+
+#include <new>
+#include <ctime>
+#include <thread>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+	Metrics::Counter publishedFrames("pollock_ring_frames_total", "Number of frames published to shared memory rings");
+	Metrics::Counter droppedFrames("pollock_ring_dropped_frames_total", "Number of frames dropped because the consumer fell behind");
+
+	constexpr uint32_t MAGIC = 0x504F4C4CU; // "POLL"
+	constexpr uint32_t VERSION = 1U;
+
+	// Policy::Block gives up after this long, so a consumer that died can not stall the producer forever
+	constexpr auto BLOCK_TIMEOUT = std::chrono::seconds(1);
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "FrameRing requires lock-free 64-bit atomics to share them between processes");
+
+	constexpr size_t AlignUp(size_t size) { return (size + 63U) & ~size_t(63U); }
+}
+
+struct FrameRing::Header
+{
+	std::atomic<uint32_t> magic; // Written last by the producer, once the rest of the header is valid
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t slotCount;
+	uint64_t slotStride;
+
+	// Each index is only written by one side, and lives on its own cache line
+	alignas(64) std::atomic<uint64_t> written; // Number of frames published by the producer
+	alignas(64) std::atomic<uint64_t> read; // Number of frames released by the consumer
+	alignas(64) std::atomic<uint64_t> dropped;
+};
+
+struct alignas(64) FrameRing::SlotHeader
+{
+	FrameInfo info;
+};
+
+FrameRing::~FrameRing()
+{
+	if (m_Memory)
+		munmap(m_Memory, m_Size);
+	if (m_Owner)
+		shm_unlink(m_Name.c_str());
+}
+
+bool FrameRing::Create(const char* name, uint32_t width, uint32_t height, uint32_t slotCount)
+{
+	if (slotCount == 0U)
+		return false;
+
+	// A new object, so consumers that still map the previous ring keep it instead of seeing it truncated
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+		return false;
+
+	size_t slotStride = AlignUp(sizeof(SlotHeader) + size_t(width) * height * 4U);
+	size_t size = AlignUp(sizeof(Header)) + slotStride * slotCount;
+	if (ftruncate(fd, off_t(size)) != 0 || !Map(fd, size))
+	{
+		close(fd);
+		shm_unlink(name);
+		return false;
+	}
+	close(fd);
+
+	m_Name = name;
+	m_Owner = true;
+
+	m_Header = new (m_Memory) Header();
+	m_Header->version = VERSION;
+	m_Header->width = width;
+	m_Header->height = height;
+	m_Header->slotCount = slotCount;
+	m_Header->slotStride = slotStride;
+	m_Header->magic.store(MAGIC, std::memory_order_release);
+	return true;
+}
+
+bool FrameRing::Open(const char* name)
+{
+	int fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return false;
+
+	struct stat info;
+	bool mapped = fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header) && Map(fd, size_t(info.st_size));
+	close(fd);
+	if (!mapped)
+		return false;
+
+	m_Name = name;
+	m_Header = static_cast<Header*>(m_Memory);
+
+	// Reject rings from other versions, or whose producer has not finished creating them, or whose slots do not fit the object
+	const size_t headerSize = AlignUp(sizeof(Header));
+	if (m_Header->magic.load(std::memory_order_acquire) != MAGIC || m_Header->version != VERSION
+		|| m_Header->slotCount == 0U || headerSize > m_Size || m_Header->slotStride > (m_Size - headerSize) / m_Header->slotCount)
+	{
+		m_Header = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool FrameRing::Map(int fd, size_t size)
+{
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (memory == MAP_FAILED)
+		return false;
+
+	m_Memory = memory;
+	m_Size = size;
+	return true;
+}
+
+FrameRing::SlotHeader* FrameRing::Slot(uint64_t index) const
+{
+	uint8_t* slots = static_cast<uint8_t*>(m_Memory) + AlignUp(sizeof(Header));
+	return reinterpret_cast<SlotHeader*>(slots + (index % m_Header->slotCount) * m_Header->slotStride);
+}
+
+#pragma region Producer
+
+uint8_t* FrameRing::BeginWrite(Policy policy)
+{
+	uint64_t written = m_Header->written.load(std::memory_order_relaxed);
+
+	// The ring is full while the consumer still holds every slot
+	auto start = std::chrono::steady_clock::now();
+	while (written - m_Header->read.load(std::memory_order_acquire) >= m_Header->slotCount)
+	{
+		if (policy == Policy::Drop || std::chrono::steady_clock::now() - start > BLOCK_TIMEOUT)
+			return nullptr;
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+	}
+
+	m_Pending = written;
+	return reinterpret_cast<uint8_t*>(Slot(written) + 1);
+}
+
+void FrameRing::EndWrite(const FrameInfo& info)
+{
+	Slot(m_Pending)->info = info;
+	m_Header->written.store(m_Pending + 1ULL, std::memory_order_release);
+	publishedFrames.Add();
+}
+
+void FrameRing::Drop()
+{
+	m_Header->dropped.fetch_add(1ULL, std::memory_order_relaxed);
+	droppedFrames.Add();
+}
+
+#pragma endregion
+
+#pragma region Consumer
+
+const uint8_t* FrameRing::BeginRead(FrameInfo& info)
+{
+	uint64_t read = m_Header->read.load(std::memory_order_relaxed);
+	if (read == m_Header->written.load(std::memory_order_acquire))
+		return nullptr;
+
+	m_Pending = read;
+	info = Slot(read)->info;
+	return reinterpret_cast<const uint8_t*>(Slot(read) + 1);
+}
+
+const uint8_t* FrameRing::BeginReadLatest(FrameInfo& info)
+{
+	uint64_t written = m_Header->written.load(std::memory_order_acquire);
+	uint64_t read = m_Header->read.load(std::memory_order_relaxed);
+	if (read == written)
+		return nullptr;
+
+	// Release every frame older than the newest one at once
+	if (written - read > 1ULL)
+		m_Header->read.store(written - 1ULL, std::memory_order_release);
+	return BeginRead(info);
+}
+
+void FrameRing::EndRead()
+{
+	m_Header->read.store(m_Pending + 1ULL, std::memory_order_release);
+}
+
+#pragma endregion
+
+uint32_t FrameRing::Width() const { return m_Header->width; }
+uint32_t FrameRing::Height() const { return m_Header->height; }
+uint64_t FrameRing::DroppedFrames() const { return m_Header->dropped.load(std::memory_order_relaxed); }
+
+uint64_t FrameRing::Now()
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return uint64_t(now.tv_sec) * 1000000000ULL + uint64_t(now.tv_nsec);
+}
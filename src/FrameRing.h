@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+/*
+	Ring of RGBA8 frames in POSIX shared memory, to hand rendered frames to a compositor on the same host without copies.
+
+	There is exactly one producer and one consumer. Each side only writes its own index,
+	so publishing and releasing a frame is a single atomic store, and neither side ever locks.
+	The producer renders straight into the next free slot, and the consumer reads frames in place.
+
+	When the consumer falls behind and every slot is still unread, the producer either waits for a slot
+	(Policy::Block) or skips the frame and counts it as dropped (Policy::Drop), so a slow mixer never stalls a live stream.
+*/
+class FrameRing
+{
+public:
+	enum class Policy { Block, Drop };
+
+	// Metadata published along with each frame
+	struct FrameInfo
+	{
+		uint64_t number; // Position in the stream, counting dropped frames
+		uint64_t seed;
+		float phase; // Phase of the animation loop, in [0, 1)
+		uint64_t timestamp; // CLOCK_MONOTONIC in nanoseconds, shared by all processes of the host
+	};
+
+	FrameRing() = default;
+	~FrameRing();
+
+	FrameRing(const FrameRing&) = delete;
+	FrameRing& operator=(const FrameRing&) = delete;
+
+	// Producer side: create (or replace) the shared memory object, e.g. "/pollock"
+	bool Create(const char* name, uint32_t width, uint32_t height, uint32_t slotCount);
+	// Consumer side: map an existing ring
+	bool Open(const char* name);
+
+	// Pixels of the next free slot, or null if the frame has to be dropped
+	uint8_t* BeginWrite(Policy policy);
+	// Publish the slot returned by BeginWrite
+	void EndWrite(const FrameInfo& info);
+	// Count a frame that was not written because BeginWrite returned null
+	void Drop();
+
+	// Pixels of the oldest unread frame (valid until EndRead), or null if there is none
+	const uint8_t* BeginRead(FrameInfo& info);
+	// Skip to the newest frame, dropping the older unread ones (for consumers that only care about latency)
+	const uint8_t* BeginReadLatest(FrameInfo& info);
+	// Give the slot returned by BeginRead back to the producer
+	void EndRead();
+
+	uint32_t Width() const;
+	uint32_t Height() const;
+	uint64_t DroppedFrames() const;
+
+	// Current CLOCK_MONOTONIC time, for FrameInfo::timestamp
+	static uint64_t Now();
+
+private:
+	struct Header;
+	struct SlotHeader;
+
+	bool Map(int fd, size_t size);
+	SlotHeader* Slot(uint64_t index) const;
+
+	std::string m_Name;
+	bool m_Owner = false;
+	void* m_Memory = nullptr;
+	size_t m_Size = 0;
+	Header* m_Header = nullptr;
+	uint64_t m_Pending = 0ULL; // Index of the slot between Begin and End
+};
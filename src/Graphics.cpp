@@ -1,37 +1,272 @@
 #include "Graphics.h"
-
+#include "GraphicsState.h"
+#include "CanvasView.h"
+#include "WallPanel.h"
+#include "Metrics.h"
+#include "Timeline.h"
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <algorithm>
+#include <unordered_map>
 
 #include <webgpu/webgpu_cpp.h>
 #include <emscripten/emscripten.h>
 #include <emscripten/html5.h>
 
-namespace
-{
-	const char* m_ShaderCode;
-	double m_LastUpdate = 0.0f;
+#include "RandFS.h"
+
+// Uncomment the line below to request the fallback (software) adapter, e.g. to test the export on a machine without a GPU
+//#define SOFTWARE_ADAPTER
 
+namespace GraphicsState
+{
 	// WebGPU core objects
 	wgpu::Instance m_Instance;
-	wgpu::Adapter m_Adapter;
 	wgpu::Device m_Device;
 
 	// Reference to the surface of the canvas
 	wgpu::Surface m_Surface;
 
+	wgpu::TextureFormat m_Format;
+
+	// Set once the code of the first program has been given (see SetShaderCode and SetProgram)
+	bool m_ShaderReady = false;
+
+	// Compiled as soon as both the device and the shader code are available
+	wgpu::ShaderModule m_ShaderModule;
+
+	// Constants of the current program, when they are not baked in the code (see SetProgram)
+	ConstantMode m_ConstantMode = ConstantMode::Baked;
+	std::vector<float> m_Constants;
+
 	// Objects to interact with the shader
 	wgpu::Buffer m_Buffer;
-	wgpu::BindGroup m_BindGroup;
+	wgpu::Buffer m_ConstantBuffer;
 
 	// Pipeline representation that holds the shader
 	wgpu::RenderPipeline m_Pipeline;
+	bool m_PipelinePending = false;
+
+	// Space stage of a split program (see SetProgram)
+	bool m_Split = false;
+	wgpu::ComputePipeline m_CachePipeline;
+	bool m_CachePipelinePending = false;
+
+	// Frame loop metrics
+	Metrics::Counter m_Frames("pollock_gpu_frames_total", "Number of frames submitted to the GPU");
+	Metrics::Histogram m_FrameTime("pollock_gpu_frame_cpu_seconds", "CPU time spent recording and submitting a frame");
+}
+
+using namespace GraphicsState;
+
+namespace
+{
+	std::string m_ShaderCode;
+	double m_LastUpdate = 0.0;
+	bool m_FirstFrame = true;
+	bool m_MainLoop = false;
+
+	uint64_t m_StructureHash = 0ULL;
+
+	wgpu::Adapter m_Adapter;
+
+	// Modules without baked constants, by structure hash, shared by every program of the same structure
+	std::unordered_map<uint64_t, wgpu::ShaderModule> m_ModuleCache;
+
+	wgpu::Buffer m_FullRegion; // Region of the uv space that covers a whole image (read by the cache compute shader)
+	wgpu::BindGroup m_BindGroup;
+
+	// Layout of the canvas pipeline, and the structure it was created for (with uniform constants)
+	wgpu::BindGroupLayout m_BindGroupLayout;
+	uint64_t m_PipelineStructure = 0ULL;
+
+	// Latest pipeline request, passed to the callbacks: the pipelines of older requests do not match the current bind groups
+	uint32_t m_PipelineRequest = 0U;
+
+	// Space stage of a split program, evaluated by a compute pass into a texture array with one layer per slot
+	// The frames only evaluate the time stage, which reads the layers at the position of its pixel
+	constexpr uint32_t MAX_CACHE_SLOTS = 16U; // Each layer takes 4 bytes per pixel
+	std::string m_CacheCode;
+	uint64_t m_CacheStructureHash = 0ULL;
+	std::vector<float> m_CacheConstants;
+	uint32_t m_CacheSlots = 0U;
+	wgpu::Buffer m_CacheConstantBuffer;
+	wgpu::BindGroupLayout m_CacheBindGroupLayout;
+
+	// Recreated when the canvas changes size, and filled again by the next frame
+	wgpu::Texture m_CacheTexture;
+	wgpu::BindGroup m_CacheBindGroup;
+	uint32_t m_CacheWidth = 0U, m_CacheHeight = 0U;
+	bool m_CacheValid = false;
+
+	// State of BenchmarkConstantModes
+	struct Benchmark
+	{
+		Program program;
+		std::vector<float> constants;
+		uint32_t variants = 0U;
+		uint32_t step = 0U; // Variant index plus mode index times variants
+		double start = 0.0;
+		std::vector<double> times[3]; // Milliseconds from SetProgram until the new program can be drawn, for each mode
+		size_t codeSize[3] = {};
+		uint32_t runs = 0U; // Salt of the constants, so the browser cannot reuse modules of a previous run
+		bool running = false;
+	};
+	Benchmark m_Benchmark;
+
+	// Vertex module of the region pipelines (wall, view and exports), created with the first of them
+	wgpu::ShaderModule m_RegionModule;
+
+	void BenchmarkStep();
+	void BenchmarkNext()
+	{
+		if (m_Benchmark.step > 0U)
+			m_Benchmark.times[(m_Benchmark.step - 1U) / m_Benchmark.variants].push_back(emscripten_get_now() - m_Benchmark.start);
+
+		// Let the browser run between two steps
+		emscripten_async_call([](void*) { BenchmarkStep(); }, nullptr, 0);
+	}
+
+	// Write constants of the current program to a constant buffer, as an array of vec4f
+	void WriteConstants(const wgpu::Buffer& buffer, const std::vector<float>& constants)
+	{
+		std::vector<float> data((constants.size() + 3U) / 4U * 4U, 0.0f);
+		std::copy(constants.begin(), constants.end(), data.begin());
+		if (!data.empty())
+			m_Device.GetQueue().WriteBuffer(buffer, 0, data.data(), data.size() * sizeof(float));
+	}
+
+	// Bind the uniforms of the fragment shader, and the cache of a split program
+	void CreateBindGroup(const wgpu::TextureView& cacheView)
+	{
+		bool uniform = m_ConstantMode == ConstantMode::Uniform && !m_Constants.empty();
+		std::vector<wgpu::BindGroupEntry> entries =
+		{
+			{
+				.binding	= 0,
+				.buffer		= m_Buffer,				// Buffer object
+				.offset		= 0,
+				.size		= 4 * sizeof(float)		// Uniform buffer size
+			}
+		};
+		if (uniform)
+		{
+			entries.push_back({ .binding = 1, .buffer = m_ConstantBuffer, .offset = 0, .size = (m_Constants.size() + 3U) / 4U * 4U * sizeof(float) });
+		}
+		if (m_Split)
+		{
+			entries.push_back({ .binding = 2, .textureView = cacheView });
+		}
+		if (WallPanel::Active())
+		{
+			entries.push_back({ .binding = 3, .buffer = WallPanel::RegionBuffer(), .offset = 0, .size = 4 * sizeof(float) });
+		}
+
+		wgpu::BindGroupDescriptor bgd =
+		{
+			.layout = m_BindGroupLayout,
+			.entryCount = entries.size(),
+			.entries = entries.data()
+		};
+		m_BindGroup = m_Device.CreateBindGroup(&bgd);
+	}
+
+	// Create the cache of a split program for the given canvas size (and the region of the wall), and bind it to both pipelines
+	void CreateCache(uint32_t width, uint32_t height)
+	{
+		if (m_CacheTexture)
+			m_CacheTexture.Destroy();
+
+		m_CacheTexture = CreateCacheTexture(width, height);
+		wgpu::TextureView view = CreateCacheView(m_CacheTexture);
+		m_CacheBindGroup = CreateCacheBindGroup(view, WallPanel::Active() ? WallPanel::RegionBuffer() : m_FullRegion, 0);
+		CreateBindGroup(view);
+
+		m_CacheWidth = width;
+		m_CacheHeight = height;
+		m_CacheValid = false;
+	}
+
+	// Frame loop metrics
+	Metrics::Histogram m_FrameInterval("pollock_gpu_frame_interval_seconds", "Time between two consecutive frames");
 }
 
-void Graphics::Initialize(const char* shaderCode)
+std::vector<wgpu::ConstantEntry> GraphicsState::OverrideConstants(const std::vector<float>& constants, std::vector<std::string>& keys)
 {
-	// Store shader code
-	m_ShaderCode = shaderCode;
+	std::vector<wgpu::ConstantEntry> entries;
+	if (m_ConstantMode != ConstantMode::Override)
+		return entries;
 
+	keys.reserve(constants.size());
+	for (size_t i = 0; i < constants.size(); i++)
+	{
+		keys.push_back('c' + std::to_string(i));
+		entries.push_back(wgpu::ConstantEntry{ .key = keys.back().c_str(), .value = constants[i] });
+	}
+	return entries;
+}
+
+wgpu::Texture GraphicsState::CreateCacheTexture(uint32_t width, uint32_t height)
+{
+	wgpu::TextureDescriptor td =
+	{
+		.usage		= wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::TextureBinding,
+		.dimension	= wgpu::TextureDimension::e2D,
+		.size		= { width, height, m_CacheSlots },
+		.format		= wgpu::TextureFormat::R32Float
+	};
+	return m_Device.CreateTexture(&td);
+}
+
+wgpu::TextureView GraphicsState::CreateCacheView(const wgpu::Texture& texture)
+{
+	// Always an array, even with a single slot
+	wgpu::TextureViewDescriptor tvd{ .dimension = wgpu::TextureViewDimension::e2DArray };
+	return texture.CreateView(&tvd);
+}
+
+wgpu::BindGroup GraphicsState::CreateCacheBindGroup(const wgpu::TextureView& view, const wgpu::Buffer& region, uint64_t regionOffset)
+{
+	bool uniform = m_ConstantMode == ConstantMode::Uniform && !m_CacheConstants.empty();
+	std::vector<wgpu::BindGroupEntry> entries =
+	{
+		{ .binding = 2, .textureView = view },
+		{ .binding = 3, .buffer = region, .offset = regionOffset, .size = 4 * sizeof(float) }
+	};
+	if (uniform)
+	{
+		entries.push_back({ .binding = 1, .buffer = m_CacheConstantBuffer, .offset = 0, .size = (m_CacheConstants.size() + 3U) / 4U * 4U * sizeof(float) });
+	}
+
+	wgpu::BindGroupDescriptor bgd =
+	{
+		.layout = m_CacheBindGroupLayout,
+		.entryCount = entries.size(),
+		.entries = entries.data()
+	};
+	return m_Device.CreateBindGroup(&bgd);
+}
+
+const wgpu::ShaderModule& GraphicsState::RegionModule()
+{
+	// The vertex shader does not depend on the program, so its module is shared by every region pipeline
+	if (!m_RegionModule)
+	{
+		std::string code = EmitRegionVertexShaderCode();
+		wgpu::ShaderModuleWGSLDescriptor wgsld{};
+		wgsld.code = code.c_str();
+		wgpu::ShaderModuleDescriptor shaderModuleDescriptor{ .nextInChain = &wgsld };
+		m_RegionModule = m_Device.CreateShaderModule(&shaderModuleDescriptor);
+	}
+	return m_RegionModule;
+}
+
+void Graphics::Initialize()
+{
 	// Check if the browser has WebGPU enabled
 	int wgpuSupported = emscripten_run_script_int("navigator.gpu ? 1 : 0");
 	if (!wgpuSupported)
@@ -41,18 +276,84 @@ void Graphics::Initialize(const char* shaderCode)
 	}
 
 	// This is the first function call in a sequence of async function calls to setup the WebGPU environment
+	// The browser resolves them in the background, while the shader is still being generated
 	GetInstance();
 }
+void Graphics::SetShaderCode(std::string shaderCode)
+{
+	CanvasView::Reset();
+	m_ShaderCode = std::move(shaderCode);
+	m_ConstantMode = ConstantMode::Baked;
+	m_Split = false;
+	m_ShaderReady = true;
+
+	// If the device arrived first, finish the setup now, otherwise GetDevice will
+	if (m_Device)
+		SetupPipeline();
+}
+void Graphics::SetProgram(const Program& program, ConstantMode mode, bool cacheSpace)
+{
+	// The split only depends on the structure, so programs of the same structure get stages of the same structure
+	Program space, time;
+	bool split = cacheSpace && SplitProgram(program, MAX_CACHE_SLOTS, space, time);
+	const Program& shown = split ? time : program;
+	CanvasView::Reset();
+
+	uint64_t structure = StructureHash(shown);
+	m_Constants = ProgramConstants(shown);
+	m_CacheConstants = split ? ProgramConstants(space) : std::vector<float>();
+
+	// Same structure as the current pipeline with uniform constants: only the constants change (and the cache is filled again)
+	if (mode == ConstantMode::Uniform && m_ConstantMode == ConstantMode::Uniform && m_Pipeline && !m_PipelinePending && m_PipelineStructure == structure)
+	{
+		WriteConstants(m_ConstantBuffer, m_Constants);
+		if (split)
+		{
+			WriteConstants(m_CacheConstantBuffer, m_CacheConstants);
+			m_CacheValid = false;
+		}
+		if (m_Benchmark.running)
+			BenchmarkNext();
+		return;
+	}
+
+	// The code is only needed when the module is not cached yet
+	bool cached = mode != ConstantMode::Baked && m_ModuleCache.count(structure);
+	m_ShaderCode = cached ? std::string() : EmitShaderCode(shown, mode);
+	m_ConstantMode = mode;
+	m_StructureHash = structure;
+	m_Split = split;
+	if (split)
+	{
+		m_CacheStructureHash = StructureHash(space);
+		m_CacheSlots = uint32_t(space.stores.size());
+		bool cacheCached = mode != ConstantMode::Baked && m_ModuleCache.count(m_CacheStructureHash);
+		m_CacheCode = cacheCached ? std::string() : EmitCacheShaderCode(space, mode);
+	}
+	m_ShaderReady = true;
+
+	if (m_Device)
+		SetupPipeline();
+}
 void Graphics::GetInstance()
 {
 	// Get instance
+	Timeline::Begin("GetInstance");
 	m_Instance = wgpu::CreateInstance();
+	Timeline::End("GetInstance");
 
 	// Call the next async setup function
-	m_Instance.RequestAdapter(nullptr, GetAdapter, nullptr);
+	wgpu::RequestAdapterOptions adapterOptions{};
+#ifdef SOFTWARE_ADAPTER
+	adapterOptions.forceFallbackAdapter = true;
+#endif
+	Timeline::Begin("RequestAdapter");
+	m_Instance.RequestAdapter(&adapterOptions, GetAdapter, nullptr);
 }
 void Graphics::GetAdapter(WGPURequestAdapterStatus status, WGPUAdapter cAdapter, const char* message, void* userdata)
 {
+	Timeline::End("RequestAdapter");
+
 	// Check if the adapter request was successful(if it wasn't, most likely the browser does not support WebGPU)
 	if (status != WGPURequestAdapterStatus_Success)
 	{
@@ -63,10 +364,13 @@ void Graphics::GetAdapter(WGPURequestAdapterStatus status, WGPUAdapter cAdapter,
 	// Get adapter
 	m_Adapter = wgpu::Adapter::Acquire(cAdapter);
 	// Call the next async setup function
+	Timeline::Begin("RequestDevice");
 	m_Adapter.RequestDevice(nullptr, GetDevice, nullptr);
 }
 void Graphics::GetDevice(WGPURequestDeviceStatus status, WGPUDevice cDevice, const char* message, void* userdata)
 {
+	Timeline::End("RequestDevice");
+
 	// Get device
 	m_Device = wgpu::Device::Acquire(cDevice);
 	m_Device.SetUncapturedErrorCallback
@@ -75,13 +379,45 @@ void Graphics::GetDevice(WGPURequestDeviceStatus status, WGPUDevice cDevice, con
 		nullptr
 	);
 	
-	// Setup the rest of the graphics pipeline
-	SetupPipeline();
+	// Setup the rest of the graphics pipeline, if the shader code is ready (otherwise SetShaderCode will)
+	if (m_ShaderReady)
+		SetupPipeline();
 }
 void Graphics::SetupPipeline()
 {
+	m_PipelineRequest++;
+	m_PipelinePending = true;
+	m_CachePipelinePending = m_Split;
+
+	// Start compiling the shader before anything else, so the browser can work on it while the rest is set up
+	// Programs of a known structure reuse the module compiled for the first one
+	bool baked = m_ConstantMode == ConstantMode::Baked;
+	auto cached = m_ModuleCache.find(m_StructureHash);
+	if (!baked && cached != m_ModuleCache.end())
+	{
+		m_ShaderModule = cached->second;
+	}
+	else
+	{
+		Timeline::Begin("CreateShaderModule");
+		wgpu::ShaderModuleWGSLDescriptor wgsld{};
+		wgsld.code = m_ShaderCode.c_str();
+		wgpu::ShaderModuleDescriptor shaderModuleDescriptor{ .nextInChain = &wgsld };
+		m_ShaderModule = m_Device.CreateShaderModule(&shaderModuleDescriptor);
+		Timeline::End("CreateShaderModule");
+
+		if (!baked)
+			m_ModuleCache[m_StructureHash] = m_ShaderModule;
+	}
+
+	// The surface and the time uniforms are only set up for the first shader
+	if (!m_Surface)
+	{
+
 	#pragma region Surface
 
+	Timeline::Begin("ConfigureSurface");
+
 	// Create the surface
 	wgpu::SurfaceDescriptorFromCanvasHTMLSelector canvasDescriptor{};
 	canvasDescriptor.selector = "#canvas";
@@ -91,16 +427,18 @@ void Graphics::SetupPipeline()
 	// Create the format
 	wgpu::SurfaceCapabilities capabilities;
 	m_Surface.GetCapabilities(m_Adapter, &capabilities);
-	wgpu::TextureFormat format = capabilities.formats[0];
+	m_Format = capabilities.formats[0];
 
 	// Configure the surface
 	wgpu::SurfaceConfiguration config
 	{
 		.device = m_Device,
-		.format = format,
+		.format = m_Format,
 	};
 	m_Surface.Configure(&config);
 
+	Timeline::End("ConfigureSurface");
+
 	#pragma endregion
 
 	#pragma region Buffer
@@ -116,43 +454,93 @@ void Graphics::SetupPipeline()
     // Create the uniform buffer
     m_Buffer = m_Device.CreateBuffer(&ubd);
 
+	// The whole uv space, for the cache of split programs
+	const float fullRegion[] = { 0.0f, 0.0f, 1.0f, 1.0f };
+	m_FullRegion = m_Device.CreateBuffer(&ubd);
+	m_Device.GetQueue().WriteBuffer(m_FullRegion, 0, fullRegion, sizeof(fullRegion));
+
+	#pragma endregion
+
+	}
+
+	#pragma region Wall
+
+	// The region and the mirrors of the panel of a wall
+	WallPanel::Setup();
+
+	#pragma endregion
+
+	#pragma region Constant buffer
+
+	// Constants of the program as an array of vec4f, only with uniform constants
+	bool uniform = m_ConstantMode == ConstantMode::Uniform && !m_Constants.empty();
+	uint64_t constantSize = (m_Constants.size() + 3U) / 4U * 4U * sizeof(float);
+	if (uniform)
+	{
+		wgpu::BufferDescriptor cbd =
+		{
+			.usage				= wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst,
+			.size				= constantSize,
+			.mappedAtCreation	= false
+		};
+		m_ConstantBuffer = m_Device.CreateBuffer(&cbd);
+		WriteConstants(m_ConstantBuffer, m_Constants);
+	}
+
 	#pragma endregion
 
 	#pragma region Bind Group
 
-    // Uniform buffer layout
-    wgpu::BindGroupLayoutEntry bindGroupLayoutEntry =
+    // Uniform buffer layouts
+    std::vector<wgpu::BindGroupLayoutEntry> bindGroupLayoutEntries =
 	{
-		.binding = 0, // Matches binding @binding(0) in WGSL
-		.visibility = wgpu::ShaderStage::Fragment,
-		.buffer = { .type = wgpu::BufferBindingType::Uniform }
+		{
+			.binding = 0, // Matches binding @binding(0) in WGSL
+			.visibility = wgpu::ShaderStage::Fragment,
+			.buffer = { .type = wgpu::BufferBindingType::Uniform }
+		}
 	};
+	if (uniform)
+	{
+		bindGroupLayoutEntries.push_back // Constants, only with uniform constants
+		({
+			.binding = 1,
+			.visibility = wgpu::ShaderStage::Fragment,
+			.buffer = { .type = wgpu::BufferBindingType::Uniform }
+		});
+	}
+	if (m_Split)
+	{
+		bindGroupLayoutEntries.push_back // Cached values, only for split programs
+		({
+			.binding = 2,
+			.visibility = wgpu::ShaderStage::Fragment,
+			.texture = { .sampleType = wgpu::TextureSampleType::UnfilterableFloat, .viewDimension = wgpu::TextureViewDimension::e2DArray }
+		});
+	}
+	if (WallPanel::Active())
+	{
+		bindGroupLayoutEntries.push_back // Region of the wall, only for the panel of a wall
+		({
+			.binding = 3,
+			.visibility = wgpu::ShaderStage::Vertex,
+			.buffer = { .type = wgpu::BufferBindingType::Uniform }
+		});
+	}
 
 	// Bind group layout
     wgpu::BindGroupLayoutDescriptor bgld =
 	{
-		.entryCount = 1,
-		.entries = &bindGroupLayoutEntry
-	};
-    wgpu::BindGroupLayout bindGroupLayout = m_Device.CreateBindGroupLayout(&bgld);
-
-    // Bind group entry
-    wgpu::BindGroupEntry bindGroupEntry =
-	{
-		.binding	= 0,
-		.buffer		= m_Buffer,				// Buffer object
-		.offset		= 0,
-		.size		= 4 * sizeof(float)		// Uniform buffer size
+		.entryCount = bindGroupLayoutEntries.size(),
+		.entries = bindGroupLayoutEntries.data()
 	};
+    m_BindGroupLayout = m_Device.CreateBindGroupLayout(&bgld);
 
-    // Bind group
-    wgpu::BindGroupDescriptor bgd =
-	{
-		.layout = bindGroupLayout,
-		.entryCount = 1,
-		.entries = &bindGroupEntry
-	};
-    m_BindGroup = m_Device.CreateBindGroup(&bgd);
+    // Bind group (for split programs, once the cache texture exists in Update)
+	m_CacheWidth = 0U;
+	m_CacheHeight = 0U;
+	if (!m_Split)
+		CreateBindGroup(wgpu::TextureView());
 
 	#pragma endregion
 
@@ -162,59 +550,220 @@ void Graphics::SetupPipeline()
     wgpu::PipelineLayoutDescriptor pld =
 	{
 		.bindGroupLayoutCount = 1,
-		.bindGroupLayouts = &bindGroupLayout
+		.bindGroupLayouts = &m_BindGroupLayout
 	};
-	
-	// Get shader code
-    wgpu::ShaderModuleWGSLDescriptor wgsld{};
-    wgsld.code = m_ShaderCode;
-
-	// Compile shader code
-    wgpu::ShaderModuleDescriptor shaderModuleDescriptor{ .nextInChain = &wgsld };
-    wgpu::ShaderModule shaderModule = m_Device.CreateShaderModule(&shaderModuleDescriptor);
     
+	// Pipeline-overridable constants
+	std::vector<std::string> constantKeys;
+	std::vector<wgpu::ConstantEntry> constantEntries = OverrideConstants(m_Constants, constantKeys);
+
 	// Fragment shader
-    wgpu::ColorTargetState colorTargetState{ .format = format };
+    wgpu::ColorTargetState colorTargetState{ .format = m_Format };
     wgpu::FragmentState fragmentState
     {
-        .module = shaderModule,
+        .module = m_ShaderModule,
+        .constantCount = constantEntries.size(),
+        .constants = constantEntries.data(),
         .targetCount = 1,
         .targets = &colorTargetState
     };
 
-    // Create the pipeline
+    // Create the pipeline asynchronously, so the browser compiles it without blocking
+	Timeline::Begin("CreateRenderPipeline");
     wgpu::RenderPipelineDescriptor rpd =
 	{
 		.layout = m_Device.CreatePipelineLayout(&pld),
-		.vertex = { .module = shaderModule },
+		.vertex = { .module = WallPanel::Active() ? RegionModule() : m_ShaderModule },
 		.fragment = &fragmentState
 	};
-    m_Pipeline = m_Device.CreateRenderPipeline(&rpd);
+    m_Device.CreateRenderPipelineAsync(&rpd, GetPipeline, reinterpret_cast<void*>(uintptr_t(m_PipelineRequest)));
 	
 	#pragma endregion
 
-	// Set the Update function as the main loop
-	emscripten_set_main_loop(Update, 0, false);
+	if (!m_Split)
+		return;
+
+	#pragma region Cache pipeline
+
+	// Compute module of the space stage, cached like the fragment module
+	wgpu::ShaderModule cacheModule;
+	auto cachedCacheModule = m_ModuleCache.find(m_CacheStructureHash);
+	if (!baked && cachedCacheModule != m_ModuleCache.end())
+	{
+		cacheModule = cachedCacheModule->second;
+	}
+	else
+	{
+		Timeline::Begin("CreateCacheShaderModule");
+		wgpu::ShaderModuleWGSLDescriptor wgsld{};
+		wgsld.code = m_CacheCode.c_str();
+		wgpu::ShaderModuleDescriptor shaderModuleDescriptor{ .nextInChain = &wgsld };
+		cacheModule = m_Device.CreateShaderModule(&shaderModuleDescriptor);
+		Timeline::End("CreateCacheShaderModule");
+
+		if (!baked)
+			m_ModuleCache[m_CacheStructureHash] = cacheModule;
+	}
+
+	// The space stage has its own constants
+	bool cacheUniform = m_ConstantMode == ConstantMode::Uniform && !m_CacheConstants.empty();
+	if (cacheUniform)
+	{
+		wgpu::BufferDescriptor cbd =
+		{
+			.usage				= wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst,
+			.size				= (m_CacheConstants.size() + 3U) / 4U * 4U * sizeof(float),
+			.mappedAtCreation	= false
+		};
+		m_CacheConstantBuffer = m_Device.CreateBuffer(&cbd);
+		WriteConstants(m_CacheConstantBuffer, m_CacheConstants);
+	}
+
+	// Layers of the cache, written by the compute shader, the region they cover, and its constants with uniform constants
+	std::vector<wgpu::BindGroupLayoutEntry> cacheLayoutEntries =
+	{
+		{
+			.binding = 2,
+			.visibility = wgpu::ShaderStage::Compute,
+			.storageTexture = { .access = wgpu::StorageTextureAccess::WriteOnly, .format = wgpu::TextureFormat::R32Float, .viewDimension = wgpu::TextureViewDimension::e2DArray }
+		},
+		{
+			.binding = 3,
+			.visibility = wgpu::ShaderStage::Compute,
+			.buffer = { .type = wgpu::BufferBindingType::Uniform }
+		}
+	};
+	if (cacheUniform)
+	{
+		cacheLayoutEntries.push_back
+		({
+			.binding = 1,
+			.visibility = wgpu::ShaderStage::Compute,
+			.buffer = { .type = wgpu::BufferBindingType::Uniform }
+		});
+	}
+	wgpu::BindGroupLayoutDescriptor cbgld =
+	{
+		.entryCount = cacheLayoutEntries.size(),
+		.entries = cacheLayoutEntries.data()
+	};
+	m_CacheBindGroupLayout = m_Device.CreateBindGroupLayout(&cbgld);
+
+	std::vector<std::string> cacheConstantKeys;
+	std::vector<wgpu::ConstantEntry> cacheConstantEntries = OverrideConstants(m_CacheConstants, cacheConstantKeys);
+
+	wgpu::PipelineLayoutDescriptor cpld =
+	{
+		.bindGroupLayoutCount = 1,
+		.bindGroupLayouts = &m_CacheBindGroupLayout
+	};
+
+	Timeline::Begin("CreateComputePipeline");
+	wgpu::ComputePipelineDescriptor cpd =
+	{
+		.layout = m_Device.CreatePipelineLayout(&cpld),
+		.compute =
+		{
+			.module = cacheModule,
+			.constantCount = cacheConstantEntries.size(),
+			.constants = cacheConstantEntries.data()
+		}
+	};
+	m_Device.CreateComputePipelineAsync(&cpd, GetCachePipeline, reinterpret_cast<void*>(uintptr_t(m_PipelineRequest)));
+
+	#pragma endregion
+}
+void Graphics::GetPipeline(WGPUCreatePipelineAsyncStatus status, WGPURenderPipeline cPipeline, const char* message, void* userdata)
+{
+	// Release the pipeline of a request replaced by a newer one (its span stays open, the latest span is the one of this request)
+	wgpu::RenderPipeline pipeline = wgpu::RenderPipeline::Acquire(status == WGPUCreatePipelineAsyncStatus_Success ? cPipeline : nullptr);
+	if (uintptr_t(userdata) != m_PipelineRequest)
+		return;
+	Timeline::End("CreateRenderPipeline");
+
+	m_PipelinePending = false;
+	if (!pipeline)
+	{
+		// The previous pipeline does not match the new bind group, so nothing is drawn until the next program
+		std::cout << "Pipeline creation failed: " << (message ? message : "") << std::endl;
+		m_Pipeline = {};
+		m_PipelineStructure = 0ULL;
+		m_Benchmark.running = false;
+		return;
+	}
+
+	// Get pipeline
+	m_Pipeline = std::move(pipeline);
+	m_PipelineStructure = m_StructureHash;
+
+	// Set the Update function as the main loop, the first time a pipeline is ready
+	if (!m_MainLoop)
+	{
+		emscripten_set_main_loop(Update, 0, false);
+		m_MainLoop = true;
+	}
+
+	if (m_Benchmark.running)
+		BenchmarkNext();
+}
+void Graphics::GetCachePipeline(WGPUCreatePipelineAsyncStatus status, WGPUComputePipeline cPipeline, const char* message, void* userdata)
+{
+	wgpu::ComputePipeline pipeline = wgpu::ComputePipeline::Acquire(status == WGPUCreatePipelineAsyncStatus_Success ? cPipeline : nullptr);
+	if (uintptr_t(userdata) != m_PipelineRequest)
+		return;
+	Timeline::End("CreateComputePipeline");
+
+	m_CachePipelinePending = false;
+	if (!pipeline)
+		std::cout << "Cache pipeline creation failed: " << (message ? message : "") << std::endl;
+	m_CachePipeline = std::move(pipeline);
 }
 
 void Graphics::Update()
 {
-	// Get frame time (for debug purposes)
-//	double now = emscripten_get_now() / 1000.0;
-//	double deltaTime = now - m_LastUpdate;
-//	m_LastUpdate = now;
-//	std::cout << deltaTime << " ms" << std::endl;
-//	std::cout << 1.0 / deltaTime << " FPS" << std::endl;
+	// SetupPipeline replaces the bind group right away, which the previous pipeline does not match,
+	// so the canvas keeps its last frame until the new pipeline (and the cache pipeline of a split program) is ready, or if it failed
+	if (m_PipelinePending || !m_Pipeline || (m_Split && (m_CachePipelinePending || !m_CachePipeline)))
+		return;
+
+	Metrics::Timer timer(m_FrameTime);
+
+	if (m_FirstFrame)
+		Timeline::Begin("FirstUpdate");
+
+	// Record the interval since the previous frame (in nanoseconds)
+	double now = emscripten_get_now();
+	if (m_LastUpdate > 0.0)
+		m_FrameInterval.Record(uint64_t((now - m_LastUpdate) * 1e6));
+	m_LastUpdate = now;
+
+	// The interactive view keeps the time uniforms of its first frame
+	if (CanvasView::Active())
+	{
+		CanvasView::Update();
+		return;
+	}
 
 	// Get time in seconds since the beginning of the program
-	float elapsedTime = emscripten_get_now() / 1000.0f;
+	float elapsedTime = now / 1000.0f;
 
 	// Calculate sin and cos of time to pass as constant buffers to the shader and use as transition alphas
 	float sinTime = 0.5f + 0.5f * sinf(0.5f * elapsedTime);
 	float cosTime = 0.5f + 0.5f * cosf(0.5f * elapsedTime);
+	// Phase of the loop, read by the polynomial surrogates of the phase (see Surrogates.h)
+	double loops = 0.5 * elapsedTime / 6.283185307179586;
+	float phase = float(loops - std::floor(loops));
+
+	// The panel of a wall shows the frame of the wall that is due, with the phase of Renderer::FramePhase, like every other panel
+	if (WallPanel::Active())
+	{
+		phase = WallPanel::Phase();
+		sinTime = 0.5f + 0.5f * sinf(6.2831853f * phase);
+		cosTime = 0.5f + 0.5f * cosf(6.2831853f * phase);
+	}
 
     // Assemble the data into an array
-	const float newData[] = { sinTime, cosTime, 0.0f, 0.0f };
+	const float newData[] = { sinTime, cosTime, phase, 0.0f };
 
 	// Update the uniform buffer
     m_Device.GetQueue().WriteBuffer(m_Buffer, 0, &newData, 4 * sizeof(float));
@@ -223,6 +772,10 @@ void Graphics::Update()
 	wgpu::SurfaceTexture surfaceTexture;
 	m_Surface.GetCurrentTexture(&surfaceTexture);
 
+	// The cache of a split program follows the size of the canvas
+	if (m_Split && (surfaceTexture.texture.GetWidth() != m_CacheWidth || surfaceTexture.texture.GetHeight() != m_CacheHeight))
+		CreateCache(surfaceTexture.texture.GetWidth(), surfaceTexture.texture.GetHeight());
+
 	// Render pass color attachment
 	wgpu::RenderPassColorAttachment attachment
 	{
@@ -240,6 +793,17 @@ void Graphics::Update()
 
 	// Create command encoder
 	wgpu::CommandEncoder encoder = m_Device.CreateCommandEncoder();
+
+	// Evaluate the space stage of a split program before the first frame that reads it
+	if (m_Split && !m_CacheValid)
+	{
+		wgpu::ComputePassEncoder computePass = encoder.BeginComputePass();
+		computePass.SetPipeline(m_CachePipeline);
+		computePass.SetBindGroup(0, m_CacheBindGroup);
+		computePass.DispatchWorkgroups((m_CacheWidth + 7U) / 8U, (m_CacheHeight + 7U) / 8U);
+		computePass.End();
+		m_CacheValid = true;
+	}
 	
 	// Begin the render pass
 	wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&rpd);
@@ -256,8 +820,93 @@ void Graphics::Update()
 	// End render pass
 	pass.End();
 
+	// Copy the frame to the mirrors of a wall panel
+	WallPanel::CopyToMirrors(encoder, surfaceTexture.texture);
+
 	// Submit the commands
 	wgpu::CommandBuffer commands = encoder.Finish();
 	m_Device.GetQueue().Submit(1, &commands);
+	m_Frames.Add();
+
+	// Print the startup timeline once the first frame is submitted
+	if (m_FirstFrame)
+	{
+		Timeline::End("FirstUpdate");
+		Timeline::End("TimeToFirstFrame");
+		Timeline::Finish();
+		Timeline::Log();
+		m_FirstFrame = false;
+	}
+}
+
+void Graphics::BenchmarkConstantModes(const Program& program, uint32_t variants)
+{
+	if (m_Benchmark.running || variants == 0U || !m_Device)
+		return;
+
+	uint32_t runs = m_Benchmark.runs + 1U;
+	m_Benchmark = Benchmark{};
+	m_Benchmark.program = program;
+	m_Benchmark.constants = ProgramConstants(program);
+	m_Benchmark.variants = variants;
+	m_Benchmark.runs = runs;
+	m_Benchmark.running = true;
+
+	for (uint32_t mode = 0U; mode < 3U; mode++)
+		m_Benchmark.codeSize[mode] = EmitShaderCode(program, ConstantMode(mode)).size();
+
+	BenchmarkNext();
+}
+
+namespace
+{
+	void BenchmarkStep()
+	{
+		Benchmark& benchmark = m_Benchmark;
+
+		// Print the results after the last variant of the last mode
+		if (benchmark.step == 3U * benchmark.variants)
+		{
+			const char* names[] = { "baked", "override", "uniform" };
+			std::string report = "{ \"variants\": " + std::to_string(benchmark.variants) + ", \"constants\": " + std::to_string(benchmark.constants.size()) + ", \"modes\": [";
+			for (uint32_t mode = 0U; mode < 3U; mode++)
+			{
+				// The first variant includes the compilation of the module in every mode
+				const std::vector<double>& times = benchmark.times[mode];
+				double sum = 0.0;
+				for (size_t i = 1; i < times.size(); i++)
+					sum += times[i];
+
+				char buffer[256];
+				std::snprintf(buffer, sizeof(buffer), "%s { \"mode\": \"%s\", \"codeBytes\": %zu, \"firstMs\": %.3f, \"nextMeanMs\": %.3f }",
+					mode ? "," : "", names[mode], benchmark.codeSize[mode], times[0], times.size() > 1 ? sum / double(times.size() - 1) : 0.0);
+				report += buffer;
+			}
+			report += " ] }";
+			std::cout << report << std::endl;
+
+			benchmark.running = false;
+			return;
+		}
+
+		// Same constants for the same variant in every mode, drawn from a hash so every run is different
+		uint32_t variant = benchmark.step % benchmark.variants;
+		std::vector<float> constants(benchmark.constants.size());
+		for (size_t i = 0; i < constants.size(); i++)
+			constants[i] = float(Hash::DoubleO(uint64_t(variant) << 32 | i, benchmark.runs));
+		SetProgramConstants(benchmark.program, constants);
+
+		ConstantMode mode = ConstantMode(benchmark.step / benchmark.variants);
+		benchmark.step++;
+		benchmark.start = emscripten_get_now();
+		Graphics::SetProgram(benchmark.program, mode);
+	}
 }
 
+// Compare the constant modes on variants of the program of the given seed (see Graphics::BenchmarkConstantModes)
+extern "C" EMSCRIPTEN_KEEPALIVE void BenchmarkConstantModes(uint32_t seed, uint32_t variants)
+{
+	Program program;
+	if (CompileProgram(GenerateShaderExpression(seed), program))
+		Graphics::BenchmarkConstantModes(program, variants);
+}
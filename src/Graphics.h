@@ -1,17 +1,40 @@
 #pragma once
 
+#include <string>
+#include <vector>
+#include <cstdint>
+
 #include <webgpu/webgpu_cpp.h>
 
+#include "Shader.h"
+#include "Program.h"
+
 namespace Graphics
 {
 	// Setup
-	void Initialize(const char* shaderCode);
+	// Initialize starts the async requests for the adapter and the device, and the setup finishes
+	// as soon as both the device and the shader code (which can be given at any time) are available
+	void Initialize();
+	void SetShaderCode(std::string shaderCode);
+	// Show a compiled program, emitted with the given constant mode (can also be called again to switch programs)
+	// Without baked constants, the shader modules are cached by structure hash, so programs of a known structure skip the WGSL compilation
+	// With uniform constants, programs of the current structure also reuse the pipeline, and only the constant buffer is written
+	// With cacheSpace, the program is split (see SplitProgram): a compute pass evaluates its space stage into a texture array
+	// whenever the canvas changes size, and every frame only evaluates the time stage
+	void SetProgram(const Program& program, ConstantMode mode, bool cacheSpace = false);
 	void GetInstance();
 	void GetAdapter(WGPURequestAdapterStatus status, WGPUAdapter cAdapter, const char* message, void* userdata);
 	void GetDevice(WGPURequestDeviceStatus status, WGPUDevice cDevice, const char* message, void* userdata);
 	void SetupPipeline();
+	void GetPipeline(WGPUCreatePipelineAsyncStatus status, WGPURenderPipeline cPipeline, const char* message, void* userdata);
+	void GetCachePipeline(WGPUCreatePipelineAsyncStatus status, WGPUComputePipeline cPipeline, const char* message, void* userdata);
 
 	// Runtime
+	// Draws the animation, or hands the frame over to the interactive view (see CanvasView.h), on the clock of a wall if the
+	// canvas shows a panel of one (see WallPanel.h). The exports and the thumbnails render offscreen (see ExportRing.h and Thumbnails.h)
 	void Update();
-}
 
+	// Time the switch between variants of a program (same structure, new constants) in each constant mode
+	// The results are printed to the console as JSON once all pipelines have been created
+	void BenchmarkConstantModes(const Program& program, uint32_t variants);
+}
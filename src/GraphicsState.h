@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include <webgpu/webgpu_cpp.h>
+
+#include "Shader.h"
+#include "Metrics.h"
+
+/*
+	State of the canvas shared by the parts of the browser renderer.
+
+	Graphics sets up the device and the program shown by the canvas, and is the only one to change them. The interactive view
+	(CanvasView.h), the video wall (WallPanel.h) and the exports (ExportRing.h) read them to render that program again with its
+	module and constants. The thumbnails (Thumbnails.h) only need the device.
+*/
+namespace GraphicsState
+{
+	constexpr uint32_t MAX_TILE_SIZE = 8192U; // Default maxTextureDimension2D, supported by every device
+
+	// WebGPU core objects
+	extern wgpu::Instance m_Instance;
+	extern wgpu::Device m_Device;
+
+	// Surface of the canvas, and its format
+	extern wgpu::Surface m_Surface;
+	extern wgpu::TextureFormat m_Format;
+
+	// Program of the canvas: its fragment module, the time uniforms, and its constants when they are not baked in the code
+	extern bool m_ShaderReady;
+	extern wgpu::ShaderModule m_ShaderModule;
+	extern ConstantMode m_ConstantMode;
+	extern std::vector<float> m_Constants;
+	extern wgpu::Buffer m_Buffer;
+	extern wgpu::Buffer m_ConstantBuffer;
+	extern wgpu::RenderPipeline m_Pipeline;
+	extern bool m_PipelinePending;
+
+	// Space stage of a split program, evaluated by a compute pass into a texture array with one layer per slot
+	extern bool m_Split;
+	extern wgpu::ComputePipeline m_CachePipeline;
+	extern bool m_CachePipelinePending;
+
+	// Frame loop metrics
+	extern Metrics::Counter m_Frames;
+	extern Metrics::Histogram m_FrameTime;
+
+	// Pipeline-overridable constants, named c0, c1... in the code (the keys must outlive the entries)
+	std::vector<wgpu::ConstantEntry> OverrideConstants(const std::vector<float>& constants, std::vector<std::string>& keys);
+
+	// Texture array that holds the cached values of a split program for the given size, one layer per slot, and its view
+	wgpu::Texture CreateCacheTexture(uint32_t width, uint32_t height);
+	wgpu::TextureView CreateCacheView(const wgpu::Texture& texture);
+	// Bind a cache texture, the region of the uv space it covers and the constants of the space stage to the compute pipeline
+	wgpu::BindGroup CreateCacheBindGroup(const wgpu::TextureView& view, const wgpu::Buffer& region, uint64_t regionOffset);
+
+	// Vertex module that draws a region of the uv space (see EmitRegionVertexShaderCode), created on first use
+	const wgpu::ShaderModule& RegionModule();
+}
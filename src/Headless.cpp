@@ -0,0 +1,792 @@
+/*
+	Native command line renderer, using the CPU evaluator instead of WebGPU.
+
+	Renders frames of a seed and writes them as raw RGBA8 to stdout, or publishes them to a shared memory ring:
+
+		pollock --seed 42 --width 1920 --height 1080 --frames 600 > frames.rgba
+		pollock --seed 42 --frames 0 --realtime --shm /pollock
+		pollock --consume /pollock
+		pollock --stream --frames 0 --width 1920 --height 1080 --realtime --shm /pollock
+		pollock --batch --seed 1 --count 1000 --width 256 --height 256 --phases 0,0.5 > gallery.tar
+		pollock --seed 42 --frames 300 --pan 4,0 --zoom 1.01 --refine 64 > path.rgba
+		pollock --seed 42 --width 256 --height 256 --format png > thumbnail.png
+		pollock --scan --seed 1 --count 1000000 --min-contrast 0.12 | pollock --batch --seeds - --format png > gallery.tar
+		pollock --scan --seed 1 --count 1000000000000 --shuffle 7 --slice 0,100000 --min-contrast 0.12 > sample.txt
+		pollock --wall 3840x1080 --panel 0,0,1920,1080 --width 1920 --height 1080 --frames 0 --realtime --clock /wall --lead --shm /left,/left-mirror
+*/
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "Shader.h"
+#include "Program.h"
+#include "Pruning.h"
+#include "Surrogates.h"
+#include "Moments.h"
+#include "Renderer.h"
+#include "Stream.h"
+#include "Batch.h"
+#include "Tar.h"
+#include "Encoder.h"
+#include "CostModel.h"
+#include "Viewport.h"
+#include "Wall.h"
+#include "FrameRing.h"
+#include "Metrics.h"
+#include "RandFS.h"
+
+namespace
+{
+	struct Options
+	{
+		uint64_t seed = 0ULL;
+		bool hasSeed = false;
+		uint32_t width = 640U;
+		uint32_t height = 360U;
+		uint64_t frames = 1ULL; // 0 renders forever
+		float fps = 60.0f;
+		bool realtime = false; // Pace the frames to the given fps instead of rendering as fast as possible
+		uint32_t threads = 0U;
+		const char* shm = nullptr; // Comma separated rings, the first one is rendered into and the others get a copy
+		uint32_t slots = 4U;
+		bool drop = false;
+		const char* consume = nullptr;
+		const char* metrics = nullptr;
+		float prune = 0.0f; // Error budget of the pruning pass, 0 disables it
+		float surrogates = 0.0f; // Error bound of the polynomial surrogates, 0 disables them
+		bool correlated = false; // Same functions in the three channels (see GenerateShaderExpression)
+		bool stream = false; // Walk a schedule of seeds instead of looping a single one
+		float segment = 12.566371f;
+		float transition = 2.0f;
+		uint32_t generators = 1U;
+		uint32_t cache = 256U; // Megabytes of time-independent values cached by the renderer, 0 disables the cache
+		bool fixed = false; // Deterministic fixed point evaluator (see Fixed.h)
+		bool batch = false; // Render a list of seeds into a tar archive
+		uint64_t count = 1ULL; // Seeds of the batch, counting up from the seed
+		const char* seeds = nullptr; // File with the seeds of the batch, - for stdin
+		bool shuffle = false; // Visit the counted seeds in the order of a permutation of the range instead of counting up
+		uint64_t shuffleKey = 0ULL;
+		uint64_t sliceFirst = 0ULL, sliceCount = 0ULL; // Positions of the counted seeds in that order, a count of 0 goes to the end
+		std::vector<float> phases = { 0.0f };
+		uint32_t variants = 0U; // Variants of the constants of every seed of the batch
+		int32_t panX = 0, panY = 0; // Pixels panned at every frame of an exploration
+		float zoom = 1.0f; // Zoom at every frame of an exploration, around the center
+		uint32_t refine = 0U; // Stale rows rendered at every frame of an exploration, 0 for all of them
+		Encoder::Format format = Encoder::Format::Raw; // Encoding of the images written to stdout or to the archive
+		bool autoFormat = false; // Choose the format of every image for the budget instead
+		float budget = 20.0f; // Milliseconds allowed to encode an image with the automatic format
+		const char* costs = nullptr; // Costs calibrated for this machine (see CostModel.h)
+		bool scan = false; // Print the seeds that are not predicted to be boring, without rendering
+		float minContrast = 0.0f; // Thresholds of the predicted statistics of a seed (see Moments.h)
+		float maxFlatness = 1.0f;
+		float minMotion = 0.0f;
+		uint32_t wallWidth = 0U, wallHeight = 0U; // Size of the video wall in wall units, 0 for a single screen (see Wall.h)
+		Renderer::Rect panel{ 0U, 0U, 0U, 0U }; // Rectangle of the wall shown by this instance, in wall units
+		const char* clock = nullptr; // Clock shared by the instances of the wall
+		bool lead = false; // Create the clock instead of joining it
+		double epoch = -1.0; // Unix time in milliseconds of frame 0, for instances on several hosts, negative if unset
+	};
+
+	void PrintUsage()
+	{
+		std::fprintf(stderr,
+			"Usage: pollock [options]\n"
+			"  --seed N          Seed of the shader (default: current time)\n"
+			"  --width N         Frame width (default: 640)\n"
+			"  --height N        Frame height (default: 360)\n"
+			"  --frames N        Number of frames, 0 for an endless stream (default: 1)\n"
+			"  --fps F           Frame rate of the animation (default: 60)\n"
+			"  --realtime        Pace the output to the frame rate\n"
+			"  --threads N       Render threads (default: one per hardware thread)\n"
+			"  --shm NAMES       Publish frames to a shared memory ring instead of stdout, comma separated rings get the same frames\n"
+			"  --slots N         Slots of the shared memory ring (default: 4)\n"
+			"  --drop            Drop frames when the ring is full instead of waiting\n"
+			"  --consume NAME    Read frames from a ring and print their metadata\n"
+			"  --metrics FILE    Write the metrics in the Prometheus text format at exit\n"
+			"  --prune E         Remove subtrees that change no channel by more than E (e.g. 0.004)\n"
+			"  --surrogates E    Replace subtrees of a single input by polynomials within E of them (e.g. 0.002)\n"
+			"  --correlated      Use the same functions in the three channels, with different constants\n"
+			"  --stream          Stream a new seed every segment, derived from the seed\n"
+			"  --segment S       Seconds between two seeds of the stream (default: one loop, 12.57)\n"
+			"  --transition S    Seconds of crossfade between two seeds of the stream (default: 2)\n"
+			"  --generators N    Threads generating the upcoming seeds of the stream (default: 1)\n"
+			"  --cache MB        Memory for the time-independent values of animations, 0 disables it (default: 256)\n"
+			"  --fixed           Render in fixed point, with bit-identical output on every machine\n"
+			"  --batch           Render many seeds into a tar archive on stdout, in completion order, with a manifest\n"
+			"  --count N         Seeds of the batch, counting up from the seed (default: 1)\n"
+			"  --seeds FILE      Read the seeds of the batch from a file instead, - for stdin\n"
+			"  --shuffle KEY     Visit the counted seeds of a batch or scan in a shuffled order given by KEY, without repeats\n"
+			"  --slice FIRST,N   Only the N counted seeds from position FIRST of that order, to shard or resume a batch or scan\n"
+			"  --phases LIST     Comma separated phases of the loop rendered for every seed of the batch (default: 0)\n"
+			"  --variants N      Also render N variants of the constants of every seed of the batch, as a family (default: 0)\n"
+			"  --pan DX,DY       Explore a static image, panning by DX,DY pixels at every frame, and only render the exposed strips\n"
+			"  --zoom F          Explore a static image, zooming by F at every frame around the center\n"
+			"  --refine N        Rows of an exploration rendered again at every frame after a zoom, 0 for all of them (default: 0)\n"
+			"  --format NAME     Encoding of the images: raw, ppm, bmp, qoi, png, png-best, or auto for the smallest within the budget (default: raw)\n"
+			"  --budget MS       Milliseconds allowed to encode an image with --format auto (default: 20)\n"
+			"  --costs FILE      Costs calibrated for this machine by calibrate, to predict frame times and weigh the ops\n"
+			"  --scan            Print the seeds of the batch list that are not predicted to be boring, without rendering them\n"
+			"  --min-contrast C  Skip the seeds of a batch or scan with a predicted contrast under C (e.g. 0.12)\n"
+			"  --max-flatness F  Skip the seeds of a batch or scan with a predicted flatness over F (e.g. 0.3)\n"
+			"  --min-motion M    Skip the seeds of a batch or scan with a predicted motion under M (e.g. 0.035)\n"
+			"  --wall WxH        Render one panel of a video wall of WxH units, at the frame size\n"
+			"  --panel X,Y,W,H   Rectangle of the wall shown by this instance, in wall units from the top left\n"
+			"  --clock NAME      Take the seed, frame rate and epoch of the animation from a shared memory clock\n"
+			"  --lead            Create the clock with the seed and frame rate of this instance\n"
+			"  --epoch MS        Unix time in milliseconds of frame 0, shared by instances on several hosts\n");
+	}
+
+	bool ParseOptions(int argc, char** argv, Options& options)
+	{
+		for (int i = 1; i < argc; i++)
+		{
+			const char* arg = argv[i];
+			const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+			auto next = [&]() { i++; return value; };
+
+			if (!std::strcmp(arg, "--realtime")) options.realtime = true;
+			else if (!std::strcmp(arg, "--drop")) options.drop = true;
+			else if (!std::strcmp(arg, "--stream")) options.stream = true;
+			else if (!std::strcmp(arg, "--correlated")) options.correlated = true;
+			else if (!std::strcmp(arg, "--fixed")) options.fixed = true;
+			else if (!std::strcmp(arg, "--batch")) options.batch = true;
+			else if (!std::strcmp(arg, "--scan")) options.scan = true;
+			else if (!std::strcmp(arg, "--lead")) options.lead = true;
+			else if (!value) return false;
+			else if (!std::strcmp(arg, "--seed")) { options.seed = std::strtoull(next(), nullptr, 10); options.hasSeed = true; }
+			else if (!std::strcmp(arg, "--width")) options.width = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--height")) options.height = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--frames")) options.frames = std::strtoull(next(), nullptr, 10);
+			else if (!std::strcmp(arg, "--fps")) options.fps = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--threads")) options.threads = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--shm")) options.shm = next();
+			else if (!std::strcmp(arg, "--slots")) options.slots = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--consume")) options.consume = next();
+			else if (!std::strcmp(arg, "--metrics")) options.metrics = next();
+			else if (!std::strcmp(arg, "--prune")) options.prune = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--surrogates")) options.surrogates = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--segment")) options.segment = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--transition")) options.transition = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--generators")) options.generators = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--cache")) options.cache = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--count")) options.count = std::strtoull(next(), nullptr, 10);
+			else if (!std::strcmp(arg, "--seeds")) options.seeds = next();
+			else if (!std::strcmp(arg, "--shuffle")) { options.shuffleKey = std::strtoull(next(), nullptr, 10); options.shuffle = true; }
+			else if (!std::strcmp(arg, "--variants")) options.variants = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--zoom")) options.zoom = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--refine")) options.refine = uint32_t(std::strtoul(next(), nullptr, 10));
+			else if (!std::strcmp(arg, "--budget")) options.budget = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--costs")) options.costs = next();
+			else if (!std::strcmp(arg, "--min-contrast")) options.minContrast = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--max-flatness")) options.maxFlatness = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--min-motion")) options.minMotion = std::strtof(next(), nullptr);
+			else if (!std::strcmp(arg, "--clock")) options.clock = next();
+			else if (!std::strcmp(arg, "--epoch")) options.epoch = std::strtod(next(), nullptr);
+			else if (!std::strcmp(arg, "--wall"))
+			{
+				if (std::sscanf(next(), "%ux%u", &options.wallWidth, &options.wallHeight) != 2)
+					return false;
+			}
+			else if (!std::strcmp(arg, "--slice"))
+			{
+				unsigned long long first, count;
+				if (std::sscanf(next(), "%llu,%llu", &first, &count) != 2)
+					return false;
+				options.sliceFirst = first;
+				options.sliceCount = count;
+			}
+			else if (!std::strcmp(arg, "--panel"))
+			{
+				Renderer::Rect& panel = options.panel;
+				if (std::sscanf(next(), "%u,%u,%u,%u", &panel.x, &panel.y, &panel.width, &panel.height) != 4)
+					return false;
+			}
+			else if (!std::strcmp(arg, "--format"))
+			{
+				const char* name = next();
+				options.autoFormat = !std::strcmp(name, "auto");
+				if (!options.autoFormat && !Encoder::Parse(name, options.format))
+					return false;
+			}
+			else if (!std::strcmp(arg, "--pan"))
+			{
+				if (std::sscanf(next(), "%d,%d", &options.panX, &options.panY) != 2)
+					return false;
+			}
+			else if (!std::strcmp(arg, "--phases"))
+			{
+				options.phases.clear();
+				for (const char* p = next(); *p;)
+				{
+					char* end;
+					options.phases.push_back(std::strtof(p, &end));
+					if (end == p)
+						return false;
+					p = *end == ',' ? end + 1 : end;
+				}
+			}
+			else return false;
+		}
+		if (options.wallWidth > 0U || options.wallHeight > 0U)
+		{
+			const Renderer::Rect& panel = options.panel;
+			if (options.wallWidth == 0U || options.wallHeight == 0U || panel.width == 0U || panel.height == 0U
+				|| panel.x + panel.width > options.wallWidth || panel.y + panel.height > options.wallHeight)
+				return false;
+		}
+		return options.width > 0U && options.height > 0U && options.fps > 0.0f;
+	}
+
+	// Names of a comma separated list
+	std::vector<std::string> SplitList(const char* list)
+	{
+		std::vector<std::string> names;
+		for (const char* p = list; p && *p;)
+		{
+			const char* end = std::strchr(p, ',');
+			names.emplace_back(p, end ? size_t(end - p) : std::strlen(p));
+			p = end ? end + 1 : nullptr;
+		}
+		return names;
+	}
+
+	// Format of the next image, chosen for the budget with --format auto
+	Encoder::Format ImageFormat(const Options& options)
+	{
+		return options.autoFormat ? Encoder::Choose(options.width, options.height, 1e-3 * options.budget) : options.format;
+	}
+
+	// Write a frame to stdout, encoded as it goes
+	bool WriteImage(const Options& options, const uint8_t* pixels)
+	{
+		Encoder::Writer writer(ImageFormat(options), options.width, options.height, [](const uint8_t* data, size_t size)
+		{
+			return std::fwrite(data, 1, size, stdout) == size;
+		});
+		return writer.AddRows(pixels, options.height, options.width * 4U) && writer.Finish();
+	}
+
+	int Consume(const Options& options)
+	{
+		FrameRing ring;
+		if (!ring.Open(options.consume))
+		{
+			std::fprintf(stderr, "Could not open the frame ring %s\n", options.consume);
+			return 1;
+		}
+
+		for (uint64_t count = 0ULL; options.frames == 0ULL || count < options.frames;)
+		{
+			FrameRing::FrameInfo info;
+			const uint8_t* pixels = ring.BeginRead(info);
+			if (!pixels)
+			{
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+				continue;
+			}
+
+			double latency = double(FrameRing::Now() - info.timestamp) / 1e6;
+			std::printf("frame %llu seed %llu phase %.4f latency %.3f ms first pixel %u %u %u\n",
+				(unsigned long long)info.number, (unsigned long long)info.seed, info.phase, latency, pixels[0], pixels[1], pixels[2]);
+			ring.EndRead();
+			count++;
+		}
+		return 0;
+	}
+
+	int RunStream(const Options& options)
+	{
+		FrameRing ring;
+		if (options.shm && !ring.Create(options.shm, options.width, options.height, options.slots))
+		{
+			std::fprintf(stderr, "Could not create the frame ring %s\n", options.shm);
+			return 1;
+		}
+
+		Stream::Settings settings;
+		settings.seed = options.seed;
+		settings.width = options.width;
+		settings.height = options.height;
+		settings.fps = options.fps;
+		settings.frames = options.frames;
+		settings.segmentSeconds = options.segment;
+		settings.transitionSeconds = options.transition;
+		settings.realtime = options.realtime;
+		settings.generatorThreads = options.generators;
+		settings.cacheBudget = size_t(options.cache) << 20U;
+		settings.deterministic = options.fixed;
+		settings.renderThreads = options.threads;
+		settings.prune = options.prune;
+		settings.surrogates = options.surrogates;
+		settings.correlated = options.correlated;
+
+		const size_t frameSize = size_t(options.width) * options.height * 4U;
+		Stream stream(settings);
+		stream.Run([&](const Stream::Frame& frame)
+		{
+			if (!options.shm)
+				return WriteImage(options, frame.pixels);
+
+			uint8_t* pixels = ring.BeginWrite(options.drop ? FrameRing::Policy::Drop : FrameRing::Policy::Block);
+			if (!pixels)
+			{
+				ring.Drop();
+				return true;
+			}
+			std::memcpy(pixels, frame.pixels, frameSize);
+			ring.EndWrite(FrameRing::FrameInfo{ frame.number, frame.seed, frame.phase, FrameRing::Now() });
+			return true;
+		});
+
+		if (options.realtime)
+			std::fprintf(stderr, "%llu frames missed their deadline\n", (unsigned long long)stream.LateFrames());
+		return 0;
+	}
+
+	// Counted seeds in the slice
+	uint64_t CountedSeeds(const Options& options)
+	{
+		uint64_t rest = options.sliceFirst < options.count ? options.count - options.sliceFirst : 0ULL;
+		return options.sliceCount > 0ULL ? std::min(options.sliceCount, rest) : rest;
+	}
+
+	// Counted seed at the given position of the slice, so shuffled ranges of any size need no memory
+	uint64_t CountedSeed(const Options& options, uint64_t position)
+	{
+		position += options.sliceFirst;
+		return options.seed + (options.shuffle ? Hash::Permute64(position, options.count, options.shuffleKey) : position);
+	}
+
+	// Seeds of the list file of a batch or scan (counted seeds are not stored, see CountedSeed)
+	bool ReadSeeds(const Options& options, std::vector<uint64_t>& seeds)
+	{
+		FILE* file = std::strcmp(options.seeds, "-") ? std::fopen(options.seeds, "r") : stdin;
+		if (!file)
+		{
+			std::fprintf(stderr, "Could not open the seed list %s\n", options.seeds);
+			return false;
+		}
+		unsigned long long seed;
+		while (std::fscanf(file, "%llu", &seed) == 1)
+			seeds.push_back(seed);
+		if (file != stdin)
+			std::fclose(file);
+		return true;
+	}
+
+	int RunBatch(const Options& options)
+	{
+		// Counted seeds are not stored, like in a scan
+		std::vector<uint64_t> list;
+		if (options.seeds && !ReadSeeds(options, list))
+			return 1;
+		const uint64_t total = options.seeds ? list.size() : CountedSeeds(options);
+		auto seed = [&](uint64_t i) { return options.seeds ? list[i] : CountedSeed(options, i); };
+
+		if (options.variants > 0U && options.prune > 0.0f)
+			std::fprintf(stderr, "Pruning would change the constants of the variants, ignoring --prune\n");
+		if (options.variants > 0U && options.surrogates > 0.0f)
+			std::fprintf(stderr, "Polynomial surrogates would change the constants of the variants, ignoring --surrogates\n");
+
+		Batch::Settings settings;
+		settings.width = options.width;
+		settings.height = options.height;
+		settings.phases = options.phases;
+		settings.generatorThreads = options.generators;
+		settings.renderThreads = options.threads;
+		settings.cacheBudget = size_t(options.cache) << 20U;
+		settings.deterministic = options.fixed;
+		settings.prune = options.prune;
+		settings.surrogates = options.surrogates;
+		settings.correlated = options.correlated;
+		settings.variants = options.variants;
+		settings.minContrast = options.minContrast;
+		settings.maxFlatness = options.maxFlatness;
+		settings.minMotion = options.minMotion;
+
+		// The manifest lists the entries in the order of the archive, and is written last since that order is only known at the end
+		// Raw images go into the archive as they are, others are encoded on the output thread while the next ones render
+		const size_t imageSize = size_t(options.width) * options.height * 4U;
+		const bool encode = options.autoFormat || options.format != Encoder::Format::Raw;
+		const char* formatName = options.autoFormat ? "auto" : encode ? Encoder::Name(options.format) : "rgba8";
+		std::string manifest = "{ \"width\": " + std::to_string(options.width) + ", \"height\": " + std::to_string(options.height) + ", \"format\": \"" + formatName + "\", \"images\": [";
+		uint64_t images = 0ULL, failures = 0ULL, skipped = 0ULL, encodedBytes = 0ULL;
+		double encodeSeconds = 0.0;
+		std::vector<uint8_t> encoded;
+		bool written = true;
+
+		auto start = std::chrono::steady_clock::now();
+		Batch batch(settings);
+		batch.Run(total, seed, [&](const Batch::Image& image)
+		{
+			char entry[320];
+			if (!image.pixels)
+			{
+				std::snprintf(entry, sizeof(entry), "%s\n\t{ \"index\": %llu, \"seed\": %llu, %s }",
+					images + failures + skipped ? "," : "", (unsigned long long)image.index, (unsigned long long)image.seed, image.skipped ? "\"skipped\": \"boring\"" : "\"error\": \"compile\"");
+				manifest += entry;
+				(image.skipped ? skipped : failures)++;
+				return true;
+			}
+
+			Encoder::Format format = ImageFormat(options);
+			double seconds = 0.0;
+			if (encode)
+			{
+				auto start = std::chrono::steady_clock::now();
+				Encoder::Encode(format, image.pixels, options.width, options.height, options.width * 4U, encoded);
+				seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				encodeSeconds += seconds;
+				encodedBytes += encoded.size();
+			}
+
+			char name[64];
+			if (image.variant == 0U)
+				std::snprintf(name, sizeof(name), "%llu_%u.%s", (unsigned long long)image.seed, image.phaseIndex, Encoder::Extension(format));
+			else
+				std::snprintf(name, sizeof(name), "%llu_v%u_%u.%s", (unsigned long long)image.seed, image.variant, image.phaseIndex, Encoder::Extension(format));
+			std::snprintf(entry, sizeof(entry), "%s\n\t{ \"file\": \"%s\", \"index\": %llu, \"seed\": %llu, \"variant\": %u, \"phase\": %.6g, \"generateMs\": %.3f, \"renderMs\": %.3f",
+				images + failures + skipped ? "," : "", name, (unsigned long long)image.index, (unsigned long long)image.seed, image.variant, image.phase, 1e3 * image.generateSeconds, 1e3 * image.renderSeconds);
+			manifest += entry;
+			if (encode)
+			{
+				std::snprintf(entry, sizeof(entry), ", \"format\": \"%s\", \"bytes\": %zu, \"encodeMs\": %.3f", Encoder::Name(format), encoded.size(), 1e3 * seconds);
+				manifest += entry;
+			}
+			manifest += " }";
+			images++;
+			return written = encode ? Tar::WriteFile(stdout, name, encoded.data(), encoded.size()) : Tar::WriteFile(stdout, name, image.pixels, imageSize);
+		});
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		manifest += "\n] }\n";
+		if (!written || !Tar::WriteFile(stdout, "manifest.json", manifest.data(), manifest.size()) || !Tar::WriteEnd(stdout))
+		{
+			std::fprintf(stderr, "Could not write the archive\n");
+			return 1;
+		}
+
+		std::fprintf(stderr, "%llu images of %llu seeds in %.2f s (%.1f images/s), %llu seeds could not be compiled\n",
+			(unsigned long long)images, (unsigned long long)total, seconds, images / std::max(seconds, 1e-9), (unsigned long long)failures);
+		if (skipped > 0ULL)
+			std::fprintf(stderr, "%llu seeds were skipped as boring\n", (unsigned long long)skipped);
+		if (encode && images > 0ULL)
+			std::fprintf(stderr, "Encoded in %.2f ms per image on the output thread, %.1f KB per image\n", 1e3 * encodeSeconds / images, encodedBytes / 1024.0 / images);
+		return 0;
+	}
+
+	int RunScan(const Options& options)
+	{
+		// Counted seeds are not stored, so a scan can cover billions of them
+		std::vector<uint64_t> list;
+		if (options.seeds && !ReadSeeds(options, list))
+			return 1;
+		const uint64_t total = options.seeds ? list.size() : CountedSeeds(options);
+
+		Moments::Settings settings;
+		settings.minContrast = options.minContrast;
+		settings.maxFlatness = options.maxFlatness;
+		settings.minMotion = options.minMotion;
+
+		// Blocks of seeds are scanned in parallel, then the kept ones are written in the order of the list
+		constexpr uint64_t BLOCK_SIZE = 4096ULL;
+		const uint32_t threadCount = options.threads > 0U ? options.threads : std::max(1U, std::thread::hardware_concurrency());
+		std::vector<uint8_t> keep(BLOCK_SIZE);
+		uint64_t kept = 0ULL;
+
+		auto start = std::chrono::steady_clock::now();
+		for (uint64_t first = 0ULL; first < total; first += BLOCK_SIZE)
+		{
+			const uint64_t count = std::min(BLOCK_SIZE, total - first);
+			auto seed = [&](uint64_t i) { return options.seeds ? list[first + i] : CountedSeed(options, first + i); };
+
+			std::atomic<uint64_t> next{ 0ULL };
+			auto scan = [&]()
+			{
+				for (uint64_t i = next++; i < count; i = next++)
+				{
+					Program program;
+					keep[i] = CompileProgram(GenerateShaderExpression(seed(i), options.correlated), program) && !Moments::Boring(Moments::Predict(program), settings);
+				}
+			};
+			std::vector<std::thread> threads;
+			for (uint32_t t = 1U; t < threadCount; t++)
+				threads.emplace_back(scan);
+			scan();
+			for (std::thread& thread : threads)
+				thread.join();
+
+			for (uint64_t i = 0ULL; i < count; i++)
+			{
+				if (!keep[i])
+					continue;
+				if (std::printf("%llu\n", (unsigned long long)seed(i)) < 0)
+					return 1;
+				kept++;
+			}
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::fprintf(stderr, "%llu of %llu seeds kept in %.2f s (%.0f seeds/s)\n",
+			(unsigned long long)kept, (unsigned long long)total, seconds, total / std::max(seconds, 1e-9));
+		return 0;
+	}
+
+	int RunExplore(const Options& options, const Program& program)
+	{
+		Renderer renderer(options.threads);
+		renderer.SetDeterministic(options.fixed);
+		Viewport view(renderer, options.width, options.height);
+		view.SetProgram(program);
+
+		uint64_t frame = 0ULL;
+		auto start = std::chrono::steady_clock::now();
+		for (; options.frames == 0ULL || frame < options.frames; frame++)
+		{
+			if (frame > 0ULL)
+			{
+				view.Pan(options.panX, options.panY);
+				view.Zoom(options.zoom, 0.5f * options.width, 0.5f * options.height);
+			}
+			view.Refine(frame > 0ULL ? options.refine : 0U);
+
+			if (!WriteImage(options, view.Pixels()))
+				break;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::fprintf(stderr, "%llu frames in %.2f s (%.1f fps), %.1f%% of the pixels shown were rendered\n", (unsigned long long)frame, seconds, frame / std::max(seconds, 1e-9),
+			100.0 * view.RenderedPixels() / std::max<double>(double(frame) * options.width * options.height, 1.0));
+		return 0;
+	}
+
+	void WriteMetrics(const char* path)
+	{
+		if (FILE* file = std::fopen(path, "w"))
+		{
+			std::string text = Metrics::Expose();
+			std::fwrite(text.data(), 1, text.size(), file);
+			std::fclose(file);
+		}
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options options;
+	if (!ParseOptions(argc, argv, options))
+	{
+		PrintUsage();
+		return 1;
+	}
+
+	if (options.consume)
+		return Consume(options);
+
+	// Calibrated costs replace the static ones everywhere, e.g. in the decisions of SplitProgram
+	CostModel::Costs costs;
+	if (options.costs)
+	{
+		if (!CostModel::Load(options.costs, costs))
+		{
+			std::fprintf(stderr, "Could not load the costs %s\n", options.costs);
+			return 1;
+		}
+		CostModel::Apply(costs);
+	}
+
+	// Use the current time as seed by default, like the browser version
+	if (!options.hasSeed)
+		options.seed = std::chrono::time_point_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now()).time_since_epoch().count();
+
+	if (options.stream || options.batch || options.scan)
+	{
+		int result = options.stream ? RunStream(options) : options.batch ? RunBatch(options) : RunScan(options);
+		if (options.metrics)
+			WriteMetrics(options.metrics);
+		return result;
+	}
+
+	// Instances of a wall take the seed and the timing of the animation from the clock of the leader
+	Wall::Clock clock;
+	Wall::Timing timing{ options.seed, 0ULL, options.fps };
+	const bool clocked = options.clock || options.epoch >= 0.0;
+	if (options.clock && options.lead)
+	{
+		timing.epoch = Wall::Now();
+		if (!clock.Create(options.clock, timing))
+		{
+			std::fprintf(stderr, "Could not create the wall clock %s\n", options.clock);
+			return 1;
+		}
+	}
+	else if (options.clock)
+	{
+		if (!clock.Open(options.clock, timing, 10.0))
+		{
+			std::fprintf(stderr, "Could not open the wall clock %s\n", options.clock);
+			return 1;
+		}
+		options.seed = timing.seed;
+		options.fps = timing.fps;
+	}
+	else if (clocked)
+	{
+		timing.epoch = uint64_t(options.epoch * 1e6);
+	}
+
+	Program program;
+	if (!CompileProgram(GenerateShaderExpression(options.seed, options.correlated), program))
+	{
+		std::fprintf(stderr, "Could not compile the shader of seed %llu\n", (unsigned long long)options.seed);
+		return 1;
+	}
+
+	if (options.prune > 0.0f && options.fixed)
+	{
+		std::fprintf(stderr, "Pruning is not supported by the fixed point evaluator, ignoring --prune\n");
+	}
+	else if (options.prune > 0.0f)
+	{
+		Pruning::Settings settings;
+		settings.errorBudget = options.prune;
+		Pruning::Report report = Pruning::Prune(program, settings);
+		std::fprintf(stderr, "Pruned %u subtrees: %u -> %u instructions, cost %.0f -> %.0f (%.1f%% removed), max error %.4f\n",
+			report.replacedSubtrees, report.instructionsBefore, report.instructionsAfter, report.costBefore, report.costAfter,
+			100.0f * (1.0f - report.costAfter / report.costBefore), report.maxError);
+	}
+
+	if (options.surrogates > 0.0f && options.fixed)
+	{
+		std::fprintf(stderr, "Polynomial surrogates are not supported by the fixed point evaluator, ignoring --surrogates\n");
+	}
+	else if (options.surrogates > 0.0f)
+	{
+		Surrogates::Settings settings;
+		settings.errorBound = options.surrogates;
+		Surrogates::Report report = Surrogates::Fit(program, settings);
+		std::fprintf(stderr, "Fitted %u subtrees: %u -> %u instructions, cost %.0f -> %.0f (%.1f%% removed), max error %.4f\n",
+			report.replacedSubtrees, report.instructionsBefore, report.instructionsAfter, report.costBefore, report.costAfter,
+			100.0f * (1.0f - report.costAfter / report.costBefore), report.maxError);
+	}
+
+	if (options.panX != 0 || options.panY != 0 || options.zoom != 1.0f)
+	{
+		int result = RunExplore(options, program);
+		if (options.metrics)
+			WriteMetrics(options.metrics);
+		return result;
+	}
+
+	std::vector<std::unique_ptr<FrameRing>> rings;
+	for (const std::string& name : SplitList(options.shm))
+	{
+		rings.push_back(std::make_unique<FrameRing>());
+		if (!rings.back()->Create(name.c_str(), options.width, options.height, options.slots))
+		{
+			std::fprintf(stderr, "Could not create the frame ring %s\n", name.c_str());
+			return 1;
+		}
+	}
+	std::vector<uint8_t*> slots(rings.size());
+
+	// A single frame would pay for the cache without reading it again
+	Renderer renderer(options.threads);
+	renderer.SetCacheBudget(options.frames == 1ULL ? 0U : size_t(options.cache) << 20U);
+	renderer.SetDeterministic(options.fixed);
+	std::vector<uint8_t> frame(options.shm ? 0U : size_t(options.width) * options.height * 4U);
+	const uint32_t rowPitch = options.width * 4U;
+	const Renderer::Region region = options.wallWidth > 0U ? Wall::PanelRegion(options.wallWidth, options.wallHeight, options.panel) : Renderer::Region();
+
+	if (options.costs)
+	{
+		std::fprintf(stderr, "Predicted %.2f ms per frame without the cache on %u threads of %s, within %.0f%% typically\n",
+			1e3 * CostModel::PredictSeconds(costs, program, options.width, options.height, renderer.ThreadCount()), renderer.ThreadCount(), costs.device.c_str(), 100.0f * costs.error);
+	}
+
+	// Frames are numbered from the epoch of the clock, so every instance of a wall shows the same phase at the same time
+	auto start = std::chrono::steady_clock::now();
+	uint64_t frames = 0ULL, skipped = 0ULL, late = 0ULL;
+	uint64_t number = clocked ? Wall::FrameAt(timing, Wall::Now()) : 0ULL;
+	for (uint64_t i = 0ULL; options.frames == 0ULL || i < options.frames; i++, frames++, number++)
+	{
+		if (options.realtime && clocked)
+		{
+			// Skip the frames that are past due instead of drifting from the other panels
+			uint64_t due = Wall::FrameAt(timing, Wall::Now());
+			if (due > number)
+			{
+				skipped += due - number;
+				number = due;
+			}
+			std::this_thread::sleep_until(std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(Wall::FrameTime(timing, number)))));
+		}
+		else if (options.realtime)
+		{
+			// Late by more than a frame, as counted by Stream
+			auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(i / options.fps));
+			if (std::chrono::steady_clock::now() > deadline + std::chrono::duration<double>(1.0 / options.fps))
+				late++;
+			std::this_thread::sleep_until(deadline);
+		}
+
+		float phase = Renderer::FramePhase(number, options.fps);
+
+		if (!rings.empty())
+		{
+			// Render straight into the shared memory of the first ring with a free slot, and copy the frame to the others
+			uint8_t* target = nullptr;
+			for (size_t r = 0U; r < rings.size(); r++)
+			{
+				slots[r] = rings[r]->BeginWrite(options.drop ? FrameRing::Policy::Drop : FrameRing::Policy::Block);
+				if (!slots[r])
+					rings[r]->Drop();
+				else if (!target)
+					target = slots[r];
+			}
+			if (!target)
+				continue;
+
+			renderer.RenderRegion(program, options.width, options.height, phase, region, target, rowPitch);
+			FrameRing::FrameInfo info{ number, options.seed, phase, FrameRing::Now() };
+			for (size_t r = 0U; r < rings.size(); r++)
+			{
+				if (!slots[r])
+					continue;
+				if (slots[r] != target)
+					std::memcpy(slots[r], target, size_t(rowPitch) * options.height);
+				rings[r]->EndWrite(info);
+			}
+		}
+		else
+		{
+			renderer.RenderRegion(program, options.width, options.height, phase, region, frame.data(), rowPitch);
+			if (!WriteImage(options, frame.data()))
+				break;
+		}
+	}
+
+	if (options.realtime && clocked)
+		std::fprintf(stderr, "%llu frames were skipped to stay on the clock\n", (unsigned long long)skipped);
+	else if (options.realtime)
+		std::fprintf(stderr, "%llu frames missed their deadline\n", (unsigned long long)late);
+
+	if (options.costs && frames > 0ULL)
+	{
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::fprintf(stderr, "Measured %.2f ms per frame over %llu frames\n", 1e3 * seconds / frames, (unsigned long long)frames);
+	}
+
+	if (options.metrics)
+		WriteMetrics(options.metrics);
+
+	return 0;
+}
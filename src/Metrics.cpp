@@ -0,0 +1,228 @@
+#include "Metrics.h"
+
+#include <mutex>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#endif
+
+namespace
+{
+	// Metrics are registered during static initialization, so the registry must be constructed on first use
+	struct Registry
+	{
+		std::mutex mutex;
+		std::vector<const Metrics::Metric*> metrics;
+	};
+	Registry& GetRegistry()
+	{
+		static Registry registry;
+		return registry;
+	}
+
+	// Slot of the calling thread, assigned the first time the thread records anything
+	uint32_t ThreadSlot()
+	{
+		static std::atomic<uint32_t> nextSlot{ 0U };
+		thread_local uint32_t slot = nextSlot.fetch_add(1U, std::memory_order_relaxed) % Metrics::MAX_THREADS;
+		return slot;
+	}
+
+	uint32_t BucketIndex(uint64_t value)
+	{
+		if (value < Metrics::Histogram::SUB_BUCKETS)
+			return uint32_t(value);
+
+		// Position of the highest set bit, then the next 3 bits select the sub-bucket
+		uint32_t exponent = 63U;
+		while (!(value >> exponent))
+			exponent--;
+		uint32_t sub = uint32_t(value >> (exponent - 3U)) & (Metrics::Histogram::SUB_BUCKETS - 1U);
+		return (exponent - 2U) * Metrics::Histogram::SUB_BUCKETS + sub;
+	}
+
+	void AppendHeader(std::string& out, const char* name, const char* help, const char* type)
+	{
+		out += "# HELP "; out += name; out += ' '; out += help; out += '\n';
+		out += "# TYPE "; out += name; out += ' '; out += type; out += '\n';
+	}
+
+	void AppendSample(std::string& out, const char* name, const char* suffix, const char* le, double value)
+	{
+		char buffer[64];
+		std::snprintf(buffer, sizeof(buffer), "%.17g", value);
+		out += name; out += suffix;
+		if (le)
+		{
+			out += "{le=\""; out += le; out += "\"}";
+		}
+		out += ' '; out += buffer; out += '\n';
+	}
+}
+
+Metrics::Metric::Metric(const char* name, const char* help)
+	: m_Name(name), m_Help(help)
+{
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	registry.metrics.push_back(this);
+}
+
+#pragma region Counter
+
+void Metrics::Counter::Add(uint64_t value)
+{
+	m_Slots[ThreadSlot()].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t Metrics::Counter::Value() const
+{
+	uint64_t total = 0ULL;
+	for (const Slot& slot : m_Slots)
+		total += slot.value.load(std::memory_order_relaxed);
+	return total;
+}
+
+void Metrics::Counter::Expose(std::string& out) const
+{
+	AppendHeader(out, m_Name, m_Help, "counter");
+	AppendSample(out, m_Name, "", nullptr, double(Value()));
+}
+
+#pragma endregion
+
+#pragma region Histogram
+
+Metrics::Histogram::~Histogram()
+{
+	for (std::atomic<Shard*>& shard : m_Shards)
+		delete shard.load();
+}
+
+void Metrics::Histogram::Record(uint64_t value)
+{
+	uint32_t slot = ThreadSlot();
+	Shard* shard = m_Shards[slot].load(std::memory_order_acquire);
+	if (!shard)
+		shard = CreateShard(slot);
+
+	shard->buckets[BucketIndex(value)].fetch_add(1ULL, std::memory_order_relaxed);
+	shard->sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+Metrics::Histogram::Shard* Metrics::Histogram::CreateShard(uint32_t slot)
+{
+	Shard* shard = new Shard();
+	for (std::atomic<uint64_t>& bucket : shard->buckets)
+		bucket.store(0ULL, std::memory_order_relaxed);
+	shard->sum.store(0ULL, std::memory_order_relaxed);
+
+	// Another thread sharing the slot may have created it first
+	Shard* expected = nullptr;
+	if (!m_Shards[slot].compare_exchange_strong(expected, shard, std::memory_order_acq_rel))
+	{
+		delete shard;
+		return expected;
+	}
+	return shard;
+}
+
+uint64_t Metrics::Histogram::Sum() const
+{
+	uint64_t total = 0ULL;
+	for (const std::atomic<Shard*>& shard : m_Shards)
+	{
+		if (const Shard* s = shard.load(std::memory_order_acquire))
+			total += s->sum.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+uint64_t Metrics::Histogram::Count() const
+{
+	uint64_t total = 0ULL;
+	for (const std::atomic<Shard*>& shard : m_Shards)
+	{
+		if (const Shard* s = shard.load(std::memory_order_acquire))
+		{
+			for (const std::atomic<uint64_t>& bucket : s->buckets)
+				total += bucket.load(std::memory_order_relaxed);
+		}
+	}
+	return total;
+}
+
+void Metrics::Histogram::Expose(std::string& out) const
+{
+	// Aggregate the shards of all threads
+	std::vector<uint64_t> buckets(BUCKET_COUNT, 0ULL);
+	uint64_t sum = 0ULL;
+	for (const std::atomic<Shard*>& shard : m_Shards)
+	{
+		if (const Shard* s = shard.load(std::memory_order_acquire))
+		{
+			for (uint32_t i = 0U; i < BUCKET_COUNT; i++)
+				buckets[i] += s->buckets[i].load(std::memory_order_relaxed);
+			sum += s->sum.load(std::memory_order_relaxed);
+		}
+	}
+
+	AppendHeader(out, m_Name, m_Help, "histogram");
+
+	// The exposed buckets are whole powers of two (groups of SUB_BUCKETS), between the first and the last ones in use
+	constexpr uint32_t groupCount = BUCKET_COUNT / SUB_BUCKETS;
+	uint32_t first = groupCount, last = 0U;
+	for (uint32_t i = 0U; i < BUCKET_COUNT; i++)
+	{
+		if (buckets[i])
+		{
+			first = std::min(first, i / SUB_BUCKETS);
+			last = std::max(last, i / SUB_BUCKETS);
+		}
+	}
+
+	uint64_t cumulative = 0ULL;
+	for (uint32_t group = 0U; group < groupCount; group++)
+	{
+		for (uint32_t i = 0U; i < SUB_BUCKETS; i++)
+			cumulative += buckets[group * SUB_BUCKETS + i];
+
+		// Group 0 holds the exact values below 8, and group g > 0 holds the values below 2^(g + 3)
+		if (group >= first && group <= last)
+		{
+			char le[32];
+			std::snprintf(le, sizeof(le), "%.6g", double((2ULL << (group + 2U)) - 1ULL) * m_Scale);
+			AppendSample(out, m_Name, "_bucket", le, double(cumulative));
+		}
+	}
+
+	AppendSample(out, m_Name, "_bucket", "+Inf", double(cumulative));
+	AppendSample(out, m_Name, "_sum", nullptr, double(sum) * m_Scale);
+	AppendSample(out, m_Name, "_count", nullptr, double(cumulative));
+}
+
+#pragma endregion
+
+std::string Metrics::Expose()
+{
+	Registry& registry = GetRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+
+	std::string out;
+	for (const Metric* metric : registry.metrics)
+		metric->Expose(out);
+	return out;
+}
+
+#ifdef __EMSCRIPTEN__
+// Exposition endpoint for the page, e.g. Module.UTF8ToString(Module._MetricsText())
+extern "C" EMSCRIPTEN_KEEPALIVE const char* MetricsText()
+{
+	static std::string text;
+	text = Metrics::Expose();
+	return text.c_str();
+}
+#endif
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <chrono>
+#include <cstdint>
+
+/*
+	Counters and histograms that are cheap enough to live in the hot paths.
+
+	Each thread writes to its own cache line with relaxed atomics, so recording never locks nor contends.
+	Values from all threads are only summed when the metrics are scraped by Metrics::Expose.
+
+	Metrics register themselves on construction, and are meant to be defined as globals next to the code they measure:
+
+		Metrics::Counter shaders("pollock_generator_shaders_total", "Number of generated shaders");
+		shaders.Add();
+*/
+namespace Metrics
+{
+	// Threads beyond this number share slots, which is still correct but may contend
+	constexpr uint32_t MAX_THREADS = 64U;
+
+	class Metric
+	{
+	public:
+		Metric(const Metric&) = delete;
+		Metric& operator=(const Metric&) = delete;
+
+		// Append the metric in the Prometheus text format
+		virtual void Expose(std::string& out) const = 0;
+
+	protected:
+		Metric(const char* name, const char* help);
+		virtual ~Metric() = default;
+
+		const char* m_Name;
+		const char* m_Help;
+	};
+
+	// Monotonically increasing count
+	class Counter : public Metric
+	{
+	public:
+		Counter(const char* name, const char* help) : Metric(name, help) {}
+
+		void Add(uint64_t value = 1ULL);
+		// Sum of all threads
+		uint64_t Value() const;
+
+		void Expose(std::string& out) const override;
+
+	private:
+		struct alignas(64) Slot
+		{
+			std::atomic<uint64_t> value{ 0ULL };
+		};
+		Slot m_Slots[MAX_THREADS];
+	};
+
+	/*
+		Distribution of integer values (usually durations in nanoseconds) with HDR-style buckets:
+		values below 8 are exact, and every power of two above that is split in 8 linear sub-buckets,
+		which keeps the relative error under 12.5% for the whole 64-bit range.
+	*/
+	class Histogram : public Metric
+	{
+	public:
+		static constexpr uint32_t SUB_BUCKETS = 8U;
+		static constexpr uint32_t BUCKET_COUNT = (64U - 2U) * SUB_BUCKETS;
+
+		// The scale converts recorded values to the exposed unit (nanoseconds to seconds by default)
+		Histogram(const char* name, const char* help, double scale = 1e-9) : Metric(name, help), m_Scale(scale) {}
+		~Histogram() override;
+
+		void Record(uint64_t value);
+		// Sum and number of recorded values of all threads
+		uint64_t Sum() const;
+		uint64_t Count() const;
+
+		void Expose(std::string& out) const override;
+
+	private:
+		// Allocated the first time each thread records a value
+		struct alignas(64) Shard
+		{
+			std::atomic<uint64_t> buckets[BUCKET_COUNT];
+			std::atomic<uint64_t> sum;
+		};
+		Shard* CreateShard(uint32_t slot);
+
+		std::atomic<Shard*> m_Shards[MAX_THREADS] = {};
+		double m_Scale;
+	};
+
+	// Record the time elapsed between construction and destruction (in nanoseconds) in a histogram
+	class Timer
+	{
+	public:
+		Timer(Histogram& histogram) : m_Histogram(histogram), m_Start(std::chrono::steady_clock::now()) {}
+		~Timer() { m_Histogram.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_Start).count()); }
+
+	private:
+		Histogram& m_Histogram;
+		std::chrono::steady_clock::time_point m_Start;
+	};
+
+	// All registered metrics in the Prometheus text exposition format (version 0.0.4)
+	std::string Expose();
+}
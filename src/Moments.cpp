@@ -0,0 +1,237 @@
+#include "Moments.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Evaluator.h"
+#include "Metrics.h"
+
+namespace
+{
+	Metrics::Histogram predictTime("pollock_moments_duration_seconds", "Time to predict the statistics of the images of one program");
+
+	using Moments::Distribution;
+
+	constexpr uint32_t MAX_ARITY = 4U;
+
+	// 3 point Gauss-Legendre rule, with the nodes in standard deviations of a uniform distribution (sqrt(3/5) of its half width)
+	// It is exact for the polynomials of degree 5 of a uniform argument, and matches the mean and variance of any other
+	constexpr uint32_t NODES = 3U;
+	constexpr float nodeOffsets[NODES] = { -1.3416408f, 0.0f, 1.3416408f };
+	constexpr double nodeWeights[NODES] = { 5.0 / 18.0, 8.0 / 18.0, 5.0 / 18.0 };
+	constexpr uint32_t MAX_GRID = NODES * NODES * NODES * NODES; // Points of the rule for a 4 input function
+
+	// Distributions of the inputs, with the phase uniform in [0, 1) (see Renderer::PhaseInputs for the time inputs)
+	constexpr Distribution coordinate = { 0.5f, 1.0f / 12.0f, 0.0f, 0.0f, 1.0f };
+	constexpr Distribution timeInput = { 0.5f, 0.125f, 0.125f, 0.0f, 1.0f };
+	constexpr Distribution phase = { 0.5f, 1.0f / 12.0f, 1.0f / 12.0f, 0.0f, 1.0f };
+
+	// Random variable behind an argument, so the arguments that are the same value (or its inverse) are not taken as independent
+	constexpr int64_t SOURCE_X = -1, SOURCE_Y = -2;
+	struct Source
+	{
+		int64_t key; // Instruction, or SOURCE_X and SOURCE_Y for the coordinates and their inverses
+		bool flipped; // The argument is 1 minus the source
+	};
+
+	Source FindSource(const std::vector<Instruction>& code, uint32_t i)
+	{
+		bool flipped = false;
+		for (; code[i].op == Op::Inv; i = code[i].args[0])
+			flipped = !flipped;
+
+		switch (code[i].op)
+		{
+		case Op::X: return { SOURCE_X, flipped };
+		case Op::InvX: return { SOURCE_X, !flipped };
+		case Op::Y: return { SOURCE_Y, flipped };
+		case Op::InvY: return { SOURCE_Y, !flipped };
+		default: return { int64_t(i), flipped };
+		}
+	}
+
+	// Arrays of the points where an instruction is evaluated, reused between instructions
+	struct Points
+	{
+		std::vector<float> args[MAX_ARITY];
+		std::vector<float> out;
+		uint32_t count = 0U;
+	};
+
+	Distribution Propagate(const std::vector<Instruction>& code, uint32_t i, const std::vector<Distribution>& values, Points& points)
+	{
+		const Instruction& instruction = code[i];
+		const uint32_t arity = OpArity(instruction.op);
+
+		// One dimension of the rule for each source that varies, shared by the arguments that read it
+		Source sources[MAX_ARITY];
+		int32_t argDimensions[MAX_ARITY];
+		int64_t keys[MAX_ARITY];
+		Distribution dimensions[MAX_ARITY];
+		float constants[MAX_ARITY];
+		uint32_t dimensionCount = 0U;
+		for (uint32_t a = 0U; a < arity; a++)
+		{
+			sources[a] = FindSource(code, instruction.args[a]);
+			const Distribution& source = sources[a].key < 0 ? coordinate : values[size_t(sources[a].key)];
+			argDimensions[a] = -1;
+			if (source.variance <= 0.0f)
+			{
+				constants[a] = sources[a].flipped ? 1.0f - source.mean : source.mean;
+				continue;
+			}
+			for (uint32_t d = 0U; d < dimensionCount && argDimensions[a] < 0; d++)
+				if (keys[d] == sources[a].key)
+					argDimensions[a] = int32_t(d);
+			if (argDimensions[a] < 0)
+			{
+				keys[dimensionCount] = sources[a].key;
+				argDimensions[a] = int32_t(dimensionCount);
+				dimensions[dimensionCount++] = source;
+			}
+		}
+
+		float nodes[MAX_ARITY][NODES];
+		for (uint32_t d = 0U; d < dimensionCount; d++)
+			for (uint32_t k = 0U; k < NODES; k++)
+				nodes[d][k] = std::clamp(dimensions[d].mean + nodeOffsets[k] * std::sqrt(dimensions[d].variance), dimensions[d].low, dimensions[d].high);
+
+		uint32_t gridSize = 1U;
+		for (uint32_t d = 0U; d < dimensionCount; d++)
+			gridSize *= NODES;
+
+		// The points are the grid of the rule, and the corners of the ranges
+		points.count = 0U;
+		auto add = [&](const float* sample)
+		{
+			for (uint32_t a = 0U; a < arity; a++)
+			{
+				if (argDimensions[a] < 0)
+					points.args[a][points.count] = constants[a];
+				else
+					points.args[a][points.count] = sources[a].flipped ? 1.0f - sample[argDimensions[a]] : sample[argDimensions[a]];
+			}
+			points.count++;
+		};
+
+		float sample[MAX_ARITY];
+		for (uint32_t g = 0U; g < gridSize; g++)
+		{
+			for (uint32_t d = 0U, index = g; d < dimensionCount; d++, index /= NODES)
+				sample[d] = nodes[d][index % NODES];
+			add(sample);
+		}
+
+		for (uint32_t corner = 0U; corner < (1U << dimensionCount); corner++)
+		{
+			for (uint32_t d = 0U; d < dimensionCount; d++)
+				sample[d] = corner >> d & 1U ? dimensions[d].high : dimensions[d].low;
+			add(sample);
+		}
+
+		const float* args[MAX_ARITY];
+		for (uint32_t a = 0U; a < arity; a++)
+			args[a] = points.args[a].data();
+		Evaluator::EvaluateInstruction(instruction, args, nullptr, nullptr, 0.0f, 0.0f, points.count, points.out.data());
+		float* out = points.out.data();
+		for (uint32_t p = 0U; p < points.count; p++)
+			if (!std::isfinite(out[p]))
+				out[p] = 0.0f; // Shown as 0 by the renderer
+
+		// Moments over the grid, with the product of the weights of the nodes of every dimension
+		double weights[MAX_GRID];
+		double sum = 0.0, squares = 0.0;
+		for (uint32_t g = 0U; g < gridSize; g++)
+		{
+			double weight = 1.0;
+			for (uint32_t d = 0U, index = g; d < dimensionCount; d++, index /= NODES)
+				weight *= nodeWeights[index % NODES];
+			weights[g] = weight;
+			sum += weight * out[g];
+			squares += weight * out[g] * out[g];
+		}
+
+		Distribution result;
+		result.mean = float(sum);
+		result.variance = float(std::max(0.0, squares - sum * sum));
+
+		// Split the variance between the pixels and the time like the arguments that cause it, weighted by the squared slopes
+		// along them (secants between the nodes of the grid, so no other point is needed)
+		double spaceShare = 0.0, timeShare = 0.0;
+		for (uint32_t d = 0U, stride = 1U; d < dimensionCount; d++, stride *= NODES)
+		{
+			double slopes = 0.0;
+			for (uint32_t g = 0U; g < gridSize; g++)
+			{
+				uint32_t k = g / stride % NODES;
+				uint32_t below = k > 0U ? k - 1U : k, above = k + 1U < NODES ? k + 1U : k;
+				float span = nodes[d][above] - nodes[d][below];
+				if (span > 0.0f)
+				{
+					double slope = (double(out[g + (above - k) * stride]) - out[g - (k - below) * stride]) / span;
+					slopes += weights[g] * slope * slope;
+				}
+			}
+			spaceShare += slopes * (dimensions[d].variance - dimensions[d].motion);
+			timeShare += slopes * dimensions[d].motion;
+		}
+		result.motion = spaceShare + timeShare > 0.0 ? float(result.variance * timeShare / (spaceShare + timeShare)) : 0.0f;
+
+		result.low = result.high = out[0];
+		for (uint32_t p = 1U; p < points.count; p++)
+		{
+			result.low = std::min(result.low, out[p]);
+			result.high = std::max(result.high, out[p]);
+		}
+		return result;
+	}
+}
+
+Moments::Prediction Moments::Predict(const Program& program)
+{
+	Metrics::Timer timer(predictTime);
+
+	const std::vector<Instruction>& code = program.code;
+	std::vector<Distribution> values(code.size());
+
+	// Enough points for the grid of a 4 input function and its corners
+	const size_t maxPoints = MAX_GRID + (1U << MAX_ARITY);
+	Points points;
+	for (std::vector<float>& args : points.args)
+		args.resize(maxPoints);
+	points.out.resize(maxPoints);
+
+	for (uint32_t i = 0U; i < code.size(); i++)
+	{
+		const Instruction& instruction = code[i];
+		switch (instruction.op)
+		{
+		case Op::X: case Op::Y: case Op::InvX: case Op::InvY: values[i] = coordinate; break;
+		case Op::SinTime: case Op::CosTime: values[i] = timeInput; break;
+		case Op::Phase: values[i] = phase; break;
+		case Op::Const: values[i] = { instruction.value, 0.0f, 0.0f, instruction.value, instruction.value }; break;
+		case Op::Cached: values[i] = coordinate; break; // Unknown, see Predict
+		default: values[i] = Propagate(code, i, values, points); break;
+		}
+	}
+
+	Prediction prediction;
+	float contrast = 0.0f, width = 0.0f, motion = 0.0f;
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		const Distribution& channel = prediction.channels[c] = values[program.outputs[c]];
+		contrast += std::max(0.0f, channel.variance - channel.motion);
+		width += std::max(0.0f, std::min(channel.high, 1.0f) - std::max(channel.low, 0.0f));
+		motion += channel.motion;
+	}
+	prediction.contrast = std::sqrt(contrast / 3.0f);
+	prediction.flatness = 1.0f - width / 3.0f;
+	prediction.motion = std::sqrt(motion / 3.0f);
+	return prediction;
+}
+
+bool Moments::Boring(const Prediction& prediction, const Settings& settings)
+{
+	return prediction.contrast < settings.minContrast || prediction.flatness > settings.maxFlatness || prediction.motion < settings.minMotion;
+}
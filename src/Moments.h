@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Program.h"
+
+/*
+	Predicts the statistics of the images of a program from its code, without evaluating a single pixel.
+
+	Every value of the program is described by its distribution over the pixels (uniform uv) and the phases of the animation loop
+	(uniform phase): mean, variance, the part of the variance that comes from the time, and range. The distributions of the inputs
+	are known exactly, and each instruction maps the distributions of its arguments to its own with a 3 point Gauss-Legendre rule
+	per argument, so every primitive of the generator (and the masks, which are lowered to the same ops) is handled by the same
+	code as the evaluator, with at most 97 evaluations for the 4 input functions. The variance is split between the pixels and
+	the time like the variances of the arguments, weighted by the slopes of the instruction along them.
+
+	Arguments are assumed independent, except where they are the same value or one is the inverse of the other (like x and invX),
+	so the predictions are approximations: good enough to reject most boring seeds before rendering them, for a fraction of the
+	cost of even a thumbnail.
+*/
+namespace Moments
+{
+	struct Distribution
+	{
+		float mean;
+		float variance; // Over the pixels and the phases
+		float motion; // Variance over the phases, averaged over the pixels (0 for values that do not depend on the time)
+		float low, high; // Range of the values met by the rule, an estimate rather than a bound
+	};
+
+	struct Prediction
+	{
+		Distribution channels[3]; // r, g and b, before the display clamps them to [0, 1]
+		float contrast; // RMS over the channels of the standard deviation over the pixels of the averaged frame
+		float flatness; // 1 minus the mean width of the ranges of the channels, 1 for a single color
+		float motion; // RMS over the channels of the standard deviation over the phases at each pixel
+	};
+
+	// Seeds that fail any of the thresholds are boring, the defaults reject nothing
+	struct Settings
+	{
+		float minContrast = 0.0f; // e.g. 0.12, which rejects about a tenth of the generated seeds
+		float maxFlatness = 1.0f; // e.g. 0.3
+		float minMotion = 0.0f; // e.g. 0.035, only for animations since static images have no motion
+	};
+
+	// Programs with cache slots are not supported, the prediction must be made before SplitProgram
+	Prediction Predict(const Program& program);
+	bool Boring(const Prediction& prediction, const Settings& settings);
+}
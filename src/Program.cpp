@@ -0,0 +1,485 @@
+#include "Program.h"
+
+#include <map>
+#include <tuple>
+#include <queue>
+#include <string>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+
+namespace
+{
+	struct OpInfo
+	{
+		const char* name;
+		uint32_t arity;
+		float cost; // Rough number of ALU operations, where transcendental functions count as several
+	};
+
+	// Must follow the order of the Op enum
+	constexpr OpInfo opInfo[] =
+	{
+		{ "input.uv.x", 0U, 0.0f }, { "input.uv.y", 0U, 0.0f }, { "invX", 0U, 0.0f }, { "invY", 0U, 0.0f }, { "sinTime", 0U, 0.0f }, { "cosTime", 0U, 0.0f }, { "#", 0U, 0.0f },
+		{ "fInv", 1U, 1.0f }, { "fSqr", 1U, 1.0f }, { "fSqrt", 1U, 4.0f }, { "fSmooth", 1U, 4.0f }, { "fSharp", 1U, 4.0f },
+		{ "fAdd", 2U, 3.0f }, { "fSub", 2U, 3.0f }, { "fMul", 2U, 1.0f }, { "fDiv", 2U, 6.0f }, { "fAvg", 2U, 2.0f }, { "fGeom", 2U, 5.0f }, { "fHarm", 2U, 7.0f },
+		{ "fHypo", 2U, 7.0f }, { "fMax", 2U, 2.0f }, { "fMin", 2U, 2.0f }, { "fPow", 2U, 20.0f }, { "fBell", 2U, 14.0f }, { "fWave", 2U, 10.0f }, { "fBounce", 2U, 18.0f },
+		{ "fLerp", 3U, 4.0f }, { "fMlerp", 3U, 14.0f }, { "fClamp", 3U, 5.0f },
+		{ "fDist", 4U, 8.0f }, { "fDistLine", 4U, 30.0f },
+		{ "cache", 0U, 2.0f },
+		{ "buf.z", 0U, 0.0f }, { "fHorner", 3U, 2.0f }
+	};
+	static_assert(sizeof(opInfo) / sizeof(OpInfo) == size_t(Op::Count), "opInfo must have one entry for each Op");
+
+	// Costs set by SetOpCosts, used instead of those of opInfo
+	float opCosts[size_t(Op::Count)];
+	bool customCosts = false;
+
+	// Recursive descent parser for the expressions produced by the generator
+	class Parser
+	{
+	public:
+		Parser(const std::string& text, std::vector<Instruction>& code)
+			: m_Text(text), m_Pos(0), m_Code(code) {}
+
+		// Parse a scalar function tree and return the instruction that produces its value
+		bool Scalar(uint32_t& node)
+		{
+			SkipSpaces();
+
+			// Random constant, e.g. 0.123457f
+			if (m_Pos < m_Text.size() && (isdigit(m_Text[m_Pos]) || m_Text[m_Pos] == '-'))
+			{
+				char* end;
+				float value = std::strtof(m_Text.c_str() + m_Pos, &end);
+				if (end == m_Text.c_str() + m_Pos)
+					return false;
+				m_Pos = end - m_Text.c_str();
+				if (m_Pos < m_Text.size() && m_Text[m_Pos] == 'f')
+					m_Pos++;
+
+				// Constants are never shared, so that programs of the same structure always have the same shape
+				Instruction instruction{ Op::Const };
+				instruction.value = value;
+				node = uint32_t(m_Code.size());
+				m_Code.push_back(instruction);
+				return true;
+			}
+
+			std::string name = Identifier();
+			for (uint32_t op = 0U; op < uint32_t(Op::Count); op++)
+			{
+				if (Op(op) == Op::Const || Op(op) >= Op::Cached || name != opInfo[op].name)
+					continue;
+
+				uint32_t args[4] = { 0U, 0U, 0U, 0U };
+				if (opInfo[op].arity > 0U)
+				{
+					if (!Expect('('))
+						return false;
+					for (uint32_t i = 0U; i < opInfo[op].arity; i++)
+					{
+						if ((i > 0U && !Expect(',')) || !Scalar(args[i]))
+							return false;
+					}
+					if (!Expect(')'))
+						return false;
+				}
+
+				node = Add(Op(op), args);
+				return true;
+			}
+
+			return false;
+		}
+
+		// Parse the rgb vector, i.e. vec3f(r, g, b)
+		bool Vector(uint32_t nodes[3])
+		{
+			if (Identifier() != "vec3f" || !Expect('('))
+				return false;
+			for (uint32_t i = 0U; i < 3U; i++)
+			{
+				if ((i > 0U && !Expect(',')) || !Scalar(nodes[i]))
+					return false;
+			}
+			return Expect(')');
+		}
+
+		// Parse the mask, lowering each vector helper to one scalar helper per channel
+		bool Mask(uint32_t nodes[3], const uint32_t rgb[3])
+		{
+			std::string name = Identifier();
+			if (name == "rgb")
+			{
+				std::copy(rgb, rgb + 3, nodes);
+				return true;
+			}
+
+			uint32_t x;
+			if (name == "fInv3")
+			{
+				if (!Expect('(') || !Mask(nodes, rgb) || !Expect(')'))
+					return false;
+				for (uint32_t i = 0U; i < 3U; i++)
+				{
+					uint32_t args[4] = { nodes[i], 0U, 0U, 0U };
+					nodes[i] = Add(Op::Inv, args);
+				}
+				return true;
+			}
+			if (name == "fAdd3" || name == "fSub3")
+			{
+				if (!Expect('(') || !Mask(nodes, rgb) || !Expect(',') || !Scalar(x) || !Expect(')'))
+					return false;
+				for (uint32_t i = 0U; i < 3U; i++)
+				{
+					uint32_t args[4] = { nodes[i], x, 0U, 0U };
+					nodes[i] = Add(name == "fAdd3" ? Op::Add : Op::Sub, args);
+				}
+				return true;
+			}
+
+			return false;
+		}
+
+		bool AtEnd()
+		{
+			SkipSpaces();
+			return m_Pos == m_Text.size();
+		}
+
+	private:
+		void SkipSpaces()
+		{
+			while (m_Pos < m_Text.size() && isspace(m_Text[m_Pos]))
+				m_Pos++;
+		}
+
+		bool Expect(char c)
+		{
+			SkipSpaces();
+			if (m_Pos < m_Text.size() && m_Text[m_Pos] == c)
+			{
+				m_Pos++;
+				return true;
+			}
+			return false;
+		}
+
+		// Names of helpers and input variables (the dots allow input.uv.x and input.uv.y)
+		std::string Identifier()
+		{
+			SkipSpaces();
+			size_t start = m_Pos;
+			while (m_Pos < m_Text.size() && (isalnum(m_Text[m_Pos]) || m_Text[m_Pos] == '_' || m_Text[m_Pos] == '.'))
+				m_Pos++;
+			return m_Text.substr(start, m_Pos - start);
+		}
+
+		// Add an instruction, or reuse an identical one that was already added
+		uint32_t Add(Op op, const uint32_t args[4])
+		{
+			auto key = std::make_tuple(op, args[0], args[1], args[2], args[3]);
+			auto it = m_Nodes.find(key);
+			if (it != m_Nodes.end())
+				return it->second;
+
+			Instruction instruction{ op };
+			std::copy(args, args + 4, instruction.args);
+			m_Code.push_back(instruction);
+			m_Nodes.emplace(key, uint32_t(m_Code.size() - 1U));
+			return uint32_t(m_Code.size() - 1U);
+		}
+
+		const std::string& m_Text;
+		size_t m_Pos;
+
+		std::vector<Instruction>& m_Code;
+		std::map<std::tuple<Op, uint32_t, uint32_t, uint32_t, uint32_t>, uint32_t> m_Nodes;
+	};
+}
+
+uint32_t OpArity(Op op) { return opInfo[uint32_t(op)].arity; }
+const char* OpName(Op op) { return opInfo[uint32_t(op)].name; }
+float OpCost(Op op) { return customCosts ? opCosts[uint32_t(op)] : opInfo[uint32_t(op)].cost; }
+
+void SetOpCosts(const float* costs)
+{
+	customCosts = costs != nullptr;
+	if (costs)
+		std::copy(costs, costs + size_t(Op::Count), opCosts);
+}
+
+float ProgramCost(const Program& program)
+{
+	float cost = 0.0f;
+	for (const Instruction& instruction : program.code)
+		cost += OpCost(instruction.op);
+	return cost;
+}
+
+uint64_t StructureHash(const Program& program)
+{
+	// FNV-1a over everything but the constant values
+	uint64_t hash = 14695981039346656037ULL;
+	auto add = [&](uint64_t value)
+	{
+		hash ^= value;
+		hash *= 1099511628211ULL;
+	};
+
+	for (const Instruction& instruction : program.code)
+	{
+		add(uint64_t(instruction.op));
+		for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+			add(instruction.args[a]);
+		if (instruction.op == Op::Cached)
+			add(instruction.args[0]);
+	}
+	for (uint32_t c = 0U; c < 3U; c++)
+		add(program.outputs[c]);
+	for (uint32_t store : program.stores)
+		add(store);
+
+	return hash;
+}
+
+std::vector<float> ProgramConstants(const Program& program)
+{
+	std::vector<float> constants;
+	for (const Instruction& instruction : program.code)
+		if (instruction.op == Op::Const)
+			constants.push_back(instruction.value);
+	return constants;
+}
+
+void SetProgramConstants(Program& program, const std::vector<float>& constants)
+{
+	size_t index = 0U;
+	for (Instruction& instruction : program.code)
+		if (instruction.op == Op::Const && index < constants.size())
+			instruction.value = constants[index++];
+}
+
+bool CompileProgram(const ShaderExpression& expression, Program& program)
+{
+	program.code.clear();
+	program.stores.clear();
+
+	uint32_t rgb[3];
+	Parser rgbParser(expression.rgb, program.code);
+	if (!rgbParser.Vector(rgb) || !rgbParser.AtEnd())
+		return false;
+
+	Parser maskParser(expression.mask, program.code);
+	if (!maskParser.Mask(program.outputs, rgb) || !maskParser.AtEnd())
+		return false;
+
+	ScheduleProgram(program);
+	return true;
+}
+
+void ScheduleProgram(Program& program)
+{
+	const std::vector<Instruction>& code = program.code;
+	const uint32_t size = uint32_t(code.size());
+
+	// Sethi-Ullman number of each instruction (arguments always come before the instructions that use them)
+	std::vector<uint32_t> need(size);
+	for (uint32_t i = 0U; i < size; i++)
+	{
+		uint32_t arity = OpArity(code[i].op);
+		uint32_t argNeeds[4];
+		for (uint32_t a = 0U; a < arity; a++)
+			argNeeds[a] = need[code[i].args[a]];
+		std::sort(argNeeds, argNeeds + arity, std::greater<uint32_t>());
+
+		need[i] = 1U;
+		for (uint32_t a = 0U; a < arity; a++)
+			need[i] = std::max(need[i], argNeeds[a] + a);
+	}
+
+	// Emit the instructions reachable from the outputs, computing the most demanding arguments first
+	std::vector<uint32_t> newIndex(size, UINT32_MAX);
+	std::vector<Instruction> ordered;
+	ordered.reserve(size);
+	// Depth first with an explicit stack, so deep code (e.g. decoded from untrusted bytecode) can not overflow the call stack
+	struct Visit
+	{
+		uint32_t i;
+		uint32_t next; // Arguments already visited
+		uint32_t order[4];
+	};
+	std::vector<Visit> stack;
+	auto emit = [&](uint32_t root)
+	{
+		auto push = [&](uint32_t i)
+		{
+			Visit visit{ i, 0U, { 0U, 1U, 2U, 3U } };
+			std::stable_sort(visit.order, visit.order + OpArity(code[i].op), [&](uint32_t a, uint32_t b) { return need[code[i].args[a]] > need[code[i].args[b]]; });
+			stack.push_back(visit);
+		};
+
+		if (newIndex[root] == UINT32_MAX)
+			push(root);
+		while (!stack.empty())
+		{
+			Visit& visit = stack.back();
+			const uint32_t i = visit.i;
+			const uint32_t arity = OpArity(code[i].op);
+			if (visit.next < arity)
+			{
+				uint32_t arg = code[i].args[visit.order[visit.next++]];
+				if (newIndex[arg] == UINT32_MAX)
+					push(arg);
+				continue;
+			}
+			stack.pop_back();
+
+			Instruction instruction = code[i];
+			for (uint32_t a = 0U; a < arity; a++)
+				instruction.args[a] = newIndex[code[i].args[a]];
+			newIndex[i] = uint32_t(ordered.size());
+			ordered.push_back(instruction);
+		}
+	};
+	uint32_t outputOrder[3] = { 0U, 1U, 2U };
+	std::stable_sort(outputOrder, outputOrder + 3, [&](uint32_t a, uint32_t b) { return need[program.outputs[a]] > need[program.outputs[b]]; });
+	for (uint32_t c : outputOrder)
+		emit(program.outputs[c]);
+	for (uint32_t store : program.stores)
+		emit(store);
+	for (uint32_t& output : program.outputs)
+		output = newIndex[output];
+	for (uint32_t& store : program.stores)
+		store = newIndex[store];
+	program.code.swap(ordered);
+
+	// Liveness: position of the last instruction that reads each value (outputs and stores stay alive until the end)
+	std::vector<uint32_t> lastUse(program.code.size(), 0U);
+	for (uint32_t i = 0U; i < program.code.size(); i++)
+	{
+		for (uint32_t a = 0U; a < OpArity(program.code[i].op); a++)
+			lastUse[program.code[i].args[a]] = i;
+	}
+	for (uint32_t output : program.outputs)
+		lastUse[output] = UINT32_MAX;
+	for (uint32_t store : program.stores)
+		lastUse[store] = UINT32_MAX;
+
+	// Assign registers, always taking the lowest free one to keep the working set compact
+	std::priority_queue<uint16_t, std::vector<uint16_t>, std::greater<uint16_t>> freeRegisters;
+	program.registerCount = 0U;
+	for (uint32_t i = 0U; i < program.code.size(); i++)
+	{
+		Instruction& instruction = program.code[i];
+		uint32_t arity = OpArity(instruction.op);
+
+		for (uint32_t a = 0U; a < arity; a++)
+			instruction.src[a] = program.code[instruction.args[a]].dst;
+
+		// Registers of arguments read for the last time can hold the result, since every element is read before being written
+		for (uint32_t a = 0U; a < arity; a++)
+		{
+			uint32_t arg = instruction.args[a];
+			if (lastUse[arg] == i && std::find(instruction.args, instruction.args + a, arg) == instruction.args + a)
+				freeRegisters.push(program.code[arg].dst);
+		}
+
+		if (freeRegisters.empty())
+		{
+			instruction.dst = uint16_t(program.registerCount++);
+		}
+		else
+		{
+			instruction.dst = freeRegisters.top();
+			freeRegisters.pop();
+		}
+	}
+}
+
+bool SplitProgram(const Program& program, uint32_t maxSlots, Program& space, Program& time)
+{
+	const std::vector<Instruction>& code = program.code;
+	const uint32_t size = uint32_t(code.size());
+
+	// Values that change over time (arguments always come before the instructions that use them)
+	std::vector<uint8_t> animated(size, 0U);
+	for (uint32_t i = 0U; i < size; i++)
+	{
+		animated[i] = code[i].op == Op::SinTime || code[i].op == Op::CosTime || code[i].op == Op::Phase;
+		for (uint32_t a = 0U; a < OpArity(code[i].op); a++)
+			animated[i] |= animated[code[i].args[a]];
+	}
+
+	// Time-independent values read by animated instructions or shown directly, which bound the space stage
+	std::vector<uint8_t> boundary(size, 0U);
+	for (uint32_t i = 0U; i < size; i++)
+		if (animated[i])
+			for (uint32_t a = 0U; a < OpArity(code[i].op); a++)
+				boundary[code[i].args[a]] = 1U;
+	for (uint32_t output : program.outputs)
+		boundary[output] = 1U;
+
+	// Cost of the subtree of each computed boundary value, counting shared values once
+	std::vector<std::pair<float, uint32_t>> candidates;
+	std::vector<uint32_t> visited(size, UINT32_MAX);
+	std::vector<uint32_t> stack;
+	for (uint32_t i = 0U; i < size; i++)
+	{
+		if (!boundary[i] || animated[i] || OpArity(code[i].op) == 0U)
+			continue;
+
+		float cost = 0.0f;
+		stack.assign(1U, i);
+		visited[i] = i;
+		while (!stack.empty())
+		{
+			uint32_t j = stack.back();
+			stack.pop_back();
+			cost += OpCost(code[j].op);
+			for (uint32_t a = 0U; a < OpArity(code[j].op); a++)
+			{
+				uint32_t arg = code[j].args[a];
+				if (visited[arg] != i)
+				{
+					visited[arg] = i;
+					stack.push_back(arg);
+				}
+			}
+		}
+
+		// Reading the cache must be cheaper than computing the value
+		if (cost > OpCost(Op::Cached))
+			candidates.emplace_back(cost, i);
+	}
+	if (candidates.empty() || maxSlots == 0U)
+		return false;
+
+	// Cache the most expensive subtrees first
+	std::stable_sort(candidates.begin(), candidates.end(), [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) { return a.first > b.first; });
+	candidates.resize(std::min<size_t>(candidates.size(), maxSlots));
+
+	space = program;
+	space.stores.clear();
+	time = program;
+	time.stores.clear();
+	for (uint32_t slot = 0U; slot < candidates.size(); slot++)
+	{
+		uint32_t i = candidates[slot].second;
+		space.stores.push_back(i);
+
+		Instruction cached{ Op::Cached };
+		cached.args[0] = slot;
+		time.code[i] = cached;
+	}
+
+	// The space stage has no outputs of its own, so they point at a stored value
+	std::fill(space.outputs, space.outputs + 3, space.stores[0]);
+	ScheduleProgram(space);
+	ScheduleProgram(time);
+
+	return ProgramCost(time) < ProgramCost(program);
+}
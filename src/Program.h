@@ -0,0 +1,106 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Shader.h"
+
+// Every primitive that can appear in a generated expression
+enum class Op : uint8_t
+{
+	// Inputs
+	X, Y, InvX, InvY, SinTime, CosTime, Const,
+
+	// 1 input
+	Inv, Sqr, Sqrt, Smooth, Sharp,
+
+	// 2 inputs
+	Add, Sub, Mul, Div, Avg, Geom, Harm, Hypo, Max, Min, Pow, Bell, Wave, Bounce,
+
+	// 3 inputs
+	Lerp, Mlerp, Clamp,
+
+	// 4 inputs
+	Dist, DistLine,
+
+	// Value read from a cache slot (args[0]), only found in the time stage of SplitProgram
+	Cached,
+
+	// Phase of the animation loop in [0, 1), an input only found in polynomial surrogates (see Surrogates.h)
+	// Appended after the other ops, so their values (and the bytecode of existing programs) do not change
+	Phase,
+	// One step of the Horner scheme of a polynomial surrogate, a * (2 * t - 1) + c for the arguments (a, t, c)
+	Horner,
+
+	Count
+};
+
+// Number of arguments taken by the given operation
+uint32_t OpArity(Op op);
+// Name of the given operation in the generated WGSL code (the helper function, or the input variable)
+const char* OpName(Op op);
+// Static estimate of the cost of the given operation, in ALU operations per pixel
+float OpCost(Op op);
+// Replace the estimates of OpCost (one per op, in the same units), e.g. by costs measured on the device (see CostModel.h)
+// Null restores the static estimates. Not thread safe, meant to be called once at startup
+void SetOpCosts(const float* costs);
+
+struct Instruction
+{
+	Op op = Op::X;
+	uint16_t dst = 0U; // Scratch register that receives the result
+	uint16_t src[4] = {}; // Scratch registers that hold the arguments
+	uint32_t args[4] = {}; // Instructions that produce the arguments (always earlier in the code), or the slot of Op::Cached
+	float value = 0.0f; // Value of Op::Const
+};
+
+// Linearised form of a generated expression
+// The three channel trees (and the mask applied over them) become a single list of instructions,
+// in which identical subtrees are computed only once
+struct Program
+{
+	std::vector<Instruction> code;
+	uint32_t outputs[3] = {}; // Instructions that produce the final r, g and b values
+	uint32_t registerCount = 0U; // Number of scratch registers needed to run the code
+	std::vector<uint32_t> stores; // Instructions whose values are written to the cache slots, in slot order (space stage of SplitProgram)
+};
+
+// Static estimate of the cost of the whole program, in ALU operations per pixel
+float ProgramCost(const Program& program);
+
+// Hash of the code and outputs of the program, ignoring the values of the constants
+// Programs with the same hash only differ in their constants (a structure family), and share their shader code
+// when it is emitted without baked constants (see ConstantMode)
+uint64_t StructureHash(const Program& program);
+// Values of the constants, in the order of the code
+std::vector<float> ProgramConstants(const Program& program);
+void SetProgramConstants(Program& program, const std::vector<float>& constants);
+
+/*
+	Split an animated program in the part that only depends on the pixel and the part that changes over time.
+
+	The space stage computes the values of the most expensive time-independent subtrees read by the rest of the code (up to maxSlots),
+	and stores them in cache slots. Its outputs are meaningless, only its stores matter.
+	The time stage is the original program with these subtrees replaced by Op::Cached reads of the slots.
+	So a renderer can run the space stage once per image size, and only the time stage for every frame.
+	Static programs become a time stage that only reads the cache.
+
+	Returns false if caching would not make the frames cheaper, e.g. when every expensive value depends on the time.
+*/
+bool SplitProgram(const Program& program, uint32_t maxSlots, Program& space, Program& time);
+
+// Parse the generated expressions into a scheduled program
+// Returns false if the expressions do not follow the grammar of the generator
+bool CompileProgram(const ShaderExpression& expression, Program& program);
+
+/*
+	Reorder the code and assign its scratch registers, similar to register allocation in a compiler.
+
+	Instructions that are not reachable from the outputs (or the stores) are removed.
+	The remaining ones are ordered with Sethi-Ullman numbering (arguments that need more registers are computed first),
+	then a liveness pass frees the register of each value right after its last use, so it can be reused by later results.
+	The register count grows with the depth of the trees instead of their size.
+
+	Must be called again after any change to the code (args and outputs are the source of truth, dst and src are derived).
+*/
+void ScheduleProgram(Program& program);
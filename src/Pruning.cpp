@@ -0,0 +1,213 @@
+#include "Pruning.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Evaluator.h"
+#include "Metrics.h"
+
+namespace
+{
+	Metrics::Counter prunedSubtrees("pollock_pruned_subtrees_total", "Number of subtrees replaced by constants when pruning programs");
+	Metrics::Histogram pruneTime("pollock_prune_duration_seconds", "Time to prune one program");
+
+	// Value of a channel as it ends up on screen (NaN is shown as 0, like in the renderer)
+	inline float Displayed(float v) { return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f; }
+
+	// Mark the instructions reachable from the outputs (arguments always come before their users)
+	void MarkLive(const Program& program, std::vector<uint8_t>& live)
+	{
+		live.assign(program.code.size(), 0U);
+		for (uint32_t c = 0U; c < 3U; c++)
+			live[program.outputs[c]] = 1U;
+
+		for (size_t i = program.code.size(); i-- > 0U;)
+			if (live[i])
+				for (uint32_t a = 0U; a < OpArity(program.code[i].op); a++)
+					live[program.code[i].args[a]] = 1U;
+	}
+}
+
+Pruning::Report Pruning::Prune(Program& program, const Settings& settings)
+{
+	Metrics::Timer timer(pruneTime);
+
+	std::vector<Instruction>& code = program.code;
+	const uint32_t n = uint32_t(code.size());
+
+	Report report{};
+	report.instructionsBefore = n;
+	report.costBefore = ProgramCost(program);
+
+	#pragma region Samples
+
+	// Static programs look the same at every phase
+	bool animated = false;
+	for (const Instruction& instruction : code)
+		animated |= instruction.op == Op::SinTime || instruction.op == Op::CosTime || instruction.op == Op::Phase;
+
+	const uint32_t gridSize = settings.gridSize > 0U ? settings.gridSize : 1U;
+	const uint32_t phaseCount = animated && settings.phaseCount > 0U ? settings.phaseCount : 1U;
+	const uint32_t perPhase = gridSize * gridSize;
+	const size_t sampleCount = size_t(perPhase) * phaseCount;
+
+	// Every phase samples a differently jittered grid (R2 sequence), so together they cover more positions
+	std::vector<float> x(sampleCount), y(sampleCount), sinTime(phaseCount), cosTime(phaseCount);
+	for (uint32_t p = 0U; p < phaseCount; p++)
+	{
+		float angle = 6.2831853f * float(p) / float(phaseCount);
+		sinTime[p] = 0.5f + 0.5f * std::sin(angle);
+		cosTime[p] = 0.5f + 0.5f * std::cos(angle);
+
+		float jitterX = std::fmod(0.5f + 0.7548777f * float(p), 1.0f);
+		float jitterY = std::fmod(0.5f + 0.5698403f * float(p), 1.0f);
+		for (uint32_t row = 0U; row < gridSize; row++)
+		{
+			for (uint32_t column = 0U; column < gridSize; column++)
+			{
+				size_t s = size_t(p) * perPhase + row * gridSize + column;
+				x[s] = (float(column) + jitterX) / float(gridSize);
+				y[s] = (float(row) + jitterY) / float(gridSize);
+			}
+		}
+	}
+
+	#pragma endregion
+
+	#pragma region Reference
+
+	// Value of every instruction for every sample, one row per instruction
+	std::vector<float> values(size_t(n) * sampleCount);
+
+	// Rows of the instructions affected by the current trial, indexed by trialRow (-1 if unaffected)
+	std::vector<int32_t> trialRow(n, -1);
+	std::vector<float> trialValues;
+	std::vector<uint32_t> trialChanged;
+
+	auto row = [&](uint32_t i) -> float*
+	{
+		return trialRow[i] >= 0 ? trialValues.data() + size_t(trialRow[i]) * sampleCount : values.data() + size_t(i) * sampleCount;
+	};
+
+	auto evaluate = [&](uint32_t i, float* out)
+	{
+		const Instruction& instruction = code[i];
+		for (uint32_t p = 0U; p < phaseCount; p++)
+		{
+			size_t offset = size_t(p) * perPhase;
+			const float* args[4];
+			for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+				args[a] = row(instruction.args[a]) + offset;
+
+			Evaluator::EvaluateInstruction(instruction, args, x.data() + offset, y.data() + offset, sinTime[p], cosTime[p], perPhase, out + offset);
+		}
+	};
+
+	for (uint32_t i = 0U; i < n; i++)
+		evaluate(i, values.data() + size_t(i) * sampleCount);
+
+	// The budget is always checked against the original program, so the errors of several replacements cannot add up past it
+	std::vector<float> reference(3U * sampleCount);
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		const float* output = row(program.outputs[c]);
+		for (size_t s = 0U; s < sampleCount; s++)
+			reference[c * sampleCount + s] = Displayed(output[s]);
+	}
+
+	#pragma endregion
+
+	#pragma region Trials
+
+	std::vector<uint8_t> live;
+	MarkLive(program, live);
+
+	// From the outputs down, so the largest subtrees are tried first
+	for (uint32_t i = n; i-- > 0U;)
+	{
+		if (!live[i] || OpArity(code[i].op) == 0U)
+			continue;
+
+		// Mean over the samples, ignoring the ones where the value is not a number
+		double sum = 0.0;
+		size_t finiteCount = 0U;
+		const float* current = values.data() + size_t(i) * sampleCount;
+		for (size_t s = 0U; s < sampleCount; s++)
+		{
+			if (std::isfinite(current[s]))
+			{
+				sum += current[s];
+				finiteCount++;
+			}
+		}
+		if (finiteCount == 0U)
+			continue;
+		float mean = float(sum / double(finiteCount));
+
+		// Replace the instruction by its mean, and recompute only the instructions that depend on it
+		trialChanged.assign(1U, i);
+		trialValues.assign(sampleCount, mean);
+		trialRow[i] = 0;
+
+		for (uint32_t j = i + 1U; j < n; j++)
+		{
+			if (!live[j])
+				continue;
+
+			bool affected = false;
+			for (uint32_t a = 0U; a < OpArity(code[j].op); a++)
+				affected |= trialRow[code[j].args[a]] >= 0;
+			if (!affected)
+				continue;
+
+			trialRow[j] = int32_t(trialChanged.size());
+			trialChanged.push_back(j);
+			trialValues.resize(trialChanged.size() * sampleCount);
+			evaluate(j, trialValues.data() + size_t(trialRow[j]) * sampleCount);
+		}
+
+		float error = 0.0f;
+		for (uint32_t c = 0U; c < 3U && error <= settings.errorBudget; c++)
+		{
+			const float* output = row(program.outputs[c]);
+			for (size_t s = 0U; s < sampleCount; s++)
+				error = std::fmax(error, std::fabs(Displayed(output[s]) - reference[c * sampleCount + s]));
+		}
+
+		// Keep the replacement
+		bool keep = error <= settings.errorBudget;
+		for (uint32_t j : trialChanged)
+		{
+			if (keep)
+				std::copy_n(row(j), sampleCount, values.data() + size_t(j) * sampleCount);
+			trialRow[j] = -1;
+		}
+
+		if (keep)
+		{
+			code[i].op = Op::Const;
+			code[i].value = mean;
+			report.replacedSubtrees++;
+			MarkLive(program, live);
+		}
+	}
+
+	#pragma endregion
+
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		const float* output = row(program.outputs[c]);
+		for (size_t s = 0U; s < sampleCount; s++)
+			report.maxError = std::fmax(report.maxError, std::fabs(Displayed(output[s]) - reference[c * sampleCount + s]));
+	}
+
+	// Remove the subtrees below the new constants
+	ScheduleProgram(program);
+
+	report.instructionsAfter = uint32_t(program.code.size());
+	report.costAfter = ProgramCost(program);
+	prunedSubtrees.Add(report.replacedSubtrees);
+
+	return report;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Program.h"
+
+/*
+	Removes the parts of a program that have no visible effect on the image.
+
+	Deep trees often contain subtrees that barely change the result, like an argument of fMin that is almost always the larger one,
+	or the second argument of fLerp when the weight stays near 0. Every instruction (from the outputs down) is tried as a constant
+	equal to its mean over a set of samples, and the replacement is kept only if the displayed color of every sample stays within
+	the error budget of the original program. The subtree below a replaced instruction is then removed as dead code.
+
+	The samples are a jittered grid of pixels, repeated over several phases of the animation loop, so the budget is checked on
+	a few thousand pixels and not on every pixel of every frame. Errors are measured after clamping to [0, 1] like the display does.
+*/
+namespace Pruning
+{
+	struct Settings
+	{
+		float errorBudget = 1.0f / 255.0f; // Maximum change of any channel of any sample (one step of an 8 bit color by default)
+		uint32_t gridSize = 16U; // Samples per phase are gridSize * gridSize
+		uint32_t phaseCount = 8U; // Phases of the animation loop to sample (only one for static programs)
+	};
+
+	struct Report
+	{
+		uint32_t replacedSubtrees;
+		uint32_t instructionsBefore;
+		uint32_t instructionsAfter;
+		float costBefore; // Static cost estimate (see OpCost)
+		float costAfter;
+		float maxError; // Largest error of the pruned program over the samples
+	};
+
+	// Prune the program in place and reschedule it
+	Report Prune(Program& program, const Settings& settings = Settings());
+}
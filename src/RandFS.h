@@ -626,6 +626,13 @@ public:
 			arr[swapIndex] = temp;
 		}
 	}
+	// Map the index i on [0, size-1] to another index on [0, size-1] from a 64-bit hash seed, visiting the whole range without repeats
+	// as i goes from 0 to size-1, in O(1) time and memory (a size of 0 stands for the whole 64-bit range)
+	static uint64_t Permute64(uint64_t i, uint64_t size, uint64_t seed);
+	// Map the index i on [0, size-1] to another index on [0, size-1] from a 32-bit hash seed, visiting the whole range without repeats
+	// as i goes from 0 to size-1, in O(1) time and memory (a size of 0 stands for the whole 32-bit range)
+	static uint32_t Permute32(uint32_t i, uint32_t size, uint32_t seed);
+
 	// Return a reference to an element in the given array selected from a 64-bit hash seed
 	template <typename T>
 	static T& Element64(T* arr, uint64_t size, uint64_t seed)
@@ -837,6 +844,71 @@ uint32_t Hash::String32(const char* string, uint32_t seed)
 	return UInt32(x, seed);
 }
 
+// Feistel network over the smallest even number of bits that holds size - 1, which is a bijection of [0, 2^bits-1] for any round function
+// Results outside of [0, size-1] are permuted again until they fall inside (cycle-walking), which keeps the bijection on [0, size-1]
+// Since size - 1 needs more than bits - 2 bits, less than 4 walks are needed on average
+// Small halves give the round functions few distinct inputs, hence a few more rounds than the 4 of Luby-Rackoff
+uint64_t Hash::Permute64(uint64_t i, uint64_t size, uint64_t seed)
+{
+	uint64_t last = size - 1ULL; // A size of 0 wraps around to the whole range
+
+	uint32_t bits = 2U;
+	while (bits < 64U && (last >> bits) != 0ULL)
+	{
+		bits += 2U;
+	}
+	uint32_t half = bits >> 1;
+	uint64_t mask = (1ULL << half) - 1ULL;
+
+	do
+	{
+		uint64_t left = i >> half;
+		uint64_t right = i & mask;
+
+		for (uint64_t round = 0ULL; round < 6ULL; round++)
+		{
+			uint64_t next = left ^ (UInt64(Pair(right, round), seed) & mask);
+			left = right;
+			right = next;
+		}
+
+		i = (left << half) | right;
+	}
+	while (i > last);
+
+	return i;
+}
+uint32_t Hash::Permute32(uint32_t i, uint32_t size, uint32_t seed)
+{
+	uint32_t last = size - 1U; // A size of 0 wraps around to the whole range
+
+	uint32_t bits = 2U;
+	while (bits < 32U && (last >> bits) != 0U)
+	{
+		bits += 2U;
+	}
+	uint32_t half = bits >> 1;
+	uint32_t mask = (1U << half) - 1U;
+
+	do
+	{
+		uint32_t left = i >> half;
+		uint32_t right = i & mask;
+
+		for (uint32_t round = 0U; round < 6U; round++)
+		{
+			uint32_t next = left ^ (UInt32(Pair(right, round), seed) & mask);
+			left = right;
+			right = next;
+		}
+
+		i = (left << half) | right;
+	}
+	while (i > last);
+
+	return i;
+}
+
 #pragma endregion
 
 #endif // RANDFS_IMPLEMENTATION
@@ -0,0 +1,371 @@
+#include "Renderer.h"
+#include "Evaluator.h"
+#include "Metrics.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+	Metrics::Counter renderedFrames("pollock_cpu_frames_total", "Number of frames rendered on the CPU");
+	Metrics::Histogram frameTime("pollock_cpu_frame_duration_seconds", "Time to render one frame on the CPU");
+	Metrics::Counter cacheFills("pollock_cpu_cache_fills_total", "Number of times the space stage of a program was evaluated into the cache");
+
+	// Same conversion as a unorm8 render target (NaN becomes black)
+	inline uint8_t ToUnorm8(float v)
+	{
+		v = v >= 0.0f ? v : 0.0f;
+		v = v <= 1.0f ? v : 1.0f;
+		return uint8_t(v * 255.0f + 0.5f);
+	}
+}
+
+Renderer::Renderer(uint32_t threadCount)
+{
+	if (threadCount == 0U)
+		threadCount = std::max(1U, std::thread::hardware_concurrency());
+
+	// The thread that calls Render also renders, so it uses the first scratch
+	m_Scratch.resize(threadCount);
+	m_FixedScratch.resize(threadCount);
+	for (uint32_t i = 1U; i < threadCount; i++)
+		m_Workers.emplace_back(&Renderer::WorkerLoop, this, i);
+}
+
+Renderer::~Renderer()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Quit = true;
+	}
+	m_Start.notify_all();
+	for (std::thread& worker : m_Workers)
+		worker.join();
+}
+
+void Renderer::PhaseInputs(float phase, float& sinTime, float& cosTime)
+{
+	// Graphics::Update uses sin(0.5 * time), so a whole loop takes 4 pi seconds
+	float angle = 6.2831853f * phase;
+	sinTime = 0.5f + 0.5f * std::sin(angle);
+	cosTime = 0.5f + 0.5f * std::cos(angle);
+}
+
+float Renderer::FramePhase(uint64_t frame, float fps)
+{
+	// A loop takes 4 pi seconds (see PhaseInputs)
+	double loops = double(frame) / (double(fps) * 12.566370614359172);
+	return float(loops - uint64_t(loops));
+}
+
+void Renderer::SetCacheBudget(size_t bytes)
+{
+	m_CacheBudget = bytes;
+	m_Caches.clear();
+}
+
+void Renderer::Render(const Program& program, uint32_t width, uint32_t height, float phase, uint8_t* pixels, uint32_t rowPitch)
+{
+	RenderRegion(program, width, height, phase, Region(), pixels, rowPitch);
+}
+
+void Renderer::RenderRegion(const Program& program, uint32_t width, uint32_t height, float phase, const Region& region, uint8_t* pixels, uint32_t rowPitch)
+{
+	Metrics::Timer timer(frameTime);
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Width = width;
+		m_Height = height;
+		m_RowPitch = rowPitch;
+		m_Pixels = pixels;
+		m_Region = region;
+		m_FullRegion = region.x == 0.0f && region.y == 0.0f && region.width == 1.0f && region.height == 1.0f;
+		m_Rect = Rect{ 0U, 0U, width, height };
+		PhaseInputs(phase, m_SinTime, m_CosTime);
+		Fixed::PhaseInputs(phase, m_FixedSinTime, m_FixedCosTime);
+		m_ChunksPerRow = (width + Evaluator::BATCH_SIZE - 1U) / Evaluator::BATCH_SIZE;
+	}
+
+	Cache* cache = m_CacheBudget > 0U && !m_Deterministic ? FindCache(program, width, height, region) : nullptr;
+	if (cache && cache->split)
+	{
+		if (cache->values.empty())
+		{
+			cache->values.resize(size_t(m_ChunksPerRow) * height * cache->space.stores.size() * Evaluator::BATCH_SIZE);
+			RunJob(cache->space, cache, true);
+			cacheFills.Add();
+		}
+		RunJob(cache->time, cache, false);
+	}
+	else
+	{
+		RunJob(program, nullptr, false);
+	}
+
+	renderedFrames.Add();
+}
+
+void Renderer::RenderRect(const Program& program, uint32_t width, uint32_t height, float phase, const Region& region, const Rect& rect, uint8_t* pixels, uint32_t rowPitch)
+{
+	if (rect.width == 0U || rect.height == 0U || rect.x + rect.width > width || rect.y + rect.height > height)
+		return;
+
+	Metrics::Timer timer(frameTime);
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Width = width;
+		m_Height = height;
+		m_RowPitch = rowPitch;
+		m_Pixels = pixels;
+		m_Region = region;
+		m_FullRegion = region.x == 0.0f && region.y == 0.0f && region.width == 1.0f && region.height == 1.0f;
+		m_Rect = rect;
+		PhaseInputs(phase, m_SinTime, m_CosTime);
+		Fixed::PhaseInputs(phase, m_FixedSinTime, m_FixedCosTime);
+		m_ChunksPerRow = (rect.width + Evaluator::BATCH_SIZE - 1U) / Evaluator::BATCH_SIZE;
+	}
+
+	RunJob(program, nullptr, false);
+}
+
+void Renderer::RenderFamily(const Program& program, const std::vector<std::vector<float>>& constants, uint32_t width, uint32_t height, float phase, uint8_t* const* pixels, uint32_t rowPitch)
+{
+	if (constants.empty())
+		return;
+
+	// The fixed point evaluator has no family version
+	if (m_Deterministic)
+	{
+		Program member = program;
+		for (size_t m = 0U; m < constants.size(); m++)
+		{
+			SetProgramConstants(member, constants[m]);
+			Render(member, width, height, phase, pixels[m], rowPitch);
+		}
+		return;
+	}
+
+	Metrics::Timer timer(frameTime);
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Width = width;
+		m_Height = height;
+		m_RowPitch = rowPitch;
+		m_Pixels = pixels[0]; // Each member is written to its own image instead
+		m_Region = Region();
+		m_FullRegion = true;
+		m_Rect = Rect{ 0U, 0U, width, height };
+		PhaseInputs(phase, m_SinTime, m_CosTime);
+		m_ChunksPerRow = (width + Evaluator::BATCH_SIZE - 1U) / Evaluator::BATCH_SIZE;
+
+		m_FamilySize = uint32_t(constants.size());
+		m_FamilyVarying = Evaluator::VaryingInstructions(program);
+		m_FamilyConstants.clear();
+		for (const std::vector<float>& values : constants)
+			m_FamilyConstants.push_back(values.data());
+		m_FamilyPixels = pixels;
+	}
+
+	RunJob(program, nullptr, false);
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_FamilySize = 0U;
+	}
+
+	renderedFrames.Add(constants.size());
+}
+
+Renderer::Cache* Renderer::FindCache(const Program& program, uint32_t width, uint32_t height, const Region& region)
+{
+	uint64_t structure = StructureHash(program);
+	std::vector<float> constants = ProgramConstants(program);
+
+	m_CacheClock++;
+	for (std::unique_ptr<Cache>& cache : m_Caches)
+	{
+		if (cache->structure == structure && cache->constants == constants && cache->width == width && cache->height == height
+			&& cache->region.x == region.x && cache->region.y == region.y && cache->region.width == region.width && cache->region.height == region.height)
+		{
+			cache->lastUse = m_CacheClock;
+			return cache.get();
+		}
+	}
+
+	std::unique_ptr<Cache> cache = std::make_unique<Cache>();
+	cache->structure = structure;
+	cache->constants = std::move(constants);
+	cache->width = width;
+	cache->height = height;
+	cache->region = region;
+	cache->lastUse = m_CacheClock;
+
+	// Each entry gets an equal share of the budget, where a slot takes one float per pixel (rounded up to whole chunks)
+	size_t slotBytes = size_t(m_ChunksPerRow) * height * Evaluator::BATCH_SIZE * sizeof(float);
+	size_t maxSlots = std::min<size_t>(m_CacheBudget / CACHE_ENTRIES / std::max<size_t>(slotBytes, 1U), UINT32_MAX);
+	cache->split = SplitProgram(program, uint32_t(maxSlots), cache->space, cache->time);
+
+	// Replace the least recently used entry
+	if (m_Caches.size() < CACHE_ENTRIES)
+	{
+		m_Caches.push_back(std::move(cache));
+		return m_Caches.back().get();
+	}
+	auto oldest = std::min_element(m_Caches.begin(), m_Caches.end(), [](const std::unique_ptr<Cache>& a, const std::unique_ptr<Cache>& b) { return a->lastUse < b->lastUse; });
+	*oldest = std::move(cache);
+	return oldest->get();
+}
+
+void Renderer::RunJob(const Program& program, Cache* cache, bool fill)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Program = &program;
+		m_Cache = cache;
+		m_Fill = fill;
+		m_NextChunk.store(0U, std::memory_order_relaxed);
+		m_Busy = uint32_t(m_Workers.size());
+		m_Generation++;
+	}
+	m_Start.notify_all();
+
+	RenderChunks(0U);
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Done.wait(lock, [this] { return m_Busy == 0U; });
+}
+
+void Renderer::WorkerLoop(uint32_t index)
+{
+	uint64_t generation = 0ULL;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Start.wait(lock, [&] { return m_Quit || m_Generation != generation; });
+			if (m_Quit)
+				return;
+			generation = m_Generation;
+		}
+
+		RenderChunks(index);
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_Busy == 0U)
+			m_Done.notify_one();
+	}
+}
+
+void Renderer::RenderChunks(uint32_t worker)
+{
+	constexpr uint32_t B = Evaluator::BATCH_SIZE;
+	float x[B], y[B], r[B], g[B], b[B];
+	Fixed::Value xi[B], yi[B], ri[B], gi[B], bi[B];
+	std::vector<float>& scratch = m_Scratch[worker];
+
+	// Cached values of the current chunk, one array per slot
+	const size_t slotCount = m_Cache ? m_Cache->space.stores.size() : 0U;
+	std::vector<float*> slots(slotCount);
+
+	// Channels of every member of the family, one array of B values each
+	const uint32_t members = m_FamilySize;
+	std::vector<float> family(size_t(members) * 3U * B);
+	std::vector<float*> channels(size_t(members) * 3U);
+	for (size_t i = 0U; i < channels.size(); i++)
+		channels[i] = family.data() + i * B;
+
+	const uint32_t chunkCount = m_ChunksPerRow * m_Rect.height;
+	for (uint32_t chunk = m_NextChunk.fetch_add(1U); chunk < chunkCount; chunk = m_NextChunk.fetch_add(1U))
+	{
+		uint32_t row = m_Rect.y + chunk / m_ChunksPerRow;
+		uint32_t start = m_Rect.x + (chunk % m_ChunksPerRow) * B;
+		uint32_t count = std::min(B, m_Rect.x + m_Rect.width - start);
+		size_t offset = size_t(row) * m_RowPitch + size_t(start) * 4U;
+		uint8_t* out = m_Pixels + offset;
+
+		if (m_Deterministic)
+		{
+			if (m_FullRegion)
+			{
+				Fixed::Value v = Fixed::ONE - Fixed::PixelCenter(row, m_Height);
+				for (uint32_t i = 0U; i < count; i++)
+				{
+					xi[i] = Fixed::PixelCenter(start + i, m_Width);
+					yi[i] = v;
+				}
+			}
+			else
+			{
+				Fixed::Value v = Fixed::FromFloat(m_Region.y + m_Region.height * (1.0f - (row + 0.5f) / m_Height));
+				for (uint32_t i = 0U; i < count; i++)
+				{
+					xi[i] = Fixed::FromFloat(m_Region.x + m_Region.width * ((start + i + 0.5f) / m_Width));
+					yi[i] = v;
+				}
+			}
+
+			Fixed::EvaluateBatch(*m_Program, xi, yi, m_FixedSinTime, m_FixedCosTime, count, ri, gi, bi, m_FixedScratch[worker]);
+
+			for (uint32_t i = 0U; i < count; i++)
+			{
+				out[4U * i + 0U] = Fixed::ToUnorm8(ri[i]);
+				out[4U * i + 1U] = Fixed::ToUnorm8(gi[i]);
+				out[4U * i + 2U] = Fixed::ToUnorm8(bi[i]);
+				out[4U * i + 3U] = 255U;
+			}
+			continue;
+		}
+
+		// Pixel centers in uv space, with uv.y = 1 at the top like the fullscreen quad of the shader (the full region maps them as they are)
+		float v = m_Region.y + m_Region.height * (1.0f - (row + 0.5f) / m_Height);
+		for (uint32_t i = 0U; i < count; i++)
+		{
+			x[i] = m_Region.x + m_Region.width * ((start + i + 0.5f) / m_Width);
+			y[i] = v;
+		}
+
+		if (members > 0U)
+		{
+			Evaluator::EvaluateFamily(*m_Program, m_FamilyVarying, m_FamilyConstants.data(), members, x, y, m_SinTime, m_CosTime, count,
+				channels.data(), channels.data() + members, channels.data() + 2U * members, scratch);
+
+			for (uint32_t m = 0U; m < members; m++)
+			{
+				const float* rm = channels[m];
+				const float* gm = channels[members + m];
+				const float* bm = channels[2U * members + m];
+				uint8_t* pixels = m_FamilyPixels[m] + offset;
+				for (uint32_t i = 0U; i < count; i++)
+				{
+					pixels[4U * i + 0U] = ToUnorm8(rm[i]);
+					pixels[4U * i + 1U] = ToUnorm8(gm[i]);
+					pixels[4U * i + 2U] = ToUnorm8(bm[i]);
+					pixels[4U * i + 3U] = 255U;
+				}
+			}
+			continue;
+		}
+
+		for (size_t slot = 0U; slot < slotCount; slot++)
+			slots[slot] = m_Cache->values.data() + (size_t(chunk) * slotCount + slot) * B;
+
+		if (m_Fill)
+		{
+			Evaluator::EvaluateStores(*m_Program, x, y, count, slots.data(), scratch);
+			continue;
+		}
+
+		Evaluator::EvaluateBatch(*m_Program, x, y, m_SinTime, m_CosTime, count, r, g, b, scratch, slots.data());
+
+		for (uint32_t i = 0U; i < count; i++)
+		{
+			out[4U * i + 0U] = ToUnorm8(r[i]);
+			out[4U * i + 1U] = ToUnorm8(g[i]);
+			out[4U * i + 2U] = ToUnorm8(b[i]);
+			out[4U * i + 3U] = 255U;
+		}
+	}
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <condition_variable>
+
+#include "Fixed.h"
+#include "Program.h"
+
+/*
+	CPU counterpart of Graphics: renders programs into RGBA8 images with a pool of worker threads.
+
+	Animated programs are split in a space stage and a time stage (see SplitProgram). The space stage is evaluated into a cache
+	the first time a program is rendered at a given size, in structure of arrays tiles that match the chunks of the frames,
+	then every frame only evaluates the time stage, reading the cached values. The cache keeps the last CACHE_ENTRIES programs,
+	so the two programs of a crossfade do not evict each other.
+*/
+class Renderer
+{
+public:
+	static constexpr size_t DEFAULT_CACHE_BUDGET = size_t(256U) << 20U;
+	static constexpr uint32_t CACHE_ENTRIES = 2U;
+
+	// Use 0 threads for one per hardware thread
+	Renderer(uint32_t threadCount = 0U);
+	~Renderer();
+
+	Renderer(const Renderer&) = delete;
+	Renderer& operator=(const Renderer&) = delete;
+
+	// Region of the uv space covered by a frame: its bottom left corner and its size, like the region of the GPU exports
+	struct Region
+	{
+		float x = 0.0f, y = 0.0f;
+		float width = 1.0f, height = 1.0f;
+	};
+
+	// Rectangle of pixels of a frame, from its top left corner
+	struct Rect
+	{
+		uint32_t x, y;
+		uint32_t width, height;
+	};
+
+	// Render a frame at the given phase of the animation loop, in [0, 1)
+	// Rows are rowPitch bytes apart (at least 4 * width), and the first row is the top of the image, as on the canvas
+	void Render(const Program& program, uint32_t width, uint32_t height, float phase, uint8_t* pixels, uint32_t rowPitch);
+	// Render a frame that covers the given region of the uv space (e.g. the panel of a video wall, see Wall.h), with the cache like Render
+	void RenderRegion(const Program& program, uint32_t width, uint32_t height, float phase, const Region& region, uint8_t* pixels, uint32_t rowPitch);
+
+	// Render only the pixels of rect, of a frame that covers the given region of the uv space (e.g. the strips exposed by a pan)
+	// The pixels are those of the whole frame, and the other pixels are left as they are. The cache is not used
+	// Outside of the full region, deterministic frames convert the uv from float, so they are only bit-identical on IEEE machines
+	void RenderRect(const Program& program, uint32_t width, uint32_t height, float phase, const Region& region, const Rect& rect, uint8_t* pixels, uint32_t rowPitch);
+
+	// Render a frame of each member of a structure family at once (see Evaluator::EvaluateFamily)
+	// The code comes from program and the constants of each member from constants (in the order of ProgramConstants),
+	// each member is written to pixels[member]. The cache is not used, and deterministic frames render the members one by one
+	void RenderFamily(const Program& program, const std::vector<std::vector<float>>& constants, uint32_t width, uint32_t height, float phase, uint8_t* const* pixels, uint32_t rowPitch);
+
+	// Including the thread that calls Render
+	uint32_t ThreadCount() const { return uint32_t(m_Scratch.size()); }
+
+	// Memory allowed for the cached values of all entries, 0 disables the cache
+	// Filling the cache costs about as much as a frame, so it is only worth it when a program is rendered several times
+	void SetCacheBudget(size_t bytes);
+
+	// Render with the fixed point evaluator, so every machine produces bit-identical pixels (see Fixed.h)
+	// The cache only holds float values, so deterministic frames always evaluate the whole program
+	void SetDeterministic(bool deterministic) { m_Deterministic = deterministic; }
+
+	// Shader inputs for the given phase, matching the time uniforms of Graphics::Update
+	static void PhaseInputs(float phase, float& sinTime, float& cosTime);
+	// Phase of the animation loop at the given frame of an animation that starts at phase 0
+	static float FramePhase(uint64_t frame, float fps);
+
+private:
+	// Space stage of a program evaluated for one image size and region
+	struct Cache
+	{
+		uint64_t structure;
+		std::vector<float> constants;
+		uint32_t width, height;
+		Region region;
+		bool split; // False if the program is not worth splitting, then it is rendered as is
+		Program space, time;
+		std::vector<float> values; // For each chunk, one array of Evaluator::BATCH_SIZE values for each slot
+		uint64_t lastUse;
+	};
+
+	Cache* FindCache(const Program& program, uint32_t width, uint32_t height, const Region& region);
+	void RunJob(const Program& program, Cache* cache, bool fill);
+
+	void WorkerLoop(uint32_t index);
+	void RenderChunks(uint32_t worker);
+
+	std::vector<std::thread> m_Workers;
+	std::vector<std::vector<float>> m_Scratch; // Registers of each worker, reused across frames
+	std::vector<std::vector<Fixed::Value>> m_FixedScratch;
+
+	// Current job, split in chunks of up to Evaluator::BATCH_SIZE pixels of a single row
+	std::mutex m_Mutex;
+	std::condition_variable m_Start;
+	std::condition_variable m_Done;
+	uint64_t m_Generation = 0ULL;
+	uint32_t m_Busy = 0U;
+	bool m_Quit = false;
+
+	const Program* m_Program = nullptr;
+	uint32_t m_Width = 0U, m_Height = 0U, m_RowPitch = 0U;
+	Region m_Region;
+	bool m_FullRegion = true;
+	Rect m_Rect{ 0U, 0U, 0U, 0U }; // Pixels rendered by the job
+	float m_SinTime = 0.0f, m_CosTime = 0.0f;
+	Fixed::Value m_FixedSinTime = 0, m_FixedCosTime = 0;
+	bool m_Deterministic = false;
+	uint8_t* m_Pixels = nullptr;
+	uint32_t m_ChunksPerRow = 0U;
+	std::atomic<uint32_t> m_NextChunk{ 0U };
+	Cache* m_Cache = nullptr; // Cache read by the job, or written when m_Fill is set
+	bool m_Fill = false;
+
+	// Family rendered by the job, none when m_FamilySize is 0
+	uint32_t m_FamilySize = 0U;
+	std::vector<uint8_t> m_FamilyVarying;
+	std::vector<const float*> m_FamilyConstants;
+	uint8_t* const* m_FamilyPixels = nullptr;
+
+	// Only used by the thread that calls Render
+	std::vector<std::unique_ptr<Cache>> m_Caches;
+	size_t m_CacheBudget = DEFAULT_CACHE_BUDGET;
+	uint64_t m_CacheClock = 0ULL;
+};
@@ -1,7 +1,15 @@
 #include "Shader.h"
 
-#include <iostream>
+#include <map>
+#include <array>
 #include <string>
+#include <vector>
+#include <iostream>
+#include <functional>
+
+#include "Program.h"
+#include "Bytecode.h"
+#include "Metrics.h"
 
 #define RANDFS_IMPLEMENTATION
 #include "RandFS.h"
@@ -9,19 +17,19 @@
 // Comment the line below to generate static images
 #define ANIMATE
 
-std::string GenerateShaderCode(uint64_t seed)
-{
-	// Uncomment here to set a specific seed
-//	seed = 302817110064ULL;
-	Random rand(seed);
+// Uncomment the line below to give the three color channels the same functions, with different constants
+// The shaders are faster (most of the code becomes vec3f operations), but the images are less varied
+//#define CORRELATE_CHANNELS
 
-	// Depths between 6 and 12 tend to generate interesting images
-	// Add two random values to bias towards the middle (9)
-	int maxDepth = rand.IntBetween(3, 7) + rand.IntBetween(3, 7);
+namespace
+{
+	Metrics::Counter generatedShaders("pollock_generator_shaders_total", "Number of shaders generated");
+	Metrics::Counter generatedBytes("pollock_generator_bytes_total", "Total size of the generated shader code");
+	Metrics::Histogram generationTime("pollock_generator_duration_seconds", "Time to generate the code of a shader");
 
 	#pragma region Function definitions
 
-	static constexpr char functionDefinitions[] =
+	constexpr char functionDefinitions[] =
 	R"(
 	
 	// 1 input
@@ -257,11 +265,209 @@ std::string GenerateShaderCode(uint64_t seed)
 	
 	)";
 
+	// Step of the Horner scheme of a polynomial surrogate (see Surrogates.h), only added to the shaders that use it
+	constexpr char hornerFunction[] =
+	R"(
+	fn fHorner(a: f32, t: f32, c: f32) -> f32
+	{
+		return a * (t + t - 1.0f) + c;
+	}
+	)";
+
+	#pragma endregion
+
+	#pragma region Vector function definitions
+
+	// vec3f versions of the helpers, for the values of the three channels that are computed by the same function
+	// Only the ones used by a shader are added to it (see EmitShaderCode)
+	struct VectorFunction
+	{
+		Op op;
+		const char* definition;
+	};
+
+	const VectorFunction vectorFunctions[] =
+	{
+		{ Op::Inv, R"(
+	fn fInvV(x: vec3f) -> vec3f
+	{
+		return 1.0f - x;
+	}
+	)" },
+		{ Op::Sqr, R"(
+	fn fSqrV(x: vec3f) -> vec3f
+	{
+		return x * x;
+	}
+	)" },
+		{ Op::Sqrt, R"(
+	fn fSqrtV(x: vec3f) -> vec3f
+	{
+		return sqrt(x);
+	}
+	)" },
+		{ Op::Smooth, R"(
+	fn fSmoothV(x: vec3f) -> vec3f
+	{
+		let x2: vec3f = x * x;
+		let x3: vec3f = x2 * x;
+		return x2 + x2 + x2 - x3 - x3;
+	}
+	)" },
+		{ Op::Sharp, R"(
+	fn fSharpV(x: vec3f) -> vec3f
+	{
+		return x * (x * (x + x - 3.0f) + 2.0f);
+	}
+	)" },
+		{ Op::Add, R"(
+	fn fAddV(x: vec3f, y: vec3f) -> vec3f
+	{
+		let res: vec3f = x + y;
+		return select(res, 2.0f - res, res > vec3f(1.0f));
+	}
+	)" },
+		{ Op::Sub, R"(
+	fn fSubV(x: vec3f, y: vec3f) -> vec3f
+	{
+		return abs(x - y);
+	}
+	)" },
+		{ Op::Mul, R"(
+	fn fMulV(x: vec3f, y: vec3f) -> vec3f
+	{
+		return x * y;
+	}
+	)" },
+		{ Op::Div, R"(
+	fn fDivV(x: vec3f, y: vec3f) -> vec3f
+	{
+		let min: vec3f = select(x, y, x > y);
+		let max: vec3f = select(y, x, x > y);
+		return min / select(max, vec3f(0.0001f), max < vec3f(0.0001f));
+	}
+	)" },
+		{ Op::Avg, R"(
+	fn fAvgV(x: vec3f, y: vec3f) -> vec3f
+	{
+		return (x + y) * 0.5f;
+	}
+	)" },
+		{ Op::Geom, R"(
+	fn fGeomV(x: vec3f, y: vec3f) -> vec3f
+	{
+		return sqrt(x * y);
+	}
+	)" },
+		{ Op::Harm, R"(
+	fn fHarmV(x: vec3f, y: vec3f) -> vec3f
+	{
+		let den: vec3f = x + y;
+		return (2.0f * x * y) / select(den, vec3f(0.0001f), den < vec3f(0.0001f));
+	}
+	)" },
+		{ Op::Hypo, R"(
+	fn fHypoV(x: vec3f, y: vec3f) -> vec3f
+	{
+		return 0.70710678f * sqrt(x * x + y * y); // Scale by 1 / sqrt(2)
+	}
+	)" },
+		{ Op::Max, R"(
+	fn fMaxV(x: vec3f, y: vec3f) -> vec3f
+	{
+		return select(y, x, x > y);
+	}
+	)" },
+		{ Op::Min, R"(
+	fn fMinV(x: vec3f, y: vec3f) -> vec3f
+	{
+		return select(y, x, x < y);
+	}
+	)" },
+		{ Op::Pow, R"(
+	fn fPowV(x: vec3f, y: vec3f) -> vec3f
+	{
+		let exp1: vec3f = y + y - 1.0f;
+		let exp2: vec3f = pow(vec3f(10.0f), exp1);
+		return pow(x, exp2);
+	}
+	)" },
+		{ Op::Bell, R"(
+	fn fBellV(x: vec3f, y: vec3f) -> vec3f
+	{
+		let y2: vec3f = y * y;
+		return pow(4.0f * x * (1.0f - x), 20.0f * y2 * y2 + 0.3f);
+	}
+	)" },
+		{ Op::Wave, R"(
+	fn fWaveV(x: vec3f, y: vec3f) -> vec3f
+	{
+		const MAX_FREQUENCY: f32 = 6.0f * 3.1415927f;
+		return 0.5f + 0.5f * cos(MAX_FREQUENCY * x * y);
+	}
+	)" },
+		{ Op::Bounce, R"(
+	fn fBounceV(x: vec3f, y: vec3f) -> vec3f
+	{
+		const FREQUENCY_FACTOR: f32 = 3.0f * 3.1415927f;
+		return abs(cos(FREQUENCY_FACTOR * x * (y + 0.5f)) * exp2(-3.0f * x));
+	}
+	)" },
+		{ Op::Lerp, R"(
+	fn fLerpV(x: vec3f, y: vec3f, z: vec3f) -> vec3f
+	{
+		return (1.0f - z) * x + z * y;
+	}
+	)" },
+		{ Op::Mlerp, R"(
+	fn fMlerpV(x: vec3f, y: vec3f, z: vec3f) -> vec3f
+	{
+		let xMin = select(x, vec3f(0.0001f), x < vec3f(0.0001f));
+		return xMin * pow(y / xMin, z);
+	}
+	)" },
+		{ Op::Clamp, R"(
+	fn fClampV(x: vec3f, y: vec3f, z: vec3f) -> vec3f
+	{
+		let min: vec3f = select(x, y, x > y);
+		let max: vec3f = select(y, x, x > y);
+		return select(select(z, max, z > max), min, z < min);
+	}
+	)" },
+		{ Op::Dist, R"(
+	fn fDistV(x: vec3f, y: vec3f, z: vec3f, w: vec3f) -> vec3f
+	{
+		let dx: vec3f = x - z;
+		let dy: vec3f = y - w;
+		return 0.70710678f * sqrt(dx * dx + dy * dy); // Scale by 1 / sqrt(2)
+	}
+	)" },
+		{ Op::DistLine, R"(
+	fn fDistLineV(x: vec3f, y: vec3f, z: vec3f, w: vec3f) -> vec3f
+	{
+		// Both sides of the scalar version are computed, and the vertical case is selected last
+		let m: vec3f = tan(z * 3.1415927f);
+		let n: vec3f = select(w - m * w, (1.0f - w) * (1.0f + m) - m, z < vec3f(0.499f));
+		let c: vec3f = (x + y * m - m * n) / (m * m + 1.0f);
+		let dx: vec3f = c - x;
+		let dy: vec3f = m * c + n - y;
+		let vertical = (z >= vec3f(0.499f)) & (z <= vec3f(0.501f));
+		return select(0.70710678f * sqrt(dx * dx + dy * dy), 0.70710678f * abs(w - x), vertical);
+	}
+	)" },
+		{ Op::Horner, R"(
+	fn fHornerV(a: vec3f, t: vec3f, c: vec3f) -> vec3f
+	{
+		return a * (t + t - 1.0f) + c;
+	}
+	)" }
+	};
+
 	#pragma endregion
 
 	#pragma region Main function
 
-	std::string mainFunction =
+	constexpr char mainFunction[] =
 	R"(
 
 	struct VertexOutput
@@ -303,8 +509,8 @@ std::string GenerateShaderCode(uint64_t seed)
 		let invY = 1.0f - input.uv.y;
 		let sinTime = buf.x;
 		let cosTime = buf.y;
-
-		let rgb: vec3f = vec3f(&, &, &);
+&BODY&
+		let rgb: vec3f = &RGB&;
 		let rgbMasked = &MASK&;
 
 		return vec4f(rgbMasked, 1.0f);
@@ -312,9 +518,165 @@ std::string GenerateShaderCode(uint64_t seed)
 
 	)";
 
+	// Evaluates the space stage of a split program once per pixel, into one layer of the cache for each slot
+	constexpr char cacheFunction[] =
+	R"(
+
+	struct CacheInput
+	{
+		uv : vec2f
+	};
+
+	@group(0) @binding(2) var cache : texture_storage_2d_array<r32float, write>;
+	@group(0) @binding(3) var<uniform> region : vec4f; // Offset and scale of the uv of the texture (0, 0, 1, 1 for a whole image)
+
+	@compute @workgroup_size(8, 8)
+	fn cacheMain(@builtin(global_invocation_id) id : vec3u)
+	{
+		let size = textureDimensions(cache);
+		if (id.x >= size.x || id.y >= size.y)
+		{
+			return;
+		}
+
+		// Same uv as the fullscreen quad at the center of the pixel
+		let input = CacheInput(region.xy + region.zw * vec2f((f32(id.x) + 0.5f) / f32(size.x), 1.0f - (f32(id.y) + 0.5f) / f32(size.y)));
+		let invX = 1.0f - input.uv.x;
+		let invY = 1.0f - input.uv.y;
+&BODY&	}
+
+	)";
+
+	// Fullscreen quad that covers a region of the uv space instead of all of it, so an image can be rendered in tiles
+	// Replaces the vertex stage of mainFunction, with the same output
+	constexpr char regionVertexFunction[] =
+	R"(
+
+	struct VertexOutput
+	{
+		@builtin(position) Position : vec4f,
+		@location(0) uv : vec2f
+	};
+
+	@group(0) @binding(3) var<uniform> region : vec4f; // Offset and scale of the uv
+
+	@vertex
+	fn vertexMain(@builtin(vertex_index) i : u32) -> VertexOutput
+	{
+		const positions = array
+		(
+			vec2f(-1.0f, 1.0f), vec2f(1.0f, 1.0f), vec2f(-1.0f, -1.0f),
+			vec2f(-1.0f, -1.0f), vec2f(1.0f, 1.0f), vec2f(1.0f, -1.0f)
+		);
+		const uvs = array
+		(
+			vec2f(0.0f, 1.0f), vec2f(1.0f, 1.0f), vec2f(0.0f, 0.0f),
+			vec2f(0.0f, 0.0f), vec2f(1.0f, 1.0f), vec2f(1.0f, 0.0f)
+		);
+
+		var output: VertexOutput;
+		output.Position = vec4f(positions[i], 0.0f, 1.0f);
+		output.uv = region.xy + region.zw * uvs[i];
+		return output;
+	}
+
+	)";
+
+	// Fullscreen quad that samples a texture through a transform of its uv (0 at the top left, like the texture coordinates),
+	// to show a zoomed view before it is rendered again, or to copy a view to the canvas with the identity transform
+	constexpr char resampleFunction[] =
+	R"(
+
+	struct VertexOutput
+	{
+		@builtin(position) Position : vec4f,
+		@location(0) uv : vec2f
+	};
+
+	@group(0) @binding(0) var source : texture_2d<f32>;
+	@group(0) @binding(1) var sourceSampler : sampler;
+	@group(0) @binding(2) var<uniform> transform : vec4f; // Offset and scale of the uv
+
+	@vertex
+	fn vertexMain(@builtin(vertex_index) i : u32) -> VertexOutput
+	{
+		const positions = array
+		(
+			vec2f(-1.0f, 1.0f), vec2f(1.0f, 1.0f), vec2f(-1.0f, -1.0f),
+			vec2f(-1.0f, -1.0f), vec2f(1.0f, 1.0f), vec2f(1.0f, -1.0f)
+		);
+		const uvs = array
+		(
+			vec2f(0.0f, 0.0f), vec2f(1.0f, 0.0f), vec2f(0.0f, 1.0f),
+			vec2f(0.0f, 1.0f), vec2f(1.0f, 0.0f), vec2f(1.0f, 1.0f)
+		);
+
+		var output: VertexOutput;
+		output.Position = vec4f(positions[i], 0.0f, 1.0f);
+		output.uv = transform.xy + transform.zw * uvs[i];
+		return output;
+	}
+
+	@fragment
+	fn fragmentMain(@location(0) uv : vec2f) -> @location(0) vec4f
+	{
+		return textureSampleLevel(source, sourceSampler, uv, 0.0f);
+	}
+
+	)";
+
+	// Runs the programs of many seeds, encoded by Bytecode::EncodeWords, one per layer of a storage texture array
+	constexpr char interpreterFunction[] =
+	R"(
+
+	@group(0) @binding(0) var<uniform> buf : vec4f; // Time uniforms, as for the fragment shader
+	@group(0) @binding(1) var<storage, read> offsets : array<u32>; // First word of the program of each layer
+	@group(0) @binding(2) var<storage, read> words : array<u32>;
+	@group(0) @binding(3) var thumbnails : texture_storage_2d_array<rgba8unorm, write>;
+
+	@compute @workgroup_size(8, 8)
+	fn interpreterMain(@builtin(global_invocation_id) id : vec3u)
+	{
+		let size = textureDimensions(thumbnails);
+		if (id.x >= size.x || id.y >= size.y)
+		{
+			return;
+		}
+
+		// Same uv as the fullscreen quad at the center of the pixel
+		let x = (f32(id.x) + 0.5f) / f32(size.x);
+		let y = 1.0f - (f32(id.y) + 0.5f) / f32(size.y);
+
+		// A workgroup only covers pixels of one layer, so its invocations run the same instructions and the switch stays uniform
+		var r : array<f32, &REGISTERS&>;
+		let start = offsets[id.z];
+		let count = words[start];
+		let outputs = words[start + 1u];
+		for (var i = 0u; i < count; i++)
+		{
+			let w0 = words[start + 2u + 2u * i];
+			let w1 = words[start + 3u + 2u * i];
+			let a = r[(w0 >> 16u) & 0xFFu];
+			let b = r[w0 >> 24u];
+			let c = r[w1 & 0xFFu];
+			let d = r[(w1 >> 8u) & 0xFFu];
+			var v = 0.0f;
+			switch (w0 & 0xFFu)
+			{
+&CASES&				default: {}
+			}
+			r[(w0 >> 8u) & 0xFFu] = v;
+		}
+
+		let rgb = vec3f(r[outputs & 0xFFu], r[(outputs >> 8u) & 0xFFu], r[(outputs >> 16u) & 0xFFu]);
+		textureStore(thumbnails, id.xy, id.z, vec4f(rgb, 1.0f));
+	}
+
+	)";
+
 	#pragma endregion
 
-	static const char* values[] =
+	const char* values[] =
 	{
 		"input.uv.x", // Normalized x coordinate
 		"input.uv.y", // Normalized y coordinate
@@ -329,7 +691,7 @@ std::string GenerateShaderCode(uint64_t seed)
 	};
 	const int valuesSize = sizeof(values) / sizeof(const char*);
 	
-	static const char* functions[] =
+	const char* functions[] =
 	{
 		"fInv(&)",
 		"fSqr(&)",
@@ -377,7 +739,7 @@ std::string GenerateShaderCode(uint64_t seed)
 	};
 	const int functionsSize = sizeof(functions) / sizeof(const char*);
 
-	static const char* masks[] =
+	const char* masks[] =
 	{
 		"rgb",
 		"rgb", // Increase the chance of no mask
@@ -393,25 +755,105 @@ std::string GenerateShaderCode(uint64_t seed)
 	};
 	const int masksSize = sizeof(masks) / sizeof(const char*);
 
-	// Replace mask token for one of the masks selected randomly
-	std::string maskToken("&MASK&");
-	size_t maskPos = mainFunction.find(maskToken);
-	const char* mask = rand.Element(masks, masksSize);
-	mainFunction.replace(maskPos, maskToken.length(), mask);
+	// Names of the values of a compiled program in the emitted code
+	// Inputs and constants are used directly, every other instruction becomes a let statement named after its index
+	class ValueNames
+	{
+	public:
+		ValueNames(const Program& program, ConstantMode mode) : m_Code(program.code), m_Mode(mode), m_ConstantIndex(program.code.size(), 0U)
+		{
+			// Number the constants in the order of the code
+			for (uint32_t i = 0U; i < m_Code.size(); i++)
+				if (m_Code[i].op == Op::Const)
+					m_ConstantIndex[i] = m_ConstantCount++;
+		}
+
+		std::string operator()(uint32_t i) const
+		{
+			const Instruction& instruction = m_Code[i];
+			if (instruction.op == Op::Const)
+			{
+				uint32_t c = m_ConstantIndex[i];
+				switch (m_Mode)
+				{
+				case ConstantMode::Override: return 'c' + std::to_string(c);
+				case ConstantMode::Uniform: return "constants[" + std::to_string(c / 4U) + "][" + std::to_string(c % 4U) + ']';
+				default: return std::to_string(instruction.value) + 'f';
+				}
+			}
+			if (OpArity(instruction.op) == 0U && instruction.op != Op::Cached)
+				return std::string(OpName(instruction.op));
+			return 'v' + std::to_string(i);
+		}
+
+		// Let statement of an instruction that is not used directly
+		std::string Statement(uint32_t i) const
+		{
+			const Instruction& instruction = m_Code[i];
+			std::string statement = "\t\tlet v" + std::to_string(i) + " = ";
+			if (instruction.op == Op::Cached)
+				return statement + "textureLoad(cache, vec2i(input.Position.xy), " + std::to_string(instruction.args[0]) + ", 0).x;\n";
+
+			statement += std::string(OpName(instruction.op)) + '(';
+			for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+				statement += (a > 0U ? ", " : "") + (*this)(instruction.args[a]);
+			return statement + ");\n";
+		}
+
+		// Declarations of the constants that are not baked in the code
+		std::string Declarations() const
+		{
+			std::string declarations;
+			if (m_Mode == ConstantMode::Override)
+			{
+				declarations += '\n';
+				for (uint32_t c = 0U; c < m_ConstantCount; c++)
+					declarations += "\toverride c" + std::to_string(c) + ": f32;\n";
+			}
+			else if (m_Mode == ConstantMode::Uniform && m_ConstantCount > 0U)
+			{
+				declarations += "\n\t@group(0) @binding(1) var<uniform> constants: array<vec4f, " + std::to_string((m_ConstantCount + 3U) / 4U) + ">;\n";
+			}
+			return declarations;
+		}
+
+	private:
+		const std::vector<Instruction>& m_Code;
+		ConstantMode m_Mode;
+		std::vector<uint32_t> m_ConstantIndex;
+		uint32_t m_ConstantCount = 0U;
+	};
+}
+
+ShaderExpression GenerateShaderExpression(uint64_t seed, bool correlated)
+{
+	// Uncomment here to set a specific seed
+//	seed = 302817110064ULL;
+	Random rand(seed);
+
+	// Depths between 6 and 12 tend to generate interesting images
+	// Add two random values to bias towards the middle (9)
+	int maxDepth = rand.IntBetween(3, 7) + rand.IntBetween(3, 7);
+
+	// Select one of the masks randomly and append it after the rgb vector
+	// Both are expanded together, so the tokens are replaced in the same order as they appear in the shader
+	// With correlated channels, a single tree is expanded and copied to the three channels afterwards
+	std::string expression(correlated ? "&\n" : "vec3f(&, &, &)\n");
+	expression += rand.Element(masks, masksSize);
 
 	// Run until maxDepth because at maxDepth all tokens must be replaced by constants
 	for (int i = 0; i <= maxDepth; i++)
 	{
 		// Find all '&' tokens and replace for '$' tokens
 		// This marks all tokens for replacement in this iteration
-		for (char& c : mainFunction)
+		for (char& c : expression)
 		{
 			if (c == '&')
 				c = '$';
 		}
 
 		// Replace all '$' tokens for either a function or a value
-		size_t pos = mainFunction.find('$');
+		size_t pos = expression.find('$');
 		while (pos != std::string::npos)
 		{
 			// Decide whether to replace the token with a function or a fixed value
@@ -421,22 +863,278 @@ std::string GenerateShaderCode(uint64_t seed)
 				? rand.Element(functions, functionsSize)
 				: rand.Element(values, valuesSize);
 
-			mainFunction.replace(pos, 1, replacement);
-			pos = mainFunction.find('$');
+			expression.replace(pos, 1, replacement);
+			pos = expression.find('$');
 		}
 	}
 
+	// Copy the tree before the constants are drawn, so only the constants differ between the channels
+	if (correlated)
+	{
+		size_t end = expression.find('\n');
+		std::string tree = expression.substr(0, end);
+		expression.replace(0, end, "vec3f(" + tree + ", " + tree + ", " + tree + ')');
+	}
+
 	// Replace '#' tokens with random constants
-	size_t pos = mainFunction.find('#');
+	size_t pos = expression.find('#');
 	while (pos != std::string::npos)
 	{
-		mainFunction.replace(pos, 1, std::to_string(rand.FloatO()) + 'f');
-		pos = mainFunction.find('#');
+		expression.replace(pos, 1, std::to_string(rand.FloatO()) + 'f');
+		pos = expression.find('#');
 	}
 
-	//std::cout << mainFunction << std::endl;
+	// Split the rgb vector from the mask
+	size_t separator = expression.find('\n');
+	return ShaderExpression{ expression.substr(0, separator), expression.substr(separator + 1) };
+}
+
+std::string AssembleShaderCode(const ShaderExpression& expression)
+{
+	std::string code(mainFunction);
+
+	// Replace the body, rgb and mask tokens for the generated expressions
+	std::string bodyToken("&BODY&");
+	code.replace(code.find(bodyToken), bodyToken.length(), expression.body);
+	std::string rgbToken("&RGB&");
+	code.replace(code.find(rgbToken), rgbToken.length(), expression.rgb);
+	std::string maskToken("&MASK&");
+	code.replace(code.find(maskToken), maskToken.length(), expression.mask);
+
+	//std::cout << code << std::endl;
+
+	return functionDefinitions + code;
+}
+
+std::string GenerateShaderCode(uint64_t seed)
+{
+	Metrics::Timer timer(generationTime);
+
+#ifdef CORRELATE_CHANNELS
+	// Compile the expression, so the shared structure of the channels is emitted as vec3f operations
+	// The few expressions that can not be compiled are assembled as text, like without correlation
+	ShaderExpression expression = GenerateShaderExpression(seed, true);
+	Program program;
+	std::string code = CompileProgram(expression, program) ? EmitShaderCode(program) : AssembleShaderCode(expression);
+#else
+	std::string code = AssembleShaderCode(GenerateShaderExpression(seed));
+#endif
+	generatedShaders.Add();
+	generatedBytes.Add(code.size());
+
 	//std::cout << "Shader code generated using seed " << seed << std::endl;
 
-	return functionDefinitions + mainFunction;
+	return code;
+}
+
+std::string EmitShaderCode(const Program& program, ConstantMode mode)
+{
+	const std::vector<Instruction>& code = program.code;
+	ValueNames name(program, mode);
+
+	#pragma region Vectorization
+
+	/*
+		Walk the three channels together, from the outputs down.
+		While the r, g and b values are computed by the same function, the three calls become a single call of its vec3f version,
+		and the walk continues with the corresponding arguments of each channel.
+		Where the channels diverge, the scalar values are packed into a vector (or splat, when the channels share the same value).
+	*/
+	std::string vectorBody;
+	std::map<std::array<uint32_t, 3>, std::string> vectors;
+	std::vector<uint8_t> scalar(code.size(), 0U); // Scalar values used by the vector code
+	bool usedOps[uint32_t(Op::Count)] = {};
+
+	// Depth first with an explicit stack, so deep code (e.g. decoded from untrusted bytecode) can not overflow the call stack
+	struct Visit
+	{
+		std::array<uint32_t, 3> channels;
+		uint32_t next; // Arguments already vectorized
+		std::string call;
+	};
+	auto vectorize = [&](const std::array<uint32_t, 3>& root) -> std::string
+	{
+		std::vector<Visit> stack;
+		std::string last; // Value of the last channels vectorized
+
+		// Returns true when the value is known without vectorizing arguments, otherwise starts a call of the vec3f version
+		auto visit = [&](const std::array<uint32_t, 3>& channels)
+		{
+			auto found = vectors.find(channels);
+			if (found != vectors.end())
+			{
+				last = found->second;
+				return true;
+			}
+
+			const Instruction& r = code[channels[0]];
+			const Instruction& g = code[channels[1]];
+			const Instruction& b = code[channels[2]];
+
+			if (channels[0] == channels[1] && channels[1] == channels[2])
+			{
+				scalar[channels[0]] = 1U;
+				last = "vec3f(" + name(channels[0]) + ')';
+			}
+			else if (r.op != g.op || g.op != b.op || OpArity(r.op) == 0U)
+			{
+				for (uint32_t i : channels)
+					scalar[i] = 1U;
+				last = "vec3f(" + name(channels[0]) + ", " + name(channels[1]) + ", " + name(channels[2]) + ')';
+			}
+			else
+			{
+				stack.push_back({ channels, 0U, std::string(OpName(r.op)) + "V(" });
+				return false;
+			}
+
+			vectors[channels] = last;
+			return true;
+		};
+
+		visit(root);
+		while (!stack.empty())
+		{
+			Visit& top = stack.back();
+			const Instruction& r = code[top.channels[0]];
+			const Instruction& g = code[top.channels[1]];
+			const Instruction& b = code[top.channels[2]];
+
+			if (top.next < OpArity(r.op))
+			{
+				uint32_t a = top.next++;
+				if (visit({ r.args[a], g.args[a], b.args[a] }))
+					top.call += (a > 0U ? ", " : "") + last;
+				continue;
+			}
+
+			usedOps[uint32_t(r.op)] = true;
+			last = 'w' + std::to_string(vectors.size());
+			vectorBody += "\t\tlet " + last + " = " + top.call + ");\n";
+			vectors[top.channels] = last;
+			stack.pop_back();
+
+			// The value is the next argument of the call below it
+			if (!stack.empty())
+				stack.back().call += (stack.back().next > 1U ? ", " : "") + last;
+		}
+		return last;
+	};
+
+	ShaderExpression expression;
+	expression.rgb = vectorize({ program.outputs[0], program.outputs[1], program.outputs[2] });
+	expression.mask = "rgb"; // The mask was already lowered into the channels
+
+	#pragma endregion
+
+	// Scalar code for the values used by the vector code, and everything they depend on
+	for (size_t i = code.size(); i-- > 0U;)
+		if (scalar[i])
+			for (uint32_t a = 0U; a < OpArity(code[i].op); a++)
+				scalar[code[i].args[a]] = 1U;
+
+	bool cached = false;
+	bool horner = false;
+	for (uint32_t i = 0U; i < code.size(); i++)
+	{
+		const Instruction& instruction = code[i];
+		if (!scalar[i] || (OpArity(instruction.op) == 0U && instruction.op != Op::Cached))
+			continue;
+
+		if (expression.body.empty())
+			expression.body += '\n';
+		expression.body += name.Statement(i);
+		cached |= instruction.op == Op::Cached;
+		horner |= instruction.op == Op::Horner;
+	}
+
+	if (expression.body.empty() && !vectorBody.empty())
+		expression.body += '\n';
+	expression.body += vectorBody;
+
+	// Add the vector helpers used by the code
+	std::string declarations(horner ? hornerFunction : "");
+	for (const VectorFunction& function : vectorFunctions)
+		if (usedOps[uint32_t(function.op)])
+			declarations += function.definition;
+
+	// Declare the constants that are not baked in the code, and the cache read by the time stage of a split program
+	declarations += name.Declarations();
+	if (cached)
+		declarations += "\n\t@group(0) @binding(2) var cache : texture_2d_array<f32>;\n";
+
+	return declarations + AssembleShaderCode(expression);
+}
+
+std::string EmitCacheShaderCode(const Program& program, ConstantMode mode)
+{
+	const std::vector<Instruction>& code = program.code;
+	ValueNames name(program, mode);
+
+	// Everything left in the space stage is needed by its stores
+	std::string body("\n");
+	bool horner = false;
+	for (uint32_t i = 0U; i < code.size(); i++)
+	{
+		if (OpArity(code[i].op) > 0U)
+			body += name.Statement(i);
+		horner |= code[i].op == Op::Horner;
+	}
+
+	body += '\n';
+	for (uint32_t slot = 0U; slot < program.stores.size(); slot++)
+		body += "\t\ttextureStore(cache, vec2i(id.xy), " + std::to_string(slot) + ", vec4f(" + name(program.stores[slot]) + "));\n";
+
+	std::string shader(cacheFunction);
+	std::string bodyToken("&BODY&");
+	shader.replace(shader.find(bodyToken), bodyToken.length(), body);
+
+	return std::string(functionDefinitions) + (horner ? hornerFunction : "") + name.Declarations() + shader;
+}
+
+std::string EmitRegionVertexShaderCode()
+{
+	return regionVertexFunction;
+}
+
+std::string EmitResampleShaderCode()
+{
+	return resampleFunction;
 }
 
+std::string EmitInterpreterShaderCode()
+{
+	// One case per op, numbered as in the Op enum
+	std::string cases;
+	for (uint32_t op = 0U; op < uint32_t(Op::Count); op++)
+	{
+		std::string value;
+		switch (Op(op))
+		{
+		case Op::X: value = "x"; break;
+		case Op::Y: value = "y"; break;
+		case Op::InvX: value = "1.0f - x"; break;
+		case Op::InvY: value = "1.0f - y"; break;
+		case Op::SinTime: value = "buf.x"; break;
+		case Op::CosTime: value = "buf.y"; break;
+		case Op::Const: value = "bitcast<f32>(w1)"; break;
+		case Op::Phase: value = "buf.z"; break;
+		case Op::Cached: continue; // Split programs are not encoded
+		default:
+			value = std::string(OpName(Op(op))) + '(';
+			for (uint32_t a = 0U; a < OpArity(Op(op)); a++)
+				value += std::string(a > 0U ? ", " : "") + char('a' + a);
+			value += ')';
+			break;
+		}
+		cases += "\t\t\t\tcase " + std::to_string(op) + "u: { v = " + value + "; }\n";
+	}
+
+	std::string shader(interpreterFunction);
+	std::string registersToken("&REGISTERS&");
+	shader.replace(shader.find(registersToken), registersToken.length(), std::to_string(Bytecode::INTERPRETER_REGISTERS));
+	std::string casesToken("&CASES&");
+	shader.replace(shader.find(casesToken), casesToken.length(), cases);
+
+	return std::string(functionDefinitions) + hornerFunction + shader;
+}
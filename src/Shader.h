@@ -3,5 +3,48 @@
 #include <string>
 #include <cstdint>
 
+struct Program;
+
+// Randomly generated parts of the fragment shader
+struct ShaderExpression
+{
+	std::string rgb; // vec3f constructor with one function tree for each channel
+	std::string mask; // Mask applied over the rgb vector (simply "rgb" when there is no mask)
+	std::string body = {}; // Statements placed before the rgb vector (empty for generated expressions)
+};
+
+// Generate the random expressions of a shader from the given seed
+// With correlated channels, the r, g and b trees are made of the same functions and only their constants differ
+ShaderExpression GenerateShaderExpression(uint64_t seed, bool correlated = false);
+// Insert the given expressions into the fragment shader and prepend the function definitions
+std::string AssembleShaderCode(const ShaderExpression& expression);
+
 std::string GenerateShaderCode(uint64_t seed);
 
+// How EmitShaderCode writes the constants of a program
+// The constants are numbered in the order of the code, so programs of the same structure get the exact same code in the last two modes
+enum class ConstantMode
+{
+	Baked, // Literals in the code, so every seed needs its own shader module
+	Override, // Pipeline-overridable constants (override c0: f32;), set by each pipeline and still folded by the driver
+	Uniform // Elements of a uniform buffer (array<vec4f, N> at @group(0) @binding(1)), so seeds can share a pipeline
+};
+
+// Generate the shader code of a compiled program, computing each shared value only once
+// Where the three channels are computed by the same functions, they are emitted as a single vec3f operation
+// The time stage of a split program reads its cached values from a texture array at @group(0) @binding(2), one layer per slot
+// Polynomial surrogates of the phase (see Surrogates.h) read it from the z component of the time uniform
+std::string EmitShaderCode(const Program& program, ConstantMode mode = ConstantMode::Baked);
+// Generate the compute shader (cacheMain) that evaluates the space stage of a split program into the layers of a storage texture array
+// at @group(0) @binding(2), with one workgroup per 8x8 pixels (see SplitProgram)
+std::string EmitCacheShaderCode(const Program& program, ConstantMode mode = ConstantMode::Baked);
+// Generate a vertex shader (vertexMain) that can replace the one of EmitShaderCode, and maps the fullscreen quad to the region
+// of the uv space given by a uniform at @group(0) @binding(3) (offset in xy, scale in zw), to render an image in tiles
+std::string EmitRegionVertexShaderCode();
+// Generate a shader (vertexMain and fragmentMain) that draws a texture at @group(0) @binding(0) with the sampler at @binding(1),
+// through the transform of its uv given by a uniform at @binding(2) (offset in xy, scale in zw), to resample an image
+std::string EmitResampleShaderCode();
+// Generate the compute shader (interpreterMain) that runs programs encoded by Bytecode::EncodeWords, from a storage buffer at
+// @group(0) @binding(2) with the first word of the program of each layer at @binding(1), into the layers of a storage texture
+// array at @binding(3), with the time uniform at @binding(0). One workgroup per 8x8 pixels of a layer, so every seed shares one pipeline
+std::string EmitInterpreterShaderCode();
@@ -0,0 +1,287 @@
+#include "Stream.h"
+
+#include <map>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+
+#include "Shader.h"
+#include "Program.h"
+#include "Pruning.h"
+#include "Surrogates.h"
+#include "Renderer.h"
+#include "BoundedQueue.h"
+#include "Metrics.h"
+
+#include "RandFS.h"
+
+namespace
+{
+	Metrics::Counter streamFrames("pollock_stream_frames_total", "Number of frames output by streams");
+	Metrics::Counter lateFrames("pollock_stream_late_frames_total", "Number of frames output after their deadline by realtime streams");
+	Metrics::Histogram generateTime("pollock_stream_generate_duration_seconds", "Time to generate and compile the program of one segment");
+	Metrics::Histogram blendTime("pollock_stream_blend_duration_seconds", "Time to crossfade the two frames of a transition");
+
+	// A frame on its way through the stages, in buffers taken from the pool
+	struct Job
+	{
+		Stream::Frame frame;
+		uint8_t* pixels; // Incoming segment, and the final frame after blending
+		uint8_t* outgoing; // Outgoing segment during a transition, null otherwise
+		uint32_t weight; // Weight of the incoming segment, in [0, 256]
+	};
+
+	// Program of a segment, with the seed it was generated from
+	struct Segment
+	{
+		uint64_t seed;
+		Program program;
+	};
+
+	// Crossfade in place: incoming = outgoing * (1 - weight) + incoming * weight
+	void Blend(uint8_t* incoming, const uint8_t* outgoing, size_t size, uint32_t weight)
+	{
+		for (size_t i = 0U; i < size; i++)
+			incoming[i] = uint8_t((outgoing[i] * (256U - weight) + incoming[i] * weight) >> 8);
+	}
+}
+
+Stream::Stream(const Settings& settings) : m_Settings(settings)
+{
+}
+
+void Stream::Stop()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Stop = true;
+	m_ProgramReady.notify_all();
+}
+
+uint64_t Stream::SegmentSeed(uint64_t seed, uint64_t segment)
+{
+	return Hash::UInt64(segment, seed);
+}
+
+void Stream::Run(const Sink& sink)
+{
+	const Settings& s = m_Settings;
+	const uint32_t pitch = s.width * 4U;
+	const size_t frameSize = size_t(pitch) * s.height;
+
+	// Frames between the starts of two segments, and frames of each transition (shorter, so at most two segments overlap)
+	const uint64_t segmentFrames = std::max<uint64_t>(1ULL, uint64_t(std::llround(double(s.segmentSeconds) * s.fps)));
+	const uint64_t transitionFrames = std::min<uint64_t>(segmentFrames - 1ULL, uint64_t(std::llround(double(s.transitionSeconds) * s.fps)));
+
+	#pragma region Generate
+
+	// Programs of the segments from the oldest one still rendered up to the lookahead, guarded by m_Mutex
+	std::map<uint64_t, std::unique_ptr<Segment>> programs;
+	uint64_t nextSegment = 0ULL;
+	uint64_t oldestSegment = 0ULL;
+
+	auto generate = [&]()
+	{
+		for (;;)
+		{
+			uint64_t segment;
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+				m_ProgramReady.wait(lock, [&]() { return m_Stop || nextSegment <= oldestSegment + s.lookahead + 1U; });
+				if (m_Stop)
+					return;
+				segment = nextSegment++;
+			}
+
+			std::unique_ptr<Segment> program = std::make_unique<Segment>();
+			{
+				Metrics::Timer timer(generateTime);
+
+				// A seed that cannot be compiled is replaced by the next one derived from it, so the schedule stays deterministic
+				program->seed = SegmentSeed(s.seed, segment);
+				while (!CompileProgram(GenerateShaderExpression(program->seed, s.correlated), program->program))
+				{
+					std::fprintf(stderr, "Could not compile the shader of seed %llu, skipping it\n", (unsigned long long)program->seed);
+					program->seed = Hash::UInt64(segment, program->seed);
+				}
+
+				if (s.prune > 0.0f && !s.deterministic)
+				{
+					Pruning::Settings settings;
+					settings.errorBudget = s.prune;
+					Pruning::Prune(program->program, settings);
+				}
+				if (s.surrogates > 0.0f && !s.deterministic)
+				{
+					Surrogates::Settings settings;
+					settings.errorBound = s.surrogates;
+					Surrogates::Fit(program->program, settings);
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			programs[segment] = std::move(program);
+			m_ProgramReady.notify_all();
+		}
+	};
+
+	// Wait for the program of a segment, null if the stream stopped first
+	auto program = [&](uint64_t segment) -> const Segment*
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_ProgramReady.wait(lock, [&]() { return m_Stop || programs.count(segment); });
+		return m_Stop ? nullptr : programs[segment].get();
+	};
+
+	// Free the programs before the given segment, so the generators can move on
+	auto release = [&](uint64_t segment)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (segment <= oldestSegment)
+			return;
+		oldestSegment = segment;
+		programs.erase(programs.begin(), programs.lower_bound(segment));
+		m_ProgramReady.notify_all();
+	};
+
+	std::vector<std::thread> generators;
+	for (uint32_t i = 0U; i < std::max(1U, s.generatorThreads); i++)
+		generators.emplace_back(generate);
+
+	#pragma endregion
+
+	#pragma region Buffers and queues
+
+	// Enough buffers for every stage and every queue slot, where a job holds two buffers at most
+	const size_t bufferCount = 4U * size_t(s.queueDepth) + 6U;
+	std::vector<std::vector<uint8_t>> storage(bufferCount, std::vector<uint8_t>(frameSize));
+	BoundedQueue<uint8_t*> pool(bufferCount);
+	for (std::vector<uint8_t>& buffer : storage)
+		pool.Push(buffer.data());
+
+	BoundedQueue<Job> blendQueue(s.queueDepth);
+	BoundedQueue<Job> outputQueue(s.queueDepth);
+
+	// Unblock every stage when the sink ends the stream early
+	auto abort = [&]()
+	{
+		Stop();
+		pool.Close();
+		blendQueue.Close();
+		outputQueue.Close();
+	};
+
+	#pragma endregion
+
+	#pragma region Blend and output
+
+	std::thread blender([&]()
+	{
+		Job job;
+		while (blendQueue.Pop(job))
+		{
+			if (job.outgoing)
+			{
+				Metrics::Timer timer(blendTime);
+				Blend(job.pixels, job.outgoing, frameSize, job.weight);
+				pool.Push(job.outgoing);
+			}
+			if (!outputQueue.Push(job))
+				break;
+		}
+		outputQueue.Close();
+	});
+
+	std::thread output([&]()
+	{
+		// The deadlines start with the first frame, so the time to generate and render it does not count as late
+		std::chrono::steady_clock::time_point start;
+		bool started = false;
+		Job job;
+		while (outputQueue.Pop(job))
+		{
+			if (s.realtime)
+			{
+				if (!started)
+				{
+					start = std::chrono::steady_clock::now() - std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(job.frame.number / double(s.fps)));
+					started = true;
+				}
+				auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(job.frame.number / double(s.fps)));
+				if (std::chrono::steady_clock::now() > deadline + std::chrono::duration<double>(1.0 / s.fps))
+				{
+					m_LateFrames++;
+					lateFrames.Add();
+				}
+				std::this_thread::sleep_until(deadline);
+			}
+
+			job.frame.pixels = job.pixels;
+			bool more = sink(job.frame);
+			streamFrames.Add();
+			pool.Push(job.pixels);
+
+			if (!more)
+			{
+				abort();
+				break;
+			}
+		}
+	});
+
+	#pragma endregion
+
+	#pragma region Render
+
+	Renderer renderer(s.renderThreads);
+	renderer.SetCacheBudget(s.cacheBudget);
+	renderer.SetDeterministic(s.deterministic);
+	for (uint64_t f = 0ULL; s.frames == 0ULL || f < s.frames; f++)
+	{
+		uint64_t segment = f / segmentFrames;
+		uint64_t local = f % segmentFrames;
+		bool transition = segment > 0ULL && local < transitionFrames;
+
+		// The previous segment is still visible during the transition
+		release(transition ? segment - 1ULL : segment);
+
+		const Segment* incoming = program(segment);
+		const Segment* outgoing = transition ? program(segment - 1ULL) : nullptr;
+		if (!incoming || (transition && !outgoing))
+			break;
+
+		Job job{};
+		job.frame = Frame{ f, incoming->seed, Renderer::FramePhase(local, s.fps), nullptr };
+		if (!pool.Pop(job.pixels))
+			break;
+		renderer.Render(incoming->program, s.width, s.height, job.frame.phase, job.pixels, pitch);
+
+		if (transition)
+		{
+			if (!pool.Pop(job.outgoing))
+				break;
+			renderer.Render(outgoing->program, s.width, s.height, Renderer::FramePhase(local + segmentFrames, s.fps), job.outgoing, pitch);
+
+			// Smoothstep from the outgoing segment to the incoming one
+			float t = float(local + 1ULL) / float(transitionFrames + 1ULL);
+			job.weight = uint32_t(256.0f * t * t * (3.0f - 2.0f * t) + 0.5f);
+		}
+
+		if (!blendQueue.Push(job))
+			break;
+	}
+
+	#pragma endregion
+
+	// Let the queued frames drain through the last stages, then stop the generators
+	blendQueue.Close();
+	blender.join();
+	output.join();
+
+	Stop();
+	for (std::thread& generator : generators)
+		generator.join();
+}
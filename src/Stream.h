@@ -0,0 +1,83 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <condition_variable>
+
+/*
+	Endless stream of animated images that never repeats, rendered on the CPU.
+
+	The stream walks a deterministic schedule of seeds (SegmentSeed), showing each one for a segment and crossfading into the next,
+	so any frame of the stream can be reproduced from the base seed and its number alone.
+
+	The work is split in pipelined stages, connected by bounded queues and each running on its own threads:
+		generate  - generator threads generate and compile the programs of the upcoming segments, ahead of time
+		render    - the thread that calls Run renders frames (two during a transition) with a Renderer and its workers
+		blend     - a thread crossfades the two frames of a transition into one
+		output    - a thread paces the frames (optionally) and hands them to the sink, e.g. an encoder
+	Frames live in a fixed pool of buffers that circulate through the stages, so the memory usage stays constant however long the stream runs.
+*/
+class Stream
+{
+public:
+	struct Settings
+	{
+		uint64_t seed = 0ULL; // Base seed of the schedule
+		uint32_t width = 1920U;
+		uint32_t height = 1080U;
+		float fps = 60.0f;
+		uint64_t frames = 0ULL; // 0 streams forever
+		float segmentSeconds = 12.566371f; // Time between the starts of two segments (one loop of the animation by default)
+		float transitionSeconds = 2.0f; // Length of the crossfade at the start of each segment
+		bool realtime = false; // Pace the output to the frame rate instead of running as fast as possible
+		uint32_t generatorThreads = 1U;
+		uint32_t renderThreads = 0U; // 0 for one per hardware thread
+		uint32_t lookahead = 2U; // Segments generated ahead of the one being rendered
+		uint32_t queueDepth = 4U; // Frames in flight between two stages
+		float prune = 0.0f; // Error budget of the pruning pass (see Pruning.h), 0 disables it (ignored when deterministic)
+		float surrogates = 0.0f; // Error bound of the polynomial surrogates (see Surrogates.h), 0 disables them (ignored when deterministic)
+		bool correlated = false; // Same functions in the three channels (see GenerateShaderExpression)
+		size_t cacheBudget = size_t(256U) << 20U; // Memory for the time-independent values of the segments (see Renderer)
+		bool deterministic = false; // Fixed point evaluator, with bit-identical frames on every machine (see Fixed.h)
+	};
+
+	struct Frame
+	{
+		uint64_t number;
+		uint64_t seed; // Seed of the segment the frame belongs to (the incoming one during a transition)
+		float phase;
+		const uint8_t* pixels; // Tightly packed RGBA8 rows, valid until the sink returns
+	};
+
+	// Called on the output thread for every frame, in order, returns false to stop the stream
+	using Sink = std::function<bool(const Frame& frame)>;
+
+	Stream(const Settings& settings);
+
+	Stream(const Stream&) = delete;
+	Stream& operator=(const Stream&) = delete;
+
+	// Run the stream until the frame count is reached, the sink returns false or Stop is called
+	void Run(const Sink& sink);
+	// Can be called from any thread, the frames already rendered are still output
+	void Stop();
+
+	// Seed of the given segment of the schedule (a seed derived from it is shown instead if it cannot be compiled)
+	static uint64_t SegmentSeed(uint64_t seed, uint64_t segment);
+
+	// Frames output late by the realtime pacing, i.e. the stream did not keep up with the frame rate
+	uint64_t LateFrames() const { return m_LateFrames; }
+
+private:
+	Settings m_Settings;
+
+	// Guards the programs of the upcoming segments, m_ProgramReady is also notified on stop
+	std::mutex m_Mutex;
+	std::condition_variable m_ProgramReady;
+	bool m_Stop = false;
+
+	std::atomic<uint64_t> m_LateFrames{ 0ULL };
+};
@@ -0,0 +1,445 @@
+#include "Surrogates.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "Evaluator.h"
+#include "Metrics.h"
+
+namespace
+{
+	Metrics::Counter fittedSubtrees("pollock_surrogate_subtrees_total", "Number of subtrees replaced by polynomials");
+	Metrics::Histogram fitTime("pollock_surrogate_duration_seconds", "Time to fit the surrogates of one program");
+
+	// Inputs a value can depend on, as bits
+	constexpr uint8_t INPUT_X = 1U, INPUT_Y = 2U, INPUT_PHASE = 4U;
+
+	uint8_t InputsOf(Op op)
+	{
+		switch (op)
+		{
+		case Op::X: case Op::InvX: return INPUT_X;
+		case Op::Y: case Op::InvY: return INPUT_Y;
+		case Op::SinTime: case Op::CosTime: case Op::Phase: return INPUT_PHASE;
+		case Op::Cached: return INPUT_X | INPUT_Y;
+		default: return 0U;
+		}
+	}
+
+	// Value of a channel as it ends up on screen (NaN is shown as 0, like in the renderer)
+	inline float Displayed(float v) { return v > 0.0f ? (v < 1.0f ? v : 1.0f) : 0.0f; }
+
+	// Mark the instructions reachable from the outputs, without going below the replaced ones
+	void MarkLive(const Program& program, const std::vector<uint8_t>& replaced, std::vector<uint8_t>& live)
+	{
+		live.assign(program.code.size(), 0U);
+		for (uint32_t c = 0U; c < 3U; c++)
+			live[program.outputs[c]] = 1U;
+
+		for (size_t i = program.code.size(); i-- > 0U;)
+			if (live[i] && !replaced[i])
+				for (uint32_t a = 0U; a < OpArity(program.code[i].op); a++)
+					live[program.code[i].args[a]] = 1U;
+	}
+
+	// Coefficients of the polynomial in u of the Chebyshev series truncated at the given degree (T0 = 1, T1 = u, Tk+1 = 2u Tk - Tk-1)
+	void ChebyshevToMonomial(const std::vector<double>& chebyshev, uint32_t degree, std::vector<float>& coefficients)
+	{
+		std::vector<double> monomial(degree + 1U, 0.0), previous(degree + 1U, 0.0), current(degree + 1U, 0.0), next(degree + 1U, 0.0);
+		previous[0] = 1.0;
+		if (degree > 0U)
+			current[1] = 1.0;
+
+		for (uint32_t k = 0U; k <= degree; k++)
+		{
+			const std::vector<double>& t = k == 0U ? previous : current;
+			for (uint32_t j = 0U; j <= degree; j++)
+				monomial[j] += chebyshev[k] * t[j];
+
+			if (k > 0U && k < degree)
+			{
+				for (uint32_t j = 0U; j <= degree; j++)
+					next[j] = (j > 0U ? 2.0 * current[j - 1U] : 0.0) - previous[j];
+				previous.swap(current);
+				current.swap(next);
+			}
+		}
+
+		coefficients.assign(monomial.begin(), monomial.end());
+	}
+
+	// Same arithmetic as the chain of Op::Horner instructions
+	inline float EvaluatePolynomial(const std::vector<float>& coefficients, float t)
+	{
+		float value = coefficients.back();
+		for (size_t k = coefficients.size() - 1U; k-- > 0U;)
+			value = value * (t + t - 1.0f) + coefficients[k];
+		return value;
+	}
+}
+
+Surrogates::Report Surrogates::Fit(Program& program, const Settings& settings)
+{
+	Metrics::Timer timer(fitTime);
+
+	const std::vector<Instruction>& code = program.code;
+	const uint32_t n = uint32_t(code.size());
+
+	Report report{};
+	report.instructionsBefore = n;
+	report.costBefore = ProgramCost(program);
+	report.costAfter = report.costBefore;
+	report.instructionsAfter = n;
+	if (!program.stores.empty())
+		return report;
+
+	#pragma region Candidates
+
+	// Inputs of every value, and the cost of its subtree (counting shared values once)
+	std::vector<uint8_t> inputs(n, 0U);
+	for (uint32_t i = 0U; i < n; i++)
+	{
+		inputs[i] = InputsOf(code[i].op);
+		for (uint32_t a = 0U; a < OpArity(code[i].op); a++)
+			inputs[i] |= inputs[code[i].args[a]];
+	}
+
+	std::vector<float> subtreeCost(n, 0.0f);
+	std::vector<uint32_t> visited(n, UINT32_MAX);
+	std::vector<uint32_t> stack;
+	for (uint32_t i = 0U; i < n; i++)
+	{
+		uint8_t in = inputs[i];
+		if (OpArity(code[i].op) == 0U || (in != INPUT_X && in != INPUT_Y && in != INPUT_PHASE))
+			continue;
+
+		stack.assign(1U, i);
+		visited[i] = i;
+		while (!stack.empty())
+		{
+			uint32_t j = stack.back();
+			stack.pop_back();
+			subtreeCost[i] += OpCost(code[j].op);
+			for (uint32_t a = 0U; a < OpArity(code[j].op); a++)
+			{
+				uint32_t arg = code[j].args[a];
+				if (visited[arg] != i)
+				{
+					visited[arg] = i;
+					stack.push_back(arg);
+				}
+			}
+		}
+	}
+
+	#pragma endregion
+
+	#pragma region Samples
+
+	// Chebyshev nodes of the fit (twice as many as the coefficients, so the series is close to the best polynomial),
+	// followed by evenly spaced inputs that include both ends of [0, 1]
+	const uint32_t maxDegree = settings.maxDegree;
+	const uint32_t nodeCount = 2U * (maxDegree + 1U);
+	const uint32_t checkCount = std::max(settings.checkPoints, 2U);
+	const uint32_t sampleCount = nodeCount + checkCount;
+
+	std::vector<float> t(sampleCount), sinTime(sampleCount), cosTime(sampleCount);
+	for (uint32_t j = 0U; j < sampleCount; j++)
+	{
+		if (j < nodeCount)
+			t[j] = float(0.5 + 0.5 * std::cos(3.141592653589793 * (j + 0.5) / nodeCount));
+		else
+			t[j] = float(j - nodeCount) / float(checkCount - 1U);
+
+		// Same time inputs as Renderer::PhaseInputs
+		float angle = 6.2831853f * t[j];
+		sinTime[j] = 0.5f + 0.5f * std::sin(angle);
+		cosTime[j] = 0.5f + 0.5f * std::cos(angle);
+	}
+
+	// Pixels where the displayed colors are checked, a jittered grid repeated over several phases like in Pruning
+	bool animated = false;
+	for (const Instruction& instruction : code)
+		animated |= (InputsOf(instruction.op) & INPUT_PHASE) != 0U;
+
+	const uint32_t gridSize = settings.gridSize > 0U ? settings.gridSize : 1U;
+	const uint32_t phaseCount = animated && settings.phaseCount > 0U ? settings.phaseCount : 1U;
+	const uint32_t perPhase = gridSize * gridSize;
+	const size_t pixelCount = size_t(perPhase) * phaseCount;
+
+	std::vector<float> x(pixelCount), y(pixelCount), phases(phaseCount), pixelSin(phaseCount), pixelCos(phaseCount);
+	for (uint32_t p = 0U; p < phaseCount; p++)
+	{
+		phases[p] = float(p) / float(phaseCount);
+		float angle = 6.2831853f * phases[p];
+		pixelSin[p] = 0.5f + 0.5f * std::sin(angle);
+		pixelCos[p] = 0.5f + 0.5f * std::cos(angle);
+
+		float jitterX = std::fmod(0.5f + 0.7548777f * float(p), 1.0f);
+		float jitterY = std::fmod(0.5f + 0.5698403f * float(p), 1.0f);
+		for (uint32_t row = 0U; row < gridSize; row++)
+		{
+			for (uint32_t column = 0U; column < gridSize; column++)
+			{
+				size_t s = size_t(p) * perPhase + row * gridSize + column;
+				x[s] = (float(column) + jitterX) / float(gridSize);
+				y[s] = (float(row) + jitterY) / float(gridSize);
+			}
+		}
+	}
+
+	#pragma endregion
+
+	#pragma region Reference
+
+	// Value of every instruction for every pixel, one row per instruction, with the trials in separate rows like in Pruning
+	std::vector<float> pixels(size_t(n) * pixelCount);
+	std::vector<int32_t> trialRow(n, -1);
+	std::vector<float> trialValues;
+	std::vector<uint32_t> trialChanged;
+
+	auto row = [&](uint32_t i) -> float*
+	{
+		return trialRow[i] >= 0 ? trialValues.data() + size_t(trialRow[i]) * pixelCount : pixels.data() + size_t(i) * pixelCount;
+	};
+
+	auto evaluate = [&](uint32_t i, float* out)
+	{
+		const Instruction& instruction = code[i];
+		for (uint32_t p = 0U; p < phaseCount; p++)
+		{
+			size_t offset = size_t(p) * perPhase;
+			const float* args[4];
+			for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+				args[a] = row(instruction.args[a]) + offset;
+
+			Evaluator::EvaluateInstruction(instruction, args, x.data() + offset, y.data() + offset, pixelSin[p], pixelCos[p], perPhase, out + offset);
+		}
+	};
+
+	for (uint32_t i = 0U; i < n; i++)
+		evaluate(i, pixels.data() + size_t(i) * pixelCount);
+
+	std::vector<float> reference(3U * pixelCount);
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		const float* output = row(program.outputs[c]);
+		for (size_t s = 0U; s < pixelCount; s++)
+			reference[c * pixelCount + s] = Displayed(output[s]);
+	}
+
+	// Replace the value of an instruction by the given polynomial of its input, and measure the largest change of the displayed colors
+	// The trial stays in place until it is ended, so it can be kept
+	std::vector<uint8_t> live;
+	auto begin = [&](uint32_t i, uint8_t input, const std::vector<float>& polynomial)
+	{
+		trialChanged.assign(1U, i);
+		trialValues.resize(pixelCount);
+		trialRow[i] = 0;
+		for (size_t s = 0U; s < pixelCount; s++)
+		{
+			float t = input == INPUT_X ? x[s] : input == INPUT_Y ? y[s] : phases[s / perPhase];
+			trialValues[s] = EvaluatePolynomial(polynomial, t);
+		}
+
+		for (uint32_t j = i + 1U; j < n; j++)
+		{
+			if (!live[j])
+				continue;
+
+			bool affected = false;
+			for (uint32_t a = 0U; a < OpArity(code[j].op); a++)
+				affected |= trialRow[code[j].args[a]] >= 0;
+			if (!affected)
+				continue;
+
+			trialRow[j] = int32_t(trialChanged.size());
+			trialChanged.push_back(j);
+			trialValues.resize(trialChanged.size() * pixelCount);
+			evaluate(j, trialValues.data() + size_t(trialRow[j]) * pixelCount);
+		}
+
+		float error = 0.0f;
+		for (uint32_t c = 0U; c < 3U && error <= settings.errorBudget; c++)
+		{
+			const float* output = row(program.outputs[c]);
+			for (size_t s = 0U; s < pixelCount; s++)
+				error = std::fmax(error, std::fabs(Displayed(output[s]) - reference[c * pixelCount + s]));
+		}
+		return error;
+	};
+	auto end = [&](bool keep)
+	{
+		for (uint32_t j : trialChanged)
+		{
+			if (keep)
+				std::copy_n(row(j), pixelCount, pixels.data() + size_t(j) * pixelCount);
+			trialRow[j] = -1;
+		}
+	};
+
+	#pragma endregion
+
+	#pragma region Fits
+
+	std::vector<uint8_t> replaced(n, 0U);
+	std::vector<std::vector<float>> fits(n);
+	std::vector<float> values;
+	std::vector<double> chebyshev(maxDegree + 1U);
+	std::vector<float> coefficients;
+
+	for (uint8_t input : { INPUT_X, INPUT_Y, INPUT_PHASE })
+	{
+		// Value of every instruction that only depends on this input (or on nothing), one row per instruction
+		// The other inputs are never read, so x and y can both be the samples
+		values.assign(size_t(n) * sampleCount, 0.0f);
+		bool any = false;
+		for (uint32_t i = 0U; i < n; i++)
+		{
+			if ((inputs[i] & ~input) != 0U)
+				continue;
+			any |= inputs[i] == input && OpArity(code[i].op) > 0U;
+
+			const Instruction& instruction = code[i];
+			const float* args[4];
+			float* out = values.data() + size_t(i) * sampleCount;
+			if (input == INPUT_PHASE)
+			{
+				// The time inputs are uniforms, so every phase is a separate call
+				for (uint32_t j = 0U; j < sampleCount; j++)
+				{
+					for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+						args[a] = values.data() + size_t(instruction.args[a]) * sampleCount + j;
+					Evaluator::EvaluateInstruction(instruction, args, t.data() + j, t.data() + j, sinTime[j], cosTime[j], 1U, out + j);
+				}
+			}
+			else
+			{
+				for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+					args[a] = values.data() + size_t(instruction.args[a]) * sampleCount;
+				Evaluator::EvaluateInstruction(instruction, args, t.data(), t.data(), 0.5f, 0.5f, sampleCount, out);
+			}
+		}
+		if (!any)
+			continue;
+
+		// From the outputs down, so the largest subtrees are tried first
+		MarkLive(program, replaced, live);
+		for (uint32_t i = n; i-- > 0U;)
+		{
+			if (!live[i] || inputs[i] != input || OpArity(code[i].op) == 0U)
+				continue;
+
+			const float* f = values.data() + size_t(i) * sampleCount;
+			if (!std::all_of(f, f + sampleCount, [](float v) { return std::isfinite(v); }))
+				continue;
+
+			// Chebyshev coefficients from the values at the nodes (discrete cosine transform)
+			for (uint32_t k = 0U; k <= maxDegree; k++)
+			{
+				double sum = 0.0;
+				for (uint32_t j = 0U; j < nodeCount; j++)
+					sum += f[j] * std::cos(3.141592653589793 * k * (j + 0.5) / nodeCount);
+				chebyshev[k] = (k == 0U ? 1.0 : 2.0) * sum / nodeCount;
+			}
+
+			// Lowest degree within the bound, among the ones cheaper than the subtree
+			for (uint32_t degree = 0U; degree <= maxDegree && float(degree) * OpCost(Op::Horner) < subtreeCost[i]; degree++)
+			{
+				ChebyshevToMonomial(chebyshev, degree, coefficients);
+
+				float error = 0.0f;
+				for (uint32_t j = 0U; j < sampleCount && error <= settings.errorBound; j++)
+					error = std::fmax(error, std::fabs(EvaluatePolynomial(coefficients, t[j]) - f[j]));
+				if (error > settings.errorBound)
+					continue;
+
+				// The operations above the subtree can amplify the error, so the fit must also keep the colors within the budget
+				bool keep = begin(i, input, coefficients) <= settings.errorBudget;
+				end(keep);
+				if (!keep)
+					continue;
+
+				fits[i] = coefficients;
+				replaced[i] = 1U;
+				report.replacedSubtrees++;
+				MarkLive(program, replaced, live);
+				break;
+			}
+		}
+	}
+
+	for (uint32_t c = 0U; c < 3U; c++)
+	{
+		const float* output = row(program.outputs[c]);
+		for (size_t s = 0U; s < pixelCount; s++)
+			report.maxError = std::fmax(report.maxError, std::fabs(Displayed(output[s]) - reference[c * pixelCount + s]));
+	}
+
+	if (report.replacedSubtrees == 0U)
+		return report;
+
+	#pragma endregion
+
+	#pragma region Rewrite
+
+	// Each fitted subtree becomes a chain of Horner steps, placed where the subtree was so arguments still come first
+	std::vector<Instruction> rewritten;
+	std::vector<uint32_t> newIndex(n);
+	uint32_t inputIndex[3] = { UINT32_MAX, UINT32_MAX, UINT32_MAX };
+	auto push = [&](const Instruction& instruction)
+	{
+		rewritten.push_back(instruction);
+		return uint32_t(rewritten.size() - 1U);
+	};
+	auto constant = [&](float value)
+	{
+		Instruction instruction{ Op::Const };
+		instruction.value = value;
+		return push(instruction);
+	};
+
+	for (uint32_t i = 0U; i < n; i++)
+	{
+		if (!replaced[i])
+		{
+			Instruction instruction = code[i];
+			for (uint32_t a = 0U; a < OpArity(instruction.op); a++)
+				instruction.args[a] = newIndex[instruction.args[a]];
+			newIndex[i] = push(instruction);
+			continue;
+		}
+
+		const std::vector<float>& c = fits[i];
+		uint32_t slot = inputs[i] == INPUT_X ? 0U : inputs[i] == INPUT_Y ? 1U : 2U;
+		if (inputIndex[slot] == UINT32_MAX)
+			inputIndex[slot] = push(Instruction{ slot == 0U ? Op::X : slot == 1U ? Op::Y : Op::Phase });
+
+		uint32_t value = constant(c.back());
+		for (size_t k = c.size() - 1U; k-- > 0U;)
+		{
+			Instruction step{ Op::Horner };
+			step.args[0] = value;
+			step.args[1] = inputIndex[slot];
+			step.args[2] = constant(c[k]);
+			value = push(step);
+		}
+		newIndex[i] = value;
+	}
+
+	for (uint32_t& output : program.outputs)
+		output = newIndex[output];
+	program.code.swap(rewritten);
+
+	// Remove the subtrees below the polynomials
+	ScheduleProgram(program);
+
+	#pragma endregion
+
+	report.instructionsAfter = uint32_t(program.code.size());
+	report.costAfter = ProgramCost(program);
+	fittedSubtrees.Add(report.replacedSubtrees);
+
+	return report;
+}
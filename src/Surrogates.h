@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Program.h"
+
+/*
+	Replaces subtrees that only depend on one input by polynomials.
+
+	Deep trees often contain large subtrees of x alone, y alone or the phase of the animation alone (like a chain of fWave and fPow
+	of input.uv.x), which are smooth functions of a single variable. Every such subtree (from the outputs down) is sampled at
+	Chebyshev nodes of its input with the CPU evaluator, and its Chebyshev series is truncated at the lowest degree whose
+	polynomial stays within the error bound of the subtree over a dense grid of the input. The fit is only kept if it is cheaper
+	than the subtree, and if the displayed colors of a set of sampled pixels stay within the error budget of the original program
+	(the operations above a subtree can amplify its error, see Pruning for the samples). The subtree is then replaced by a chain of
+	Op::Horner steps over the input, with the coefficients as constants, so the WGSL and CPU backends (and the constant modes)
+	need nothing else.
+
+	The polynomials are in 2 * t - 1, where the Chebyshev coefficients are smallest, and the checks evaluate them exactly like the
+	evaluator does, so the rounding of high degree coefficients is part of the measured error.
+	Subtrees of the phase read it from Op::Phase, which is not supported by the fixed point evaluator.
+*/
+namespace Surrogates
+{
+	struct Settings
+	{
+		float errorBound = 0.5f / 255.0f; // Maximum difference between a subtree and its polynomial over the checked inputs
+		uint32_t maxDegree = 12U; // Higher degrees lose too much precision to the rounding of the coefficients in float
+		uint32_t checkPoints = 1024U; // Evenly spaced inputs where the error is checked, in addition to the nodes
+		float errorBudget = 1.0f / 255.0f; // Maximum change of any channel of any sampled pixel, like in Pruning
+		uint32_t gridSize = 16U;
+		uint32_t phaseCount = 8U;
+	};
+
+	struct Report
+	{
+		uint32_t replacedSubtrees;
+		uint32_t instructionsBefore;
+		uint32_t instructionsAfter;
+		float costBefore; // Static cost estimate (see OpCost)
+		float costAfter;
+		float maxError; // Largest error of the displayed colors over the sampled pixels
+	};
+
+	// Fit the subtrees of the program in place and reschedule it
+	// Programs with cache slots are left unchanged, the surrogates must be fitted before SplitProgram
+	Report Fit(Program& program, const Settings& settings = Settings());
+}
@@ -0,0 +1,51 @@
+#include "Tar.h"
+
+#include <cstdint>
+#include <cstring>
+
+namespace
+{
+	constexpr size_t BLOCK_SIZE = 512U;
+
+	// Zero padded octal number that fills a field, including its terminating null
+	void WriteOctal(char* field, size_t length, unsigned long long value)
+	{
+		std::snprintf(field, length, "%0*llo", int(length - 1U), value);
+	}
+}
+
+bool Tar::WriteFile(std::FILE* file, const std::string& name, const void* data, size_t size)
+{
+	if (name.size() > 100U)
+		return false;
+
+	char header[BLOCK_SIZE] = {};
+	std::memcpy(header, name.data(), name.size());
+	WriteOctal(header + 100, 8U, 0644U); // Mode
+	WriteOctal(header + 108, 8U, 0U); // Owner
+	WriteOctal(header + 116, 8U, 0U); // Group
+	WriteOctal(header + 124, 12U, size);
+	WriteOctal(header + 136, 12U, 0U); // Modification time
+	header[156] = '0'; // Regular file
+	std::memcpy(header + 257, "ustar", 6U);
+	std::memcpy(header + 263, "00", 2U);
+
+	// The checksum is computed with its own field filled with spaces
+	std::memset(header + 148, ' ', 8U);
+	unsigned int checksum = 0U;
+	for (size_t i = 0U; i < BLOCK_SIZE; i++)
+		checksum += uint8_t(header[i]);
+	std::snprintf(header + 148, 7U, "%06o", checksum);
+
+	static const char padding[BLOCK_SIZE] = {};
+	size_t paddingSize = (BLOCK_SIZE - size % BLOCK_SIZE) % BLOCK_SIZE;
+	return std::fwrite(header, 1, BLOCK_SIZE, file) == BLOCK_SIZE
+		&& std::fwrite(data, 1, size, file) == size
+		&& std::fwrite(padding, 1, paddingSize, file) == paddingSize;
+}
+
+bool Tar::WriteEnd(std::FILE* file)
+{
+	static const char end[2U * BLOCK_SIZE] = {};
+	return std::fwrite(end, 1, sizeof(end), file) == sizeof(end) && std::fflush(file) == 0;
+}
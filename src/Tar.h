@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <cstdio>
+#include <cstddef>
+
+/*
+	Minimal writer of ustar archives, so a stream of images can be written to a pipe as they are rendered.
+
+	Every entry is a regular file with a 512 byte header followed by its data, padded to whole blocks.
+	Nothing is seeked back, and the modification times are 0, so the same entries always give the same bytes.
+*/
+namespace Tar
+{
+	// Write a file entry, the name must fit in the 100 characters of the header
+	bool WriteFile(std::FILE* file, const std::string& name, const void* data, size_t size);
+
+	// Write the two empty blocks that end an archive
+	bool WriteEnd(std::FILE* file);
+}
@@ -0,0 +1,549 @@
+#include "Thumbnails.h"
+#include "GraphicsState.h"
+#include "Metrics.h"
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#include <webgpu/webgpu_cpp.h>
+#include <emscripten/emscripten.h>
+
+#include "Shader.h"
+#include "Bytecode.h"
+
+using namespace GraphicsState;
+
+namespace
+{
+	// State of Render
+	// The programs of every seed run in one compute pipeline (see EmitInterpreterShaderCode), a dispatch per THUMBNAIL_LAYERS programs,
+	// and the dispatches of a chunk are read back with a single copy per dispatch into one staging buffer, mapped once
+	constexpr uint32_t THUMBNAIL_LAYERS = 256U; // Default maxTextureArrayLayers, supported by every device
+	constexpr uint64_t THUMBNAIL_CHUNK_BYTES = uint64_t(64U) << 20U; // Staging memory (and code) of a chunk
+	struct ThumbnailRun
+	{
+		uint32_t width = 0U, height = 0U;
+		uint32_t rowPitch = 0U; // Bytes per row in the staging buffer, padded to the 256 bytes required by copies
+		std::vector<std::vector<uint32_t>> words; // Encoding of each program, empty if the interpreter can not run it
+		uint32_t next = 0U; // First program of the current chunk
+		uint32_t chunkEnd = 0U; // Programs before it are in the current chunk or delivered
+		uint32_t chunkCount = 0U; // Layers of the current chunk, i.e. its interpreted programs
+		uint32_t interpreted = 0U;
+		wgpu::Buffer timeBuffer;
+		wgpu::Buffer staging;
+		std::vector<uint8_t> image; // Thumbnail without the row padding
+		std::function<void(uint32_t index, const uint8_t* pixels)> sink;
+		std::function<void(double ms, uint32_t interpreted)> done;
+		double start = 0.0;
+		bool running = false;
+	};
+	ThumbnailRun m_Thumbnails;
+	Metrics::Counter m_InterpretedThumbnails("pollock_gpu_interpreted_thumbnails_total", "Number of thumbnails rendered by the GPU interpreter");
+
+	// Interpreter pipeline, created with the first thumbnails and shared by every program
+	wgpu::BindGroupLayout m_InterpreterLayout;
+	wgpu::ComputePipeline m_InterpreterPipeline;
+
+	// State of Benchmark, which renders the first programs again with a pipeline each, as the canvas does
+	struct ThumbnailBenchmark
+	{
+		std::vector<Program> programs; // The first ones, rendered with their own pipeline
+		uint32_t seeds = 0U;
+		uint32_t pipelines = 0U;
+		uint32_t width = 0U, height = 0U, rowPitch = 0U;
+		float phase = 0.0f;
+		uint32_t next = 0U;
+		std::vector<std::vector<uint8_t>> batched; // Thumbnails of the interpreter for these programs, to compare
+		double batchedMs = 0.0;
+		uint32_t interpreted = 0U;
+		uint32_t maxDifference = 0U;
+		uint64_t differentChannels = 0ULL, comparedChannels = 0ULL; // Color channels more than 2 levels apart, out of those compared
+		wgpu::BindGroupLayout layout;
+		wgpu::BindGroup bindGroup;
+		wgpu::Texture target;
+		wgpu::Buffer staging;
+		double start = 0.0;
+		bool running = false;
+	};
+	ThumbnailBenchmark m_ThumbnailBenchmark;
+
+
+	void ThumbnailSetup(const std::vector<Program>& programs, float phase, uint32_t width, uint32_t height);
+	void ThumbnailSubmit();
+	void ThumbnailMapped(WGPUBufferMapAsyncStatus status, void* userdata);
+	void BenchmarkPipelineStep();
+	void BenchmarkPipelineMapped(WGPUBufferMapAsyncStatus status, void* userdata);
+}
+
+void Thumbnails::Render(const std::vector<Program>& programs, float phase, uint32_t width, uint32_t height, Sink sink)
+{
+	if (m_Thumbnails.running || m_ThumbnailBenchmark.running || !m_Device || programs.empty() || width == 0U || height == 0U || width > MAX_TILE_SIZE || height > MAX_TILE_SIZE)
+		return;
+
+	ThumbnailSetup(programs, phase, width, height);
+	ThumbnailRun& t = m_Thumbnails;
+	t.sink = [sink, width, height](uint32_t index, const uint8_t* pixels)
+	{
+		sink(index, pixels, width, height);
+	};
+	t.done = [seeds = uint32_t(programs.size()), width, height](double ms, uint32_t interpreted)
+	{
+		char report[256];
+		std::snprintf(report, sizeof(report), "{ \"seeds\": %u, \"interpreted\": %u, \"width\": %u, \"height\": %u, \"ms\": %.1f, \"thumbnailsPerSecond\": %.1f }",
+			seeds, interpreted, width, height, ms, 1000.0 * interpreted / ms);
+		std::cout << report << std::endl;
+	};
+	ThumbnailSubmit();
+}
+
+void Thumbnails::Benchmark(const std::vector<Program>& programs, uint32_t width, uint32_t height, uint32_t pipelines)
+{
+	if (m_Thumbnails.running || m_ThumbnailBenchmark.running || !m_Device || programs.empty() || width == 0U || height == 0U || width > MAX_TILE_SIZE || height > MAX_TILE_SIZE)
+		return;
+
+	ThumbnailBenchmark& benchmark = m_ThumbnailBenchmark;
+	benchmark = ThumbnailBenchmark{};
+	benchmark.pipelines = std::min(pipelines, uint32_t(programs.size()));
+	benchmark.programs.assign(programs.begin(), programs.begin() + benchmark.pipelines);
+	benchmark.batched.resize(benchmark.pipelines);
+	benchmark.seeds = uint32_t(programs.size());
+	benchmark.width = width;
+	benchmark.height = height;
+	benchmark.rowPitch = (width * 4U + 255U) / 256U * 256U;
+	benchmark.phase = 0.25f;
+	benchmark.running = true;
+
+	// The interpreter first, keeping the thumbnails of the programs that are then rendered with a pipeline each
+	ThumbnailSetup(programs, benchmark.phase, width, height);
+	ThumbnailRun& t = m_Thumbnails;
+	t.sink = [width, height](uint32_t index, const uint8_t* pixels)
+	{
+		ThumbnailBenchmark& benchmark = m_ThumbnailBenchmark;
+		if (index < benchmark.pipelines && pixels)
+			benchmark.batched[index].assign(pixels, pixels + size_t(width) * height * 4U);
+	};
+	t.done = [](double ms, uint32_t interpreted)
+	{
+		ThumbnailBenchmark& benchmark = m_ThumbnailBenchmark;
+		benchmark.batchedMs = ms;
+		benchmark.interpreted = interpreted;
+		benchmark.start = emscripten_get_now();
+		BenchmarkPipelineStep();
+	};
+	ThumbnailSubmit();
+}
+
+namespace
+{
+	// Encode the programs and create the interpreter pipeline if needed, the callbacks of the thumbnails are set by the caller
+	void ThumbnailSetup(const std::vector<Program>& programs, float phase, uint32_t width, uint32_t height)
+	{
+		ThumbnailRun& t = m_Thumbnails;
+		t = ThumbnailRun{};
+		t.width = width;
+		t.height = height;
+		t.rowPitch = (width * 4U + 255U) / 256U * 256U;
+		t.image.resize(size_t(width) * height * 4U);
+
+		// Programs the interpreter can not run are left empty, and given to the sink without pixels
+		t.words.resize(programs.size());
+		for (size_t i = 0; i < programs.size(); i++)
+			Bytecode::EncodeWords(programs[i], t.words[i]);
+
+		// Same time inputs as Update, for every thumbnail
+		float angle = 6.2831853f * phase;
+		const float times[] = { 0.5f + 0.5f * sinf(angle), 0.5f + 0.5f * cosf(angle), phase, 0.0f };
+		wgpu::BufferDescriptor ubd =
+		{
+			.usage				= wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst,
+			.size				= sizeof(times),
+			.mappedAtCreation	= false
+		};
+		t.timeBuffer = m_Device.CreateBuffer(&ubd);
+		m_Device.GetQueue().WriteBuffer(t.timeBuffer, 0, times, sizeof(times));
+
+		// The interpreter does not depend on the programs, so it is only compiled once, and its creation can block
+		if (!m_InterpreterPipeline)
+		{
+			std::string code = EmitInterpreterShaderCode();
+			wgpu::ShaderModuleWGSLDescriptor wgsld{};
+			wgsld.code = code.c_str();
+			wgpu::ShaderModuleDescriptor shaderModuleDescriptor{ .nextInChain = &wgsld };
+			wgpu::ShaderModule module = m_Device.CreateShaderModule(&shaderModuleDescriptor);
+
+			wgpu::BindGroupLayoutEntry layoutEntries[] =
+			{
+				{
+					.binding = 0,
+					.visibility = wgpu::ShaderStage::Compute,
+					.buffer = { .type = wgpu::BufferBindingType::Uniform }
+				},
+				{
+					.binding = 1,
+					.visibility = wgpu::ShaderStage::Compute,
+					.buffer = { .type = wgpu::BufferBindingType::ReadOnlyStorage }
+				},
+				{
+					.binding = 2,
+					.visibility = wgpu::ShaderStage::Compute,
+					.buffer = { .type = wgpu::BufferBindingType::ReadOnlyStorage }
+				},
+				{
+					.binding = 3,
+					.visibility = wgpu::ShaderStage::Compute,
+					.storageTexture = { .access = wgpu::StorageTextureAccess::WriteOnly, .format = wgpu::TextureFormat::RGBA8Unorm, .viewDimension = wgpu::TextureViewDimension::e2DArray }
+				}
+			};
+			wgpu::BindGroupLayoutDescriptor bgld = { .entryCount = 4, .entries = layoutEntries };
+			m_InterpreterLayout = m_Device.CreateBindGroupLayout(&bgld);
+
+			wgpu::PipelineLayoutDescriptor pld = { .bindGroupLayoutCount = 1, .bindGroupLayouts = &m_InterpreterLayout };
+			wgpu::ComputePipelineDescriptor cpd =
+			{
+				.layout = m_Device.CreatePipelineLayout(&pld),
+				.compute = { .module = module }
+			};
+			m_InterpreterPipeline = m_Device.CreateComputePipeline(&cpd);
+		}
+
+		t.start = emscripten_get_now();
+		t.running = true;
+	}
+
+	// Interpret the next chunk of programs, a dispatch per THUMBNAIL_LAYERS of them, and copy every layer into one staging buffer
+	void ThumbnailSubmit()
+	{
+		ThumbnailRun& t = m_Thumbnails;
+		const uint64_t imageSize = uint64_t(t.rowPitch) * t.height;
+
+		// As many programs as the staging memory allows, and their code, with at least one program
+		std::vector<uint32_t> words, offsets;
+		t.chunkEnd = t.next;
+		t.chunkCount = 0U;
+		for (; t.chunkEnd < t.words.size(); t.chunkEnd++)
+		{
+			const std::vector<uint32_t>& program = t.words[t.chunkEnd];
+			if (program.empty())
+				continue;
+			if (t.chunkCount > 0U && (uint64_t(t.chunkCount + 1U) * imageSize > THUMBNAIL_CHUNK_BYTES || (words.size() + program.size()) * sizeof(uint32_t) > THUMBNAIL_CHUNK_BYTES))
+				break;
+			offsets.push_back(uint32_t(words.size()));
+			words.insert(words.end(), program.begin(), program.end());
+			t.chunkCount++;
+		}
+
+		// Nothing left to interpret, the remaining programs only need to be given to the sink
+		if (t.chunkCount == 0U)
+		{
+			ThumbnailMapped(WGPUBufferMapAsyncStatus_Success, nullptr);
+			return;
+		}
+
+		// The offsets of each dispatch are bound at their own (aligned) offset
+		const uint32_t dispatches = (t.chunkCount + THUMBNAIL_LAYERS - 1U) / THUMBNAIL_LAYERS;
+		offsets.resize(size_t(dispatches) * THUMBNAIL_LAYERS, 0U);
+
+		#pragma region Buffers and target
+
+		wgpu::BufferDescriptor obd =
+		{
+			.usage				= wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst,
+			.size				= offsets.size() * sizeof(uint32_t),
+			.mappedAtCreation	= false
+		};
+		wgpu::Buffer offsetBuffer = m_Device.CreateBuffer(&obd);
+		m_Device.GetQueue().WriteBuffer(offsetBuffer, 0, offsets.data(), offsets.size() * sizeof(uint32_t));
+
+		wgpu::BufferDescriptor wbd =
+		{
+			.usage				= wgpu::BufferUsage::Storage | wgpu::BufferUsage::CopyDst,
+			.size				= words.size() * sizeof(uint32_t),
+			.mappedAtCreation	= false
+		};
+		wgpu::Buffer wordBuffer = m_Device.CreateBuffer(&wbd);
+		m_Device.GetQueue().WriteBuffer(wordBuffer, 0, words.data(), words.size() * sizeof(uint32_t));
+
+		wgpu::BufferDescriptor sbd =
+		{
+			.usage				= wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst,
+			.size				= imageSize * t.chunkCount,
+			.mappedAtCreation	= false
+		};
+		t.staging = m_Device.CreateBuffer(&sbd);
+
+		// One layer per program of a dispatch, reused by the next dispatch once it has been copied
+		const uint32_t layers = std::min(t.chunkCount, THUMBNAIL_LAYERS);
+		wgpu::TextureDescriptor td =
+		{
+			.usage		= wgpu::TextureUsage::StorageBinding | wgpu::TextureUsage::CopySrc,
+			.dimension	= wgpu::TextureDimension::e2D,
+			.size		= { t.width, t.height, layers },
+			.format		= wgpu::TextureFormat::RGBA8Unorm
+		};
+		wgpu::Texture target = m_Device.CreateTexture(&td);
+		wgpu::TextureViewDescriptor tvd{ .dimension = wgpu::TextureViewDimension::e2DArray };
+		wgpu::TextureView targetView = target.CreateView(&tvd);
+
+		#pragma endregion
+
+		wgpu::CommandEncoder encoder = m_Device.CreateCommandEncoder();
+		for (uint32_t d = 0U; d < dispatches; d++)
+		{
+			const uint32_t count = std::min(THUMBNAIL_LAYERS, t.chunkCount - d * THUMBNAIL_LAYERS);
+			wgpu::BindGroupEntry entries[] =
+			{
+				{ .binding = 0, .buffer = t.timeBuffer, .offset = 0, .size = 4 * sizeof(float) },
+				{ .binding = 1, .buffer = offsetBuffer, .offset = uint64_t(d) * THUMBNAIL_LAYERS * sizeof(uint32_t), .size = THUMBNAIL_LAYERS * sizeof(uint32_t) },
+				{ .binding = 2, .buffer = wordBuffer, .offset = 0, .size = words.size() * sizeof(uint32_t) },
+				{ .binding = 3, .textureView = targetView }
+			};
+			wgpu::BindGroupDescriptor bgd = { .layout = m_InterpreterLayout, .entryCount = 4, .entries = entries };
+
+			wgpu::ComputePassEncoder pass = encoder.BeginComputePass();
+			pass.SetPipeline(m_InterpreterPipeline);
+			pass.SetBindGroup(0, m_Device.CreateBindGroup(&bgd));
+			pass.DispatchWorkgroups((t.width + 7U) / 8U, (t.height + 7U) / 8U, count);
+			pass.End();
+
+			wgpu::ImageCopyTexture source{ .texture = target };
+			wgpu::ImageCopyBuffer destination
+			{
+				.layout = { .offset = imageSize * d * THUMBNAIL_LAYERS, .bytesPerRow = t.rowPitch, .rowsPerImage = t.height },
+				.buffer = t.staging
+			};
+			wgpu::Extent3D size{ t.width, t.height, count };
+			encoder.CopyTextureToBuffer(&source, &destination, &size);
+		}
+
+		wgpu::CommandBuffer commands = encoder.Finish();
+		m_Device.GetQueue().Submit(1, &commands);
+		t.staging.MapAsync(wgpu::MapMode::Read, 0, imageSize * t.chunkCount, ThumbnailMapped, nullptr);
+	}
+
+	// Give the programs of the chunk to the sink in order, then interpret the next chunk
+	void ThumbnailMapped(WGPUBufferMapAsyncStatus status, void* userdata)
+	{
+		ThumbnailRun& t = m_Thumbnails;
+		if (status != WGPUBufferMapAsyncStatus_Success)
+		{
+			std::cout << "Thumbnail readback failed: " << status << std::endl;
+			t.running = false;
+			m_ThumbnailBenchmark.running = false;
+			return;
+		}
+
+		const size_t imageSize = size_t(t.rowPitch) * t.height;
+		const uint8_t* data = t.chunkCount > 0U ? static_cast<const uint8_t*>(t.staging.GetConstMappedRange(0, imageSize * t.chunkCount)) : nullptr;
+		for (uint32_t layer = 0U; t.next < t.chunkEnd; t.next++)
+		{
+			if (t.words[t.next].empty())
+			{
+				t.sink(t.next, nullptr);
+				continue;
+			}
+			for (uint32_t row = 0U; row < t.height; row++)
+				std::memcpy(t.image.data() + size_t(row) * t.width * 4U, data + imageSize * layer + size_t(row) * t.rowPitch, t.width * 4U);
+			t.sink(t.next, t.image.data());
+			m_InterpretedThumbnails.Add();
+			t.interpreted++;
+			layer++;
+		}
+		if (data)
+			t.staging.Unmap();
+
+		if (t.next < t.words.size())
+		{
+			ThumbnailSubmit();
+			return;
+		}
+
+		// Free the staging buffer, the done callback may start other work
+		std::function<void(double, uint32_t)> done = std::move(t.done);
+		double ms = emscripten_get_now() - t.start;
+		uint32_t interpreted = t.interpreted;
+		t = ThumbnailRun{};
+		done(ms, interpreted);
+	}
+
+	// Render the next program of the thumbnail benchmark with its own module and pipeline, as the canvas does, then read it back
+	void BenchmarkPipelineStep()
+	{
+		ThumbnailBenchmark& benchmark = m_ThumbnailBenchmark;
+
+		// Print the results after the last program
+		if (benchmark.next == benchmark.pipelines)
+		{
+			double pipelineMs = emscripten_get_now() - benchmark.start;
+			double batchedPerSeed = benchmark.batchedMs / std::max(benchmark.interpreted, 1U);
+			double pipelinePerSeed = benchmark.pipelines > 0U ? pipelineMs / benchmark.pipelines : 0.0;
+			char report[512];
+			std::snprintf(report, sizeof(report), "{ \"seeds\": %u, \"interpreted\": %u, \"width\": %u, \"height\": %u, \"batchedMs\": %.1f, \"batchedPerSeedMs\": %.4f, "
+				"\"pipelineSeeds\": %u, \"pipelinePerSeedMs\": %.3f, \"speedup\": %.1f, \"maxDifference\": %u, \"differentChannels\": %llu, \"comparedChannels\": %llu }",
+				benchmark.seeds, benchmark.interpreted, benchmark.width, benchmark.height, benchmark.batchedMs, batchedPerSeed,
+				benchmark.pipelines, pipelinePerSeed, batchedPerSeed > 0.0 ? pipelinePerSeed / batchedPerSeed : 0.0,
+				benchmark.maxDifference, (unsigned long long)benchmark.differentChannels, (unsigned long long)benchmark.comparedChannels);
+			std::cout << report << std::endl;
+
+			benchmark = ThumbnailBenchmark{};
+			return;
+		}
+
+		// Target, staging buffer and bindings shared by every program
+		if (!benchmark.target)
+		{
+			wgpu::TextureDescriptor td =
+			{
+				.usage		= wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc,
+				.dimension	= wgpu::TextureDimension::e2D,
+				.size		= { benchmark.width, benchmark.height, 1 },
+				.format		= wgpu::TextureFormat::RGBA8Unorm
+			};
+			benchmark.target = m_Device.CreateTexture(&td);
+
+			wgpu::BufferDescriptor sbd =
+			{
+				.usage				= wgpu::BufferUsage::MapRead | wgpu::BufferUsage::CopyDst,
+				.size				= uint64_t(benchmark.rowPitch) * benchmark.height,
+				.mappedAtCreation	= false
+			};
+			benchmark.staging = m_Device.CreateBuffer(&sbd);
+
+			// Same time inputs as the interpreter
+			const float times[] = { 0.5f + 0.5f * sinf(6.2831853f * benchmark.phase), 0.5f + 0.5f * cosf(6.2831853f * benchmark.phase), benchmark.phase, 0.0f };
+			wgpu::BufferDescriptor ubd =
+			{
+				.usage				= wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst,
+				.size				= sizeof(times),
+				.mappedAtCreation	= false
+			};
+			wgpu::Buffer timeBuffer = m_Device.CreateBuffer(&ubd);
+			m_Device.GetQueue().WriteBuffer(timeBuffer, 0, times, sizeof(times));
+
+			wgpu::BindGroupLayoutEntry layoutEntry =
+			{
+				.binding = 0,
+				.visibility = wgpu::ShaderStage::Fragment,
+				.buffer = { .type = wgpu::BufferBindingType::Uniform }
+			};
+			wgpu::BindGroupLayoutDescriptor bgld = { .entryCount = 1, .entries = &layoutEntry };
+			benchmark.layout = m_Device.CreateBindGroupLayout(&bgld);
+			wgpu::BindGroupEntry entry = { .binding = 0, .buffer = timeBuffer, .offset = 0, .size = sizeof(times) };
+			wgpu::BindGroupDescriptor bgd = { .layout = benchmark.layout, .entryCount = 1, .entries = &entry };
+			benchmark.bindGroup = m_Device.CreateBindGroup(&bgd);
+		}
+
+		// Baked constants, like the default of the canvas
+		std::string code = EmitShaderCode(benchmark.programs[benchmark.next], ConstantMode::Baked);
+		wgpu::ShaderModuleWGSLDescriptor wgsld{};
+		wgsld.code = code.c_str();
+		wgpu::ShaderModuleDescriptor shaderModuleDescriptor{ .nextInChain = &wgsld };
+		wgpu::ShaderModule module = m_Device.CreateShaderModule(&shaderModuleDescriptor);
+
+		wgpu::ColorTargetState colorTargetState{ .format = wgpu::TextureFormat::RGBA8Unorm };
+		wgpu::FragmentState fragmentState{ .module = module, .targetCount = 1, .targets = &colorTargetState };
+		wgpu::PipelineLayoutDescriptor pld = { .bindGroupLayoutCount = 1, .bindGroupLayouts = &benchmark.layout };
+		wgpu::RenderPipelineDescriptor rpd =
+		{
+			.layout = m_Device.CreatePipelineLayout(&pld),
+			.vertex = { .module = module },
+			.fragment = &fragmentState
+		};
+		wgpu::RenderPipeline pipeline = m_Device.CreateRenderPipeline(&rpd);
+
+		wgpu::CommandEncoder encoder = m_Device.CreateCommandEncoder();
+		wgpu::RenderPassColorAttachment attachment
+		{
+			.view = benchmark.target.CreateView(),
+			.loadOp = wgpu::LoadOp::Clear,
+			.storeOp = wgpu::StoreOp::Store
+		};
+		wgpu::RenderPassDescriptor passDescriptor{ .colorAttachmentCount = 1, .colorAttachments = &attachment };
+		wgpu::RenderPassEncoder pass = encoder.BeginRenderPass(&passDescriptor);
+		pass.SetPipeline(pipeline);
+		pass.SetBindGroup(0, benchmark.bindGroup);
+		pass.Draw(6);
+		pass.End();
+
+		wgpu::ImageCopyTexture source{ .texture = benchmark.target };
+		wgpu::ImageCopyBuffer destination
+		{
+			.layout = { .offset = 0, .bytesPerRow = benchmark.rowPitch, .rowsPerImage = benchmark.height },
+			.buffer = benchmark.staging
+		};
+		wgpu::Extent3D size{ benchmark.width, benchmark.height, 1 };
+		encoder.CopyTextureToBuffer(&source, &destination, &size);
+
+		wgpu::CommandBuffer commands = encoder.Finish();
+		m_Device.GetQueue().Submit(1, &commands);
+		benchmark.staging.MapAsync(wgpu::MapMode::Read, 0, size_t(benchmark.rowPitch) * benchmark.height, BenchmarkPipelineMapped, nullptr);
+	}
+
+	// Compare the render of the pipeline with the thumbnail of the interpreter, then go on with the next program
+	void BenchmarkPipelineMapped(WGPUBufferMapAsyncStatus status, void* userdata)
+	{
+		ThumbnailBenchmark& benchmark = m_ThumbnailBenchmark;
+		if (status != WGPUBufferMapAsyncStatus_Success)
+		{
+			std::cout << "Thumbnail benchmark readback failed: " << status << std::endl;
+			benchmark = ThumbnailBenchmark{};
+			return;
+		}
+
+		const std::vector<uint8_t>& batched = benchmark.batched[benchmark.next];
+		if (!batched.empty())
+		{
+			const uint8_t* data = static_cast<const uint8_t*>(benchmark.staging.GetConstMappedRange(0, size_t(benchmark.rowPitch) * benchmark.height));
+			for (uint32_t row = 0U; row < benchmark.height; row++)
+				for (uint32_t i = 0U; i < benchmark.width * 4U; i++)
+				{
+					// Alpha is 1 for both
+					if (i % 4U == 3U)
+						continue;
+					uint32_t difference = uint32_t(std::abs(int32_t(data[size_t(row) * benchmark.rowPitch + i]) - int32_t(batched[size_t(row) * benchmark.width * 4U + i])));
+					benchmark.maxDifference = std::max(benchmark.maxDifference, difference);
+					benchmark.differentChannels += difference > 2U ? 1U : 0U;
+					benchmark.comparedChannels++;
+				}
+		}
+		benchmark.staging.Unmap();
+
+		benchmark.next++;
+		BenchmarkPipelineStep();
+	}
+}
+
+// Render thumbnails of count seeds from firstSeed (see Thumbnails::Render), calling Module.onThumbnail(index, pixels, width, height)
+// for each seed in order, with null pixels for the seeds the interpreter can not run. The pixels are a view of the wasm memory, only valid during the call
+// The seeds are compiled before the render starts, so their compilation is not part of the timings
+extern "C" EMSCRIPTEN_KEEPALIVE void RenderThumbnails(uint32_t firstSeed, uint32_t count, uint32_t width, uint32_t height, float phase)
+{
+	// A seed that can not be compiled keeps an empty program, which the interpreter rejects, so it still gets its null pixels
+	std::vector<Program> programs(count);
+	for (uint32_t i = 0U; i < count; i++)
+		if (!CompileProgram(GenerateShaderExpression(firstSeed + i), programs[i]))
+			programs[i] = Program();
+	Thumbnails::Render(programs, phase, width, height, [](uint32_t index, const uint8_t* pixels, uint32_t width, uint32_t height)
+	{
+		EM_ASM({ if (Module.onThumbnail) Module.onThumbnail($0, $1 ? HEAPU8.subarray($1, $1 + $2 * $3 * 4) : null, $2, $3); }, index, pixels, width, height);
+	});
+}
+
+// Compare the interpreter with a pipeline per seed on count seeds from firstSeed (see Thumbnails::Benchmark), the first 32 of them
+// rendered both ways, e.g. with the software adapter to test the interpreter on a machine without a GPU
+extern "C" EMSCRIPTEN_KEEPALIVE void BenchmarkThumbnails(uint32_t firstSeed, uint32_t count, uint32_t width, uint32_t height)
+{
+	// Only the seeds that compile, since the pipelines are created from the emitted code
+	std::vector<Program> programs;
+	for (uint32_t i = 0U; i < count; i++)
+	{
+		Program program;
+		if (CompileProgram(GenerateShaderExpression(firstSeed + i), program))
+			programs.push_back(std::move(program));
+	}
+	Thumbnails::Benchmark(programs, width, height, 32U);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+#include "Program.h"
+
+/*
+	Thumbnails of many programs at once, rendered by the GPU interpreter (see Bytecode::EncodeWords and EmitInterpreterShaderCode).
+
+	The code of every program goes into one storage buffer, and a single compute pipeline renders a thumbnail of each into the
+	layers of a texture array, up to 256 programs per dispatch, with one readback for all the dispatches of a chunk of up to
+	64 MB of pixels. No shader is compiled per program, so this is the way to preview a large range of seeds.
+	Only the device of Graphics is needed, not the program of the canvas.
+*/
+namespace Thumbnails
+{
+	// Programs the interpreter can not run (empty or split programs, or ones that need too many registers) are given to the sink
+	// without pixels, to be rendered another way. The sink gets the thumbnails in the order of the programs (the pixels are
+	// tightly packed, and only valid during the call), and the timings are printed to the console as JSON at the end
+	using Sink = std::function<void(uint32_t index, const uint8_t* pixels, uint32_t width, uint32_t height)>;
+	void Render(const std::vector<Program>& programs, float phase, uint32_t width, uint32_t height, Sink sink);
+
+	// Render the thumbnails, then the first pipelines programs again with a module and a pipeline each, and print the time per
+	// seed of both to the console as JSON, along with the largest difference between their pixels
+	void Benchmark(const std::vector<Program>& programs, uint32_t width, uint32_t height, uint32_t pipelines);
+}
@@ -0,0 +1,115 @@
+#include "Timeline.h"
+
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstdio>
+#include <iostream>
+
+#ifdef __EMSCRIPTEN__
+#include <emscripten/emscripten.h>
+#endif
+
+namespace
+{
+	struct Span
+	{
+		const char* name;
+		double start;
+		double end; // Negative while the span is open
+	};
+
+	std::mutex m_Mutex;
+	std::vector<Span> m_Spans;
+	bool m_Finished = false;
+
+	double Now()
+	{
+#ifdef __EMSCRIPTEN__
+		return emscripten_get_now();
+#else
+		static const auto origin = std::chrono::steady_clock::now();
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - origin).count();
+#endif
+	}
+}
+
+void Timeline::Begin(const char* name)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Finished)
+		return;
+	m_Spans.push_back(Span{ name, Now(), -1.0 });
+
+#ifdef __EMSCRIPTEN__
+	EM_ASM({ performance.mark("pollock:" + UTF8ToString($0) + ":start"); }, name);
+#endif
+}
+
+void Timeline::End(const char* name)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Finished)
+		return;
+
+	// Close the most recent open span with this name
+	for (auto it = m_Spans.rbegin(); it != m_Spans.rend(); ++it)
+	{
+		if (it->end < 0.0 && std::string(it->name) == name)
+		{
+			it->end = Now();
+
+#ifdef __EMSCRIPTEN__
+			EM_ASM(
+			{
+				const name = "pollock:" + UTF8ToString($0);
+				performance.mark(name + ":end");
+				performance.measure(name, name + ":start", name + ":end");
+				performance.clearMarks(name + ":start");
+				performance.clearMarks(name + ":end");
+			}, name);
+#endif
+			return;
+		}
+	}
+}
+
+void Timeline::Finish()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Finished = true;
+}
+
+std::string Timeline::Report()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	std::string report = "{ \"spans\": [";
+	for (size_t i = 0; i < m_Spans.size(); i++)
+	{
+		const Span& span = m_Spans[i];
+		char buffer[256];
+		if (span.end < 0.0)
+			std::snprintf(buffer, sizeof(buffer), "%s { \"name\": \"%s\", \"start\": %.3f, \"end\": null, \"duration\": null }", i ? "," : "", span.name, span.start);
+		else
+			std::snprintf(buffer, sizeof(buffer), "%s { \"name\": \"%s\", \"start\": %.3f, \"end\": %.3f, \"duration\": %.3f }", i ? "," : "", span.name, span.start, span.end, span.end - span.start);
+		report += buffer;
+	}
+	report += " ] }";
+	return report;
+}
+
+void Timeline::Log()
+{
+	std::cout << "Startup timeline: " << Report() << std::endl;
+}
+
+#ifdef __EMSCRIPTEN__
+// Report for the page, e.g. JSON.parse(Module.UTF8ToString(Module._TimelineReport()))
+extern "C" EMSCRIPTEN_KEEPALIVE const char* TimelineReport()
+{
+	static std::string report;
+	report = Timeline::Report();
+	return report.c_str();
+}
+#endif
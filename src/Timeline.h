@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+/*
+	Timestamped spans of the startup stages, to find out where the time to first frame goes.
+
+	In the browser, every span is also recorded as performance.mark/performance.measure entries (prefixed with "pollock:"),
+	so they show up in the performance panel of the developer tools next to the browser's own work.
+	Timestamps are in milliseconds since the page started loading (performance.now()), or since the first span natively.
+	Only the startup is recorded: once Finish is called, new spans are ignored, so the stages that run again for every program
+	(shader modules and pipelines) do not grow the timeline or the performance buffer of the browser for the life of the page.
+*/
+namespace Timeline
+{
+	// Start and end a span, named with a string literal (spans may overlap with other spans, but not with themselves)
+	void Begin(const char* name);
+	void End(const char* name);
+	// Stop recording, the spans still open stay open in the report
+	void Finish();
+
+	// Machine readable summary of all spans, as JSON:
+	// { "spans": [ { "name": "...", "start": 12.3, "end": 45.6, "duration": 33.3 }, ... ] }
+	std::string Report();
+	// Print the report to the console (the JS console in the browser)
+	void Log();
+}
@@ -0,0 +1,184 @@
+#include "Viewport.h"
+#include "Metrics.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	Metrics::Counter viewPixels("pollock_viewport_rendered_pixels_total", "Number of pixels rendered by interactive views");
+	Metrics::Counter viewMoves("pollock_viewport_moves_total", "Number of pans and zooms of interactive views");
+
+	constexpr uint32_t COARSEST_STEP = 64U;
+}
+
+Viewport::Viewport(Renderer& renderer, uint32_t width, uint32_t height)
+	: m_Renderer(renderer), m_Width(width), m_Height(height), m_Pixels(size_t(width) * height * 4U, 0U), m_Stale(height, 1U)
+{
+	// Every 64th row, then every 32nd row not listed yet, and so on
+	std::vector<uint8_t> listed(height, 0U);
+	for (uint32_t step = COARSEST_STEP; step > 0U; step /= 2U)
+	{
+		for (uint32_t row = 0U; row < height; row += step)
+		{
+			if (!listed[row])
+			{
+				m_RefineOrder.push_back(row);
+				listed[row] = 1U;
+			}
+		}
+	}
+	m_StaleRows = height;
+}
+
+void Viewport::SetProgram(const Program& program, float phase)
+{
+	m_Program = &program;
+	m_Phase = phase;
+	m_X = 0.0;
+	m_Y = 0.0;
+	m_RegionWidth = 1.0;
+	m_RegionHeight = 1.0;
+	m_RenderedPixels = 0ULL;
+	MarkStale();
+}
+
+void Viewport::MarkStale()
+{
+	std::fill(m_Stale.begin(), m_Stale.end(), 1U);
+	m_StaleRows = m_Height;
+	m_NextRefine = 0U;
+}
+
+void Viewport::RenderRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+	if (!m_Program || width == 0U || height == 0U)
+		return;
+
+	m_Renderer.RenderRect(*m_Program, m_Width, m_Height, m_Phase, Region(), Renderer::Rect{ x, y, width, height }, m_Pixels.data(), m_Width * 4U);
+	m_RenderedPixels += uint64_t(width) * height;
+	viewPixels.Add(uint64_t(width) * height);
+}
+
+void Viewport::Pan(int32_t dx, int32_t dy)
+{
+	if (dx == 0 && dy == 0)
+		return;
+	viewMoves.Add();
+
+	// uv.y = 1 at the top, so moving down lowers the region
+	m_X += m_RegionWidth * dx / m_Width;
+	m_Y -= m_RegionHeight * dy / m_Height;
+
+	const uint32_t ax = uint32_t(std::abs(dx)), ay = uint32_t(std::abs(dy));
+	if (ax >= m_Width || ay >= m_Height)
+	{
+		MarkStale();
+		Refine();
+		return;
+	}
+
+	// Pixel (x, y) of the new view is pixel (x + dx, y + dy) of the previous one
+	const size_t pitch = size_t(m_Width) * 4U;
+	const uint32_t keptWidth = m_Width - ax, keptHeight = m_Height - ay;
+	const uint32_t fromX = dx > 0 ? ax : 0U, toX = dx > 0 ? 0U : ax;
+	const uint32_t fromY = dy > 0 ? ay : 0U, toY = dy > 0 ? 0U : ay;
+	if (dy > 0)
+	{
+		for (uint32_t row = 0U; row < keptHeight; row++)
+			std::memmove(&m_Pixels[(toY + row) * pitch + toX * 4U], &m_Pixels[(fromY + row) * pitch + fromX * 4U], size_t(keptWidth) * 4U);
+	}
+	else
+	{
+		for (uint32_t row = keptHeight; row-- > 0U;)
+			std::memmove(&m_Pixels[(toY + row) * pitch + toX * 4U], &m_Pixels[(fromY + row) * pitch + fromX * 4U], size_t(keptWidth) * 4U);
+	}
+
+	// The stale rows move with their pixels, and the exposed rows are rendered below
+	if (m_StaleRows > 0U)
+	{
+		std::vector<uint8_t> stale(m_Height, 0U);
+		for (uint32_t row = 0U; row < keptHeight; row++)
+			stale[toY + row] = m_Stale[fromY + row];
+		m_Stale.swap(stale);
+		m_StaleRows = uint32_t(std::count(m_Stale.begin(), m_Stale.end(), 1U));
+		m_NextRefine = 0U;
+	}
+
+	// Exposed rows across the whole width, then the exposed columns of the kept rows
+	const uint32_t rowsY = dy > 0 ? keptHeight : 0U;
+	RenderRect(0U, rowsY, m_Width, ay);
+	RenderRect(dx > 0 ? keptWidth : 0U, toY, ax, keptHeight);
+}
+
+void Viewport::Zoom(float factor, float px, float py)
+{
+	if (!(factor > 0.0f) || factor == 1.0f)
+		return;
+	viewMoves.Add();
+
+	// The uv under the given position stays in place
+	const double u = m_X + m_RegionWidth * px / m_Width;
+	const double v = m_Y + m_RegionHeight * (1.0 - double(py) / m_Height);
+	const double oldX = m_X, oldY = m_Y, oldWidth = m_RegionWidth, oldHeight = m_RegionHeight;
+	m_RegionWidth /= factor;
+	m_RegionHeight /= factor;
+	m_X = u - m_RegionWidth * px / m_Width;
+	m_Y = v - m_RegionHeight * (1.0 - double(py) / m_Height);
+
+	// Bilinear resampling of the previous view, clamped at its edges
+	m_Previous = m_Pixels;
+	const double scaleX = m_RegionWidth / oldWidth, scaleY = m_RegionHeight / oldHeight;
+	const double offsetX = (m_X - oldX) / oldWidth * m_Width, offsetY = (oldY + oldHeight - m_Y - m_RegionHeight) / oldHeight * m_Height;
+	for (uint32_t y = 0U; y < m_Height; y++)
+	{
+		double sy = std::clamp(offsetY + (y + 0.5) * scaleY - 0.5, 0.0, double(m_Height - 1U));
+		uint32_t y0 = uint32_t(sy), y1 = std::min(y0 + 1U, m_Height - 1U);
+		uint32_t wy = uint32_t((sy - y0) * 256.0);
+		for (uint32_t x = 0U; x < m_Width; x++)
+		{
+			double sx = std::clamp(offsetX + (x + 0.5) * scaleX - 0.5, 0.0, double(m_Width - 1U));
+			uint32_t x0 = uint32_t(sx), x1 = std::min(x0 + 1U, m_Width - 1U);
+			uint32_t wx = uint32_t((sx - x0) * 256.0);
+			const uint8_t* p00 = &m_Previous[(size_t(y0) * m_Width + x0) * 4U];
+			const uint8_t* p01 = &m_Previous[(size_t(y0) * m_Width + x1) * 4U];
+			const uint8_t* p10 = &m_Previous[(size_t(y1) * m_Width + x0) * 4U];
+			const uint8_t* p11 = &m_Previous[(size_t(y1) * m_Width + x1) * 4U];
+			uint8_t* out = &m_Pixels[(size_t(y) * m_Width + x) * 4U];
+			for (uint32_t c = 0U; c < 4U; c++)
+			{
+				uint32_t top = p00[c] * (256U - wx) + p01[c] * wx;
+				uint32_t bottom = p10[c] * (256U - wx) + p11[c] * wx;
+				out[c] = uint8_t((top * (256U - wy) + bottom * wy + 32768U) >> 16);
+			}
+		}
+	}
+
+	MarkStale();
+}
+
+bool Viewport::Refine(uint32_t maxRows)
+{
+	// A view that is stale as a whole is rendered in a single job
+	if (m_StaleRows == m_Height && (maxRows == 0U || maxRows >= m_Height))
+	{
+		RenderRect(0U, 0U, m_Width, m_Height);
+		std::fill(m_Stale.begin(), m_Stale.end(), 0U);
+		m_StaleRows = 0U;
+		return true;
+	}
+
+	for (uint32_t rendered = 0U; m_StaleRows > 0U && (maxRows == 0U || rendered < maxRows); m_NextRefine++)
+	{
+		uint32_t row = m_RefineOrder[m_NextRefine];
+		if (!m_Stale[row])
+			continue;
+
+		RenderRect(0U, row, m_Width, 1U);
+		m_Stale[row] = 0U;
+		m_StaleRows--;
+		rendered++;
+	}
+	return m_StaleRows == 0U;
+}
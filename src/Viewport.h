@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "Program.h"
+#include "Renderer.h"
+
+/*
+	Interactive view of a static image on the CPU, that reuses the previous view when it moves instead of rendering every pixel again.
+
+	A pan shifts the pixels that stay in view and only renders the strips it exposes, which are a few rows or columns for the
+	small steps of a drag. A zoom resamples the previous view right away (bilinear, so it is shown without delay, only blurry
+	or blocky), marks every row as stale, and the rows are rendered again over the following calls of Refine, coarse to fine
+	(every 64th row first, then the rows in between), so the whole view sharpens evenly within the time budget of each frame.
+
+	The phase of the animation is fixed, so only static programs (or a paused animation) can be explored.
+	The pixels of a pan are computed at the same uv as in a full render, up to the rounding of the region in float.
+*/
+class Viewport
+{
+public:
+	Viewport(Renderer& renderer, uint32_t width, uint32_t height);
+
+	Viewport(const Viewport&) = delete;
+	Viewport& operator=(const Viewport&) = delete;
+
+	// Show a program at the given phase, over the full uv space, the whole view is stale until refined
+	// The program must outlive the view (or the next call)
+	void SetProgram(const Program& program, float phase = 0.0f);
+
+	// Move the view by whole pixels, a positive dx shows more of the right and a positive dy more of the bottom
+	void Pan(int32_t dx, int32_t dy);
+	// Scale the view around the given position in pixels, a factor above 1 zooms in
+	void Zoom(float factor, float px, float py);
+
+	// Render up to maxRows of the stale rows (0 for all of them), coarse to fine
+	// Returns true once no row is stale, i.e. the view is the same as a full render of its region
+	bool Refine(uint32_t maxRows = 0U);
+
+	const uint8_t* Pixels() const { return m_Pixels.data(); }
+	uint32_t Width() const { return m_Width; }
+	uint32_t Height() const { return m_Height; }
+	uint32_t StaleRows() const { return m_StaleRows; }
+	Renderer::Region Region() const { return Renderer::Region{ float(m_X), float(m_Y), float(m_RegionWidth), float(m_RegionHeight) }; }
+
+	// Pixels rendered since the program was set, to compare with the pixels shown
+	uint64_t RenderedPixels() const { return m_RenderedPixels; }
+
+private:
+	void RenderRect(uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+	void MarkStale();
+
+	Renderer& m_Renderer;
+	const Program* m_Program = nullptr;
+	float m_Phase = 0.0f;
+
+	uint32_t m_Width, m_Height;
+	double m_X = 0.0, m_Y = 0.0, m_RegionWidth = 1.0, m_RegionHeight = 1.0; // Region of the view, accumulated in double over many moves
+	std::vector<uint8_t> m_Pixels;
+	std::vector<uint8_t> m_Previous; // Previous view while it is resampled
+
+	std::vector<uint32_t> m_RefineOrder; // Rows from coarse to fine
+	std::vector<uint8_t> m_Stale; // One flag per row
+	uint32_t m_StaleRows = 0U;
+	uint32_t m_NextRefine = 0U; // Position in m_RefineOrder, the rows before it are not stale
+
+	uint64_t m_RenderedPixels = 0ULL;
+};
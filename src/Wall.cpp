@@ -0,0 +1,126 @@
+#include "Wall.h"
+
+#include <new>
+#include <cmath>
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+	constexpr uint32_t MAGIC = 0x57414C4CU; // "WALL"
+	constexpr uint32_t VERSION = 1U;
+}
+
+struct Wall::Clock::Header
+{
+	std::atomic<uint32_t> magic; // Written last by the leader, once the timing is valid
+	uint32_t version;
+	Timing timing;
+};
+
+Renderer::Region Wall::PanelRegion(uint32_t wallWidth, uint32_t wallHeight, const Renderer::Rect& panel)
+{
+	// The wall goes from the top left, the uv space from the bottom left
+	Renderer::Region region;
+	region.x = float(panel.x) / wallWidth;
+	region.y = 1.0f - float(panel.y + panel.height) / wallHeight;
+	region.width = float(panel.width) / wallWidth;
+	region.height = float(panel.height) / wallHeight;
+	return region;
+}
+
+uint64_t Wall::Now()
+{
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return uint64_t(now.tv_sec) * 1000000000ULL + uint64_t(now.tv_nsec);
+}
+
+uint64_t Wall::FrameAt(const Timing& timing, uint64_t time)
+{
+	return time > timing.epoch ? uint64_t(std::floor(double(time - timing.epoch) * timing.fps / 1e9)) : 0ULL;
+}
+
+uint64_t Wall::FrameTime(const Timing& timing, uint64_t frame)
+{
+	return timing.epoch + uint64_t(std::ceil(double(frame) * 1e9 / timing.fps));
+}
+
+Wall::Clock::~Clock()
+{
+	if (m_Memory)
+		munmap(m_Memory, sizeof(Header));
+	if (m_Owner)
+		shm_unlink(m_Name.c_str());
+}
+
+bool Wall::Clock::Create(const char* name, const Timing& timing)
+{
+	// A new object, like FrameRing::Create, so followers that still map the clock of a previous leader are not truncated under it
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+		return false;
+
+	void* memory = MAP_FAILED;
+	if (ftruncate(fd, off_t(sizeof(Header))) == 0)
+		memory = mmap(nullptr, sizeof(Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (memory == MAP_FAILED)
+	{
+		shm_unlink(name);
+		return false;
+	}
+
+	m_Name = name;
+	m_Owner = true;
+	m_Memory = memory;
+
+	Header* header = new (m_Memory) Header();
+	header->version = VERSION;
+	header->timing = timing;
+	header->magic.store(MAGIC, std::memory_order_release);
+	return true;
+}
+
+bool Wall::Clock::Open(const char* name, Timing& timing, double timeoutSeconds)
+{
+	// The leader may still be starting
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+	for (;; std::this_thread::sleep_for(std::chrono::milliseconds(10)))
+	{
+		if (!m_Memory)
+		{
+			int fd = shm_open(name, O_RDONLY, 0);
+			if (fd >= 0)
+			{
+				struct stat info;
+				if (fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header))
+				{
+					void* memory = mmap(nullptr, sizeof(Header), PROT_READ, MAP_SHARED, fd, 0);
+					m_Memory = memory != MAP_FAILED ? memory : nullptr;
+				}
+				close(fd);
+			}
+		}
+
+		const Header* header = static_cast<const Header*>(m_Memory);
+		if (header && header->magic.load(std::memory_order_acquire) == MAGIC)
+		{
+			if (header->version != VERSION)
+				return false;
+			m_Name = name;
+			timing = header->timing;
+			return true;
+		}
+		if (std::chrono::steady_clock::now() >= deadline)
+			return false;
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "Renderer.h"
+
+/*
+	Video walls: one seed spanning many panels, each driven by its own process (or browser, see WallPanel.h).
+
+	A wall is a rectangle of wall units, e.g. the pixels of the whole wall, and each panel shows a rectangle of it at its own
+	native resolution. Every instance only renders the region of the uv space under its panel, so the total work follows
+	the area of the wall rather than the number of panels times a full frame, and panels of different sizes can be mixed.
+
+	The instances lock to a shared clock instead of talking to each other: frame n is due at epoch + n / fps on every panel,
+	with the phase of Renderer::FramePhase (the same as Graphics::Update), and an instance that falls behind skips to the
+	frame that is due rather than drifting. The clock is CLOCK_REALTIME, kept in sync across hosts by NTP or PTP.
+	Clock stands in for a time sync service on a single host: the leader publishes the seed, the epoch and the frame rate
+	in POSIX shared memory, where the other instances read them, so they only need its name.
+*/
+namespace Wall
+{
+	// Region of the uv space under a panel, given as a rectangle of wall units from the top left corner of the wall
+	Renderer::Region PanelRegion(uint32_t wallWidth, uint32_t wallHeight, const Renderer::Rect& panel);
+
+	// What every instance of a wall agrees on
+	struct Timing
+	{
+		uint64_t seed;
+		uint64_t epoch; // CLOCK_REALTIME in nanoseconds when frame 0 is due
+		float fps;
+	};
+
+	// Current CLOCK_REALTIME time in nanoseconds
+	uint64_t Now();
+	// Last frame due at the given time, 0 before the epoch
+	uint64_t FrameAt(const Timing& timing, uint64_t time);
+	// Time when the given frame is due
+	uint64_t FrameTime(const Timing& timing, uint64_t frame);
+
+	class Clock
+	{
+	public:
+		Clock() = default;
+		~Clock();
+
+		Clock(const Clock&) = delete;
+		Clock& operator=(const Clock&) = delete;
+
+		// Leader side: create (or replace) the shared memory object, e.g. "/pollock-wall"
+		bool Create(const char* name, const Timing& timing);
+		// Other instances: read the timing of the leader, waiting up to timeoutSeconds for it to create the clock
+		bool Open(const char* name, Timing& timing, double timeoutSeconds);
+
+	private:
+		struct Header;
+
+		std::string m_Name;
+		bool m_Owner = false;
+		void* m_Memory = nullptr;
+	};
+}
@@ -0,0 +1,176 @@
+#include "WallPanel.h"
+#include "GraphicsState.h"
+#include "CanvasView.h"
+#include "Graphics.h"
+
+#include <string>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <webgpu/webgpu_cpp.h>
+#include <emscripten/emscripten.h>
+
+using namespace GraphicsState;
+
+namespace
+{
+	// Panel of a video wall shown by the canvas (see WallPanel::Set)
+	struct Panel
+	{
+		bool active = false;
+		float region[4] = { 0.0f, 0.0f, 1.0f, 1.0f }; // Region of the uv space under the panel
+		double epoch = 0.0; // Unix time in milliseconds when frame 0 is due
+		double fps = 60.0;
+		double offset = 0.0; // Correction of the local clock in milliseconds
+		wgpu::Buffer regionBuffer; // Read by the region vertex shader and the cache compute shader
+		std::vector<std::string> mirrorSelectors;
+		std::vector<wgpu::Surface> mirrors; // Canvases that get a copy of every frame
+	};
+	Panel m_Wall;
+
+	// Frame of the wall due now, by the local clock of the browser
+	uint64_t WallFrame()
+	{
+		double clock = EM_ASM_DOUBLE({ return performance.timeOrigin + performance.now(); }) + m_Wall.offset;
+		return clock > m_Wall.epoch ? uint64_t(std::floor((clock - m_Wall.epoch) * m_Wall.fps / 1000.0)) : 0ULL;
+	}
+
+	// Configure the surfaces of the mirrors added since the last call, once the canvas surface exists
+	void ConfigureMirrors()
+	{
+		if (!m_Surface || m_Wall.mirrors.size() == m_Wall.mirrorSelectors.size())
+			return;
+
+		// The canvas becomes the source of a copy
+		wgpu::SurfaceConfiguration config
+		{
+			.device = m_Device,
+			.format = m_Format,
+			.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopySrc
+		};
+		m_Surface.Configure(&config);
+
+		for (size_t i = m_Wall.mirrors.size(); i < m_Wall.mirrorSelectors.size(); i++)
+		{
+			wgpu::SurfaceDescriptorFromCanvasHTMLSelector canvasDescriptor{};
+			canvasDescriptor.selector = m_Wall.mirrorSelectors[i].c_str();
+			wgpu::SurfaceDescriptor surfaceDescriptor{ .nextInChain = &canvasDescriptor };
+			wgpu::Surface mirror = m_Instance.CreateSurface(&surfaceDescriptor);
+
+			wgpu::SurfaceConfiguration mirrorConfig
+			{
+				.device = m_Device,
+				.format = m_Format,
+				.usage = wgpu::TextureUsage::RenderAttachment | wgpu::TextureUsage::CopyDst
+			};
+			mirror.Configure(&mirrorConfig);
+			m_Wall.mirrors.push_back(mirror);
+		}
+	}
+}
+
+void WallPanel::Set(float x, float y, float width, float height, double epoch, float fps)
+{
+	CanvasView::Reset();
+	m_Wall.active = true;
+	m_Wall.region[0] = x;
+	m_Wall.region[1] = y;
+	m_Wall.region[2] = width;
+	m_Wall.region[3] = height;
+	m_Wall.epoch = epoch;
+	m_Wall.fps = fps > 0.0f ? fps : 60.0;
+
+	// The pipeline and the cache are created again with the region
+	if (m_Device && m_ShaderReady)
+		Graphics::SetupPipeline();
+}
+
+void WallPanel::SetClockOffset(double milliseconds)
+{
+	m_Wall.offset = milliseconds;
+}
+
+void WallPanel::AddMirror(const std::string& selector)
+{
+	m_Wall.mirrorSelectors.push_back(selector);
+	if (m_Device)
+		ConfigureMirrors();
+}
+
+bool WallPanel::Active()
+{
+	return m_Wall.active;
+}
+
+void WallPanel::Setup()
+{
+	// The panel draws its region with the region vertex shader, instead of the fullscreen quad of the fragment module
+	if (m_Wall.active)
+	{
+		if (!m_Wall.regionBuffer)
+		{
+			wgpu::BufferDescriptor rbd =
+			{
+				.usage				= wgpu::BufferUsage::Uniform | wgpu::BufferUsage::CopyDst,
+				.size				= 4 * sizeof(float),
+				.mappedAtCreation	= false
+			};
+			m_Wall.regionBuffer = m_Device.CreateBuffer(&rbd);
+		}
+		m_Device.GetQueue().WriteBuffer(m_Wall.regionBuffer, 0, m_Wall.region, sizeof(m_Wall.region));
+	}
+	ConfigureMirrors();
+}
+
+const wgpu::Buffer& WallPanel::RegionBuffer()
+{
+	return m_Wall.regionBuffer;
+}
+
+float WallPanel::Phase()
+{
+	double loops = double(WallFrame()) / (m_Wall.fps * 12.566370614359172);
+	return float(loops - std::floor(loops));
+}
+
+void WallPanel::CopyToMirrors(wgpu::CommandEncoder& encoder, const wgpu::Texture& frame)
+{
+	for (wgpu::Surface& mirror : m_Wall.mirrors)
+	{
+		wgpu::SurfaceTexture mirrorTexture;
+		mirror.GetCurrentTexture(&mirrorTexture);
+		wgpu::ImageCopyTexture source{ .texture = frame };
+		wgpu::ImageCopyTexture destination{ .texture = mirrorTexture.texture };
+		wgpu::Extent3D size
+		{
+			std::min(frame.GetWidth(), mirrorTexture.texture.GetWidth()),
+			std::min(frame.GetHeight(), mirrorTexture.texture.GetHeight()),
+			1
+		};
+		encoder.CopyTextureToTexture(&source, &destination, &size);
+	}
+}
+
+// Show the panel of a video wall for the given seed (see WallPanel::Set), e.g. from the parameters of the page
+// The region is in uv space, from the bottom left, and the epoch in Unix milliseconds (performance.timeOrigin + performance.now())
+extern "C" EMSCRIPTEN_KEEPALIVE void JoinWall(uint32_t seed, float x, float y, float width, float height, double epoch, float fps)
+{
+	Program program;
+	if (!CompileProgram(GenerateShaderExpression(seed), program))
+		return;
+	WallPanel::Set(x, y, width, height, epoch, fps);
+	Graphics::SetProgram(program, ConstantMode::Baked);
+}
+
+// Correct the clock of the wall by the given milliseconds, e.g. from the offset measured by a time sync service
+extern "C" EMSCRIPTEN_KEEPALIVE void SetWallClockOffset(double milliseconds)
+{
+	WallPanel::SetClockOffset(milliseconds);
+}
+
+// Copy every frame to another canvas, given by its CSS selector (e.g. "#mirror")
+extern "C" EMSCRIPTEN_KEEPALIVE void AddWallMirror(const char* selector)
+{
+	WallPanel::AddMirror(selector);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include <webgpu/webgpu_cpp.h>
+
+/*
+	Panel of a video wall shown by the canvas (see Wall.h for the headless version).
+
+	The canvas shows a region of the uv space (its panel of the wall), and the animation follows a clock shared by every panel:
+	each frame shows the frame of the wall due at epoch + n / fps, with the epoch in Unix milliseconds, so panels on any number
+	of machines (whose clocks are kept in sync by NTP or PTP, or corrected by SetClockOffset) show the same phase, and each one
+	only renders its own pixels at the resolution of its canvas.
+	Mirrors are other canvases (CSS selectors) that get a copy of every frame instead of rendering it again.
+*/
+namespace WallPanel
+{
+	// The region is in uv space, from the bottom left, and the pipeline of the canvas is created again with it
+	void Set(float x, float y, float width, float height, double epoch, float fps);
+	void SetClockOffset(double milliseconds);
+	void AddMirror(const std::string& selector);
+
+	// Used by the setup and the frames of Graphics
+	bool Active();
+	// Write the region buffer of the panel and configure the mirrors added since the last call, once the canvas surface exists
+	void Setup();
+	// Region of the panel, read by the region vertex shader and the cache compute shader
+	const wgpu::Buffer& RegionBuffer();
+	// Phase of the frame of the wall due now, with the phase of Renderer::FramePhase
+	float Phase();
+	// Copy the frame of the canvas to the mirrors, over the size they share
+	void CopyToMirrors(wgpu::CommandEncoder& encoder, const wgpu::Texture& frame);
+}
@@ -3,20 +3,110 @@
 #include <chrono>
 
 #include "Shader.h"
+#include "Program.h"
+#include "Pruning.h"
+#include "Surrogates.h"
 #include "Graphics.h"
+#include "Timeline.h"
+
+#include <emscripten/emscripten.h>
+
+// Uncomment the line below to remove the parts of the shader that have no visible effect before compiling it (see Pruning.h)
+//#define PRUNE
+
+// Uncomment the line below to replace the subtrees that only depend on x, y or the phase by polynomials (see Surrogates.h)
+//#define SURROGATES
+
+// Uncomment the line below to compute the parts of the shader that do not change over time only when the canvas changes size (see SplitProgram)
+//#define CACHE_SPACE
+
+namespace
+{
+	// Startup state, carried between the stages that run after main (see main)
+	std::string m_PixelShader;
+#if defined(PRUNE) || defined(SURROGATES) || defined(CACHE_SPACE)
+	Program m_Program;
+	bool m_Compiled = false;
+#endif
+
+	// Hand the code over to finish the setup once the device is available
+	void Finish(void* userdata)
+	{
+#ifdef CACHE_SPACE
+		// The program is split and emitted by Graphics, instead of using the generated code
+		if (m_Compiled)
+		{
+			Graphics::SetProgram(m_Program, ConstantMode::Baked, true);
+			return;
+		}
+#endif
+		Graphics::SetShaderCode(std::move(m_PixelShader));
+	}
+
+	void FitSurrogates(void* userdata)
+	{
+#ifdef SURROGATES
+		Timeline::Begin("FitSurrogates");
+		if (m_Compiled)
+		{
+			Surrogates::Fit(m_Program);
+			m_PixelShader = EmitShaderCode(m_Program);
+		}
+		Timeline::End("FitSurrogates");
+#endif
+		Finish(nullptr);
+	}
+
+	void Prune(void* userdata)
+	{
+#ifdef PRUNE
+		Timeline::Begin("PruneShader");
+		if (m_Compiled)
+		{
+			Pruning::Prune(m_Program);
+			m_PixelShader = EmitShaderCode(m_Program);
+		}
+		Timeline::End("PruneShader");
+#endif
+#ifdef SURROGATES
+		emscripten_async_call(FitSurrogates, nullptr, 0);
+#else
+		FitSurrogates(nullptr);
+#endif
+	}
+}
 
 int main()
 {
+	// Covers the whole startup, until the first frame is submitted in Graphics::Update
+	Timeline::Begin("TimeToFirstFrame");
+
 	// Get time at the beginning of the program to use as an initial seed
 	auto now = std::chrono::high_resolution_clock::now();
 	uint64_t currentTime = std::chrono::time_point_cast<std::chrono::microseconds>(now).time_since_epoch().count();
 
-	// Generate the first shader using time as seed
-	std::string pixelShader = GenerateShaderCode(currentTime);
-	
 	// Create window and initialize graphics API
-	Graphics::Initialize(pixelShader.c_str());
+	// This only starts the async adapter request, which the browser resolves while the shader is generated below
+	// The callbacks only run once main has returned, so the device is requested after the generation (and between the stages below)
+	Graphics::Initialize();
+
+	// Generate the first shader using time as seed
+	Timeline::Begin("GenerateShaderCode");
+	m_PixelShader = GenerateShaderCode(currentTime);
+	Timeline::End("GenerateShaderCode");
+
+#if defined(PRUNE) || defined(SURROGATES)
+	m_Compiled = CompileProgram(GenerateShaderExpression(currentTime), m_Program);
+
+	// The slower passes run in their own tasks, so the adapter callback can request the device in between,
+	// and the device request overlaps them instead of waiting for the whole startup
+	emscripten_async_call(Prune, nullptr, 0);
+#else
+#ifdef CACHE_SPACE
+	m_Compiled = CompileProgram(GenerateShaderExpression(currentTime), m_Program);
+#endif
+	Finish(nullptr);
+#endif
 
 	return 0;
 }
-